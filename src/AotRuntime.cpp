@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * AotRuntime
+ * Runs basic blocks recompiled ahead of time by imit8_recomp, falling back to the Chip8 interpreter
+ * for anything that was not (or can no longer be) compiled.
+ */
+
+#include <cstring>
+#include "AotRuntime.h"
+#include "Disassembler.h"
+
+AotRuntime::
+AotRuntime(Chip8* chip8, LogWriter* logWrit, const AotProgram* aotProgram)
+{
+    cpu = chip8;
+    logWriter = logWrit;
+    program = aotProgram;
+    isDirty = false;
+    compiledInstructions = 0;
+    interpretedInstructions = 0;
+
+    std::fill_n(blockAt, MEMORY_SIZE, nullptr);
+    std::fill_n(isCodeByte, MEMORY_SIZE, false);
+    for (unsigned short i = 0; i < program->blockCount; ++i)
+    {
+        const AotBlock& block = program->blocks[i];
+        std::fill(isCodeByte + block.start, isCodeByte + block.end, true);
+    }
+    validateBlocks(0, MEMORY_SIZE);
+
+    unsigned short enabled = 0;
+    for (unsigned short i = 0; i < program->blockCount; ++i)
+    {
+        enabled += blockAt[program->blocks[i].start] == &program->blocks[i] ? 1 : 0;
+    }
+    logWriter->log(LogWriter::LogLevel::INFO, "AOT runtime: " + std::to_string(enabled) + " of " +
+            std::to_string(program->blockCount) + " recompiled blocks match the loaded ROM.");
+}
+
+bool AotRuntime::
+runCycles(int cycles)
+{
+    Chip8State& state = cpu->getState();
+    isDirty = false;
+
+    while (cycles > 0)
+    {
+        const AotBlock* block = blockAt[state.progCounter & (MEMORY_SIZE - 1)];
+        if (block != nullptr && state.progCounter < MEMORY_SIZE)
+        {
+            state.isDirty = false;
+            int ran = block->function(state, cycles);
+            isDirty |= state.isDirty;
+            compiledInstructions += ran;
+            cycles -= ran;
+            if (ran > 0)
+            {
+                continue;
+            }
+        }
+
+        // not compiled, or the block handed this instruction back to us
+        unsigned short pc = state.progCounter;
+        unsigned short opCode = pc < MEMORY_SIZE - 1 ? (state.memory[pc] << 8 | state.memory[pc + 1]) : 0;
+        bool isRunning = cpu->runCycle();
+        isDirty |= cpu->isDirtyScreen();
+        ++interpretedInstructions;
+        --cycles;
+        if (!isRunning)
+        {
+            return false;
+        }
+
+        // self-modifying code: stop using any block whose bytes no longer match the ROM image
+        if (Disassembler::isStore(opCode))
+        {
+            unsigned int length = (opCode & 0xFF) == 0x33 ? 3 : ((opCode >> 8) & 0xF) + 1u;
+            unsigned int from = state.index;
+            unsigned int to = std::min<unsigned int>(from + length, MEMORY_SIZE);
+            for (unsigned int address = from; address < to; ++address)
+            {
+                if (isCodeByte[address])
+                {
+                    validateBlocks(from, to);
+                    break;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+bool AotRuntime::
+isDirtyScreen()
+{
+    return isDirty;
+}
+
+unsigned long long AotRuntime::
+getCompiledInstructions() const
+{
+    return compiledInstructions;
+}
+
+unsigned long long AotRuntime::
+getInterpretedInstructions() const
+{
+    return interpretedInstructions;
+}
+
+void AotRuntime::
+validateBlocks(unsigned int from, unsigned int to)
+{
+    const unsigned char* memory = cpu->getState().memory;
+    for (unsigned short i = 0; i < program->blockCount; ++i)
+    {
+        const AotBlock& block = program->blocks[i];
+        if (block.end <= from || block.start >= to)
+        {
+            continue;
+        }
+        unsigned int offset = block.start - CODE_START;
+        bool isMatch = block.end <= CODE_START + program->romBytes &&
+                       std::memcmp(memory + block.start, program->romImage + offset, block.end - block.start) == 0;
+        if (!isMatch && blockAt[block.start] == &block)
+        {
+            logWriter->log(LogWriter::LogLevel::DEBUG, "AOT block at " + std::to_string(block.start) +
+                    " no longer matches memory, interpreting it instead.");
+        }
+        for (unsigned int address = block.start; address < block.end; address += 2)
+        {
+            blockAt[address] = isMatch ? &block : nullptr;
+        }
+    }
+}
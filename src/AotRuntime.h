@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * AotRuntime
+ * Runs basic blocks recompiled ahead of time by imit8_recomp, falling back to the Chip8 interpreter
+ * for anything that was not (or can no longer be) compiled.
+ */
+
+#ifndef IMIT8_CHIP8_AOTRUNTIME_H
+#define IMIT8_CHIP8_AOTRUNTIME_H
+
+#include "Chip8.h"
+
+// A recompiled basic block. It can be entered at any of its instructions (whichever progCounter points
+// at), runs at most `budget` (>= 1) instructions, leaves progCounter at the next instruction to run and
+// returns how many it ran. Returning early is how a block hands an instruction that might fault back to
+// the interpreter.
+typedef int (*AotBlockFunction)(Chip8State& state, int budget);
+
+struct AotBlock
+{
+    unsigned short start; // address of the first instruction
+    unsigned short end;   // one past the last byte of the block
+    AotBlockFunction function;
+};
+
+// Everything imit8_recomp generates for one ROM
+struct AotProgram
+{
+    const unsigned char* romImage;
+    unsigned short romBytes;
+    const AotBlock* blocks;
+    unsigned short blockCount;
+};
+
+// Defined by the generated translation unit
+extern const AotProgram imit8AotProgram;
+
+class AotRuntime
+{
+    public:
+        AotRuntime(Chip8* cpu, LogWriter* logWriter, const AotProgram* program);
+
+        // Run up to `cycles` instructions. Returns false once the machine halts.
+        bool runCycles(int cycles);
+
+        // Did anything run by the last runCycles() touch the screen?
+        bool isDirtyScreen();
+
+        unsigned long long getCompiledInstructions() const;
+        unsigned long long getInterpretedInstructions() const;
+
+    private:
+        Chip8* cpu;
+        LogWriter* logWriter;
+        const AotProgram* program;
+
+        // Block containing the instruction at each address, or nullptr if that address has to be interpreted.
+        const AotBlock* blockAt[MEMORY_SIZE];
+
+        // Bytes of memory that belong to at least one compiled block.
+        bool isCodeByte[MEMORY_SIZE];
+
+        bool isDirty;
+        unsigned long long compiledInstructions;
+        unsigned long long interpretedInstructions;
+
+        // Enable each block whose bytes in memory still match the ROM it was compiled from
+        void validateBlocks(unsigned int from, unsigned int to);
+};
+
+#endif //IMIT8_CHIP8_AOTRUNTIME_H
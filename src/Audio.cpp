@@ -0,0 +1,180 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Audio
+ * Renders the sound timer to 16-bit samples one frame at a time and hands them to a writer thread.
+ */
+
+#include <chrono>
+#include <cstring>
+#include "Audio.h"
+
+// How long the writer thread sleeps when the ring is empty
+#define AUDIO_WRITER_SLEEP_MILLISECONDS 5
+#define AUDIO_WRITE_CHUNK 4096
+
+SampleRing::
+SampleRing(size_t capacity)
+        : buffer(capacity), mask(capacity - 1)
+{
+    head.store(0);
+    tail.store(0);
+}
+
+size_t SampleRing::
+push(const short* samples, size_t count)
+{
+    size_t writeAt = head.load(std::memory_order_relaxed);
+    size_t space = buffer.size() - (writeAt - tail.load(std::memory_order_acquire));
+    count = std::min(count, space);
+    size_t first = std::min(count, buffer.size() - (writeAt & mask));
+    std::memcpy(&buffer[writeAt & mask], samples, first * sizeof(short));
+    std::memcpy(&buffer[0], samples + first, (count - first) * sizeof(short));
+    head.store(writeAt + count, std::memory_order_release);
+    return count;
+}
+
+size_t SampleRing::
+pop(short* samples, size_t count)
+{
+    size_t readAt = tail.load(std::memory_order_relaxed);
+    size_t available = head.load(std::memory_order_acquire) - readAt;
+    count = std::min(count, available);
+    size_t first = std::min(count, buffer.size() - (readAt & mask));
+    std::memcpy(samples, &buffer[readAt & mask], first * sizeof(short));
+    std::memcpy(samples + first, &buffer[0], (count - first) * sizeof(short));
+    tail.store(readAt + count, std::memory_order_release);
+    return count;
+}
+
+Audio::
+Audio(LogWriter* logWrit, unsigned int rate)
+        : ring(AUDIO_RING_SAMPLES)
+{
+    logWriter = logWrit;
+    sampleRate = rate;
+    frames = 0;
+    samplesRendered = 0;
+    phase = 0;
+    sink = nullptr;
+    isWriting.store(false);
+    hasWriteFailed.store(false);
+}
+
+Audio::
+~Audio()
+{
+    stop();
+}
+
+bool Audio::
+start(AudioSink* audioSink)
+{
+    if (isWriting.load())
+    {
+        return false;
+    }
+    sink = audioSink;
+    isWriting.store(true);
+    writer = std::thread(&Audio::write, this);
+    return true;
+}
+
+void Audio::
+stop()
+{
+    if (!isWriting.exchange(false))
+    {
+        return;
+    }
+    writer.join();
+    if (hasWriteFailed.load())
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Audio: writing samples failed.");
+    }
+}
+
+void Audio::
+renderFrame(const Chip8State& state)
+{
+    // samples in [frames * rate / 60, (frames + 1) * rate / 60) belong to this frame
+    size_t count = static_cast<size_t>((frames + 1) * sampleRate / FRAMES_PER_SECOND -
+                                       frames * sampleRate / FRAMES_PER_SECOND);
+    ++frames;
+    frameSamples.resize(count);
+
+    if (state.soundInterruptTimer == 0)
+    {
+        std::fill(frameSamples.begin(), frameSamples.end(), 0);
+    }
+    else
+    {
+        double step = static_cast<double>(AUDIO_TONE_HZ) / sampleRate;
+        for (short& sample : frameSamples)
+        {
+            sample = phase < 0.5 ? AUDIO_AMPLITUDE : -AUDIO_AMPLITUDE;
+            phase += step;
+            if (phase >= 1)
+            {
+                phase -= 1;
+            }
+        }
+    }
+
+    samplesRendered += count;
+    if (!isWriting.load(std::memory_order_relaxed) || hasWriteFailed.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    // Sinks are files and pipes, so rather than drop samples when the writer falls behind (e.g. in
+    // turbo mode) wait for it; a pipe to a live player then paces the emulator.
+    size_t pushed = ring.push(frameSamples.data(), count);
+    while (pushed < count && !hasWriteFailed.load(std::memory_order_relaxed))
+    {
+        std::this_thread::yield();
+        pushed += ring.push(frameSamples.data() + pushed, count - pushed);
+    }
+}
+
+unsigned int Audio::
+getSampleRate() const
+{
+    return sampleRate;
+}
+
+unsigned long long Audio::
+getSamplesRendered() const
+{
+    return samplesRendered;
+}
+
+// Writer thread: move samples from the ring to the sink until stopped, then drain what is left.
+// A failed write only sets hasWriteFailed; stop() logs it, once, after the thread has ended.
+void Audio::
+write()
+{
+    short chunk[AUDIO_WRITE_CHUNK];
+    bool isRunning = true;
+    while (isRunning)
+    {
+        isRunning = isWriting.load();
+        size_t count;
+        while ((count = ring.pop(chunk, AUDIO_WRITE_CHUNK)) != 0)
+        {
+            if (!sink->write(chunk, count))
+            {
+                hasWriteFailed.store(true);
+                return;
+            }
+        }
+        if (isRunning)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(AUDIO_WRITER_SLEEP_MILLISECONDS));
+        }
+    }
+}
@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Audio
+ * Renders the sound timer to 16-bit samples of a square wave one frame at a time. Samples go through a
+ * lock-free single-producer/single-consumer ring to a writer thread that feeds an AudioSink.
+ */
+
+#ifndef IMIT8_CHIP8_AUDIO_H
+#define IMIT8_CHIP8_AUDIO_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "AudioSink.h"
+#include "Chip8.h"
+
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_TONE_HZ 440
+#define AUDIO_AMPLITUDE 8000
+#define AUDIO_RING_SAMPLES 65536   // power of two, about 1.5 s at 44.1 kHz
+
+// Lock-free ring of samples between exactly one producer and one consumer thread
+class SampleRing
+{
+    public:
+        explicit SampleRing(size_t capacity);
+
+        // Producer: copy in as many samples as fit; returns how many did
+        size_t push(const short* samples, size_t count);
+
+        // Consumer: copy out up to count samples; returns how many were available
+        size_t pop(short* samples, size_t count);
+
+    private:
+        std::vector<short> buffer;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head; // total samples pushed, written by the producer
+        alignas(64) std::atomic<size_t> tail; // total samples popped, written by the consumer
+};
+
+class Audio
+{
+    public:
+        explicit Audio(LogWriter* logWriter, unsigned int sampleRate = AUDIO_SAMPLE_RATE);
+        ~Audio();
+
+        // Start the writer thread feeding sink, which must already be open
+        bool start(AudioSink* sink);
+
+        // Drain what is left in the ring to the sink and stop the writer thread
+        void stop();
+
+        // Render one 1/60 s frame: tone while the sound timer is running, silence otherwise.
+        // The number of samples per frame alternates so that frames line up exactly with the sample rate.
+        void renderFrame(const Chip8State& state);
+
+        unsigned int getSampleRate() const;
+        unsigned long long getSamplesRendered() const;
+
+    private:
+        LogWriter* logWriter;
+        unsigned int sampleRate;
+        unsigned long long frames;
+        unsigned long long samplesRendered;
+
+        double phase;                      // fraction of a square wave period
+        std::vector<short> frameSamples;
+
+        SampleRing ring;
+        AudioSink* sink;
+        std::thread writer;
+        std::atomic<bool> isWriting;
+        std::atomic<bool> hasWriteFailed;
+
+        void write();
+};
+
+#endif //IMIT8_CHIP8_AUDIO_H
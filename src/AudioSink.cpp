@@ -0,0 +1,153 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * AudioSink
+ * Destinations for rendered audio: 16-bit mono samples written to a WAV file or as raw PCM to a file,
+ * FIFO or stdout.
+ */
+
+#include <vector>
+#include "AudioSink.h"
+
+#define WAV_HEADER_BYTES 44
+
+static void
+putLittleEndian(unsigned char* out, unsigned int value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+    {
+        out[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+}
+
+// Write samples as little-endian regardless of the host
+static bool
+writeSamples(FILE* file, const short* samples, size_t count)
+{
+    std::vector<unsigned char> bytes(count * 2);
+    for (size_t i = 0; i < count; ++i)
+    {
+        putLittleEndian(&bytes[2 * i], static_cast<unsigned short>(samples[i]), 2);
+    }
+    return std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+}
+
+WavSink::
+WavSink(LogWriter* logWrit)
+{
+    logWriter = logWrit;
+    file = nullptr;
+    samplesWritten = 0;
+    sampleRate = 0;
+}
+
+WavSink::
+~WavSink()
+{
+    close();
+}
+
+bool WavSink::
+open(const std::string& path, unsigned int sampleRate)
+{
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not open WAV file (" + path + ")");
+        return false;
+    }
+    samplesWritten = 0;
+    WavSink::sampleRate = sampleRate;
+    return writeHeader(0);
+}
+
+bool WavSink::
+write(const short* samples, size_t count)
+{
+    if (file == nullptr || !writeSamples(file, samples, count))
+    {
+        return false;
+    }
+    samplesWritten += count;
+    return true;
+}
+
+bool WavSink::
+close()
+{
+    if (file == nullptr)
+    {
+        return true;
+    }
+    // patch the RIFF and data chunk sizes now that they are known
+    bool isGood = std::fseek(file, 0, SEEK_SET) == 0 && writeHeader(static_cast<unsigned int>(samplesWritten * 2));
+    isGood = std::fclose(file) == 0 && isGood;
+    file = nullptr;
+    if (!isGood)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not finish WAV file");
+    }
+    return isGood;
+}
+
+bool WavSink::
+writeHeader(unsigned int dataBytes)
+{
+    unsigned char header[WAV_HEADER_BYTES] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+                                              'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 1, 0,     // PCM, mono
+                                              0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 16, 0,             // 2-byte frames, 16 bit
+                                              'd', 'a', 't', 'a', 0, 0, 0, 0};
+    putLittleEndian(header + 4, 36 + dataBytes, 4);
+    putLittleEndian(header + 24, sampleRate, 4);
+    putLittleEndian(header + 28, sampleRate * 2, 4);
+    putLittleEndian(header + 40, dataBytes, 4);
+    return std::fwrite(header, 1, sizeof(header), file) == sizeof(header);
+}
+
+PcmSink::
+PcmSink(LogWriter* logWrit)
+{
+    logWriter = logWrit;
+    file = nullptr;
+}
+
+PcmSink::
+~PcmSink()
+{
+    close();
+}
+
+bool PcmSink::
+open(const std::string& path, unsigned int)
+{
+    file = path == "-" ? stdout : std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not open PCM output (" + path + ")");
+        return false;
+    }
+    return true;
+}
+
+bool PcmSink::
+write(const short* samples, size_t count)
+{
+    return file != nullptr && writeSamples(file, samples, count);
+}
+
+bool PcmSink::
+close()
+{
+    if (file == nullptr)
+    {
+        return true;
+    }
+    bool isGood = file == stdout ? std::fflush(file) == 0 : std::fclose(file) == 0;
+    file = nullptr;
+    return isGood;
+}
@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * AudioSink
+ * Destinations for rendered audio: 16-bit mono samples written to a WAV file or as raw PCM to a file,
+ * FIFO or stdout.
+ */
+
+#ifndef IMIT8_CHIP8_AUDIOSINK_H
+#define IMIT8_CHIP8_AUDIOSINK_H
+
+#include <cstdio>
+#include <string>
+#include "LogWriter.h"
+
+class AudioSink
+{
+    public:
+        virtual ~AudioSink() {}
+
+        virtual bool open(const std::string& path, unsigned int sampleRate) = 0;
+        virtual bool write(const short* samples, size_t count) = 0;
+        virtual bool close() = 0;
+};
+
+// RIFF/WAVE, 16-bit signed mono. The sizes in the header are filled in by close().
+class WavSink : public AudioSink
+{
+    public:
+        explicit WavSink(LogWriter* logWriter);
+        ~WavSink() override;
+
+        bool open(const std::string& path, unsigned int sampleRate) override;
+        bool write(const short* samples, size_t count) override;
+        bool close() override;
+
+    private:
+        LogWriter* logWriter;
+        FILE* file;
+        unsigned long long samplesWritten;
+        unsigned int sampleRate;
+
+        bool writeHeader(unsigned int dataBytes);
+};
+
+// Headerless signed 16-bit little-endian mono; "-" writes to stdout
+class PcmSink : public AudioSink
+{
+    public:
+        explicit PcmSink(LogWriter* logWriter);
+        ~PcmSink() override;
+
+        bool open(const std::string& path, unsigned int sampleRate) override;
+        bool write(const short* samples, size_t count) override;
+        bool close() override;
+
+    private:
+        LogWriter* logWriter;
+        FILE* file;
+};
+
+#endif //IMIT8_CHIP8_AUDIOSINK_H
@@ -0,0 +1,203 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Benchmark
+ * Times the Chip8 core on generated ROMs that each stress one class of opCode.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include "Benchmark.h"
+
+using namespace std::chrono;
+
+// Two-sided 95% critical values of Student's t distribution for 1 to 30 degrees of freedom
+static const double T_95[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                              2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                              2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+#define T_95_LARGE 1.960
+
+static void
+emit(std::vector<unsigned char>& rom, std::initializer_list<unsigned short> opCodes)
+{
+    for (unsigned short opCode : opCodes)
+    {
+        rom.push_back(static_cast<unsigned char>(opCode >> 8));
+        rom.push_back(static_cast<unsigned char>(opCode));
+    }
+}
+
+Benchmark::
+Benchmark(unsigned long long warmup, unsigned long long frames, int repeatCount)
+        : logWriter("bench_log.txt", LogWriter::LogLevel::OFF), cpu(&logWriter)
+{
+    warmupFrames = warmup;
+    framesPerSample = frames;
+    repeats = repeatCount;
+    cpu.setKeyWaitBlocking(false);
+}
+
+std::vector<Benchmark::Workload> Benchmark::
+workloads()
+{
+    std::vector<Workload> list;
+
+    // register arithmetic and logic, with an occasional skip
+    Workload alu = {"alu", "8XYN arithmetic, 7XNN adds and 9XY0 skips", {}, false};
+    emit(alu.rom, {0x6001, 0x6102, 0x6203, 0x6304});
+    for (int i = 0; i < 4; ++i)
+    {
+        emit(alu.rom, {0x8014, 0x8125, 0x7203, 0x8321, 0x8432, 0x8543, 0x8506, 0x860E, 0x7701, 0x8871, 0x9010});
+    }
+    emit(alu.rom, {0x7E01, 0x1208}); // the last skip may jump over 7E01, never over the loop
+    list.push_back(alu);
+
+    // font sprites drawn all over the screen
+    Workload draw = {"draw", "DXY5 sprites at moving, wrapped coordinates", {}, false};
+    emit(draw.rom, {0x00E0, 0x6000, 0x6100, 0x633F, 0x641F,
+                    0xF229, 0xD015, 0x7007, 0x8032, 0x7103, 0x8142, 0xD015, 0x7201, 0x120A});
+    list.push_back(draw);
+
+    // nested subroutine calls
+    Workload call = {"call", "2NNN calls two deep and 00EE returns", {}, false};
+    emit(call.rom, {0x2208, 0x2208, 0x1200, 0x0000, 0x220C, 0x00EE, 0x00EE});
+    list.push_back(call);
+
+    // decimal conversion and register dumps to memory and back
+    Workload store = {"store", "FX33 BCD, FX55 stores and FX65 loads", {}, false};
+    emit(store.rom, {0x6A7B, 0xA300, 0xFA33, 0xF265, 0x8A04, 0xA310, 0xF355, 0xF365, 0x7A01, 0x1202});
+    list.push_back(store);
+
+    // the usual way to wait: poll the delay timer until it runs out
+    Workload timer = {"timer", "FX07 / 3X00 / 1NNN delay timer wait loop", {}, false};
+    emit(timer.rom, {0x6A3C, 0xFA15, 0xF007, 0x3000, 0x1204, 0x1200});
+    list.push_back(timer);
+
+    // fusion speeds some of these up several times over, which would hide a regression in either path
+    size_t unfused = list.size();
+    for (size_t i = 0; i < unfused; ++i)
+    {
+        Workload fused = list[i];
+        fused.name += "-fused";
+        fused.description += ", fused";
+        fused.isFusing = true;
+        list.push_back(fused);
+    }
+    return list;
+}
+
+bool Benchmark::
+run(const Workload& workload, Result& result)
+{
+    cpu.init();
+    cpu.setFusion(workload.isFusing);
+    if (!cpu.loadBuffer(workload.rom.data(), workload.rom.size()) || !runFrames(warmupFrames))
+    {
+        return false;
+    }
+
+    result.name = workload.name;
+    result.instructionsPerSample = framesPerSample * OPCODES_PER_FRAME;
+    result.samples.clear();
+    for (int i = 0; i < repeats; ++i)
+    {
+        steady_clock::time_point start = steady_clock::now();
+        if (!runFrames(framesPerSample))
+        {
+            return false;
+        }
+        double nanoseconds = duration_cast<duration<double, std::nano>>(steady_clock::now() - start).count();
+        result.samples.push_back(nanoseconds / result.instructionsPerSample);
+    }
+
+    double sum = 0;
+    for (double sample : result.samples)
+    {
+        sum += sample;
+    }
+    result.mean = sum / result.samples.size();
+    double squares = 0;
+    for (double sample : result.samples)
+    {
+        squares += (sample - result.mean) * (sample - result.mean);
+    }
+    size_t n = result.samples.size();
+    result.standardDeviation = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+    double t = n < 2 ? 0 : n - 1 <= sizeof(T_95) / sizeof(T_95[0]) ? T_95[n - 2] : T_95_LARGE;
+    result.confidence95 = t * result.standardDeviation / std::sqrt(static_cast<double>(n));
+    return true;
+}
+
+bool Benchmark::
+runFrames(unsigned long long frames)
+{
+    for (unsigned long long frame = 0; frame < frames; ++frame)
+    {
+        unsigned int executed = 0;
+        for (unsigned int i = 0; i < OPCODES_PER_FRAME; i += executed)
+        {
+            if (!cpu.runStep(OPCODES_PER_FRAME - i, executed))
+            {
+                return false;
+            }
+        }
+        cpu.updateTimers();
+    }
+    return true;
+}
+
+bool Benchmark::
+writeJson(const std::string& path, const std::vector<Result>& results)
+{
+    std::ofstream out(path);
+    out << "{\n  \"unit\": \"ns/instruction\",\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result& result = results[i];
+        out << "    {\"name\": \"" << result.name << "\", \"mean\": " << result.mean
+            << ", \"ci95\": " << result.confidence95 << ", \"stddev\": " << result.standardDeviation
+            << ", \"repeats\": " << result.samples.size()
+            << ", \"instructions\": " << result.instructionsPerSample << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    out.close();
+    return out.good();
+}
+
+// Only has to understand what writeJson produces: each "name" is followed by its "mean".
+bool Benchmark::
+readBaseline(const std::string& path, std::map<std::string, double>& baseline)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        return false;
+    }
+    std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const std::string nameKey = "\"name\"";
+    const std::string meanKey = "\"mean\"";
+    for (size_t at = text.find(nameKey); at != std::string::npos; at = text.find(nameKey, at))
+    {
+        size_t open = text.find('"', text.find(':', at) + 1);
+        size_t close = text.find('"', open + 1);
+        size_t mean = text.find(meanKey, close);
+        if (open == std::string::npos || close == std::string::npos || mean == std::string::npos)
+        {
+            return false;
+        }
+        std::string name = text.substr(open + 1, close - open - 1);
+        baseline[name] = std::strtod(text.c_str() + text.find(':', mean) + 1, nullptr);
+        at = mean;
+    }
+    return !baseline.empty();
+}
@@ -0,0 +1,71 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Benchmark
+ * Times the Chip8 core on generated ROMs that each stress one class of opCode, and compares the results
+ * against a JSON baseline.
+ */
+
+#ifndef IMIT8_CHIP8_BENCHMARK_H
+#define IMIT8_CHIP8_BENCHMARK_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+#include "LogWriter.h"
+
+class Benchmark
+{
+    public:
+        // A generated ROM that loops forever
+        struct Workload
+        {
+            std::string name;
+            std::string description;
+            std::vector<unsigned char> rom;
+            bool isFusing;                 // run through instruction fusion rather than one instruction at a time
+        };
+
+        struct Result
+        {
+            std::string name;
+            unsigned long long instructionsPerSample;
+            std::vector<double> samples;   // ns per instruction
+            double mean;
+            double standardDeviation;
+            double confidence95;           // half-width of the 95% confidence interval of the mean
+        };
+
+        Benchmark(unsigned long long warmupFrames, unsigned long long framesPerSample, int repeats);
+
+        // The built-in workloads: alu, draw, call, store and timer one instruction at a time, then the same
+        // through instruction fusion as alu-fused, ... so each name keeps measuring one path
+        static std::vector<Workload> workloads();
+
+        // Run a workload headless, one frame being OPCODES_PER_FRAME cycles and a timer update. Returns
+        // false if the core stopped, which would make the numbers meaningless.
+        bool run(const Workload& workload, Result& result);
+
+        // Write results as JSON, which is also the baseline format
+        static bool writeJson(const std::string& path, const std::vector<Result>& results);
+
+        // Read the mean ns per instruction of every benchmark in a file written by writeJson
+        static bool readBaseline(const std::string& path, std::map<std::string, double>& baseline);
+
+    private:
+        LogWriter logWriter;
+        Chip8 cpu;
+        unsigned long long warmupFrames;
+        unsigned long long framesPerSample;
+        int repeats;
+
+        bool runFrames(unsigned long long frames);
+};
+
+#endif //IMIT8_CHIP8_BENCHMARK_H
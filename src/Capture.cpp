@@ -0,0 +1,565 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Capture
+ * Records the screen once per frame to a Y4M video, a PNG sequence or an animated GIF, encoding on a
+ * separate thread. PNG uses uncompressed deflate blocks and GIF its own LZW coder, so no image
+ * libraries are needed.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include "Capture.h"
+
+// How long the encoder thread sleeps when there is nothing to encode
+#define CAPTURE_ENCODER_SLEEP_MILLISECONDS 2
+#define GIF_MAX_CODES 4096
+#define GIF_MIN_CODE_SIZE 2        // two colours still need a minimum code size of 2
+#define DEFLATE_MAX_STORED 65535
+
+static void
+putBigEndian(std::vector<unsigned char>& out, unsigned int value)
+{
+    out.push_back(static_cast<unsigned char>(value >> 24));
+    out.push_back(static_cast<unsigned char>(value >> 16));
+    out.push_back(static_cast<unsigned char>(value >> 8));
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+static void
+putLittleEndian16(std::vector<unsigned char>& out, unsigned int value)
+{
+    out.push_back(static_cast<unsigned char>(value));
+    out.push_back(static_cast<unsigned char>(value >> 8));
+}
+
+static unsigned int
+crc32(const unsigned char* data, size_t length)
+{
+    static unsigned int table[256];
+    static bool hasTable = false;
+    if (!hasTable)
+    {
+        for (unsigned int n = 0; n < 256; ++n)
+        {
+            unsigned int c = n;
+            for (int k = 0; k < 8; ++k)
+            {
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        hasTable = true;
+    }
+    unsigned int crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; ++i)
+    {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static void
+putPngChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data)
+{
+    putBigEndian(out, static_cast<unsigned int>(data.size()));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    putBigEndian(out, crc32(&out[start], out.size() - start));
+}
+
+// zlib stream made of stored (uncompressed) deflate blocks
+static std::vector<unsigned char>
+zlibStore(const std::vector<unsigned char>& data)
+{
+    std::vector<unsigned char> out = {0x78, 0x01};
+    size_t offset = 0;
+    do
+    {
+        size_t length = std::min<size_t>(data.size() - offset, DEFLATE_MAX_STORED);
+        out.push_back(offset + length == data.size() ? 1 : 0);
+        putLittleEndian16(out, static_cast<unsigned int>(length));
+        putLittleEndian16(out, static_cast<unsigned int>(~length & 0xFFFF));
+        out.insert(out.end(), data.begin() + offset, data.begin() + offset + length);
+        offset += length;
+    } while (offset < data.size());
+
+    unsigned int a = 1;
+    unsigned int b = 0;
+    for (unsigned char byte : data)
+    {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    putBigEndian(out, b << 16 | a);
+    return out;
+}
+
+// Packs variable-length LZW codes least significant bit first into GIF data sub-blocks
+class GifCodeWriter
+{
+    public:
+        explicit GifCodeWriter(std::vector<unsigned char>& output) : out(output), bits(0), bitCount(0) {}
+
+        void write(unsigned int code, unsigned int size)
+        {
+            bits |= code << bitCount;
+            bitCount += size;
+            while (bitCount >= 8)
+            {
+                putByte(static_cast<unsigned char>(bits));
+                bits >>= 8;
+                bitCount -= 8;
+            }
+        }
+
+        void finish()
+        {
+            if (bitCount > 0)
+            {
+                putByte(static_cast<unsigned char>(bits));
+            }
+            if (!block.empty())
+            {
+                out.push_back(static_cast<unsigned char>(block.size()));
+                out.insert(out.end(), block.begin(), block.end());
+            }
+            out.push_back(0); // block terminator
+        }
+
+    private:
+        std::vector<unsigned char>& out;
+        std::vector<unsigned char> block;
+        unsigned int bits;
+        unsigned int bitCount;
+
+        void putByte(unsigned char byte)
+        {
+            block.push_back(byte);
+            if (block.size() == 255)
+            {
+                out.push_back(255);
+                out.insert(out.end(), block.begin(), block.end());
+                block.clear();
+            }
+        }
+};
+
+Capture::
+Capture(LogWriter* logWrit)
+        : pool(CAPTURE_POOL_FRAMES)
+{
+    logWriter = logWrit;
+    format = Y4M;
+    scale = CAPTURE_DEFAULT_SCALE;
+    file = nullptr;
+    hasPending = false;
+    framesCaptured = 0;
+    head.store(0);
+    tail.store(0);
+    isEncoding.store(false);
+    hasFailed.store(false);
+    framesEncoded = 0;
+    imagesEncoded = 0;
+}
+
+Capture::
+~Capture()
+{
+    stop();
+}
+
+Capture::Format Capture::
+formatFor(const std::string& path)
+{
+    std::string extension = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+    for (char& c : extension)
+    {
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    if (extension == ".y4m")
+    {
+        return Y4M;
+    }
+    return extension == ".gif" ? GIF : PNG_SEQUENCE;
+}
+
+bool Capture::
+start(Format captureFormat, const std::string& capturePath, unsigned int captureScale)
+{
+    if (isEncoding.load() || captureScale == 0)
+    {
+        return false;
+    }
+    format = captureFormat;
+    path = capturePath;
+    scale = captureScale;
+    if (format != PNG_SEQUENCE)
+    {
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr)
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, "Could not open capture file (" + path + ")");
+            return false;
+        }
+    }
+    if (!writeHeader())
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not write capture file (" + path + ")");
+        return false;
+    }
+    isEncoding.store(true);
+    encoder = std::thread(&Capture::encode, this);
+    return true;
+}
+
+void Capture::
+captureFrame(const unsigned char* screen, const DirtyRegion& dirty)
+{
+    ++framesCaptured;
+    if (hasPending && isSameRows(pending.pixels, screen, dirty.rows))
+    {
+        ++pending.duration;
+        return;
+    }
+    if (hasPending)
+    {
+        publish();
+    }
+    std::memcpy(pending.pixels, screen, SCREEN_SIZE);
+    pending.duration = 1;
+    hasPending = true;
+}
+
+// Rows outside `rows` are the same already; a sprite drawn and erased again leaves its rows dirty but unchanged
+bool Capture::
+isSameRows(const unsigned char* pixels, const unsigned char* screen, unsigned int rows)
+{
+    for (int row = 0; rows >> row != 0; ++row)
+    {
+        if ((rows & (1u << row)) &&
+            std::memcmp(pixels + row * SCREEN_WIDTH_SIZE, screen + row * SCREEN_WIDTH_SIZE, SCREEN_WIDTH_SIZE) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Capture::
+stop()
+{
+    if (!isEncoding.load())
+    {
+        return;
+    }
+    if (hasPending)
+    {
+        publish();
+        hasPending = false;
+    }
+    isEncoding.store(false);
+    encoder.join();
+
+    bool isGood = !hasFailed.load() && writeTrailer();
+    if (file != nullptr)
+    {
+        isGood = std::fclose(file) == 0 && isGood;
+        file = nullptr;
+    }
+    if (isGood)
+    {
+        logWriter->log(LogWriter::LogLevel::INFO, "Captured " + std::to_string(framesCaptured) + " frames as " +
+                       std::to_string(imagesEncoded) + " images to " + path);
+    }
+    else
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Writing the capture failed (" + path + ")");
+    }
+}
+
+unsigned long long Capture::
+getFramesCaptured() const
+{
+    return framesCaptured;
+}
+
+unsigned long long Capture::
+getImagesEncoded() const
+{
+    return imagesEncoded;
+}
+
+// Hand the pending record to the encoder, waiting for a free slot rather than losing frames
+void Capture::
+publish()
+{
+    unsigned long long writeAt = head.load(std::memory_order_relaxed);
+    while (writeAt - tail.load(std::memory_order_acquire) >= CAPTURE_POOL_FRAMES)
+    {
+        if (hasFailed.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+        std::this_thread::yield();
+    }
+    pool[writeAt % CAPTURE_POOL_FRAMES] = pending;
+    head.store(writeAt + 1, std::memory_order_release);
+}
+
+// Encoder thread. It leaves logging to stop(), as LogWriter belongs to the emulation thread.
+void Capture::
+encode()
+{
+    bool isRunning = true;
+    while (isRunning)
+    {
+        isRunning = isEncoding.load();
+        unsigned long long readAt = tail.load(std::memory_order_relaxed);
+        unsigned long long available = head.load(std::memory_order_acquire);
+        for (; readAt < available; ++readAt)
+        {
+            if (!writeRecord(pool[readAt % CAPTURE_POOL_FRAMES]))
+            {
+                hasFailed.store(true);
+                return;
+            }
+            tail.store(readAt + 1, std::memory_order_release);
+        }
+        if (isRunning)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(CAPTURE_ENCODER_SLEEP_MILLISECONDS));
+        }
+    }
+}
+
+bool Capture::
+writeRecord(const FrameRecord& record)
+{
+    bool isGood;
+    switch (format)
+    {
+        case Y4M:
+            isGood = writeY4mFrame(record);
+            break;
+        case PNG_SEQUENCE:
+            isGood = writePngFrame(record);
+            break;
+        default:
+            isGood = writeGifImage(record);
+            break;
+    }
+    framesEncoded += record.duration;
+    ++imagesEncoded;
+    return isGood;
+}
+
+bool Capture::
+writeY4mFrame(const FrameRecord& record)
+{
+    unsigned int width = SCREEN_WIDTH * scale;
+    unsigned int height = SCREEN_HEIGHT * scale;
+    std::vector<unsigned char> frame;
+    frame.reserve(6 + width * height * 3 / 2);
+    const char* marker = "FRAME\n";
+    frame.insert(frame.end(), marker, marker + 6);
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        for (unsigned int x = 0; x < width; ++x)
+        {
+            frame.push_back(isLit(record, x / scale, y / scale) ? 255 : 0);
+        }
+    }
+    frame.resize(frame.size() + (width / 2) * (height / 2) * 2, 128); // neutral chroma
+    for (unsigned int i = 0; i < record.duration; ++i)
+    {
+        if (std::fwrite(frame.data(), 1, frame.size(), file) != frame.size())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Capture::
+writePngFrame(const FrameRecord& record)
+{
+    unsigned int width = SCREEN_WIDTH * scale;
+    unsigned int height = SCREEN_HEIGHT * scale;
+    unsigned int rowBytes = (width + 7) / 8;
+
+    std::vector<unsigned char> raw;
+    raw.reserve((rowBytes + 1) * height);
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        raw.push_back(0); // filter: none
+        for (unsigned int byte = 0; byte < rowBytes; ++byte)
+        {
+            unsigned char packed = 0;
+            for (unsigned int bit = 0; bit < 8; ++bit)
+            {
+                unsigned int x = byte * 8 + bit;
+                if (x < width && isLit(record, x / scale, y / scale))
+                {
+                    packed |= 0x80 >> bit;
+                }
+            }
+            raw.push_back(packed);
+        }
+    }
+
+    std::vector<unsigned char> header;
+    putBigEndian(header, width);
+    putBigEndian(header, height);
+    header.push_back(1); // bit depth
+    header.push_back(0); // greyscale
+    header.push_back(0); // deflate
+    header.push_back(0); // adaptive filtering
+    header.push_back(0); // not interlaced
+
+    lastPng.assign({0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'});
+    putPngChunk(lastPng, "IHDR", header);
+    putPngChunk(lastPng, "IDAT", zlibStore(raw));
+    putPngChunk(lastPng, "IEND", std::vector<unsigned char>());
+
+    // repeated frames are written again so that the sequence keeps one file per frame
+    for (unsigned int i = 0; i < record.duration; ++i)
+    {
+        char number[32];
+        std::snprintf(number, sizeof(number), "%06llu.png", framesEncoded + i);
+        FILE* image = std::fopen((path + number).c_str(), "wb");
+        if (image == nullptr)
+        {
+            return false;
+        }
+        bool isGood = std::fwrite(lastPng.data(), 1, lastPng.size(), image) == lastPng.size();
+        if (std::fclose(image) != 0 || !isGood)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Capture::
+writeGifImage(const FrameRecord& record)
+{
+    unsigned int width = SCREEN_WIDTH * scale;
+    unsigned int height = SCREEN_HEIGHT * scale;
+    std::vector<unsigned char> out;
+
+    // delay in hundredths of a second, rounded from the frame clock so that errors do not add up
+    unsigned long long start = (framesEncoded * 100 + FRAMES_PER_SECOND / 2) / FRAMES_PER_SECOND;
+    unsigned long long end = ((framesEncoded + record.duration) * 100 + FRAMES_PER_SECOND / 2) / FRAMES_PER_SECOND;
+    unsigned int delay = static_cast<unsigned int>(std::min<unsigned long long>(end - start, 0xFFFF));
+
+    out.reserve(SCREEN_SIZE * scale * scale);
+    out.insert(out.end(), {0x21, 0xF9, 0x04, 0x00}); // graphic control extension
+    putLittleEndian16(out, delay);
+    out.push_back(0x00);
+    out.push_back(0x00);
+    out.push_back(0x2C);                            // image descriptor
+    putLittleEndian16(out, 0);
+    putLittleEndian16(out, 0);
+    putLittleEndian16(out, width);
+    putLittleEndian16(out, height);
+    out.push_back(0x00);
+    out.push_back(GIF_MIN_CODE_SIZE);
+
+    // LZW over the pixel indices (0 = black, 1 = white)
+    static unsigned short next[GIF_MAX_CODES][1 << GIF_MIN_CODE_SIZE];
+    const unsigned int clearCode = 1 << GIF_MIN_CODE_SIZE;
+    GifCodeWriter codes(out);
+    unsigned int codeSize = GIF_MIN_CODE_SIZE + 1;
+    unsigned int maxCode = clearCode + 1;
+    std::memset(next, 0, sizeof(next));
+    codes.write(clearCode, codeSize);
+
+    int current = -1;
+    for (unsigned int y = 0; y < height; ++y)
+    {
+        for (unsigned int x = 0; x < width; ++x)
+        {
+            unsigned int pixel = isLit(record, x / scale, y / scale) ? 1 : 0;
+            if (current < 0)
+            {
+                current = static_cast<int>(pixel);
+                continue;
+            }
+            if (next[current][pixel] != 0)
+            {
+                current = next[current][pixel];
+                continue;
+            }
+            codes.write(static_cast<unsigned int>(current), codeSize);
+            next[current][pixel] = static_cast<unsigned short>(++maxCode);
+            if (maxCode >= (1u << codeSize))
+            {
+                ++codeSize;
+            }
+            if (maxCode == GIF_MAX_CODES - 1)
+            {
+                codes.write(clearCode, codeSize);
+                std::memset(next, 0, sizeof(next));
+                codeSize = GIF_MIN_CODE_SIZE + 1;
+                maxCode = clearCode + 1;
+            }
+            current = static_cast<int>(pixel);
+        }
+    }
+    codes.write(static_cast<unsigned int>(current), codeSize);
+    codes.write(clearCode + 1, codeSize); // end of information
+    codes.finish();
+
+    return std::fwrite(out.data(), 1, out.size(), file) == out.size();
+}
+
+bool Capture::
+writeHeader()
+{
+    unsigned int width = SCREEN_WIDTH * scale;
+    unsigned int height = SCREEN_HEIGHT * scale;
+    if (format == Y4M)
+    {
+        return std::fprintf(file, "YUV4MPEG2 W%u H%u F%d:1 Ip A1:1 C420jpeg\n", width, height, FRAMES_PER_SECOND) > 0;
+    }
+    if (format == GIF)
+    {
+        std::vector<unsigned char> out = {'G', 'I', 'F', '8', '9', 'a'};
+        putLittleEndian16(out, width);
+        putLittleEndian16(out, height);
+        out.push_back(0x80);    // global colour table of 2 entries
+        out.push_back(0);       // background colour
+        out.push_back(0);       // square pixels
+        out.insert(out.end(), {0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF});
+        // loop forever
+        out.insert(out.end(), {0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0',
+                               0x03, 0x01, 0x00, 0x00, 0x00});
+        return std::fwrite(out.data(), 1, out.size(), file) == out.size();
+    }
+    return true;
+}
+
+bool Capture::
+writeTrailer()
+{
+    if (format == GIF)
+    {
+        return std::fputc(0x3B, file) != EOF;
+    }
+    return true;
+}
+
+bool Capture::
+isLit(const FrameRecord& record, unsigned int x, unsigned int y) const
+{
+    return (record.pixels[y * SCREEN_WIDTH_SIZE + x / 8] >> (7 - x % 8)) & 1;
+}
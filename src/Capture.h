@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Capture
+ * Records the screen once per frame to a Y4M video, a PNG sequence or an animated GIF. The emulation
+ * loop only copies the 256-byte framebuffer into a preallocated slot (or, if nothing changed, bumps
+ * the previous frame's duration); encoding and file I/O happen on a separate thread.
+ */
+
+#ifndef IMIT8_CHIP8_CAPTURE_H
+#define IMIT8_CHIP8_CAPTURE_H
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Chip8.h"
+
+#define CAPTURE_POOL_FRAMES 256   // power of two
+#define CAPTURE_DEFAULT_SCALE 4
+
+class Capture
+{
+    public:
+        enum Format
+        {
+            Y4M,            // uncompressed 4:2:0 video at 60 fps
+            PNG_SEQUENCE,   // one 1-bit PNG per frame, named PATH000000.png, PATH000001.png, ...
+            GIF,            // animated GIF, one image per change of screen
+        };
+
+        explicit Capture(LogWriter* logWriter);
+        ~Capture();
+
+        // .y4m and .gif pick those formats; any other path is the prefix of a PNG sequence
+        static Format formatFor(const std::string& path);
+
+        // Open the output and start the encoder thread. Each Chip-8 pixel becomes scale x scale pixels.
+        bool start(Format format, const std::string& path, unsigned int scale = CAPTURE_DEFAULT_SCALE);
+
+        // Record one frame of a SCREEN_SIZE-byte, 1 bit per pixel screen. dirty is what changed since the last
+        // frame captured: only those rows are compared, and none at all when it is empty.
+        void captureFrame(const unsigned char* screen, const DirtyRegion& dirty);
+
+        // Encode whatever is left, finish the file and stop the encoder thread
+        void stop();
+
+        unsigned long long getFramesCaptured() const;
+        unsigned long long getImagesEncoded() const;
+
+    private:
+        // A run of identical frames
+        struct FrameRecord
+        {
+            unsigned char pixels[SCREEN_SIZE];
+            unsigned int duration;   // in frames
+        };
+
+        LogWriter* logWriter;
+        Format format;
+        std::string path;
+        unsigned int scale;
+        FILE* file;
+
+        // Producer side (emulation thread)
+        FrameRecord pending;
+        bool hasPending;
+        unsigned long long framesCaptured;
+
+        // Pool of records shared with the encoder thread
+        std::vector<FrameRecord> pool;
+        alignas(64) std::atomic<unsigned long long> head;   // records published
+        alignas(64) std::atomic<unsigned long long> tail;   // records encoded
+        std::thread encoder;
+        std::atomic<bool> isEncoding;
+        std::atomic<bool> hasFailed;
+
+        // Encoder side
+        unsigned long long framesEncoded;
+        unsigned long long imagesEncoded;
+        std::vector<unsigned char> lastPng;
+
+        void publish();
+        static bool isSameRows(const unsigned char* pixels, const unsigned char* screen, unsigned int rows);
+        void encode();
+        bool writeRecord(const FrameRecord& record);
+        bool writeY4mFrame(const FrameRecord& record);
+        bool writePngFrame(const FrameRecord& record);
+        bool writeGifImage(const FrameRecord& record);
+        bool writeHeader();
+        bool writeTrailer();
+        bool isLit(const FrameRecord& record, unsigned int x, unsigned int y) const;
+};
+
+#endif //IMIT8_CHIP8_CAPTURE_H
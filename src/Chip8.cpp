@@ -10,12 +10,53 @@
  * Implementation of the Chip-8 CPU Core.
  */
 
+#include <cstring>
 #include "Chip8.h"
+#include "Coverage.h"
+#include "PerfCounters.h"
+
+// Debug messages are assembled from several temporaries; only build them when they will be written.
+#define LOG_DEBUG(...) \
+    do { if (logWriter->isLogging(LogWriter::LogLevel::DEBUG)) logWriter->log(LogWriter::LogLevel::DEBUG, __VA_ARGS__); } while (0)
+
+// idleJumpAddress when no loop is being watched
+#define NO_IDLE_JUMP 0xFFFF
+
+// Could the code at this address start a sequence runStep fuses? Only the first hex digits of the first two
+// instructions are compared: ANNN DXYN, 6XNN 6YNN, 7XNN 3XNN and FX07 3X00.
+static inline bool
+startsSequence(const unsigned char* code)
+{
+    unsigned char digits = static_cast<unsigned char>((code[0] & 0xF0) | code[2] >> 4);
+    return digits == 0xAD || digits == 0x66 || digits == 0x73 || digits == 0xF3;
+}
+
+const unsigned char Chip8::font[FONT_SIZE] = {0xF0, 0x90, 0x90, 0x90, 0xF0, 0x20, 0x60, 0x20, 0x20, 0x70,
+                                              0xF0, 0x10, 0xF0, 0x80, 0xF0, 0xF0, 0x10, 0xF0, 0x10, 0xF0,
+                                              0x90, 0x90, 0xF0, 0x10, 0x10, 0xF0, 0x80, 0xF0, 0x10, 0xF0,
+                                              0xF0, 0x80, 0xF0, 0x90, 0xF0, 0xF0, 0x10, 0x20, 0x40, 0x40,
+                                              0xF0, 0x90, 0xF0, 0x90, 0xF0, 0xF0, 0x90, 0xF0, 0x10, 0xF0,
+                                              0xF0, 0x90, 0xF0, 0x90, 0x90, 0xE0, 0x90, 0xE0, 0x90, 0xE0,
+                                              0xF0, 0x80, 0x80, 0x80, 0xF0, 0xE0, 0x90, 0x90, 0x90, 0xE0,
+                                              0xF0, 0x80, 0xF0, 0x80, 0xF0, 0xF0, 0x80, 0xF0, 0x80, 0x80};
 
 Chip8::
 Chip8(LogWriter * logWrit)
 {
     logWriter = logWrit;
+    isKeyWaitBlocking = true;
+    keyReads = 0;
+    metrics = nullptr;
+    debugHook = nullptr;
+    coverage = nullptr;
+    perfCounters = nullptr;
+    heldMetrics = nullptr;
+    heldCoverage = nullptr;
+    heldPerfCounters = nullptr;
+    isSpeculating = false;
+    isIdleDetecting = false;
+    isFusing = true;
+    std::memset(&fusion, 0, sizeof(fusion));
     init();
 }
 
@@ -24,33 +65,37 @@ init()
 {
     logWriter->log(LogWriter::LogLevel::INFO, "Initializing CPU...");
 
-    for (unsigned char& i : registers)
+    for (unsigned char& i : state.registers)
     {
         i = 0;
     }
-    for (unsigned char& i : graphicsBuffer)
+    for (unsigned char& i : state.graphicsBuffer)
     {
         i = 0;
     }
-    while (!callStack.empty())
+    for (unsigned char& i : state.keypad)
     {
-        callStack.pop();
+        i = 0;
     }
+    state.stackPointer = 0;
 
     loadFontSet(); // load font to memory, then zero the rest
     for (int i = FONT_SIZE; i < MEMORY_SIZE; ++i)
     {
-        memory[i] = 0;
+        state.memory[i] = 0;
     }
 
-    delayInterruptTimer = 0;
-    index = 0;
-    opCode = 0;
-    progCounter = CODE_START;
-    romBytes = 0;
-    soundInterruptTimer = 0;
-    isDirty = false;
-    srand(static_cast<unsigned int>(time(nullptr)));
+    state.delayInterruptTimer = 0;
+    state.index = 0;
+    state.opCode = 0;
+    state.progCounter = CODE_START;
+    state.romBytes = 0;
+    state.soundInterruptTimer = 0;
+    state.isDirty = false;
+    std::memset(&state.dirty, 0, sizeof(state.dirty));
+    isIdleLoop = false;
+    idleJumpAddress = NO_IDLE_JUMP;
+    state.randomState = static_cast<unsigned int>(time(nullptr)) | 1; // xorshift must not start at 0
 
     logWriter->log(LogWriter::LogLevel::INFO, "Done initializing CPU.");
     return true;
@@ -62,14 +107,14 @@ bool Chip8::
 loadFile(const std::string& fileToLoad)
 {
     logWriter->log(LogWriter::LogLevel::INFO, "Reading CHIP-8 ROM file...");
-    std::ifstream fin(fileToLoad, std::ios::in);
-    bool isRomLoaded = loadROM(&fin);
+    std::ifstream fin(fileToLoad, std::ios::in | std::ios::binary);
+    std::vector<unsigned char> rom((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
     fin.close();
-    if (isRomLoaded)
+    if (loadBuffer(rom.data(), rom.size()))
     {
         std::string fileRead = "CHIP-8 ROM file loaded (" + fileToLoad;
         fileRead += ": ";
-        fileRead += std::to_string(romBytes);
+        fileRead += std::to_string(state.romBytes);
         fileRead += " bytes).";
         logWriter->log(LogWriter::LogLevel::INFO, fileRead);
         return true;
@@ -81,104 +126,358 @@ loadFile(const std::string& fileToLoad)
     }
 }
 
+// Copy a ROM image into memory at 0x200. Fails on an empty ROM or one that does not fit.
+bool Chip8::
+loadBuffer(const unsigned char* rom, size_t length)
+{
+    if (length == 0 || length > MEMORY_SIZE - CODE_START)
+    {
+        return false;
+    }
+    std::copy_n(rom, length, state.memory + CODE_START);
+    state.romBytes = static_cast<unsigned short>(length);
+    return true;
+}
+
 // Copy font to first 80 memory locations
 bool Chip8::
 loadFontSet()
 {
-    std::copy_n(font, FONT_SIZE, memory);
+    std::copy_n(font, FONT_SIZE, state.memory);
     return true;
 }
 
+// Get the starting location of vram
+unsigned char* Chip8::
+getScreen()
+{
+    return state.graphicsBuffer;
+}
+
+// Run the next cycle
 bool Chip8::
-loadROM(std::ifstream* fin)
+runCycle()
 {
-    char op;
-    unsigned short i;
-    for (i = CODE_START; i < MEMORY_SIZE && !fin->eof(); ++i)
+    state.isDirty = false;
+    isIdleLoop = false;
+    if (debugHook != nullptr && debugHook->beforeInstruction(state))
+    {
+        return true;
+    }
+    if (state.progCounter > MEMORY_SIZE - 2)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Program counter out of bounds", {{"pc", state.progCounter, true}});
+        return false;
+    }
+    fetch();
+    if (metrics != nullptr)
+    {
+        metrics->countOpCode(state.opCode);
+    }
+    if (coverage == nullptr && perfCounters == nullptr)
+    {
+        return decodeAndExecute();
+    }
+    unsigned short address = state.progCounter;
+    bool isRunning;
+    if (perfCounters != nullptr && perfCounters->countInstruction())
+    {
+        perfCounters->beginSample();
+        isRunning = decodeAndExecute();
+        perfCounters->endSample(state.opCode);
+    }
+    else
+    {
+        isRunning = decodeAndExecute();
+    }
+    if (coverage != nullptr)
     {
-        fin->read(&op, 1);
-        memory[i] = static_cast<unsigned char>(op);
+        coverage->countInstruction(address, state.opCode, state.progCounter);
+    }
+    return isRunning;
+}
+
+bool Chip8::
+runStep(unsigned int budget, unsigned int& executed)
+{
+    // most instructions start no sequence, so that is ruled out first
+    if (state.progCounter <= MEMORY_SIZE - 6 && startsSequence(state.memory + state.progCounter) && budget >= 2 &&
+        isFusing && debugHook == nullptr && coverage == nullptr && perfCounters == nullptr &&
+        !logWriter->isLogging(LogWriter::LogLevel::DEBUG))
+    {
+        executed = 0;
+        bool isRunning = runFused(budget, executed);
+        if (executed != 0)
+        {
+            fusion.instructions += executed;
+            return isRunning;
+        }
+    }
+    executed = 1;
+    ++fusion.instructions;
+    return runCycle();
+}
+
+// Run the fused sequence at the program counter, if there is one. Nothing is cached: what is in memory now
+// decides, so neither jumps into a sequence nor code that rewrites one need any bookkeeping.
+bool Chip8::
+runFused(unsigned int budget, unsigned int& executed)
+{
+    unsigned short address = state.progCounter;
+    unsigned short first = state.memory[address] << 8 | state.memory[address + 1];
+    unsigned short second = state.memory[address + 2] << 8 | state.memory[address + 3];
+    unsigned short third = state.memory[address + 4] << 8 | state.memory[address + 5];
+    state.isDirty = false;
+    isIdleLoop = false;
+    switch (first >> 12)
+    {
+        case 0xA:
+            if ((second & 0xF000) == 0xD000)
+            {
+                return runSpriteDraw(first, second, executed);
+            }
+            break;
+
+        case 0x6:
+            if ((second & 0xF000) == 0x6000)
+            {
+                runCoordinates(first, second, executed);
+            }
+            break;
+
+        case 0xF:
+            if ((first & 0xFF) == 0x07 && second == (0x3000 | (first & 0x0F00)) && third == (0x1000 | address))
+            {
+                if (budget < 3)
+                {
+                    ++fusion.shortBudget[FUSED_TIMER_WAIT];
+                    break;
+                }
+                runTimerWait(first, second, third, budget, executed);
+            }
+            break;
+
+        case 0x7:
+            if ((second & 0xFF00) == (0x3000 | (first & 0x0F00)) && (third & 0xF000) == 0x1000)
+            {
+                if (budget < 3)
+                {
+                    ++fusion.shortBudget[FUSED_COUNTED_LOOP];
+                    break;
+                }
+                return runCountedLoop(first, second, third, budget, executed);
+            }
+            break;
+
+        default:
+            break;
     }
+    return true;
+}
 
-    romBytes = i - CODE_START;
-    if (romBytes > 0)
+// ANNN, DXYN: as the two would, including stopping at the DXYN if the sprite is not in memory
+bool Chip8::
+runSpriteDraw(unsigned short first, unsigned short second, unsigned int& executed)
+{
+    countOpCode(first);
+    countOpCode(second);
+    state.index = first & 0x0FFF;
+    state.progCounter += 2;
+    state.opCode = second;
+    executed = 2;
+    countFused(FUSED_SPRITE_DRAW, executed);
+    unsigned char h = second & 0xF;
+    if (!isInMemory(state.index, h))
     {
-        romBytes--;
+        return false;
     }
+    drawSprite(state, (second >> 8) & 0xF, (second >> 4) & 0xF, h);
+    state.progCounter += 2;
+    state.isDirty = true;
+    idleJumpAddress = NO_IDLE_JUMP;
+    return true;
+}
 
-    // If we filled the memory, but we're not at the end of the file, then the ROM is too big.
-    // If the length of the ROM file is 0, it's an error.
-    bool loadSuccess = !((i >= MEMORY_SIZE && !fin->eof()) || !romBytes);
-    return loadSuccess;
+// 6XNN, 6YNN, in order in case X is Y
+void Chip8::
+runCoordinates(unsigned short first, unsigned short second, unsigned int& executed)
+{
+    countOpCode(first);
+    countOpCode(second);
+    state.registers[(first >> 8) & 0xF] = first & 0xFF;
+    state.registers[(second >> 8) & 0xF] = second & 0xFF;
+    state.progCounter += 4;
+    state.opCode = second;
+    executed = 2;
+    countFused(FUSED_COORDINATES, executed);
 }
 
-// Get the starting location of vram
-unsigned char* Chip8::
-getScreen()
+// FX07, 3X00, 1NNN back to the FX07. The delay timer only changes between frames, so every pass in the
+// budget goes the same way; they stop early where the idle loop watch would have stopped the frame.
+void Chip8::
+runTimerWait(unsigned short first, unsigned short second, unsigned short third, unsigned int budget,
+             unsigned int& executed)
 {
-    return graphicsBuffer;
+    unsigned short address = state.progCounter;
+    unsigned char x = (first >> 8) & 0xF;
+    do
+    {
+        countOpCode(first);
+        countOpCode(second);
+        state.registers[x] = state.delayInterruptTimer;
+        if (state.registers[x] == 0)
+        {
+            state.progCounter = address + 6;
+            state.opCode = second;
+            executed += 2;
+            break;
+        }
+        countOpCode(third);
+        state.progCounter = address;
+        state.opCode = third;
+        executed += 3;
+        if (isIdleDetecting)
+        {
+            watchIdleLoop(address + 4);
+        }
+    } while (budget - executed >= 3 && !isIdleLoop);
+    countFused(FUSED_TIMER_WAIT, executed);
 }
 
-// Run the next cycle
+// 7XNN, 3XMM, 1NNN. When the 1NNN jumps back to the 7XNN the passes in the budget are run here too.
 bool Chip8::
-runCycle()
+runCountedLoop(unsigned short first, unsigned short second, unsigned short third, unsigned int budget,
+               unsigned int& executed)
 {
-    isDirty = false;
-    fetch();
-    return decodeAndExecute();
+    unsigned short address = state.progCounter;
+    unsigned short target = third & 0x0FFF;
+    unsigned char x = (first >> 8) & 0xF;
+    bool isRunning = true;
+    while (true)
+    {
+        countOpCode(first);
+        countOpCode(second);
+        state.registers[x] += first & 0xFF;
+        if (state.registers[x] == (second & 0xFF))
+        {
+            state.progCounter = address + 6;
+            state.opCode = second;
+            executed += 2;
+            break;
+        }
+        countOpCode(third);
+        state.progCounter = target;
+        state.opCode = third;
+        executed += 3;
+        if (target == address + 4)
+        {
+            isRunning = false; // a goto to itself ends execution, as in decodeAndExecute
+            break;
+        }
+        if (isIdleDetecting && target < address + 4)
+        {
+            watchIdleLoop(address + 4);
+        }
+        if (target != address || budget - executed < 3 || isIdleLoop)
+        {
+            break;
+        }
+    }
+    countFused(FUSED_COUNTED_LOOP, executed);
+    return isRunning;
+}
+
+void Chip8::
+countFused(Chip8Fusion kind, unsigned int executed)
+{
+    ++fusion.hits[kind];
+    fusion.fusedInstructions[kind] += executed;
+}
+
+void Chip8::
+countOpCode(unsigned short opCode)
+{
+    if (metrics != nullptr)
+    {
+        metrics->countOpCode(opCode);
+    }
+}
+
+void Chip8::
+setFusion(bool isFusing)
+{
+    Chip8::isFusing = isFusing;
+}
+
+const Chip8FusionStatistics& Chip8::
+getFusionStatistics() const
+{
+    return fusion;
+}
+
+// Called at a backward jump from address. The loop is idle when the same jump comes round again with the
+// registers unchanged and, in between, no instruction that touches memory, the screen, the timers or the
+// random number generator (those reset idleJumpAddress). Nothing then differs from one iteration to the next
+// until the delay timer or the keypad changes.
+void Chip8::
+watchIdleLoop(unsigned short address)
+{
+    if (idleJumpAddress == address && idleIndex == state.index && idleStackPointer == state.stackPointer &&
+        std::equal(state.registers, state.registers + NUMBER_OF_REGISTERS, idleRegisters))
+    {
+        isIdleLoop = true;
+        return;
+    }
+    idleJumpAddress = address;
+    std::copy_n(state.registers, NUMBER_OF_REGISTERS, idleRegisters);
+    idleIndex = state.index;
+    idleStackPointer = state.stackPointer;
 }
 
 // Fetch the next opCode
 void Chip8::
 fetch()
 {
-    opCode = memory[progCounter] << 8 | memory[progCounter + 1];
-    std::string log = "Fetch: PC=" + intToHexString(progCounter);
-    log += ", opCode=" + intToHexString(opCode);
-    logWriter->log(LogWriter::LogLevel::DEBUG, log);
+    state.opCode = state.memory[state.progCounter] << 8 | state.memory[state.progCounter + 1];
+    LOG_DEBUG("Fetch: PC=" + intToHexString(state.progCounter) + ", opCode=" + intToHexString(state.opCode));
 }
 
 // Decode the fetched opCode and execute it
 bool Chip8::
 decodeAndExecute()
 {
-    switch (getHexDigit1(opCode))
+    switch (getHexDigit1(state.opCode))
     {
         // 0x0XXX ()
         case 0x0:
-            switch (getHexAddress(opCode))
+            switch (getHexAddress(state.opCode))
             {
                 // 0x00E0 (clear the screen)
                 case 0x0E0:
                 {
-                    for (unsigned char& i : graphicsBuffer)
-                    {
-                        i = 0;
-                    }
-                    progCounter += 2;
-                    isDirty = true;
-                    logWriter->log(LogWriter::LogLevel::DEBUG, "Clear screen");
+                    clearScreen(state);
+                    state.progCounter += 2;
+                    idleJumpAddress = NO_IDLE_JUMP;
+                    LOG_DEBUG("Clear screen");
                     break;
                 }
 
                 // 0x00EE (return from subroutine)
                 case 0x0EE:
                 {
-                    if (callStack.empty())
+                    if (state.stackPointer == 0)
                     {
-                        logWriter->log(LogWriter::LogLevel::ERROR, "Call stack is empty. Exiting.");
+                        logInstructionError("Call stack is empty. Exiting.");
                         return false;
                     }
-                    std::string log = "Return from subroutine";
-                    logWriter->log(LogWriter::LogLevel::DEBUG, log);
-                    progCounter = callStack.top();
-                    callStack.pop();
+                    LOG_DEBUG("Return from subroutine");
+                    state.progCounter = state.callStack[--state.stackPointer];
                     break;
                 }
 
                 // call to address XXX
                 default:
-                    logWriter->log(LogWriter::LogLevel::DEBUG, "0x0XXX: call to address XXX not used in modern VMs");
+                    LOG_DEBUG("0x0XXX: call to address XXX not used in modern VMs");
                     return false;
             }
             break;
@@ -186,134 +485,136 @@ decodeAndExecute()
         // 0x1XXX (goto)
         case 0x1:
         {
-            unsigned short prevProgramCounter = progCounter;
-            progCounter = getHexAddress(opCode);
+            unsigned short prevProgramCounter = state.progCounter;
+            state.progCounter = getHexAddress(state.opCode);
             // if in a single-instruction goto loop, may as well end computation
-            if (progCounter == prevProgramCounter)
+            if (state.progCounter == prevProgramCounter)
             {
-                std::string log = "Execution ended due to GOTO loop, PC=" + intToHexString(progCounter) +
-                        ", OpCode=" + intToHexString(opCode);
-                logWriter->log(LogWriter::LogLevel::DEBUG, log);
+                LOG_DEBUG("Execution ended due to GOTO loop, PC=" + intToHexString(state.progCounter) +
+                        ", OpCode=" + intToHexString(state.opCode));
                 return false;
             }
-            logWriter->log(LogWriter::LogLevel::DEBUG, "GoTo");
+            if (isIdleDetecting && state.progCounter < prevProgramCounter)
+            {
+                watchIdleLoop(prevProgramCounter);
+            }
+            LOG_DEBUG("GoTo");
             break;
         }
 
         // 0x2XXX (subroutine call)
         case 0x2:
-            callStack.push(progCounter + 2);
-            progCounter = getHexAddress(opCode);
-
             // stack overflow
-            if (callStack.size() > STACK_DEPTH)
+            if (state.stackPointer >= STACK_DEPTH)
             {
-                logWriter->log(LogWriter::LogLevel::DEBUG, "Stack overflow");
+                LOG_DEBUG("Stack overflow");
                 return false;
             }
+            state.callStack[state.stackPointer++] = state.progCounter + 2;
+            state.progCounter = getHexAddress(state.opCode);
 
-            logWriter->log(LogWriter::LogLevel::DEBUG, "Subroutine call");
+            LOG_DEBUG("Subroutine call");
             break;
 
         // 0x3RXX (skip next opcode if registers[R] == XX
         case 0x3:
-            if (registers[getHexDigit2(opCode)] == getHexDigits3and4(opCode))
+            if (state.registers[getHexDigit2(state.opCode)] == getHexDigits3and4(state.opCode))
             {
-                progCounter += 4;
-                logWriter->log(LogWriter::LogLevel::DEBUG, "Skip if register == value: EQUAL (" + std::to_string(getHexDigits3and4(opCode)) + ")");
+                state.progCounter += 4;
+                LOG_DEBUG("Skip if register == value: EQUAL (" + std::to_string(getHexDigits3and4(state.opCode)) + ")");
             }
             else
             {
-                progCounter += 2;
-                logWriter->log(LogWriter::LogLevel::DEBUG, "Skip if register == value: NOT EQUAL (" + std::to_string(registers[getHexDigit2(opCode)]) + " != " + std::to_string(getHexDigits3and4(opCode)) + ")");
+                state.progCounter += 2;
+                LOG_DEBUG("Skip if register == value: NOT EQUAL (" + std::to_string(state.registers[getHexDigit2(state.opCode)]) + " != " + std::to_string(getHexDigits3and4(state.opCode)) + ")");
             }
             break;
 
         // 0x4RXX (skip next opCode if registers[R] != XX
         case 0x4:
-            if (registers[getHexDigit2(opCode)] != getHexDigits3and4(opCode))
+            if (state.registers[getHexDigit2(state.opCode)] != getHexDigits3and4(state.opCode))
             {
-                progCounter += 4;
-                logWriter->log(LogWriter::LogLevel::DEBUG, "Skip if register != value: NOT EQUAL (" + std::to_string(registers[getHexDigit2(opCode)]) + " != " + std::to_string(getHexDigits3and4(opCode)) + ")");
+                state.progCounter += 4;
+                LOG_DEBUG("Skip if register != value: NOT EQUAL (" + std::to_string(state.registers[getHexDigit2(state.opCode)]) + " != " + std::to_string(getHexDigits3and4(state.opCode)) + ")");
             }
             else
             {
-                progCounter += 2;
-                logWriter->log(LogWriter::LogLevel::DEBUG, "Skip if register != value: EQUAL (" + std::to_string(getHexDigits3and4(opCode)) + ")");
+                state.progCounter += 2;
+                LOG_DEBUG("Skip if register != value: EQUAL (" + std::to_string(getHexDigits3and4(state.opCode)) + ")");
             }
             break;
 
         // 0x5RS0 (skip next opCode if registers[R] == registers[S]
         case 0x5:
-            if (getHexDigit4(opCode) != 0)
+            if (getHexDigit4(state.opCode) != 0)
             {
-                logWriter->log(LogWriter::LogLevel::ERROR, "OpCode not implemented: " + intToHexString(opCode));
+                logInstructionError("OpCode not implemented");
                 return false;
             }
 
-            if (registers[getHexDigit2(opCode)] == registers[getHexDigit3(opCode)])
+            if (state.registers[getHexDigit2(state.opCode)] == state.registers[getHexDigit3(state.opCode)])
             {
-                progCounter += 4;
-                logWriter->log(LogWriter::LogLevel::DEBUG, "Skip if register == register: EQUAL (" +
-                        std::to_string(registers[getHexDigit2(opCode)]) + ")");
+                state.progCounter += 4;
+                LOG_DEBUG("Skip if register == register: EQUAL (" +
+                        std::to_string(state.registers[getHexDigit2(state.opCode)]) + ")");
             }
             else
             {
-                progCounter += 2;
-                logWriter->log(LogWriter::LogLevel::DEBUG, "Skip if register == register: NOT EQUAL (" +
-                        std::to_string(registers[getHexDigit2(opCode)]) + " != " + std::to_string(registers[getHexDigit3(opCode)]) + ")");
+                state.progCounter += 2;
+                LOG_DEBUG("Skip if register == register: NOT EQUAL (" +
+                        std::to_string(state.registers[getHexDigit2(state.opCode)]) + " != " + std::to_string(state.registers[getHexDigit3(state.opCode)]) + ")");
             }
             break;
 
         // 0x6RXX (registers[R] = XX)
         case 0x6:
-            registers[getHexDigit2(opCode)] = getHexDigits3and4(opCode);
-            progCounter += 2;
-            logWriter->log(LogWriter::LogLevel::DEBUG, "Set register = value (reg[" +
-                    intToHexString(getHexDigit2(opCode), 1) + "] = " + std::to_string(getHexDigits3and4(opCode)) + ")");
+            state.registers[getHexDigit2(state.opCode)] = getHexDigits3and4(state.opCode);
+            state.progCounter += 2;
+            LOG_DEBUG("Set register = value (reg[" +
+                    intToHexString(getHexDigit2(state.opCode), 1) + "] = " + std::to_string(getHexDigits3and4(state.opCode)) + ")");
             break;
 
         // 0x7RXX (registers[R] += XX)
         case 0x7:
-            registers[getHexDigit2(opCode)] += getHexDigits3and4(opCode);
-            progCounter += 2;
-            logWriter->log(LogWriter::LogLevel::DEBUG, "Set register += value (reg[" +
-                    intToHexString(getHexDigit2(opCode), 1) + "] += " +
-                    std::to_string(getHexDigits3and4(opCode)) + ")");
+            state.registers[getHexDigit2(state.opCode)] += getHexDigits3and4(state.opCode);
+            state.progCounter += 2;
+            LOG_DEBUG("Set register += value (reg[" +
+                    intToHexString(getHexDigit2(state.opCode), 1) + "] += " +
+                    std::to_string(getHexDigits3and4(state.opCode)) + ")");
             break;
 
         // 0x8XXX
         case 0x8:
-            switch (getHexDigit4(opCode))
+            switch (getHexDigit4(state.opCode))
             {
                 // 0x8RS0 (registers[R] = registers[S])
                 case 0x0:
-                    registers[getHexDigit2(opCode)] = registers[getHexDigit3(opCode)];
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
-                            "Set register = register (reg[" + intToHexString(getHexDigit2(opCode), 1) + "] = " +
-                            std::to_string(registers[getHexDigit3(opCode)]));
+                    state.registers[getHexDigit2(state.opCode)] = state.registers[getHexDigit3(state.opCode)];
+                    state.progCounter += 2;
+                    LOG_DEBUG(
+                            "Set register = register (reg[" + intToHexString(getHexDigit2(state.opCode), 1) + "] = " +
+                            std::to_string(state.registers[getHexDigit3(state.opCode)]));
                     break;
 
                 // 0x8RS1 (registers[R] |= registers[S])
                 case 0x1:
-                    registers[getHexDigit2(opCode)] |= registers[getHexDigit3(opCode)];
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
-                            "Set register |= register (reg[" + intToHexString(getHexDigit2(opCode), 1) + "] = " +
-                            std::to_string(registers[getHexDigit2(opCode)]) + " | " +
-                            std::to_string(registers[getHexDigit3(opCode)]) + ")");
+                    state.registers[getHexDigit2(state.opCode)] |= state.registers[getHexDigit3(state.opCode)];
+                    state.progCounter += 2;
+                    LOG_DEBUG(
+                            "Set register |= register (reg[" + intToHexString(getHexDigit2(state.opCode), 1) + "] = " +
+                            std::to_string(state.registers[getHexDigit2(state.opCode)]) + " | " +
+                            std::to_string(state.registers[getHexDigit3(state.opCode)]) + ")");
                     break;
 
                 // 0x8RS2 (registers[R] &= registers[S])
                 case 0x2:
                 {
-                    unsigned char dig2= getHexDigit2(opCode);
-                    unsigned char reg2 = registers[dig2];
-                    unsigned char reg3 = registers[getHexDigit3(opCode)];
-                    registers[dig2] &= reg3;
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
+                    unsigned char dig2= getHexDigit2(state.opCode);
+                    unsigned char reg2 = state.registers[dig2];
+                    unsigned char reg3 = state.registers[getHexDigit3(state.opCode)];
+                    state.registers[dig2] &= reg3;
+                    state.progCounter += 2;
+                    LOG_DEBUG(
                            "Set register &= register (reg[" + intToHexString(dig2, 1) + "] = " +
                            std::to_string(reg2) + " & " +
                            std::to_string(reg3) + ")");
@@ -323,12 +624,12 @@ decodeAndExecute()
                 // 0x8RS3 (registers[R] ^= registers[S])
                 case 0x3:
                 {
-                    unsigned char digit2 = getHexDigit2(opCode);
-                    unsigned char reg2 = registers[digit2];
-                    unsigned char reg3 = registers[getHexDigit3(opCode)];
-                    registers[digit2] ^= reg3;
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
+                    unsigned char digit2 = getHexDigit2(state.opCode);
+                    unsigned char reg2 = state.registers[digit2];
+                    unsigned char reg3 = state.registers[getHexDigit3(state.opCode)];
+                    state.registers[digit2] ^= reg3;
+                    state.progCounter += 2;
+                    LOG_DEBUG(
                            "Set register ^= register (reg[" + intToHexString(digit2, 1) + "] = " +
                            std::to_string(reg2) + " & " +
                            std::to_string(reg3) + ")");
@@ -338,13 +639,13 @@ decodeAndExecute()
                 // 0x8RS4 (registers[R] += registers[S], updates carry (registers[0xF]))
                 case 0x4:
                 {
-                    unsigned char dig2 = getHexDigit2(opCode);
-                    unsigned char reg2 = registers[dig2];
-                    unsigned char reg3 = registers[getHexDigit3(opCode)];
-                    registers[dig2] += reg3;
-                    registers[0xF] = reg2 > 0xFF - reg3 ? 1 : 0; // carry bit
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
+                    unsigned char dig2 = getHexDigit2(state.opCode);
+                    unsigned char reg2 = state.registers[dig2];
+                    unsigned char reg3 = state.registers[getHexDigit3(state.opCode)];
+                    state.registers[dig2] += reg3;
+                    state.registers[0xF] = reg2 > 0xFF - reg3 ? 1 : 0; // carry bit
+                    state.progCounter += 2;
+                    LOG_DEBUG(
                             "Set register += register (reg[" + std::to_string(dig2) + "] = " +
                             std::to_string(reg2) + " + " +
                             std::to_string(reg3) + ")");
@@ -354,13 +655,13 @@ decodeAndExecute()
                 // 0x8RS5 (registers[R] -= registers[S], updates carry (registers[0xF]) as borrow)
                 case 0x5:
                 {
-                    unsigned char dig2 = getHexDigit2(opCode);
-                    unsigned char reg2 = registers[dig2];
-                    unsigned char reg3 = registers[getHexDigit3(opCode)];
-                    registers[dig2] -= reg3;
-                    registers[0xF] = reg3 > reg2 ? 0 : 1; // carry (borrow) bit
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
+                    unsigned char dig2 = getHexDigit2(state.opCode);
+                    unsigned char reg2 = state.registers[dig2];
+                    unsigned char reg3 = state.registers[getHexDigit3(state.opCode)];
+                    state.registers[dig2] -= reg3;
+                    state.registers[0xF] = reg3 > reg2 ? 0 : 1; // carry (borrow) bit
+                    state.progCounter += 2;
+                    LOG_DEBUG(
                                    "Set register -= register (reg[" + std::to_string(dig2) + "] = " +
                                    std::to_string(reg2) + " - " +
                                    std::to_string(reg3) + ")");
@@ -370,341 +671,349 @@ decodeAndExecute()
                 // 0x8RX6 (registers[R] >>= 1, registers[0xF] = LSB)
                 case 0x6:
                 {
-                    unsigned char dig2 = getHexDigit2(opCode);
-                    unsigned char reg2 = registers[dig2];
-                    registers[0xF] = reg2 & 0x1;
-                    registers[dig2] = reg2 >> 1;
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
+                    unsigned char dig2 = getHexDigit2(state.opCode);
+                    unsigned char reg2 = state.registers[dig2];
+                    state.registers[0xF] = reg2 & 0x1;
+                    state.registers[dig2] = reg2 >> 1;
+                    state.progCounter += 2;
+                    LOG_DEBUG(
                             "Set register >>= 1 (reg[" + intToHexString(dig2, 1) + "] = " +
                             std::to_string(reg2) + " >> 1, reg[0xF] = " +
-                            std::to_string(registers[0xF]) + ")");
+                            std::to_string(state.registers[0xF]) + ")");
                     break;
                 }
 
                 // 0x8RS7 (registers[R] = registers[S] - registers[R], updates carry (registers[0xF]) as borrow)
                 case 0x7:
                 {
-                    unsigned char dig2 = getHexDigit2(opCode);
-                    unsigned char reg2 = registers[dig2];
-                    unsigned char reg3 = registers[getHexDigit3(opCode)];
-                    registers[dig2] = reg3 - reg2;
-                    registers[0xF] = reg2 > reg3 ? 0 : 1; // carry (borrow) bit
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
+                    unsigned char dig2 = getHexDigit2(state.opCode);
+                    unsigned char reg2 = state.registers[dig2];
+                    unsigned char reg3 = state.registers[getHexDigit3(state.opCode)];
+                    state.registers[dig2] = reg3 - reg2;
+                    state.registers[0xF] = reg2 > reg3 ? 0 : 1; // carry (borrow) bit
+                    state.progCounter += 2;
+                    LOG_DEBUG(
                                    "Set register[A] = register[B] - register[A] (reg[" +
                                    intToHexString(dig2, 1) + "] = " +
                                    std::to_string(reg3) + " - " +
                                    std::to_string(reg2) + ", reg[0xF] = " +
-                                   std::to_string(registers[0xF]) + ")");
+                                   std::to_string(state.registers[0xF]) + ")");
                     break;
                 }
 
                 // 0x8RXE (registers[R] <<= 1, registers[0xF] = MSB)
                 case 0xE:
                 {
-                    unsigned char dig2 = getHexDigit2(opCode);
-                    unsigned char reg2 = registers[dig2];
-                    registers[0xF] = reg2 >> 7;
-                    registers[dig2] = reg2 << 1;
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
+                    unsigned char dig2 = getHexDigit2(state.opCode);
+                    unsigned char reg2 = state.registers[dig2];
+                    state.registers[0xF] = reg2 >> 7;
+                    state.registers[dig2] = reg2 << 1;
+                    state.progCounter += 2;
+                    LOG_DEBUG(
                             "Set register <<= 1 (reg[" + intToHexString(dig2, 1) + "] = " +
                             std::to_string(reg2) + " << 1, reg[0xF] = " +
-                            std::to_string(registers[0xF]) + ")");
+                            std::to_string(state.registers[0xF]) + ")");
                     break;
                 }
 
                 default:
-                    logWriter->log(LogWriter::LogLevel::ERROR,
-                            "OpCode not implemented (" + intToHexString(opCode) + ")");
+                    logInstructionError("OpCode not implemented");
                     return false;
             }
             break;
 
         // 0x9RS0 (skips next opCode if registers[R] != registers[S])
         case 0x9:
-            if (getHexDigit4(opCode) != 0)
+            if (getHexDigit4(state.opCode) != 0)
             {
-                logWriter->log(LogWriter::LogLevel::ERROR,
-                        "OpCode not implemented (" + intToHexString(opCode) + ")");
+                logInstructionError("OpCode not implemented");
                 return false;
             }
 
-            if (registers[getHexDigit2(opCode)] != registers[getHexDigit3(opCode)])
+            if (state.registers[getHexDigit2(state.opCode)] != state.registers[getHexDigit3(state.opCode)])
             {
-                progCounter += 4;
-                logWriter->log(LogWriter::LogLevel::DEBUG, "Skip next opCode (" + intToHexString(opCode) + ")");
+                state.progCounter += 4;
+                LOG_DEBUG("Skip next opCode (" + intToHexString(state.opCode) + ")");
             }
             else
             {
-                progCounter += 2;
-                logWriter->log(LogWriter::LogLevel::DEBUG, "Do not skip next opCode (" + intToHexString(opCode) + ")");
+                state.progCounter += 2;
+                LOG_DEBUG("Do not skip next opCode (" + intToHexString(state.opCode) + ")");
             }
             break;
 
         // 0xAXXX (index = XXX)
         case 0xA:
-            index = getHexAddress(opCode);
-            progCounter += 2;
-            logWriter->log(LogWriter::LogLevel::DEBUG, "Index = XXX (" + intToHexString(opCode, 3) + ")");
+            state.index = getHexAddress(state.opCode);
+            state.progCounter += 2;
+            LOG_DEBUG("Index = XXX (" + intToHexString(state.opCode, 3) + ")");
             break;
 
         // 0xBXXX (pc = registers[0] + XXX)
         case 0xB:
-            progCounter = registers[0] + getHexAddress(opCode);
-            logWriter->log(LogWriter::LogLevel::DEBUG, "Program Counter = registers[0] + XXX (" +
-                    std::to_string(registers[0]) + " + " + intToHexString(opCode, 3) + ")");
+            state.progCounter = state.registers[0] + getHexAddress(state.opCode);
+            LOG_DEBUG("Program Counter = registers[0] + XXX (" +
+                    std::to_string(state.registers[0]) + " + " + intToHexString(state.opCode, 3) + ")");
             break;
 
         // 0xCRXX (registers[R] = rand() & XX)
         case 0xC:
         {
-            unsigned char dig2 = getHexDigit2(opCode);
-            unsigned char rando = rand() % 256;
-            registers[dig2] = rando & getHexDigits3and4(opCode);
-            progCounter += 2;
-            logWriter->log(LogWriter::LogLevel::DEBUG, "Registers[" + intToHexString(dig2, 1) + "] = rand() & XX (" +
-                    std::to_string(rando) + " & " + intToHexString(opCode, 2) + ")");
+            unsigned char dig2 = getHexDigit2(state.opCode);
+            unsigned char rando = nextRandom(state);
+            idleJumpAddress = NO_IDLE_JUMP;
+            state.registers[dig2] = rando & getHexDigits3and4(state.opCode);
+            state.progCounter += 2;
+            LOG_DEBUG("Registers[" + intToHexString(dig2, 1) + "] = rand() & XX (" +
+                    std::to_string(rando) + " & " + intToHexString(state.opCode, 2) + ")");
             break;
         }
 
         // 0xDXYH (draw an 8xH sprite at x = registers[X], y = registers[Y])
         case 0xD:
         {
-            registers[0xF] = 0;
-            unsigned char x = registers[getHexDigit2(opCode)];
-            unsigned char y = registers[getHexDigit3(opCode)];
-            if (x < SCREEN_WIDTH && y < SCREEN_HEIGHT)
+            unsigned char h = getHexDigit4(state.opCode);
+            if (!isInMemory(state.index, h))
             {
-                unsigned char h = getHexDigit4(opCode);
-                int xByte = x / 8;
-                int xBit = x % 8;
-                unsigned short start = xByte + y * SCREEN_WIDTH_SIZE;
-                if (xBit == 0) // Drawing to a single byte per line
-                {
-                    for (int i = 0; i < h; ++i)
-                    {
-                        unsigned short loc = (start + i * SCREEN_WIDTH_SIZE) % SCREEN_SIZE;
-                        unsigned char temp = graphicsBuffer[loc];
-                        graphicsBuffer[loc] ^= memory[index + i];
-                        if (temp & ~graphicsBuffer[loc])
-                        {
-                            registers[0xF] = 1;
-                        }
-                    }
-                }
-                else // Drawing to two bytes per line
-                {
-                    for (int i = 0; i < h; ++i)
-                    {
-                        unsigned short loc = (start + i * SCREEN_WIDTH_SIZE) % SCREEN_SIZE;
-                        unsigned char temp1 = graphicsBuffer[loc];
-                        unsigned char toWrite1 = memory[index + i] >> xBit;
-                        graphicsBuffer[loc] ^= toWrite1;
-                        if (temp1 & ~graphicsBuffer[loc])
-                        {
-                            registers[0xF] = 1;
-                        }
-                        if (xByte < 7) // Does not wrap horizontally
-                        {
-                            unsigned char temp2 = graphicsBuffer[loc + 1];
-                            unsigned char toWrite2 = memory[index + i] << (8 - xBit);
-                            graphicsBuffer[loc + 1] ^= toWrite2;
-                            if (temp2 & ~graphicsBuffer[loc + 1])
-                            {
-                                registers[0xF] = 1;
-                            }
-                        }
-                        else // Does wrap horizontally
-                        {
-                            unsigned char temp2 = graphicsBuffer[loc + 1 - 8];
-                            unsigned char toWrite2 = memory[index + i] << (8 - xBit);
-                            graphicsBuffer[loc + 1 - 8] ^= toWrite2;
-                            if (temp2 & ~graphicsBuffer[loc + 1 - 8])
-                            {
-                                registers[0xF] = 1;
-                            }
-                        }
-                    }
-                }
+                return false;
             }
-            progCounter += 2;
-            isDirty = true;
-            logWriter->log(LogWriter::LogLevel::DEBUG, "0xDXYH - Draw (" + intToHexString(opCode) + ")");
+            if (coverage != nullptr)
+            {
+                coverage->countRead(state.index, h);
+            }
+            drawSprite(state, getHexDigit2(state.opCode), getHexDigit3(state.opCode), h);
+            state.progCounter += 2;
+            state.isDirty = true;
+            idleJumpAddress = NO_IDLE_JUMP;
+            LOG_DEBUG("0xDXYH - Draw (" + intToHexString(state.opCode) + ")");
             break;
         }
 
         // 0xEXXX
         case 0xE:
-            switch (getHexDigits3and4(opCode))
+            switch (getHexDigits3and4(state.opCode))
             {
                 // 0xER9E (skip next opCode if key[registers[R]])
                 case 0x9E:
-                    if (keypad[registers[getHexDigit2(opCode)]])
+                    if (state.keypad[state.registers[getHexDigit2(state.opCode)] & 0xF])
                     {
-                        progCounter += 4;
-                        logWriter->log(LogWriter::LogLevel::DEBUG, "Skip next opCode if key[registers[R]] (key[registers[" +
-                                intToHexString(getHexDigit2(opCode)) + "] = " +
-                                intToHexString(keypad[registers[getHexDigit2(opCode)]]) + ")");
+                        state.progCounter += 4;
+                        LOG_DEBUG("Skip next opCode if key[registers[R]] (key[registers[" +
+                                intToHexString(getHexDigit2(state.opCode)) + "] = " +
+                                intToHexString(state.keypad[state.registers[getHexDigit2(state.opCode)] & 0xF]) + ")");
                     }
                     else
                     {
-                        progCounter += 2;
-                        logWriter->log(LogWriter::LogLevel::DEBUG, "Skip next opCode if key[registers[R]] (key[registers[" +
-                                intToHexString(getHexDigit2(opCode)) + "] = " +
-                                intToHexString(keypad[registers[getHexDigit2(opCode)]]) + ")");
+                        state.progCounter += 2;
+                        LOG_DEBUG("Skip next opCode if key[registers[R]] (key[registers[" +
+                                intToHexString(getHexDigit2(state.opCode)) + "] = " +
+                                intToHexString(state.keypad[state.registers[getHexDigit2(state.opCode)] & 0xF]) + ")");
                     }
                     break;
 
                 // 0xERA1 (skip next opCode if !key[registers[R]])
                 case 0xA1:
-                    if (!keypad[registers[getHexDigit2(opCode)]])
+                    if (!state.keypad[state.registers[getHexDigit2(state.opCode)] & 0xF])
                     {
-                        progCounter += 4;
-                        logWriter->log(LogWriter::LogLevel::DEBUG, "Skip next opCode if !key[registers[R]] (key[registers[" +
-                                intToHexString(getHexDigit2(opCode)) + "] = " +
-                                intToHexString(keypad[registers[getHexDigit2(opCode)]]) + ")");
+                        state.progCounter += 4;
+                        LOG_DEBUG("Skip next opCode if !key[registers[R]] (key[registers[" +
+                                intToHexString(getHexDigit2(state.opCode)) + "] = " +
+                                intToHexString(state.keypad[state.registers[getHexDigit2(state.opCode)] & 0xF]) + ")");
                     }
                     else
                     {
-                        progCounter += 2;
-                        logWriter->log(LogWriter::LogLevel::DEBUG, "Skip next opCode if !key[registers[R]] (key[registers[" +
-                                intToHexString(getHexDigit2(opCode)) + "] = " +
-                                intToHexString(keypad[registers[getHexDigit2(opCode)]]) + ")");
+                        state.progCounter += 2;
+                        LOG_DEBUG("Skip next opCode if !key[registers[R]] (key[registers[" +
+                                intToHexString(getHexDigit2(state.opCode)) + "] = " +
+                                intToHexString(state.keypad[state.registers[getHexDigit2(state.opCode)] & 0xF]) + ")");
                     }
                     break;
 
                 default:
-                    logWriter->log(LogWriter::LogLevel::ERROR,
-                                   "OpCode not implemented (" + intToHexString(opCode) + ")");
+                    logInstructionError("OpCode not implemented");
                     return false;
             }
             break;
 
         // 0xFRXX
         case 0xF:
-            switch (getHexDigits3and4(opCode))
+            switch (getHexDigits3and4(state.opCode))
             {
                 // 0xFR07 (registers[R] = delayInterruptTimer)
                 case 0x07:
-                    registers[getHexDigit2(opCode)] = delayInterruptTimer;
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
-                            "Set registers[R] = delayInterruptTimer (reg[" + std::to_string(getHexDigit2(opCode)) + "] = " +
-                            std::to_string(delayInterruptTimer) + ")");
+                    state.registers[getHexDigit2(state.opCode)] = state.delayInterruptTimer;
+                    state.progCounter += 2;
+                    LOG_DEBUG(
+                            "Set registers[R] = delayInterruptTimer (reg[" + std::to_string(getHexDigit2(state.opCode)) + "] = " +
+                            std::to_string(state.delayInterruptTimer) + ")");
                     break;
 
                 // 0xFR0A (execution waits for keypress, stored in registers[R])
                 case 0x0A:
+                {
                     //std::cout << "0xFR0A: waiting for keypress..." << std::endl;
                     unsigned char tempChar;
-                    do
+                    if (!isKeyWaitBlocking)
                     {
-                        tempChar = static_cast<unsigned char>(getchar());
-                    } while (!isxdigit(tempChar));
-                    registers[getHexDigit2(opCode)] = tempChar;
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
-                                   "registers[R] = keypress (reg[" + std::to_string(getHexDigit2(opCode)) + "] = " +
+                        // leave the program counter here until a key is down; the caller keeps cycling
+                        unsigned char key = 0;
+                        while (key < NUMBER_OF_KEYPAD_BUTTONS && !state.keypad[key])
+                        {
+                            ++key;
+                        }
+                        if (key == NUMBER_OF_KEYPAD_BUTTONS)
+                        {
+                            isIdleLoop = isIdleDetecting; // nothing happens until a key goes down
+                            break;
+                        }
+                        tempChar = key;
+                    }
+                    else
+                    {
+                        do
+                        {
+                            tempChar = static_cast<unsigned char>(getchar());
+                        } while (!isxdigit(tempChar));
+                        ++keyReads;
+                    }
+                    state.registers[getHexDigit2(state.opCode)] = tempChar;
+                    state.progCounter += 2;
+                    idleJumpAddress = NO_IDLE_JUMP;
+                    LOG_DEBUG(
+                                   "registers[R] = keypress (reg[" + std::to_string(getHexDigit2(state.opCode)) + "] = " +
                                    std::to_string(tempChar) + ")");
                     break;
+                }
 
                 // 0xFR15 (delayInterruptTimer = registers[R])
                 case 0x15:
-                    delayInterruptTimer = registers[getHexDigit2(opCode)];
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
-                                   "delayInterruptTimer = registers[R] (reg[" + std::to_string(getHexDigit2(opCode)) + "] = " +
-                                   std::to_string(registers[getHexDigit2(opCode)]) + ")");
+                    state.delayInterruptTimer = state.registers[getHexDigit2(state.opCode)];
+                    state.progCounter += 2;
+                    idleJumpAddress = NO_IDLE_JUMP;
+                    LOG_DEBUG(
+                                   "delayInterruptTimer = registers[R] (reg[" + std::to_string(getHexDigit2(state.opCode)) + "] = " +
+                                   std::to_string(state.registers[getHexDigit2(state.opCode)]) + ")");
                     break;
 
                 // 0xFR18 (soundInterruptTimer = registers[R])
                 case 0x18:
-                    soundInterruptTimer = registers[getHexDigit2(opCode)];
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
-                                   "soundInterruptTimer = registers[R] (reg[" + std::to_string(getHexDigit2(opCode)) + "] = " +
-                                   std::to_string(registers[getHexDigit2(opCode)]) + ")");
+                    state.soundInterruptTimer = state.registers[getHexDigit2(state.opCode)];
+                    state.progCounter += 2;
+                    idleJumpAddress = NO_IDLE_JUMP;
+                    LOG_DEBUG(
+                                   "soundInterruptTimer = registers[R] (reg[" + std::to_string(getHexDigit2(state.opCode)) + "] = " +
+                                   std::to_string(state.registers[getHexDigit2(state.opCode)]) + ")");
                     break;
 
                 // 0xFR1E (index += registers[R])
                 case 0x1E:
-                    index += registers[getHexDigit2(opCode)];
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
-                                   "Index += registers[R] (Index = " + std::to_string(index) +
-                                   " + reg[" + std::to_string(getHexDigit2(opCode)) + "] = " +
-                                   std::to_string(registers[getHexDigit2(opCode)]) + ")");
+                    state.index += state.registers[getHexDigit2(state.opCode)];
+                    state.progCounter += 2;
+                    LOG_DEBUG(
+                                   "Index += registers[R] (Index = " + std::to_string(state.index) +
+                                   " + reg[" + std::to_string(getHexDigit2(state.opCode)) + "] = " +
+                                   std::to_string(state.registers[getHexDigit2(state.opCode)]) + ")");
                     break;
 
                 // 0xFR29 (set index to address of sprite for character in registers[R])
                 case 0x29:
-                    index = registers[getHexDigit2(opCode)] * BYTES_PER_FONT_CHAR;
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
+                    state.index = state.registers[getHexDigit2(state.opCode)] * BYTES_PER_FONT_CHAR;
+                    state.progCounter += 2;
+                    LOG_DEBUG(
                                    "Index = registers[R] * " + std::to_string(BYTES_PER_FONT_CHAR) +
-                                   " (reg[" + std::to_string(getHexDigit2(opCode)) + "] = " +
-                                   std::to_string(registers[getHexDigit2(opCode)]) + ")");
+                                   " (reg[" + std::to_string(getHexDigit2(state.opCode)) + "] = " +
+                                   std::to_string(state.registers[getHexDigit2(state.opCode)]) + ")");
                     break;
 
                 // 0xFR33 (binary-coded decimal of registers[R] stored in index, +1, +2)
                 case 0x33:
                 {
-                    unsigned char tempNum = registers[getHexDigit2(opCode)];
-                    memory[index] = tempNum / 100;
-                    memory[index + 1] = tempNum / 10 % 10;
-                    memory[index + 2] = tempNum % 10;
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
-                                   "Index = BCD(registers[R]) (reg[" + std::to_string(getHexDigit2(opCode)) + "] = " +
-                                   std::to_string(registers[getHexDigit2(opCode)]) + ")");
+                    if (!isInMemory(state.index, 3))
+                    {
+                        return false;
+                    }
+                    unsigned char tempNum = state.registers[getHexDigit2(state.opCode)];
+                    state.memory[state.index] = tempNum / 100;
+                    state.memory[state.index + 1] = tempNum / 10 % 10;
+                    state.memory[state.index + 2] = tempNum % 10;
+                    state.progCounter += 2;
+                    idleJumpAddress = NO_IDLE_JUMP;
+                    if (debugHook != nullptr)
+                    {
+                        debugHook->afterStore(state.index, 3);
+                    }
+                    if (coverage != nullptr)
+                    {
+                        coverage->countWrite(state.index, 3);
+                    }
+                    LOG_DEBUG(
+                                   "Index = BCD(registers[R]) (reg[" + std::to_string(getHexDigit2(state.opCode)) + "] = " +
+                                   std::to_string(state.registers[getHexDigit2(state.opCode)]) + ")");
                     break;
                 }
 
                 // 0xFR55 (registers[0 to R] are dumped to memory starting at index)
                 case 0x55:
                 {
-                    int lastRegister = getHexDigit2(opCode);
+                    int lastRegister = getHexDigit2(state.opCode);
+                    if (!isInMemory(state.index, lastRegister + 1))
+                    {
+                        return false;
+                    }
                     for (int i = 0; i <= lastRegister; ++i)
                     {
-                        memory[index + i] = registers[i];
+                        state.memory[state.index + i] = state.registers[i];
                     }
                     // some sources say to do the next line, others say don't
                     // index += lastRegister + 1;
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
-                                   "Write regs[0-R] at Index (reg[0-" + std::to_string(getHexDigit2(opCode)) + "], Index = " +
-                                   std::to_string(index) + ")");
+                    state.progCounter += 2;
+                    idleJumpAddress = NO_IDLE_JUMP;
+                    if (debugHook != nullptr)
+                    {
+                        debugHook->afterStore(state.index, lastRegister + 1);
+                    }
+                    if (coverage != nullptr)
+                    {
+                        coverage->countWrite(state.index, lastRegister + 1);
+                    }
+                    LOG_DEBUG(
+                                   "Write regs[0-R] at Index (reg[0-" + std::to_string(getHexDigit2(state.opCode)) + "], Index = " +
+                                   std::to_string(state.index) + ")");
                     break;
                 }
 
                 // 0xFR65 (memory starting at index copied to registers[0 to R])
                 case 0x65:
                 {
-                    int lastRegister = getHexDigit2(opCode);
+                    int lastRegister = getHexDigit2(state.opCode);
+                    if (!isInMemory(state.index, lastRegister + 1))
+                    {
+                        return false;
+                    }
                     for (int i = 0; i <= lastRegister; ++i)
                     {
-                        registers[i] = memory[index + i];
+                        state.registers[i] = state.memory[state.index + i];
+                    }
+                    if (coverage != nullptr)
+                    {
+                        coverage->countRead(state.index, lastRegister + 1);
                     }
-                    progCounter += 2;
-                    logWriter->log(LogWriter::LogLevel::DEBUG,
-                                   "Write Index to regs[0-R] (reg[0-" + std::to_string(getHexDigit2(opCode)) + "], Index = " +
-                                   std::to_string(index) + ")");
+                    state.progCounter += 2;
+                    LOG_DEBUG(
+                                   "Write Index to regs[0-R] (reg[0-" + std::to_string(getHexDigit2(state.opCode)) + "], Index = " +
+                                   std::to_string(state.index) + ")");
                     break;
                 }
 
                 default:
-                    logWriter->log(LogWriter::LogLevel::ERROR,
-                                   "OpCode not implemented (" + intToHexString(opCode) + ")");
+                    logInstructionError("OpCode not implemented");
                     return false;
             }
             break;
 
         default:
         {
-            logWriter->log(LogWriter::LogLevel::ERROR,
-                           "OpCode not implemented (" + intToHexString(opCode) + ")");
+            logInstructionError("OpCode not implemented");
             return false;
         }
     }
@@ -716,18 +1025,16 @@ decodeAndExecute()
 bool Chip8::
 updateTimers()
 {
-    if (soundInterruptTimer > 0)
+    // the tone itself is rendered from soundInterruptTimer by Audio
+    if (state.soundInterruptTimer > 0)
     {
-        if (soundInterruptTimer > 1)
-        {
-            //std::cout << "beeping..." << std::endl;
-        }
-        --soundInterruptTimer;
+        --state.soundInterruptTimer;
     }
-    if (delayInterruptTimer > 0)
+    if (state.delayInterruptTimer > 0)
     {
-        --delayInterruptTimer;
+        --state.delayInterruptTimer;
     }
+    idleJumpAddress = NO_IDLE_JUMP; // the timer may have moved, so any loop has to prove itself again
 
     return true;
 }
@@ -771,7 +1078,237 @@ getHexAddress(unsigned short hexShort)
 bool Chip8::
 isDirtyScreen()
 {
-    return isDirty;
+    return state.isDirty;
+}
+
+DirtyRegion Chip8::
+takeDirtyRegion()
+{
+    DirtyRegion dirty = state.dirty;
+    state.dirty.rows = 0;
+    std::memset(state.dirty.columns, 0, sizeof(state.dirty.columns));
+    return dirty;
+}
+
+void Chip8::
+setKey(unsigned char key, bool isPressed)
+{
+    state.keypad[key & 0xF] = isPressed ? 1 : 0;
+    idleJumpAddress = NO_IDLE_JUMP;
+}
+
+void Chip8::
+setKeyWaitBlocking(bool isBlocking)
+{
+    isKeyWaitBlocking = isBlocking;
+}
+
+unsigned long long Chip8::
+getKeyReads() const
+{
+    return keyReads;
+}
+
+void Chip8::
+setIdleDetection(bool isDetecting)
+{
+    isIdleDetecting = isDetecting;
+    isIdleLoop = false;
+    idleJumpAddress = NO_IDLE_JUMP;
+}
+
+bool Chip8::
+isIdle() const
+{
+    return isIdleLoop;
+}
+
+void Chip8::
+setMetrics(Metrics* metrics)
+{
+    Chip8::metrics = metrics;
+}
+
+void Chip8::
+setDebugHook(DebugHook* hook)
+{
+    debugHook = hook;
+}
+
+void Chip8::
+setCoverage(Coverage* cov)
+{
+    coverage = cov;
+}
+
+void Chip8::
+setPerfCounters(PerfCounters* counters)
+{
+    perfCounters = counters;
+}
+
+Chip8State& Chip8::
+getState()
+{
+    return state;
+}
+
+const Chip8State& Chip8::
+getState() const
+{
+    return state;
+}
+
+void Chip8::
+saveSnapshot(Chip8Snapshot& snapshot) const
+{
+    snapshot.state = state;
+    snapshot.isIdleLoop = isIdleLoop;
+    snapshot.idleJumpAddress = idleJumpAddress;
+    std::memcpy(snapshot.idleRegisters, idleRegisters, sizeof(idleRegisters));
+    snapshot.idleIndex = idleIndex;
+    snapshot.idleStackPointer = idleStackPointer;
+}
+
+void Chip8::
+restoreSnapshot(const Chip8Snapshot& snapshot)
+{
+    state = snapshot.state;
+    isIdleLoop = snapshot.isIdleLoop;
+    idleJumpAddress = snapshot.idleJumpAddress;
+    std::memcpy(idleRegisters, snapshot.idleRegisters, sizeof(idleRegisters));
+    idleIndex = snapshot.idleIndex;
+    idleStackPointer = snapshot.idleStackPointer;
+}
+
+void Chip8::
+setSpeculating(bool isSpeculating)
+{
+    if (isSpeculating == Chip8::isSpeculating)
+    {
+        return;
+    }
+    Chip8::isSpeculating = isSpeculating;
+    if (isSpeculating)
+    {
+        heldMetrics = metrics;
+        heldCoverage = coverage;
+        heldPerfCounters = perfCounters;
+        metrics = nullptr;
+        coverage = nullptr;
+        perfCounters = nullptr;
+    }
+    else
+    {
+        metrics = heldMetrics;
+        coverage = heldCoverage;
+        perfCounters = heldPerfCounters;
+    }
+}
+
+unsigned char Chip8::
+nextRandom(Chip8State& state)
+{
+    // xorshift32 (Marsaglia)
+    unsigned int x = state.randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    state.randomState = x;
+    return static_cast<unsigned char>(x);
+}
+
+// XOR an 8xH sprite from memory[index] onto the screen at (registers[xReg], registers[yReg])
+void Chip8::
+drawSprite(Chip8State& state, unsigned char xReg, unsigned char yReg, unsigned char h)
+{
+    state.registers[0xF] = 0;
+    unsigned char x = state.registers[xReg];
+    unsigned char y = state.registers[yReg];
+    if (x < SCREEN_WIDTH && y < SCREEN_HEIGHT)
+    {
+        int xByte = x / 8;
+        int xBit = x % 8;
+        unsigned short start = xByte + y * SCREEN_WIDTH_SIZE;
+        if (xBit == 0) // Drawing to a single byte per line
+        {
+            for (int i = 0; i < h; ++i)
+            {
+                unsigned short loc = (start + i * SCREEN_WIDTH_SIZE) % SCREEN_SIZE;
+                unsigned char temp = state.graphicsBuffer[loc];
+                unsigned char toWrite = state.memory[state.index + i];
+                state.graphicsBuffer[loc] ^= toWrite;
+                if (temp & ~state.graphicsBuffer[loc])
+                {
+                    state.registers[0xF] = 1;
+                }
+                if (toWrite != 0)
+                {
+                    markDirty(state.dirty, loc / SCREEN_WIDTH_SIZE, xByte);
+                }
+            }
+        }
+        else // Drawing to two bytes per line
+        {
+            for (int i = 0; i < h; ++i)
+            {
+                unsigned short loc = (start + i * SCREEN_WIDTH_SIZE) % SCREEN_SIZE;
+                unsigned char temp1 = state.graphicsBuffer[loc];
+                unsigned char toWrite1 = state.memory[state.index + i] >> xBit;
+                state.graphicsBuffer[loc] ^= toWrite1;
+                if (temp1 & ~state.graphicsBuffer[loc])
+                {
+                    state.registers[0xF] = 1;
+                }
+                // the second byte is to the right, or wraps round to the start of the line
+                int xByte2 = xByte < 7 ? xByte + 1 : 0;
+                unsigned short loc2 = loc - xByte + xByte2;
+                unsigned char temp2 = state.graphicsBuffer[loc2];
+                unsigned char toWrite2 = state.memory[state.index + i] << (8 - xBit);
+                state.graphicsBuffer[loc2] ^= toWrite2;
+                if (temp2 & ~state.graphicsBuffer[loc2])
+                {
+                    state.registers[0xF] = 1;
+                }
+                if (toWrite1 != 0)
+                {
+                    markDirty(state.dirty, loc / SCREEN_WIDTH_SIZE, xByte);
+                }
+                if (toWrite2 != 0)
+                {
+                    markDirty(state.dirty, loc / SCREEN_WIDTH_SIZE, xByte2);
+                }
+            }
+        }
+    }
+}
+
+// Only the bytes that had pixels lit are marked dirty
+void Chip8::
+clearScreen(Chip8State& state)
+{
+    for (unsigned int i = 0; i < SCREEN_SIZE; ++i)
+    {
+        if (state.graphicsBuffer[i] != 0)
+        {
+            markDirty(state.dirty, i / SCREEN_WIDTH_SIZE, i % SCREEN_WIDTH_SIZE);
+            state.graphicsBuffer[i] = 0;
+        }
+    }
+    state.isDirty = true;
+}
+
+bool Chip8::
+isInMemory(unsigned int address, unsigned int length)
+{
+    if (address + length > MEMORY_SIZE)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Memory access out of bounds",
+                       {{"pc", state.progCounter, true}, {"opcode", state.opCode, true}, {"index", address, true},
+                        {"length", length, false}});
+        return false;
+    }
+    return true;
 }
 
 std::string Chip8::
@@ -782,3 +1319,10 @@ intToHexString(unsigned short number, int width)
     sstream << "0x" << std::uppercase << std::setfill ('0') << std::setw(width) << std::hex << number;
     return sstream.str();
 }
+
+// Report a failure of the instruction at the program counter, with its address and opCode as fields
+void Chip8::
+logInstructionError(const std::string& message)
+{
+    logWriter->log(LogWriter::LogLevel::ERROR, message, {{"pc", state.progCounter, true}, {"opcode", state.opCode, true}});
+}
@@ -20,12 +20,10 @@
 #include <sstream>
 #include <stack>
 #include <vector>
+#include "Core.h"
 #include "LogWriter.h"
+#include "Metrics.h"
 
-#define SCREEN_HEIGHT 32
-#define SCREEN_WIDTH 64
-#define SCREEN_WIDTH_SIZE (SCREEN_WIDTH / 8)
-#define SCREEN_SIZE (SCREEN_WIDTH_SIZE * SCREEN_HEIGHT)
 #define MEMORY_SIZE 4096
 #define NUMBER_OF_REGISTERS 16
 #define STACK_DEPTH 16
@@ -38,7 +36,103 @@
 const unsigned char BYTES_PER_FONT_CHAR = 0x5;
 const unsigned short CODE_START = 0x200;
 
-class Chip8
+// The complete state of a running Chip-8 machine. It is kept as plain data so that a snapshot, restore
+// or reset is a single struct copy.
+struct Chip8State
+{
+    // Simulates the system memory (RAM).
+    unsigned char memory[MEMORY_SIZE];
+
+    // Simulates the CPU registers.
+    // Registers named V0 through VE. 16th register ("VF") used as "carry flag".
+    unsigned char registers[NUMBER_OF_REGISTERS];
+
+    // "Index" register.
+    unsigned short index;
+
+    // Program counter.
+    unsigned short progCounter;
+
+    // Used to store the current opCode to be processed
+    unsigned short opCode;
+
+    // The Chip-8 system does not have a stack, but we need one to keep track of where to return to
+    // when a function call is made. stackPointer is the number of entries in use.
+    unsigned short callStack[STACK_DEPTH];
+    unsigned char stackPointer;
+
+    // "Interrupt timers" used for delays and sound purposes.
+    unsigned char delayInterruptTimer;
+    unsigned char soundInterruptTimer;
+
+    // The Chip-8 system has a keypad that uses 16 buttons, labeled in HEX (0x0-0xF).
+    // This array stores the values of the keys currently being pressed.
+    unsigned char keypad[NUMBER_OF_KEYPAD_BUTTONS];
+
+    // Used to simulate VRAM, this is the buffer that gets written to the display. One bit per pixel.
+    unsigned char graphicsBuffer[SCREEN_SIZE];
+
+    // size of loaded ROM in bytes
+    unsigned short romBytes;
+
+    // xorshift state behind 0xCRXX, kept here so that restoring a snapshot replays the same numbers
+    unsigned int randomState;
+
+    // display needs to be updated if dirty
+    bool isDirty;
+
+    // everything drawn since the display last took it (see Core::takeDirtyRegion)
+    DirtyRegion dirty;
+};
+
+// A point to rewind a running interpreter to: the machine state and the idle loop watch, which is not part
+// of the machine but must agree with it
+struct Chip8Snapshot
+{
+    Chip8State state;
+    bool isIdleLoop;
+    unsigned short idleJumpAddress;
+    unsigned char idleRegisters[NUMBER_OF_REGISTERS];
+    unsigned short idleIndex;
+    unsigned char idleStackPointer;
+};
+
+// Instruction sequences that Chip8::runStep runs as one
+enum Chip8Fusion
+{
+    FUSED_SPRITE_DRAW,      // ANNN, DXYN
+    FUSED_COORDINATES,      // 6XNN, 6YNN
+    FUSED_TIMER_WAIT,       // FX07, 3X00, 1NNN back to the FX07: every pass in the step at once
+    FUSED_COUNTED_LOOP,     // 7XNN, 3XNN, 1NNN: every pass in the step at once when the 1NNN jumps to the 7XNN
+    FUSIONS
+};
+
+// How often runStep fused, and how much
+struct Chip8FusionStatistics
+{
+    unsigned long long hits[FUSIONS];           // fused handlers run
+    unsigned long long fusedInstructions[FUSIONS];
+    unsigned long long shortBudget[FUSIONS];    // sequences left to single steps, too long for the budget
+    unsigned long long instructions;            // everything runStep ran, fused or not
+};
+
+class Coverage;
+class PerfCounters;
+
+// Gets control from the interpreter while a debugger has something to look out for
+class DebugHook
+{
+    public:
+        virtual ~DebugHook() {}
+
+        // Called before each instruction. Return true to stop without running it.
+        virtual bool beforeInstruction(const Chip8State& state) = 0;
+
+        // Called after 0xFR33 or 0xFR55 wrote [address, address + length)
+        virtual void afterStore(unsigned int address, unsigned int length) = 0;
+};
+
+class Chip8 final : public Core
 {
     public:
 
@@ -51,77 +145,156 @@ class Chip8
         // Loads the supplied file as the ROM
         bool loadFile(const std::string& fileToLoad);
 
+        // Loads a ROM image that is already in memory
+        bool loadBuffer(const unsigned char* rom, size_t length);
+
         // Returns a pointer to the screen section of memory
-        unsigned char* getScreen();
+        unsigned char* getScreen() override;
 
         // Run one cycle of the VM
-        bool runCycle();
+        bool runCycle() override;
+
+        // Run the instruction at the program counter, or a whole fused sequence (see Chip8Fusion) starting
+        // there if it fits in budget. The sequence is matched against memory every time, so a jump into the
+        // middle of one or code that rewrote one just runs instruction by instruction. Fusion is left out
+        // while a debug hook, coverage, host counters or DEBUG logging want to see every instruction.
+        bool runStep(unsigned int budget, unsigned int& executed) override;
+
+        // Turn fusion in runStep on (the default) or off
+        void setFusion(bool isFusing);
+        const Chip8FusionStatistics& getFusionStatistics() const;
 
         // Does the screen need to be drawn?
-        bool isDirtyScreen();
+        bool isDirtyScreen() override;
 
         // Update timers
-        bool updateTimers();
+        bool updateTimers() override;
 
-    private:
+        // What has been drawn since the last call
+        DirtyRegion takeDirtyRegion() override;
+
+        // Press or release one of the 16 keypad buttons
+        void setKey(unsigned char key, bool isPressed) override;
+
+        // Choose whether 0xFR0A reads a key from the terminal (default) or waits on setKey()
+        void setKeyWaitBlocking(bool isBlocking);
+
+        // How many keys 0xFR0A has read from the terminal: input from outside that the state does not show
+        unsigned long long getKeyReads() const;
+
+        // Count executed opCodes in metrics (may be nullptr)
+        void setMetrics(Metrics* metrics);
+
+        // Hand control to hook around instructions and stores (nullptr when there is nothing to check)
+        void setDebugHook(DebugHook* hook);
+
+        // Record executed addresses, skip outcomes and data accesses in coverage (may be nullptr)
+        void setCoverage(Coverage* coverage);
+
+        // Count instructions and sample their host cost by opCode class in perfCounters (may be nullptr)
+        void setPerfCounters(PerfCounters* perfCounters);
 
-        // Simulates the system memory (RAM).
-        unsigned char memory[MEMORY_SIZE];
+        // Watch for wait loops (see isIdle). Off by default, as skipping changes where in the loop a frame ends.
+        void setIdleDetection(bool isDetecting);
 
-        // Simulates the CPU registers.
-        // Registers named V0 through VE. 16th register ("VF") used as "carry flag".
-        unsigned char registers[NUMBER_OF_REGISTERS];
+        // Did the last cycle finish an iteration of a loop that cannot get anywhere until the delay timer or
+        // the keypad changes? Such a loop only re-reads them, so the rest of the frame can be skipped.
+        bool isIdle() const override;
 
-        // "Index" register.
-        unsigned short index;
+        // Direct access to the machine state, for snapshots and tooling
+        Chip8State& getState();
+        const Chip8State& getState() const;
 
-        // Program counter.
-        unsigned short progCounter;
+        // Save and rewind to a snapshot: a few struct copies, cheap enough to do several times a frame
+        void saveSnapshot(Chip8Snapshot& snapshot) const;
+        void restoreSnapshot(const Chip8Snapshot& snapshot);
 
-        // Used to store the current opCode to be processed
-        unsigned short opCode;
+        // While speculating, instructions that will be rewound are not counted in metrics, coverage or the
+        // host counters
+        void setSpeculating(bool isSpeculating);
 
-        // Used to simulate VRAM, this is the buffer that gets written to the display.
-        unsigned char graphicsBuffer[SCREEN_HEIGHT * SCREEN_WIDTH];
+        // XOR an 8xH sprite from memory[index] onto the screen, setting VF on collision and marking what
+        // changed dirty. The caller checks that the sprite lies inside memory. Static so that recompiled code
+        // shares the same routine.
+        static void drawSprite(Chip8State& state, unsigned char xReg, unsigned char yReg, unsigned char h);
 
-        // Font to store in memory (0-F)
-        unsigned char font[FONT_SIZE] = {0xF0, 0x90, 0x90, 0x90, 0xF0, 0x20, 0x60, 0x20, 0x20, 0x70,
-                                         0xF0, 0x10, 0xF0, 0x80, 0xF0, 0xF0, 0x10, 0xF0, 0x10, 0xF0,
-                                         0x90, 0x90, 0xF0, 0x10, 0x10, 0xF0, 0x80, 0xF0, 0x10, 0xF0,
-                                         0xF0, 0x80, 0xF0, 0x90, 0xF0, 0xF0, 0x10, 0x20, 0x40, 0x40,
-                                         0xF0, 0x90, 0xF0, 0x90, 0xF0, 0xF0, 0x90, 0xF0, 0x10, 0xF0,
-                                         0xF0, 0x90, 0xF0, 0x90, 0x90, 0xE0, 0x90, 0xE0, 0x90, 0xE0,
-                                         0xF0, 0x80, 0x80, 0x80, 0xF0, 0xE0, 0x90, 0x90, 0x90, 0xE0,
-                                         0xF0, 0x80, 0xF0, 0x80, 0xF0, 0xF0, 0x80, 0xF0, 0x80, 0x80};
+        // 0x00E0: blank the screen, marking what was lit dirty
+        static void clearScreen(Chip8State& state);
 
-        // "Interrupt timers" used for delays and sound purposes.
-        unsigned char delayInterruptTimer;
-        unsigned char soundInterruptTimer;
+        // Add pixel byte column of row to the dirty region
+        static void markDirty(DirtyRegion& dirty, unsigned int row, unsigned int column)
+        {
+            dirty.rows |= 1u << row;
+            dirty.columns[row] |= static_cast<unsigned char>(1u << column);
+        }
 
-        // The Chip-8 system does not have a stack, but we need one to keep track of where to return to
-        // when a function call is made.
-        std::stack<unsigned short, std::vector<unsigned short>> callStack;
+        // Next value from the machine's random number generator
+        static unsigned char nextRandom(Chip8State& state);
 
-        // The Chip-8 system has a keypad that uses 16 buttons, labeled in HEX (0x0-0xF).
-        // This array stores the values of the keys currently being pressed.
-        unsigned char keypad[NUMBER_OF_KEYPAD_BUTTONS];
+        // Font loaded into memory at address 0 (0-F), shared by every machine
+        static const unsigned char font[FONT_SIZE];
 
-        // size of loaded ROM in bytes
-        unsigned short romBytes;
+    private:
 
-        // display needs to be updated if dirty
-        bool isDirty;
+        // Everything that makes up the running machine.
+        Chip8State state;
 
+        // 0xFR0A reads from the terminal when true, otherwise it waits on the keypad array.
+        bool isKeyWaitBlocking;
+        unsigned long long keyReads;
 
         // shared LogWriter
         LogWriter* logWriter;
 
+        // shared Metrics, or nullptr
+        Metrics* metrics;
+
+        // debugger, or nullptr
+        DebugHook* debugHook;
+
+        // coverage being recorded, or nullptr
+        Coverage* coverage;
+
+        // host counters, or nullptr
+        PerfCounters* perfCounters;
+
+        // the above, put aside while speculating
+        Metrics* heldMetrics;
+        Coverage* heldCoverage;
+        PerfCounters* heldPerfCounters;
+        bool isSpeculating;
+
+        // Idle loop detection: registers seen at the last backward jump (see watchIdleLoop)
+        bool isIdleDetecting;
+        bool isIdleLoop;
+        unsigned short idleJumpAddress;
+        unsigned char idleRegisters[NUMBER_OF_REGISTERS];
+        unsigned short idleIndex;
+        unsigned char idleStackPointer;
+
+        // Check for an idle loop at a backward jump from address
+        void watchIdleLoop(unsigned short address);
+
+        // runStep's fusion: on or off, and what it did
+        bool isFusing;
+        Chip8FusionStatistics fusion;
+
+        // Run the sequence at the program counter fused if it is one, setting executed; else leave it at 0
+        bool runFused(unsigned int budget, unsigned int& executed);
+
+        // The fused handlers, for the sequence at the program counter made of first, second and third
+        bool runSpriteDraw(unsigned short first, unsigned short second, unsigned int& executed);
+        void runCoordinates(unsigned short first, unsigned short second, unsigned int& executed);
+        void runTimerWait(unsigned short first, unsigned short second, unsigned short third, unsigned int budget,
+                          unsigned int& executed);
+        bool runCountedLoop(unsigned short first, unsigned short second, unsigned short third, unsigned int budget,
+                            unsigned int& executed);
+        void countFused(Chip8Fusion kind, unsigned int executed);
+        void countOpCode(unsigned short opCode);
+
         // Load font into memory
         bool loadFontSet();
 
-        // Load ROM file into memory
-        bool loadROM(std::ifstream * fin);
-
         // What they say on the box
         void fetch();
         bool decodeAndExecute();
@@ -134,6 +307,12 @@ class Chip8
         unsigned char getHexDigits3and4(unsigned short hexShort);
         unsigned short getHexAddress(unsigned short hexShort); // digits 2, 3, 4
 
+        // Is [address, address + length) inside memory? Logs an error if not.
+        bool isInMemory(unsigned int address, unsigned int length);
+
+        // Log an ERROR about the current instruction, with pc and opcode fields
+        void logInstructionError(const std::string& message);
+
         // helper function for printing hex numbers
         std::string intToHexString(unsigned short number, int width = 4);
 };
@@ -0,0 +1,645 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * CompactChip8
+ * Copy-on-write paged memory and the instruction set over it.
+ */
+
+#include <cstring>
+#include <ctime>
+#include "CompactChip8.h"
+
+// idleJumpAddress when no loop is being watched
+#define NO_IDLE_JUMP 0xFFFF
+
+RomImage::
+RomImage()
+{
+    std::memset(memory, 0, sizeof(memory));
+    std::copy_n(Chip8::font, FONT_SIZE, memory);
+    romBytes = 0;
+}
+
+bool RomImage::
+load(const unsigned char* rom, size_t length)
+{
+    if (length == 0 || length > MEMORY_SIZE - CODE_START)
+    {
+        return false;
+    }
+    std::copy_n(rom, length, memory + CODE_START);
+    romBytes = static_cast<unsigned short>(length);
+    return true;
+}
+
+bool RomImage::
+isSameRom(const unsigned char* rom, size_t length) const
+{
+    return length == romBytes && std::equal(rom, rom + length, memory + CODE_START);
+}
+
+const unsigned char* RomImage::
+getMemory() const
+{
+    return memory;
+}
+
+unsigned short RomImage::
+getRomBytes() const
+{
+    return romBytes;
+}
+
+CompactChip8::
+CompactChip8(LogWriter* logWrit, const RomImage* romImage)
+{
+    logWriter = logWrit;
+    image = romImage;
+    std::memset(slots, 0, sizeof(slots));
+    ownedPages = 0;
+    storePages = 0;
+    std::memset(registers, 0, sizeof(registers));
+    index = 0;
+    progCounter = CODE_START;
+    opCode = 0;
+    keys = 0;
+    stackPointer = 0;
+    delayInterruptTimer = 0;
+    soundInterruptTimer = 0;
+    isDirty = false;
+    randomState = static_cast<unsigned int>(time(nullptr)) | 1; // xorshift must not start at 0
+    std::memset(callStack, 0, sizeof(callStack));
+    isIdleDetecting = false;
+    isIdleLoop = false;
+    idleJumpAddress = NO_IDLE_JUMP;
+    std::memset(graphicsBuffer, 0, sizeof(graphicsBuffer));
+    std::memset(&dirty, 0, sizeof(dirty));
+}
+
+unsigned char CompactChip8::
+read(unsigned int address) const
+{
+    unsigned int page = address / COMPACT_PAGE_SIZE;
+    if (ownedPages & (1u << page))
+    {
+        return store[slots[page] * COMPACT_PAGE_SIZE + address % COMPACT_PAGE_SIZE];
+    }
+    return image->getMemory()[address];
+}
+
+void CompactChip8::
+write(unsigned int address, unsigned char value)
+{
+    unsigned int page = address / COMPACT_PAGE_SIZE;
+    if (!(ownedPages & (1u << page)))
+    {
+        ownPage(page);
+    }
+    store[slots[page] * COMPACT_PAGE_SIZE + address % COMPACT_PAGE_SIZE] = value;
+}
+
+// The store grows a page at a time: programs write to few pages, and rarely, so an exact fit beats spare room
+void CompactChip8::
+ownPage(unsigned int page)
+{
+    std::unique_ptr<unsigned char[]> grown(new unsigned char[(storePages + 1) * COMPACT_PAGE_SIZE]);
+    if (storePages > 0)
+    {
+        std::memcpy(grown.get(), store.get(), storePages * COMPACT_PAGE_SIZE);
+    }
+    std::memcpy(grown.get() + storePages * COMPACT_PAGE_SIZE, image->getMemory() + page * COMPACT_PAGE_SIZE,
+                COMPACT_PAGE_SIZE);
+    store = std::move(grown);
+    slots[page] = storePages++;
+    ownedPages |= 1u << page;
+}
+
+size_t CompactChip8::
+getPrivateBytes() const
+{
+    return storePages * COMPACT_PAGE_SIZE;
+}
+
+bool CompactChip8::
+runCycle()
+{
+    isDirty = false;
+    isIdleLoop = false;
+    if (progCounter > MEMORY_SIZE - 2)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Program counter out of bounds", {{"pc", progCounter, true}});
+        return false;
+    }
+    opCode = read(progCounter) << 8 | read(progCounter + 1u);
+    return execute();
+}
+
+// As Chip8::watchIdleLoop
+void CompactChip8::
+watchIdleLoop(unsigned short address)
+{
+    if (idleJumpAddress == address && idleIndex == index && idleStackPointer == stackPointer &&
+        std::equal(registers, registers + NUMBER_OF_REGISTERS, idleRegisters))
+    {
+        isIdleLoop = true;
+        return;
+    }
+    idleJumpAddress = address;
+    std::copy_n(registers, NUMBER_OF_REGISTERS, idleRegisters);
+    idleIndex = index;
+    idleStackPointer = stackPointer;
+}
+
+// Decode and execute opCode, with the same results as Chip8::decodeAndExecute
+bool CompactChip8::
+execute()
+{
+    unsigned char x = (opCode >> 8) & 0xF;
+    unsigned char y = (opCode >> 4) & 0xF;
+    unsigned char value = opCode & 0xFF;
+    unsigned short address = opCode & 0xFFF;
+    switch (opCode >> 12)
+    {
+        case 0x0:
+            if (address == 0x0E0)
+            {
+                for (unsigned int i = 0; i < SCREEN_SIZE; ++i)
+                {
+                    if (graphicsBuffer[i] != 0)
+                    {
+                        Chip8::markDirty(dirty, i / SCREEN_WIDTH_SIZE, i % SCREEN_WIDTH_SIZE);
+                        graphicsBuffer[i] = 0;
+                    }
+                }
+                progCounter += 2;
+                isDirty = true;
+                idleJumpAddress = NO_IDLE_JUMP;
+            }
+            else if (address == 0x0EE)
+            {
+                if (stackPointer == 0)
+                {
+                    logInstructionError("Call stack is empty. Exiting.");
+                    return false;
+                }
+                progCounter = callStack[--stackPointer];
+            }
+            else
+            {
+                return false; // call to a machine code routine
+            }
+            break;
+
+        case 0x1:
+        {
+            unsigned short prevProgramCounter = progCounter;
+            progCounter = address;
+            if (progCounter == prevProgramCounter)
+            {
+                return false;
+            }
+            if (isIdleDetecting && progCounter < prevProgramCounter)
+            {
+                watchIdleLoop(prevProgramCounter);
+            }
+            break;
+        }
+
+        case 0x2:
+            if (stackPointer >= STACK_DEPTH)
+            {
+                return false;
+            }
+            callStack[stackPointer++] = progCounter + 2;
+            progCounter = address;
+            break;
+
+        case 0x3:
+            progCounter += registers[x] == value ? 4 : 2;
+            break;
+
+        case 0x4:
+            progCounter += registers[x] != value ? 4 : 2;
+            break;
+
+        case 0x5:
+            if ((opCode & 0xF) != 0)
+            {
+                logInstructionError("OpCode not implemented");
+                return false;
+            }
+            progCounter += registers[x] == registers[y] ? 4 : 2;
+            break;
+
+        case 0x6:
+            registers[x] = value;
+            progCounter += 2;
+            break;
+
+        case 0x7:
+            registers[x] += value;
+            progCounter += 2;
+            break;
+
+        case 0x8:
+        {
+            unsigned char regX = registers[x];
+            unsigned char regY = registers[y];
+            switch (opCode & 0xF)
+            {
+                case 0x0:
+                    registers[x] = regY;
+                    break;
+                case 0x1:
+                    registers[x] = regX | regY;
+                    break;
+                case 0x2:
+                    registers[x] = regX & regY;
+                    break;
+                case 0x3:
+                    registers[x] = regX ^ regY;
+                    break;
+                case 0x4:
+                    registers[x] = regX + regY;
+                    registers[0xF] = regX > 0xFF - regY ? 1 : 0;
+                    break;
+                case 0x5:
+                    registers[x] = regX - regY;
+                    registers[0xF] = regY > regX ? 0 : 1;
+                    break;
+                case 0x6:
+                    registers[0xF] = regX & 0x1;
+                    registers[x] = regX >> 1;
+                    break;
+                case 0x7:
+                    registers[x] = regY - regX;
+                    registers[0xF] = regX > regY ? 0 : 1;
+                    break;
+                case 0xE:
+                    registers[0xF] = regX >> 7;
+                    registers[x] = regX << 1;
+                    break;
+                default:
+                    logInstructionError("OpCode not implemented");
+                    return false;
+            }
+            progCounter += 2;
+            break;
+        }
+
+        case 0x9:
+            if ((opCode & 0xF) != 0)
+            {
+                logInstructionError("OpCode not implemented");
+                return false;
+            }
+            progCounter += registers[x] != registers[y] ? 4 : 2;
+            break;
+
+        case 0xA:
+            index = address;
+            progCounter += 2;
+            break;
+
+        case 0xB:
+            progCounter = registers[0] + address;
+            break;
+
+        case 0xC:
+        {
+            // xorshift32, as Chip8::nextRandom
+            unsigned int random = randomState;
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            randomState = random;
+            registers[x] = static_cast<unsigned char>(random) & value;
+            progCounter += 2;
+            idleJumpAddress = NO_IDLE_JUMP;
+            break;
+        }
+
+        case 0xD:
+        {
+            unsigned char h = opCode & 0xF;
+            if (!isInMemory(index, h))
+            {
+                return false;
+            }
+            drawSprite(x, y, h);
+            progCounter += 2;
+            isDirty = true;
+            idleJumpAddress = NO_IDLE_JUMP;
+            break;
+        }
+
+        case 0xE:
+        {
+            bool isDown = (keys >> (registers[x] & 0xF)) & 1;
+            if (value == 0x9E)
+            {
+                progCounter += isDown ? 4 : 2;
+            }
+            else if (value == 0xA1)
+            {
+                progCounter += isDown ? 2 : 4;
+            }
+            else
+            {
+                logInstructionError("OpCode not implemented");
+                return false;
+            }
+            break;
+        }
+
+        case 0xF:
+            switch (value)
+            {
+                case 0x07:
+                    registers[x] = delayInterruptTimer;
+                    break;
+
+                case 0x0A:
+                {
+                    // leave the program counter here until a key is down
+                    if (keys == 0)
+                    {
+                        isIdleLoop = isIdleDetecting;
+                        return true;
+                    }
+                    unsigned char key = 0;
+                    while (!((keys >> key) & 1))
+                    {
+                        ++key;
+                    }
+                    registers[x] = key;
+                    idleJumpAddress = NO_IDLE_JUMP;
+                    break;
+                }
+
+                case 0x15:
+                    delayInterruptTimer = registers[x];
+                    idleJumpAddress = NO_IDLE_JUMP;
+                    break;
+
+                case 0x18:
+                    soundInterruptTimer = registers[x];
+                    idleJumpAddress = NO_IDLE_JUMP;
+                    break;
+
+                case 0x1E:
+                    index += registers[x];
+                    break;
+
+                case 0x29:
+                    index = registers[x] * BYTES_PER_FONT_CHAR;
+                    break;
+
+                case 0x33:
+                    if (!isInMemory(index, 3))
+                    {
+                        return false;
+                    }
+                    write(index, registers[x] / 100);
+                    write(index + 1u, registers[x] / 10 % 10);
+                    write(index + 2u, registers[x] % 10);
+                    idleJumpAddress = NO_IDLE_JUMP;
+                    break;
+
+                case 0x55:
+                    if (!isInMemory(index, x + 1u))
+                    {
+                        return false;
+                    }
+                    for (unsigned int i = 0; i <= x; ++i)
+                    {
+                        write(index + i, registers[i]);
+                    }
+                    idleJumpAddress = NO_IDLE_JUMP;
+                    break;
+
+                case 0x65:
+                    if (!isInMemory(index, x + 1u))
+                    {
+                        return false;
+                    }
+                    for (unsigned int i = 0; i <= x; ++i)
+                    {
+                        registers[i] = read(index + i);
+                    }
+                    break;
+
+                default:
+                    logInstructionError("OpCode not implemented");
+                    return false;
+            }
+            progCounter += 2;
+            break;
+
+        default:
+            logInstructionError("OpCode not implemented");
+            return false;
+    }
+    return true;
+}
+
+// As Chip8::drawSprite, reading the sprite through the pages
+void CompactChip8::
+drawSprite(unsigned char xReg, unsigned char yReg, unsigned char h)
+{
+    registers[0xF] = 0;
+    unsigned char x = registers[xReg];
+    unsigned char y = registers[yReg];
+    if (x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT)
+    {
+        return;
+    }
+    int xByte = x / 8;
+    int xBit = x % 8;
+    unsigned short start = xByte + y * SCREEN_WIDTH_SIZE;
+    for (int i = 0; i < h; ++i)
+    {
+        unsigned char sprite = read(index + i);
+        if (sprite == 0)
+        {
+            continue;
+        }
+        unsigned short loc = (start + i * SCREEN_WIDTH_SIZE) % SCREEN_SIZE;
+        unsigned char toWrite = sprite >> xBit;
+        if (toWrite != 0)
+        {
+            unsigned char before = graphicsBuffer[loc];
+            graphicsBuffer[loc] ^= toWrite;
+            if (before & ~graphicsBuffer[loc])
+            {
+                registers[0xF] = 1;
+            }
+            Chip8::markDirty(dirty, loc / SCREEN_WIDTH_SIZE, xByte);
+        }
+        toWrite = static_cast<unsigned char>(sprite << (8 - xBit));
+        if (xBit != 0 && toWrite != 0)
+        {
+            int nextByte = xByte < SCREEN_WIDTH_SIZE - 1 ? xByte + 1 : 0;
+            unsigned short next = loc - xByte + nextByte;
+            unsigned char before = graphicsBuffer[next];
+            graphicsBuffer[next] ^= toWrite;
+            if (before & ~graphicsBuffer[next])
+            {
+                registers[0xF] = 1;
+            }
+            Chip8::markDirty(dirty, loc / SCREEN_WIDTH_SIZE, nextByte);
+        }
+    }
+}
+
+bool CompactChip8::
+updateTimers()
+{
+    if (soundInterruptTimer > 0)
+    {
+        --soundInterruptTimer;
+    }
+    if (delayInterruptTimer > 0)
+    {
+        --delayInterruptTimer;
+    }
+    idleJumpAddress = NO_IDLE_JUMP;
+    return true;
+}
+
+bool CompactChip8::
+isDirtyScreen()
+{
+    return isDirty;
+}
+
+bool CompactChip8::
+isIdle() const
+{
+    return isIdleLoop;
+}
+
+unsigned char* CompactChip8::
+getScreen()
+{
+    return graphicsBuffer;
+}
+
+DirtyRegion CompactChip8::
+takeDirtyRegion()
+{
+    DirtyRegion taken = dirty;
+    std::memset(&dirty, 0, sizeof(dirty));
+    return taken;
+}
+
+void CompactChip8::
+setKey(unsigned char key, bool isPressed)
+{
+    if (isPressed)
+    {
+        keys |= 1u << (key & 0xF);
+    }
+    else
+    {
+        keys &= ~(1u << (key & 0xF));
+    }
+    idleJumpAddress = NO_IDLE_JUMP;
+}
+
+void CompactChip8::
+setIdleDetection(bool isDetecting)
+{
+    isIdleDetecting = isDetecting;
+    isIdleLoop = false;
+    idleJumpAddress = NO_IDLE_JUMP;
+}
+
+void CompactChip8::
+exportState(Chip8State& state) const
+{
+    for (unsigned int address = 0; address < MEMORY_SIZE; address += COMPACT_PAGE_SIZE)
+    {
+        unsigned int page = address / COMPACT_PAGE_SIZE;
+        const unsigned char* from = ownedPages & (1u << page) ? store.get() + slots[page] * COMPACT_PAGE_SIZE
+                                                               : image->getMemory() + address;
+        std::memcpy(state.memory + address, from, COMPACT_PAGE_SIZE);
+    }
+    std::copy_n(registers, NUMBER_OF_REGISTERS, state.registers);
+    state.index = index;
+    state.progCounter = progCounter;
+    state.opCode = opCode;
+    std::copy_n(callStack, STACK_DEPTH, state.callStack);
+    state.stackPointer = stackPointer;
+    state.delayInterruptTimer = delayInterruptTimer;
+    state.soundInterruptTimer = soundInterruptTimer;
+    for (unsigned char key = 0; key < NUMBER_OF_KEYPAD_BUTTONS; ++key)
+    {
+        state.keypad[key] = (keys >> key) & 1;
+    }
+    std::copy_n(graphicsBuffer, SCREEN_SIZE, state.graphicsBuffer);
+    state.dirty = dirty;
+    state.romBytes = image->getRomBytes();
+    state.randomState = randomState;
+    state.isDirty = isDirty;
+}
+
+void CompactChip8::
+importState(const Chip8State& state)
+{
+    store.reset();
+    ownedPages = 0;
+    storePages = 0;
+    for (unsigned int address = 0; address < MEMORY_SIZE; address += COMPACT_PAGE_SIZE)
+    {
+        if (std::memcmp(state.memory + address, image->getMemory() + address, COMPACT_PAGE_SIZE) != 0)
+        {
+            unsigned int page = address / COMPACT_PAGE_SIZE;
+            ownPage(page);
+            std::memcpy(store.get() + slots[page] * COMPACT_PAGE_SIZE, state.memory + address, COMPACT_PAGE_SIZE);
+        }
+    }
+    std::copy_n(state.registers, NUMBER_OF_REGISTERS, registers);
+    index = state.index;
+    progCounter = state.progCounter;
+    opCode = state.opCode;
+    std::copy_n(state.callStack, STACK_DEPTH, callStack);
+    stackPointer = state.stackPointer;
+    delayInterruptTimer = state.delayInterruptTimer;
+    soundInterruptTimer = state.soundInterruptTimer;
+    keys = 0;
+    for (unsigned char key = 0; key < NUMBER_OF_KEYPAD_BUTTONS; ++key)
+    {
+        keys |= (state.keypad[key] ? 1u : 0u) << key;
+    }
+    std::copy_n(state.graphicsBuffer, SCREEN_SIZE, graphicsBuffer);
+    dirty = state.dirty;
+    randomState = state.randomState;
+    isDirty = state.isDirty;
+    isIdleLoop = false;
+    idleJumpAddress = NO_IDLE_JUMP;
+}
+
+bool CompactChip8::
+isInMemory(unsigned int address, unsigned int length)
+{
+    if (address + length > MEMORY_SIZE)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Memory access out of bounds",
+                       {{"pc", progCounter, true}, {"opcode", opCode, true}, {"index", address, true},
+                        {"length", length, false}});
+        return false;
+    }
+    return true;
+}
+
+void CompactChip8::
+logInstructionError(const std::string& message)
+{
+    logWriter->log(LogWriter::LogLevel::ERROR, message, {{"pc", progCounter, true}, {"opcode", opCode, true}});
+}
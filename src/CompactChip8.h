@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * CompactChip8
+ * A Chip8 core for running thousands of machines at once. Memory is COMPACT_PAGES pages that start out
+ * pointing into a RomImage (font and ROM as loaded) shared by every machine running that ROM; the first
+ * store into a page gives the machine its own copy of just that page. The screen and call stack are kept
+ * inline, so a machine that has not written memory costs sizeof(CompactChip8) and nothing more.
+ * Runs the same instruction set as Chip8, with 0xFR0A always waiting on setKey() and no debug hooks.
+ */
+
+#ifndef IMIT8_CHIP8_COMPACTCHIP8_H
+#define IMIT8_CHIP8_COMPACTCHIP8_H
+
+#include <memory>
+#include "Chip8.h"
+
+#define COMPACT_PAGE_SIZE 256
+#define COMPACT_PAGES (MEMORY_SIZE / COMPACT_PAGE_SIZE)
+
+// Memory as it is after the font and a ROM have been loaded. Read only once machines use it.
+class RomImage
+{
+    public:
+        RomImage();
+
+        // Lay out the font and rom. Fails on an empty ROM or one that does not fit.
+        bool load(const unsigned char* rom, size_t length);
+
+        // Was this image loaded from exactly rom?
+        bool isSameRom(const unsigned char* rom, size_t length) const;
+
+        const unsigned char* getMemory() const;
+        unsigned short getRomBytes() const;
+
+    private:
+        unsigned char memory[MEMORY_SIZE];
+        unsigned short romBytes;
+};
+
+class CompactChip8 final : public Core
+{
+    public:
+        // image must outlive the machine
+        CompactChip8(LogWriter* logWriter, const RomImage* image);
+
+        bool runCycle() override;
+        bool isDirtyScreen() override;
+        bool isIdle() const override;
+        bool updateTimers() override;
+        unsigned char* getScreen() override;
+        DirtyRegion takeDirtyRegion() override;
+        void setKey(unsigned char key, bool isPressed) override;
+
+        // Watch for wait loops, as Chip8::setIdleDetection
+        void setIdleDetection(bool isDetecting);
+
+        // Copy the machine out to, or in from, the layout every other engine uses. Pages of state.memory that
+        // match the image are shared again on import.
+        void exportState(Chip8State& state) const;
+        void importState(const Chip8State& state);
+
+        // Heap memory held on top of sizeof(CompactChip8): the private copies of written pages
+        size_t getPrivateBytes() const;
+
+    private:
+        // shared LogWriter
+        LogWriter* logWriter;
+
+        // Pages not in ownedPages are read from image; page p of the rest is at store + slots[p] pages
+        const RomImage* image;
+        std::unique_ptr<unsigned char[]> store;
+        unsigned char slots[COMPACT_PAGES];
+        unsigned short ownedPages;
+        unsigned char storePages;
+
+        // Machine state, as in Chip8State. keys holds one bit per keypad button.
+        unsigned char registers[NUMBER_OF_REGISTERS];
+        unsigned short index;
+        unsigned short progCounter;
+        unsigned short opCode;
+        unsigned short keys;
+        unsigned char stackPointer;
+        unsigned char delayInterruptTimer;
+        unsigned char soundInterruptTimer;
+        bool isDirty;
+        unsigned int randomState;
+        unsigned short callStack[STACK_DEPTH];
+
+        // Idle loop detection, as in Chip8
+        bool isIdleDetecting;
+        bool isIdleLoop;
+        unsigned char idleStackPointer;
+        unsigned short idleJumpAddress;
+        unsigned short idleIndex;
+        unsigned char idleRegisters[NUMBER_OF_REGISTERS];
+
+        unsigned char graphicsBuffer[SCREEN_SIZE];
+        DirtyRegion dirty;
+
+        unsigned char read(unsigned int address) const;
+        void write(unsigned int address, unsigned char value);
+
+        // Give the machine its own copy of page
+        void ownPage(unsigned int page);
+
+        bool execute();
+        void drawSprite(unsigned char xReg, unsigned char yReg, unsigned char h);
+        void watchIdleLoop(unsigned short address);
+
+        // Is [address, address + length) inside memory? Logs an error if not.
+        bool isInMemory(unsigned int address, unsigned int length);
+        void logInstructionError(const std::string& message);
+};
+
+#endif //IMIT8_CHIP8_COMPACTCHIP8_H
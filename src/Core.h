@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Core
+ * What the frame loop needs from an emulated CPU. Chip8 implements it; other cores can be dropped in. The
+ * loop itself (FrameLoop) is a template, so code written against a concrete core makes direct calls.
+ */
+
+#ifndef IMIT8_CHIP8_CORE_H
+#define IMIT8_CHIP8_CORE_H
+
+#define SCREEN_HEIGHT 32
+#define SCREEN_WIDTH 64
+#define SCREEN_WIDTH_SIZE (SCREEN_WIDTH / 8)
+#define SCREEN_SIZE (SCREEN_WIDTH_SIZE * SCREEN_HEIGHT)
+
+// The parts of the screen that changed: bit r of rows for row r, and in columns[r] bit c for the 8 pixels of
+// byte c of that row. Only pixels that were drawn or cleared count, so an empty region means nothing to redraw.
+struct DirtyRegion
+{
+    unsigned int rows;
+    unsigned char columns[SCREEN_HEIGHT];
+};
+
+class Core
+{
+    public:
+        virtual ~Core() {}
+
+        // Run one instruction. Returns false once the machine has halted.
+        virtual bool runCycle() = 0;
+
+        // Run the next instruction, or, in a core that fuses common sequences of instructions, up to budget
+        // (at least 1) of them at once. executed is set to how many ran. Returns false once halted.
+        virtual bool runStep(unsigned int budget, unsigned int& executed)
+        {
+            (void) budget;
+            executed = 1;
+            return runCycle();
+        }
+
+        // Did the last instruction change the screen?
+        virtual bool isDirtyScreen() = 0;
+
+        // Is the program waiting on something that cannot change before the frame ends?
+        virtual bool isIdle() const = 0;
+
+        // Tick the timers once, at the end of a frame
+        virtual bool updateTimers() = 0;
+
+        // Packed 1 bit per pixel screen, most significant bit leftmost
+        virtual unsigned char* getScreen() = 0;
+
+        // What changed on the screen since the last call, accumulated over every instruction in between
+        virtual DirtyRegion takeDirtyRegion() = 0;
+
+        virtual void setKey(unsigned char key, bool isPressed) = 0;
+};
+
+#endif //IMIT8_CHIP8_CORE_H
@@ -0,0 +1,426 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Coverage
+ * Recording, merging and reporting what a ROM exercised.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <sys/file.h>
+#include <unistd.h>
+#include "Coverage.h"
+#include "Disassembler.h"
+
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+static std::string
+hex(unsigned int number, int width)
+{
+    std::stringstream stream;
+    stream << std::uppercase << std::hex << std::setw(width) << std::setfill('0') << number;
+    return stream.str();
+}
+
+// "start,end" lines for each run of set entries
+static void
+formatRanges(std::ostream& out, const char* tag, const std::vector<bool>& isSet)
+{
+    for (size_t start = 0; start < isSet.size(); ++start)
+    {
+        if (!isSet[start])
+        {
+            continue;
+        }
+        size_t end = start;
+        while (end < isSet.size() && isSet[end])
+        {
+            ++end;
+        }
+        out << tag << ':' << start << ',' << end << '\n';
+        start = end;
+    }
+}
+
+Coverage::
+Coverage(LogWriter* logWrit)
+{
+    logWriter = logWrit;
+    std::memset(hits, 0, sizeof(hits));
+    std::memset(taken, 0, sizeof(taken));
+    std::memset(notTaken, 0, sizeof(notTaken));
+    std::memset(reads, 0, sizeof(reads));
+    std::memset(writes, 0, sizeof(writes));
+}
+
+void Coverage::
+setRom(const std::string& romName, const unsigned char* romBytes, size_t length)
+{
+    name = romName;
+    rom.assign(romBytes, romBytes + std::min<size_t>(length, MEMORY_SIZE - CODE_START));
+}
+
+// Ties a record to the exact ROM, so that an edited ROM of the same name starts over
+std::string Coverage::
+getRomHash() const
+{
+    unsigned long long hash = FNV_OFFSET_BASIS;
+    for (unsigned char byte : rom)
+    {
+        hash = (hash ^ byte) * FNV_PRIME;
+    }
+    return hex(static_cast<unsigned int>(hash >> 32), 8) + hex(static_cast<unsigned int>(hash), 8);
+}
+
+Coverage::Record Coverage::
+toRecord() const
+{
+    Record record;
+    record.hits.assign(hits, hits + MEMORY_SIZE);
+    record.takenRuns.resize(MEMORY_SIZE);
+    record.notTakenRuns.resize(MEMORY_SIZE);
+    record.isRead.resize(MEMORY_SIZE);
+    record.isWritten.resize(MEMORY_SIZE);
+    for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+    {
+        record.takenRuns[address] = isMarked(taken, address);
+        record.notTakenRuns[address] = isMarked(notTaken, address);
+        record.isRead[address] = isMarked(reads, address);
+        record.isWritten[address] = isMarked(writes, address);
+    }
+    return record;
+}
+
+// Add the DA, BRDA, RD and WR lines of a record to record; anything else is left to lcov
+bool Coverage::
+parseRecord(const std::vector<std::string>& lines, Record& record)
+{
+    for (const std::string& line : lines)
+    {
+        unsigned long address;
+        unsigned long long count;
+        unsigned long block;
+        unsigned long branch;
+        unsigned long end;
+        char countText[32];
+        if (std::sscanf(line.c_str(), "DA:%lu,%llu", &address, &count) == 2)
+        {
+            if (address >= MEMORY_SIZE)
+            {
+                return false;
+            }
+            record.hits[address] += count;
+        }
+        else if (std::sscanf(line.c_str(), "BRDA:%lu,%lu,%lu,%31s", &address, &block, &branch, countText) == 4)
+        {
+            if (address >= MEMORY_SIZE || branch > 1)
+            {
+                return false;
+            }
+            count = countText[0] == '-' ? 0 : std::strtoull(countText, nullptr, 10);
+            (branch == 0 ? record.takenRuns : record.notTakenRuns)[address] += count;
+        }
+        else if (std::sscanf(line.c_str(), "RD:%lu,%lu", &address, &end) == 2 ||
+                 std::sscanf(line.c_str(), "WR:%lu,%lu", &address, &end) == 2)
+        {
+            if (address > end || end > MEMORY_SIZE)
+            {
+                return false;
+            }
+            std::vector<bool>& isSet = line[0] == 'R' ? record.isRead : record.isWritten;
+            for (unsigned long i = address; i < end; ++i)
+            {
+                isSet[i] = true;
+            }
+        }
+    }
+    return true;
+}
+
+// The opCode at address as loaded: the font, the ROM, or zeroes
+unsigned short Coverage::
+fetch(unsigned int address) const
+{
+    unsigned char bytes[2];
+    for (unsigned int i = 0; i < 2; ++i)
+    {
+        unsigned int at = address + i;
+        bytes[i] = at < FONT_SIZE ? Chip8::font[at] :
+                   at >= CODE_START && at - CODE_START < rom.size() ? rom[at - CODE_START] : 0;
+    }
+    return bytes[0] << 8 | bytes[1];
+}
+
+// Addresses to report as instructions, in order: everything executed, and in between whatever lines up with
+// it and was not read as data. Covers the ROM and anything executed outside it.
+std::vector<unsigned short> Coverage::
+getInstructions(const Record& record) const
+{
+    unsigned int start = CODE_START;
+    unsigned int end = CODE_START + static_cast<unsigned int>(rom.size());
+    for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+    {
+        if (record.hits[address] != 0)
+        {
+            start = std::min(start, address);
+            end = std::max(end, std::min(address + 2, static_cast<unsigned int>(MEMORY_SIZE)));
+        }
+    }
+    std::vector<unsigned short> instructions;
+    for (unsigned int address = start; address + 1 < end;)
+    {
+        if (record.hits[address] == 0 && (record.hits[address + 1] != 0 || record.isRead[address]))
+        {
+            ++address; // data, or the byte before code that starts on an odd address
+            continue;
+        }
+        instructions.push_back(static_cast<unsigned short>(address));
+        address += 2;
+    }
+    return instructions;
+}
+
+bool Coverage::
+isSkip(const Record& record, unsigned short address) const
+{
+    return Disassembler::getFlowType(fetch(address)) == Disassembler::SKIP || record.takenRuns[address] != 0 ||
+           record.notTakenRuns[address] != 0;
+}
+
+std::string Coverage::
+formatRecord(const Record& record) const
+{
+    std::vector<unsigned short> instructions = getInstructions(record);
+    std::stringstream out;
+    out << "TN:\nSF:" << name << "\nROM:" << getRomHash() << '\n';
+    int branches = 0;
+    int branchesHit = 0;
+    for (unsigned short address : instructions)
+    {
+        if (!isSkip(record, address))
+        {
+            continue;
+        }
+        const unsigned long long* runs[2] = {&record.takenRuns[address], &record.notTakenRuns[address]};
+        for (int branch = 0; branch < 2; ++branch)
+        {
+            out << "BRDA:" << address << ",0," << branch << ',';
+            if (record.hits[address] == 0)
+            {
+                out << "-\n";
+            }
+            else
+            {
+                out << *runs[branch] << '\n';
+            }
+            ++branches;
+            branchesHit += *runs[branch] != 0;
+        }
+    }
+    out << "BRF:" << branches << "\nBRH:" << branchesHit << '\n';
+    int linesHit = 0;
+    for (unsigned short address : instructions)
+    {
+        out << "DA:" << address << ',' << record.hits[address] << '\n';
+        linesHit += record.hits[address] != 0;
+    }
+    out << "LF:" << instructions.size() << "\nLH:" << linesHit << '\n';
+    formatRanges(out, "RD", record.isRead);
+    formatRanges(out, "WR", record.isWritten);
+    out << "end_of_record\n";
+    return out.str();
+}
+
+bool Coverage::
+write(const std::string& path, const std::string& listingPath)
+{
+    int lock = open((path + ".lock").c_str(), O_CREAT | O_RDWR, 0644);
+    if (lock < 0 || flock(lock, LOCK_EX) != 0)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not lock " + path + ".lock (" + std::strerror(errno) + ")");
+        if (lock >= 0)
+        {
+            close(lock);
+        }
+        return false;
+    }
+
+    // split what is there into records, merging the ones for this ROM into this run
+    std::vector<std::vector<std::string>> records;
+    std::ifstream inputStream(path);
+    std::string line;
+    std::vector<std::string> lines;
+    while (std::getline(inputStream, line))
+    {
+        lines.push_back(line);
+        if (line == "end_of_record")
+        {
+            records.push_back(lines);
+            lines.clear();
+        }
+    }
+    Record merged = toRecord();
+    std::string romLine = "ROM:" + getRomHash();
+    int ours = -1;
+    bool isGood = true;
+    for (size_t i = 0; i < records.size() && isGood; ++i)
+    {
+        const std::vector<std::string>& record = records[i];
+        if (std::find(record.begin(), record.end(), "SF:" + name) == record.end())
+        {
+            continue;
+        }
+        if (ours < 0)
+        {
+            ours = static_cast<int>(i);
+        }
+        if (std::find(record.begin(), record.end(), romLine) == record.end())
+        {
+            logWriter->log(LogWriter::LogLevel::WARNING, "Coverage of " + name + " in " + path +
+                           " is of a different ROM. Starting over.");
+            continue;
+        }
+        isGood = parseRecord(record, merged);
+    }
+    if (!isGood)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Coverage file " + path + " has a malformed record for " + name);
+        close(lock);
+        return false;
+    }
+
+    std::string temporaryPath = path + ".tmp";
+    std::ofstream outputStream(temporaryPath, std::ofstream::trunc);
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        if (static_cast<int>(i) == ours)
+        {
+            outputStream << formatRecord(merged);
+        }
+        else if (std::find(records[i].begin(), records[i].end(), "SF:" + name) == records[i].end())
+        {
+            for (const std::string& recordLine : records[i])
+            {
+                outputStream << recordLine << '\n';
+            }
+        }
+    }
+    if (ours < 0)
+    {
+        outputStream << formatRecord(merged);
+    }
+    outputStream.close();
+    isGood = outputStream.good() && std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+    if (!isGood)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not write coverage to " + path);
+    }
+    close(lock);
+    if (isGood && !listingPath.empty() && !writeListing(merged, listingPath))
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not write the coverage listing to " + listingPath);
+        isGood = false;
+    }
+    return isGood;
+}
+
+// One line per instruction or data byte: hits (##### for never), address, bytes, data access, mnemonic and,
+// for skips, the runs that went each way
+bool Coverage::
+writeListing(const Record& record, const std::string& path) const
+{
+    std::vector<unsigned short> instructions = getInstructions(record);
+    std::ofstream out(path, std::ofstream::trunc);
+    int linesHit = 0;
+    for (unsigned short address : instructions)
+    {
+        linesHit += record.hits[address] != 0;
+    }
+    out << "; " << name << ": " << linesHit << " of " << instructions.size() << " instructions executed\n";
+    out << ";         hits  address  code  data  instruction\n";
+    unsigned int start = instructions.empty() ? CODE_START : std::min<unsigned int>(CODE_START, instructions.front());
+    unsigned int end = std::max<unsigned int>(CODE_START + static_cast<unsigned int>(rom.size()),
+                                              instructions.empty() ? 0 : instructions.back() + 2u);
+    size_t next = 0;
+    for (unsigned int address = start; address < end;)
+    {
+        bool isInstruction = next < instructions.size() && instructions[next] == address;
+        unsigned int length = isInstruction ? 2 : 1;
+        bool isRead = false;
+        bool isWritten = false;
+        for (unsigned int i = address; i < address + length && i < MEMORY_SIZE; ++i)
+        {
+            isRead = isRead || record.isRead[i];
+            isWritten = isWritten || record.isWritten[i];
+        }
+        std::string data = std::string(isRead ? "R" : "") + (isWritten ? "W" : "");
+        if (isInstruction)
+        {
+            unsigned short opCode = fetch(address);
+            std::string count = record.hits[address] == 0 ? "#####" : std::to_string(record.hits[address]);
+            out << std::setw(14) << count << "  0x" << hex(address, 4) << "   " << hex(opCode, 4) << "  "
+                << std::left << std::setw(4) << data << "  ";
+            if (isSkip(record, address))
+            {
+                out << std::setw(20) << Disassembler::toString(opCode) << "  ; taken in " << record.takenRuns[address]
+                    << " runs, not taken in " << record.notTakenRuns[address];
+            }
+            else
+            {
+                out << Disassembler::toString(opCode);
+            }
+            out << std::right;
+            out << '\n';
+            ++next;
+        }
+        else
+        {
+            out << std::setw(14) << "." << "  0x" << hex(address, 4) << "   " << hex(fetch(address) >> 8, 2) << "    "
+                << std::left << std::setw(4) << data << "  .byte" << std::right << '\n';
+        }
+        address += length;
+    }
+    out.close();
+    return out.good();
+}
+
+std::string Coverage::
+summarize() const
+{
+    Record record = toRecord();
+    std::vector<unsigned short> instructions = getInstructions(record);
+    int executed = 0;
+    int skips = 0;
+    int outcomes = 0;
+    for (unsigned short address : instructions)
+    {
+        executed += record.hits[address] != 0;
+        if (isSkip(record, address))
+        {
+            ++skips;
+            outcomes += (record.takenRuns[address] != 0) + (record.notTakenRuns[address] != 0);
+        }
+    }
+    int bytesRead = 0;
+    int bytesWritten = 0;
+    for (unsigned int address = 0; address < MEMORY_SIZE; ++address)
+    {
+        bytesRead += record.isRead[address];
+        bytesWritten += record.isWritten[address];
+    }
+    return std::to_string(executed) + " of " + std::to_string(instructions.size()) + " instructions executed, " +
+           std::to_string(outcomes) + " of " + std::to_string(skips * 2) + " skip outcomes, " +
+           std::to_string(bytesRead) + " bytes read and " + std::to_string(bytesWritten) + " written as data";
+}
@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Coverage
+ * What a run of a ROM exercised: how often each address was executed, which way every skip instruction
+ * went, and which bytes of memory were read or written as data by DXYN, FX33, FX55 and FX65. Outcomes and
+ * data accesses are flat bitsets over the 4 KB address space, so recording one is a shift and an OR.
+ *
+ * At exit the run is merged into an lcov-like tracefile with one record per ROM: DA lines give hits per
+ * instruction address, BRDA lines the runs in which each skip was taken (branch 0) or not (branch 1), and
+ * RD and WR lines ranges of bytes read and written. Runs of the same ROM add up, so a batch of runs over a
+ * corpus can all name one file. An annotated disassembly of the merged record can be written alongside.
+ */
+
+#ifndef IMIT8_CHIP8_COVERAGE_H
+#define IMIT8_CHIP8_COVERAGE_H
+
+#include <string>
+#include <vector>
+#include "Chip8.h"
+#include "LogWriter.h"
+
+#define COVERAGE_WORDS (MEMORY_SIZE / 64)
+
+class Coverage
+{
+    public:
+        explicit Coverage(LogWriter* logWriter);
+
+        // The ROM being run, as loaded at CODE_START. name identifies its record in the tracefile.
+        void setRom(const std::string& name, const unsigned char* rom, size_t length);
+
+        // Hot path: the instruction at address ran and left the program counter at nextAddress. Skips are
+        // told apart from other instructions by their opCode, and taken from not by how far the program
+        // counter moved.
+        inline void countInstruction(unsigned short address, unsigned short opCode, unsigned short nextAddress)
+        {
+            ++hits[address];
+            unsigned char kind = opCode >> 12;
+            if (kind == 0x3 || kind == 0x4 || kind == 0x5 || kind == 0x9 || kind == 0xE)
+            {
+                if (nextAddress == address + 4)
+                {
+                    mark(taken, address, 1);
+                }
+                else if (nextAddress == address + 2)
+                {
+                    mark(notTaken, address, 1);
+                }
+            }
+        }
+
+        // [address, address + length) was read, or written, as data. The caller has checked it is in memory.
+        inline void countRead(unsigned int address, unsigned int length)
+        {
+            mark(reads, address, length);
+        }
+
+        inline void countWrite(unsigned int address, unsigned int length)
+        {
+            mark(writes, address, length);
+        }
+
+        // Add this run to the tracefile at path, creating it if need be, and write the annotated disassembly
+        // of the merged record to listingPath unless it is empty. Concurrent runs naming the same path take
+        // turns through path.lock.
+        bool write(const std::string& path, const std::string& listingPath);
+
+        // "N of M instructions, ..." for this run alone
+        std::string summarize() const;
+
+    private:
+        // A ROM's record, as merged
+        struct Record
+        {
+            std::vector<unsigned long long> hits;
+            std::vector<unsigned long long> takenRuns;
+            std::vector<unsigned long long> notTakenRuns;
+            std::vector<bool> isRead;
+            std::vector<bool> isWritten;
+        };
+
+        LogWriter* logWriter;
+        std::string name;
+        std::vector<unsigned char> rom;
+        unsigned long long hits[MEMORY_SIZE];
+        unsigned long long taken[COVERAGE_WORDS];
+        unsigned long long notTaken[COVERAGE_WORDS];
+        unsigned long long reads[COVERAGE_WORDS];
+        unsigned long long writes[COVERAGE_WORDS];
+
+        inline static void mark(unsigned long long* bits, unsigned int address, unsigned int length)
+        {
+            for (unsigned int i = address; i < address + length; ++i)
+            {
+                bits[i / 64] |= 1ULL << (i % 64);
+            }
+        }
+
+        inline static bool isMarked(const unsigned long long* bits, unsigned int address)
+        {
+            return (bits[address / 64] >> (address % 64)) & 1;
+        }
+
+        std::string getRomHash() const;
+        Record toRecord() const;
+        static bool parseRecord(const std::vector<std::string>& lines, Record& record);
+        unsigned short fetch(unsigned int address) const;
+        std::vector<unsigned short> getInstructions(const Record& record) const;
+        bool isSkip(const Record& record, unsigned short address) const;
+        std::string formatRecord(const Record& record) const;
+        bool writeListing(const Record& record, const std::string& path) const;
+};
+
+#endif //IMIT8_CHIP8_COVERAGE_H
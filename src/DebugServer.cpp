@@ -0,0 +1,621 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * DebugServer
+ * Remote debugging over a subset of the GDB remote serial protocol, on a localhost TCP port or a Unix
+ * domain socket.
+ */
+
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "DebugServer.h"
+
+// How often the server thread checks whether it should stop
+#define DEBUG_SERVER_POLL_MILLISECONDS 200
+#define DEBUG_SERVER_INTERRUPT "\x03"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static void
+appendHexByte(std::string& text, unsigned char byte)
+{
+    text += HEX_DIGITS[byte >> 4];
+    text += HEX_DIGITS[byte & 0xF];
+}
+
+static int
+hexValue(char digit)
+{
+    if (digit >= '0' && digit <= '9')
+    {
+        return digit - '0';
+    }
+    if (digit >= 'a' && digit <= 'f')
+    {
+        return digit - 'a' + 10;
+    }
+    if (digit >= 'A' && digit <= 'F')
+    {
+        return digit - 'A' + 10;
+    }
+    return -1;
+}
+
+static bool
+parseHexByte(const std::string& text, size_t position, unsigned char& byte)
+{
+    if (position + 2 > text.size())
+    {
+        return false;
+    }
+    int high = hexValue(text[position]);
+    int low = hexValue(text[position + 1]);
+    if (high < 0 || low < 0)
+    {
+        return false;
+    }
+    byte = static_cast<unsigned char>(high << 4 | low);
+    return true;
+}
+
+// One hex number at text, which must fit in an unsigned int rather than be truncated into one. No sign or
+// spaces, which strtoul would take, so "-1" is not read as ULONG_MAX.
+static bool
+parseHexNumber(const char* text, unsigned int& number, char*& end)
+{
+    if (!std::isxdigit(static_cast<unsigned char>(*text)))
+    {
+        return false;
+    }
+    errno = 0;
+    unsigned long value = std::strtoul(text, &end, 16);
+    if (errno == ERANGE || value > UINT_MAX)
+    {
+        return false;
+    }
+    number = static_cast<unsigned int>(value);
+    return true;
+}
+
+// "addr,length" with both in hex; `rest` gets whatever follows (e.g. ":data")
+static bool
+parseAddressLength(const std::string& text, unsigned int& address, unsigned int& length, std::string& rest)
+{
+    char* end = nullptr;
+    if (!parseHexNumber(text.c_str(), address, end) || *end != ',' || !parseHexNumber(end + 1, length, end))
+    {
+        return false;
+    }
+    rest = end;
+    return true;
+}
+
+// Does [address, address + length) lie in memory? Written so that address + length cannot wrap.
+static bool
+isInMemory(unsigned int address, unsigned int length)
+{
+    return address < MEMORY_SIZE && length <= MEMORY_SIZE - address;
+}
+
+DebugServer::
+DebugServer(Chip8* chip8, Debugger* debug, LogWriter* logWrit)
+{
+    cpu = chip8;
+    debugger = debug;
+    logWriter = logWrit;
+    isServing.store(false);
+    serverSocket = -1;
+    clientSocket = -1;
+    hasPackets.store(false);
+    isAwaitingStop = false;
+    isQuitting = false;
+}
+
+DebugServer::
+~DebugServer()
+{
+    stop(0);
+}
+
+bool DebugServer::
+start(const std::string& address)
+{
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        sockaddr_un local;
+        std::memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        std::string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(local.sun_path))
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, "Debug server: bad socket path (" + path + ")");
+            return false;
+        }
+        std::strncpy(local.sun_path, path.c_str(), sizeof(local.sun_path) - 1);
+        serverSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(path.c_str());
+        if (serverSocket < 0 || bind(serverSocket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0)
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, "Debug server (" + address + "): " + std::strerror(errno));
+            closeServerSocket();
+            return false;
+        }
+        serverPath = path;
+    }
+    else
+    {
+        char* end = nullptr;
+        unsigned long port = std::strtoul(address.c_str(), &end, 10);
+        if (address.empty() || *end != '\0' || port == 0 || port > 65535)
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, "Debug server: bad port (" + address + ")");
+            return false;
+        }
+        sockaddr_in local;
+        std::memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = htons(static_cast<unsigned short>(port));
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // never reachable from other machines
+        serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+        int isReusable = 1;
+        if (serverSocket >= 0)
+        {
+            setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &isReusable, sizeof(isReusable));
+        }
+        if (serverSocket < 0 || bind(serverSocket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0)
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, "Debug server (" + address + "): " + std::strerror(errno));
+            closeServerSocket();
+            return false;
+        }
+    }
+
+    if (listen(serverSocket, 1) != 0)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Debug server (" + address + "): " + std::strerror(errno));
+        closeServerSocket();
+        return false;
+    }
+    isServing.store(true);
+    server = std::thread(&DebugServer::serve, this);
+    logWriter->log(LogWriter::LogLevel::INFO, "Debug server listening on " + address);
+    return true;
+}
+
+void DebugServer::
+stop(int exitCode)
+{
+    if (!isServing.exchange(false))
+    {
+        return;
+    }
+    std::string reply = "W";
+    appendHexByte(reply, static_cast<unsigned char>(exitCode));
+    sendPacket(reply);
+    server.join();
+    {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        if (clientSocket >= 0)
+        {
+            close(clientSocket);
+            clientSocket = -1;
+        }
+    }
+    closeServerSocket();
+}
+
+void DebugServer::
+closeServerSocket()
+{
+    if (serverSocket >= 0)
+    {
+        close(serverSocket);
+        serverSocket = -1;
+    }
+    if (!serverPath.empty())
+    {
+        unlink(serverPath.c_str());
+        serverPath.clear();
+    }
+}
+
+void DebugServer::
+service()
+{
+    if (!hasPackets.load(std::memory_order_relaxed) && !isAwaitingStop)
+    {
+        return;
+    }
+
+    std::deque<std::string> received;
+    {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        received.swap(packets);
+        hasPackets.store(false, std::memory_order_relaxed);
+    }
+    for (const std::string& packet : received)
+    {
+        handlePacket(packet);
+    }
+
+    if (isAwaitingStop && debugger->isPaused())
+    {
+        isAwaitingStop = false;
+        sendPacket(stopReply());
+    }
+}
+
+bool DebugServer::
+isQuitRequested() const
+{
+    return isQuitting;
+}
+
+// Server thread: accept one client at a time and queue its packets for the emulation thread
+void DebugServer::
+serve()
+{
+    std::string buffer;
+    while (isServing.load())
+    {
+        int client;
+        {
+            std::lock_guard<std::mutex> lock(clientMutex);
+            client = clientSocket;
+        }
+
+        pollfd waiting = {client >= 0 ? client : serverSocket, POLLIN, 0};
+        if (poll(&waiting, 1, DEBUG_SERVER_POLL_MILLISECONDS) <= 0)
+        {
+            continue;
+        }
+
+        if (client < 0)
+        {
+            int accepted = accept(serverSocket, nullptr, nullptr);
+            if (accepted >= 0)
+            {
+                int isNoDelay = 1;
+                setsockopt(accepted, IPPROTO_TCP, TCP_NODELAY, &isNoDelay, sizeof(isNoDelay)); // fails harmlessly on Unix sockets
+                buffer.clear();
+                std::lock_guard<std::mutex> lock(clientMutex);
+                clientSocket = accepted;
+            }
+            continue;
+        }
+        receive(client, buffer);
+    }
+}
+
+void DebugServer::
+receive(int client, std::string& buffer)
+{
+    char data[1024];
+    ssize_t count = recv(client, data, sizeof(data), 0);
+    if (count <= 0)
+    {
+        // client went away: let the program run on without it
+        {
+            std::lock_guard<std::mutex> lock(clientMutex);
+            close(clientSocket);
+            clientSocket = -1;
+        }
+        queuePacket("D");
+        return;
+    }
+
+    buffer.append(data, static_cast<size_t>(count));
+    while (!buffer.empty())
+    {
+        if (buffer[0] == '\x03')
+        {
+            queuePacket(DEBUG_SERVER_INTERRUPT);
+            buffer.erase(0, 1);
+            continue;
+        }
+        if (buffer[0] != '$')
+        {
+            buffer.erase(0, 1); // acknowledgements and noise
+            continue;
+        }
+        size_t hash = buffer.find('#');
+        if (hash == std::string::npos || hash + 2 >= buffer.size())
+        {
+            return; // wait for the rest of the packet
+        }
+        std::string payload = buffer.substr(1, hash - 1);
+        unsigned char checksum = 0;
+        for (char c : payload)
+        {
+            checksum = static_cast<unsigned char>(checksum + c);
+        }
+        unsigned char expected = 0;
+        bool isValid = parseHexByte(buffer, hash + 1, expected) && expected == checksum;
+        buffer.erase(0, hash + 3);
+        sendRaw(isValid ? "+" : "-");
+        if (isValid)
+        {
+            queuePacket(payload);
+        }
+    }
+}
+
+void DebugServer::
+queuePacket(const std::string& packet)
+{
+    std::lock_guard<std::mutex> lock(clientMutex);
+    packets.push_back(packet);
+    hasPackets.store(true, std::memory_order_relaxed);
+}
+
+void DebugServer::
+handlePacket(const std::string& packet)
+{
+    if (packet.empty())
+    {
+        return;
+    }
+    char command = packet[0];
+    std::string arguments = packet.substr(1);
+    unsigned int address = 0;
+    unsigned int length = 0;
+    std::string rest;
+
+    switch (command)
+    {
+        case '\x03':
+            if (!debugger->isPaused())
+            {
+                debugger->pause();
+            }
+            return;
+        case '?':
+            sendPacket(stopReply());
+            return;
+        case 'g':
+            sendPacket(readRegisters());
+            return;
+        case 'G':
+            sendPacket(writeRegisters(arguments) ? "OK" : "E01");
+            return;
+        case 'm':
+            if (parseAddressLength(arguments, address, length, rest) && isInMemory(address, length))
+            {
+                sendPacket(readMemory(address, length));
+            }
+            else
+            {
+                sendPacket("E01");
+            }
+            return;
+        case 'M':
+            if (parseAddressLength(arguments, address, length, rest) && !rest.empty() && rest[0] == ':' &&
+                writeMemory(address, length, rest.substr(1)))
+            {
+                sendPacket("OK");
+            }
+            else
+            {
+                sendPacket("E01");
+            }
+            return;
+        case 's':
+        case 'c':
+            debugger->resume(command == 's' ? 1 : 0);
+            isAwaitingStop = true;
+            return;
+        case 'Z':
+        case 'z':
+        {
+            // Ztype,addr,kind
+            char type = arguments.empty() ? '?' : arguments[0];
+            bool isSet = command == 'Z';
+            if (arguments.size() < 2 || arguments[1] != ',' ||
+                !parseAddressLength(arguments.substr(2), address, length, rest) || address >= MEMORY_SIZE)
+            {
+                sendPacket("E01");
+                return;
+            }
+            if (type == '0' || type == '1')
+            {
+                debugger->setBreakpoint(static_cast<unsigned short>(address), isSet);
+                sendPacket("OK");
+            }
+            else if (type == '2')
+            {
+                debugger->setWatchpoint(static_cast<unsigned short>(address), static_cast<unsigned short>(length), isSet);
+                sendPacket("OK");
+            }
+            else
+            {
+                sendPacket(""); // read and access watchpoints are not supported
+            }
+            return;
+        }
+        case 'k':
+            isQuitting = true;
+            debugger->resume(0);
+            return;
+        case 'D':
+            debugger->clearAll();
+            if (debugger->isPaused())
+            {
+                debugger->resume(0);
+            }
+            isAwaitingStop = false;
+            sendPacket("OK");
+            return;
+        case 'H':
+            sendPacket("OK"); // there is only one thread
+            return;
+        case 'q':
+            if (arguments.compare(0, 9, "Supported") == 0)
+            {
+                sendPacket("PacketSize=1000");
+            }
+            else if (arguments == "Attached")
+            {
+                sendPacket("1");
+            }
+            else
+            {
+                sendPacket("");
+            }
+            return;
+        default:
+            sendPacket(""); // not supported
+            return;
+    }
+}
+
+void DebugServer::
+sendPacket(const std::string& payload)
+{
+    unsigned char checksum = 0;
+    for (char c : payload)
+    {
+        checksum = static_cast<unsigned char>(checksum + c);
+    }
+    std::string packet = "$" + payload + "#";
+    appendHexByte(packet, checksum);
+    sendRaw(packet);
+}
+
+void DebugServer::
+sendRaw(const std::string& data)
+{
+    std::lock_guard<std::mutex> lock(clientMutex);
+    size_t written = 0;
+    while (clientSocket >= 0 && written < data.size())
+    {
+        ssize_t result = send(clientSocket, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (result <= 0)
+        {
+            break;
+        }
+        written += static_cast<size_t>(result);
+    }
+}
+
+std::string DebugServer::
+stopReply() const
+{
+    switch (debugger->getStopReason())
+    {
+        case Debugger::RUNNING:
+        case Debugger::PAUSED:
+            return "S02";
+        case Debugger::WATCHPOINT:
+        {
+            std::string reply = "T05watch:";
+            appendHexByte(reply, static_cast<unsigned char>(debugger->getLastWrite() >> 8));
+            appendHexByte(reply, static_cast<unsigned char>(debugger->getLastWrite()));
+            return reply + ";";
+        }
+        default:
+            return "S05";
+    }
+}
+
+std::string DebugServer::
+readRegisters() const
+{
+    const Chip8State& state = cpu->getState();
+    std::string reply;
+    for (unsigned char reg : state.registers)
+    {
+        appendHexByte(reply, reg);
+    }
+    appendHexByte(reply, static_cast<unsigned char>(state.index));
+    appendHexByte(reply, static_cast<unsigned char>(state.index >> 8));
+    appendHexByte(reply, static_cast<unsigned char>(state.progCounter));
+    appendHexByte(reply, static_cast<unsigned char>(state.progCounter >> 8));
+    appendHexByte(reply, state.stackPointer);
+    appendHexByte(reply, state.delayInterruptTimer);
+    appendHexByte(reply, state.soundInterruptTimer);
+    return reply;
+}
+
+bool DebugServer::
+writeRegisters(const std::string& hexBytes)
+{
+    unsigned char bytes[DEBUG_SERVER_REGISTER_BYTES];
+    if (hexBytes.size() != 2 * DEBUG_SERVER_REGISTER_BYTES)
+    {
+        return false;
+    }
+    for (int i = 0; i < DEBUG_SERVER_REGISTER_BYTES; ++i)
+    {
+        if (!parseHexByte(hexBytes, 2 * i, bytes[i]))
+        {
+            return false;
+        }
+    }
+    unsigned short index = static_cast<unsigned short>(bytes[16] | bytes[17] << 8);
+    unsigned short progCounter = static_cast<unsigned short>(bytes[18] | bytes[19] << 8);
+    if (index >= MEMORY_SIZE || progCounter >= MEMORY_SIZE || bytes[20] > STACK_DEPTH)
+    {
+        return false;
+    }
+
+    Chip8State& state = cpu->getState();
+    std::memcpy(state.registers, bytes, NUMBER_OF_REGISTERS);
+    state.index = index;
+    state.progCounter = progCounter;
+    state.stackPointer = bytes[20];
+    state.delayInterruptTimer = bytes[21];
+    state.soundInterruptTimer = bytes[22];
+    return true;
+}
+
+std::string DebugServer::
+readMemory(unsigned int address, unsigned int length) const
+{
+    const Chip8State& state = cpu->getState();
+    std::string reply;
+    for (unsigned int i = address; i < address + length; ++i)
+    {
+        appendHexByte(reply, state.memory[i]);
+    }
+    return reply;
+}
+
+bool DebugServer::
+writeMemory(unsigned int address, unsigned int length, const std::string& hexBytes)
+{
+    if (!isInMemory(address, length) || hexBytes.size() != 2 * static_cast<size_t>(length))
+    {
+        return false;
+    }
+    std::string bytes(length, '\0');
+    for (unsigned int i = 0; i < length; ++i)
+    {
+        unsigned char byte = 0;
+        if (!parseHexByte(hexBytes, 2 * i, byte))
+        {
+            return false;
+        }
+        bytes[i] = static_cast<char>(byte);
+    }
+    std::memcpy(cpu->getState().memory + address, bytes.data(), length);
+    return true;
+}
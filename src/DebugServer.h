@@ -0,0 +1,83 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * DebugServer
+ * Remote debugging over a subset of the GDB remote serial protocol, on a localhost TCP port or a Unix
+ * domain socket. A background thread receives packets; the emulation loop answers them between
+ * frames through service(), so the machine is never touched from two threads at once.
+ *
+ * Supported: ? g G m M s c Z0/z0 Z1/z1 (breakpoints) Z2/z2 (write watchpoints) k D, Ctrl-C, qSupported
+ * and qAttached. Register block for g/G, as hex bytes: V0..VF, I (little-endian u16), PC (u16), SP, DT, ST.
+ */
+
+#ifndef IMIT8_CHIP8_DEBUGSERVER_H
+#define IMIT8_CHIP8_DEBUGSERVER_H
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Chip8.h"
+#include "Debugger.h"
+
+#define DEBUG_SERVER_REGISTER_BYTES (NUMBER_OF_REGISTERS + 7)
+
+class DebugServer
+{
+    public:
+        DebugServer(Chip8* cpu, Debugger* debugger, LogWriter* logWriter);
+        ~DebugServer();
+
+        // Listen on 127.0.0.1:port, or on a Unix domain socket when given "unix:PATH"
+        bool start(const std::string& address);
+
+        // Tell an attached client that the program ended, then close everything
+        void stop(int exitCode);
+
+        // Called by the emulation loop between frames: answer queued packets and report stops.
+        // Costs one relaxed atomic load while no client has sent anything.
+        void service();
+
+        // Has the client asked to kill the program?
+        bool isQuitRequested() const;
+
+    private:
+        Chip8* cpu;
+        Debugger* debugger;
+        LogWriter* logWriter;
+
+        std::thread server;
+        std::atomic<bool> isServing;
+        int serverSocket;
+        std::string serverPath;        // set for Unix domain sockets, to unlink on stop
+
+        std::mutex clientMutex;        // guards clientSocket and packets
+        int clientSocket;
+        std::deque<std::string> packets;
+        std::atomic<bool> hasPackets;
+
+        // Emulation thread only
+        bool isAwaitingStop;           // a c or s is running; send a stop reply when the debugger stops
+        bool isQuitting;
+
+        void closeServerSocket();
+        void serve();
+        void receive(int client, std::string& buffer);
+        void queuePacket(const std::string& packet);
+        void handlePacket(const std::string& packet);
+        void sendPacket(const std::string& payload);
+        void sendRaw(const std::string& data);
+        std::string stopReply() const;
+        std::string readRegisters() const;
+        bool writeRegisters(const std::string& hexBytes);
+        std::string readMemory(unsigned int address, unsigned int length) const;
+        bool writeMemory(unsigned int address, unsigned int length, const std::string& hexBytes);
+};
+
+#endif //IMIT8_CHIP8_DEBUGSERVER_H
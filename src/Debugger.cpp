@@ -0,0 +1,425 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Debugger
+ * Breakpoints, memory watchpoints, register conditions and single-stepping for the Chip8 interpreter.
+ */
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include "Debugger.h"
+#include "Disassembler.h"
+
+static std::string
+hex(unsigned int number, int width)
+{
+    std::stringstream sstream;
+    sstream << "0x" << std::uppercase << std::setfill('0') << std::setw(width) << std::hex << number;
+    return sstream.str();
+}
+
+// Numbers are typed in hex, with or without 0x
+static bool
+parseNumber(const std::string& text, unsigned int& number)
+{
+    if (text.empty())
+    {
+        return false;
+    }
+    char* end = nullptr;
+    unsigned long value = std::strtoul(text.c_str(), &end, 16);
+    if (*end != '\0')
+    {
+        return false;
+    }
+    number = static_cast<unsigned int>(value);
+    return true;
+}
+
+static void
+printHelp(std::ostream& out)
+{
+    out << "  s [N]             step N instructions (default 1)\n"
+           "  c                 continue\n"
+           "  b ADDR            set a breakpoint\n"
+           "  d ADDR            delete a breakpoint\n"
+           "  w ADDR [LEN]      stop after a store writes [ADDR, ADDR + LEN)\n"
+           "  uw ADDR [LEN]     remove a watchpoint\n"
+           "  v X OP VALUE      stop when VX OP VALUE becomes true (OP is == != < >)\n"
+           "  vc                clear register conditions\n"
+           "  r                 show registers\n"
+           "  m ADDR [LEN]      show memory\n"
+           "  l [N]             disassemble N instructions from PC\n"
+           "  q                 quit\n"
+           "Numbers are hex. An empty line repeats the last command." << std::endl;
+}
+
+Debugger::
+Debugger(Chip8* chip8, LogWriter* logWrit)
+{
+    cpu = chip8;
+    logWriter = logWrit;
+    std::memset(breakpoints, 0, sizeof(breakpoints));
+    std::memset(watchpoints, 0, sizeof(watchpoints));
+    breakpointCount = 0;
+    watchpointCount = 0;
+    stopReason = RUNNING;
+    pendingStop = RUNNING;
+    isStepping = false;
+    stepsLeft = 0;
+    isResuming = false;
+    lastWrite = 0;
+}
+
+Debugger::
+~Debugger()
+{
+    cpu->setDebugHook(nullptr);
+}
+
+bool Debugger::
+beforeInstruction(const Chip8State& state)
+{
+    StopReason reason = pendingStop;
+    pendingStop = RUNNING;
+    bool isFirst = isResuming;
+    isResuming = false;
+
+    for (Condition& condition : conditions)
+    {
+        bool isTrue = evaluate(condition, state);
+        if (isTrue && !condition.wasTrue && reason == RUNNING)
+        {
+            reason = CONDITION;
+        }
+        condition.wasTrue = isTrue;
+    }
+    if (reason == RUNNING && !isFirst && isBitSet(breakpoints, state.progCounter))
+    {
+        reason = BREAKPOINT;
+    }
+    if (reason == RUNNING && isStepping)
+    {
+        if (stepsLeft == 0)
+        {
+            reason = STEPPED;
+        }
+        else
+        {
+            --stepsLeft;
+        }
+    }
+
+    if (reason == RUNNING)
+    {
+        return false;
+    }
+    stop(reason);
+    return true;
+}
+
+void Debugger::
+afterStore(unsigned int address, unsigned int length)
+{
+    for (unsigned int i = address; i < address + length && i < MEMORY_SIZE; ++i)
+    {
+        if (isBitSet(watchpoints, i))
+        {
+            pendingStop = WATCHPOINT;
+            lastWrite = static_cast<unsigned short>(i);
+            return;
+        }
+    }
+}
+
+void Debugger::
+setBreakpoint(unsigned short address, bool isSet)
+{
+    if (address >= MEMORY_SIZE || isBitSet(breakpoints, address) == isSet)
+    {
+        return;
+    }
+    setBit(breakpoints, address, isSet);
+    breakpointCount += isSet ? 1 : -1;
+    rearm();
+}
+
+void Debugger::
+setWatchpoint(unsigned short address, unsigned short length, bool isSet)
+{
+    for (unsigned int i = address; i < static_cast<unsigned int>(address) + length && i < MEMORY_SIZE; ++i)
+    {
+        if (isBitSet(watchpoints, i) != isSet)
+        {
+            setBit(watchpoints, i, isSet);
+            watchpointCount += isSet ? 1 : -1;
+        }
+    }
+    rearm();
+}
+
+void Debugger::
+addCondition(unsigned char reg, Comparison comparison, unsigned char value)
+{
+    Condition condition = {static_cast<unsigned char>(reg & 0xF), comparison, value, false};
+    condition.wasTrue = evaluate(condition, cpu->getState());
+    conditions.push_back(condition);
+    rearm();
+}
+
+void Debugger::
+clearConditions()
+{
+    conditions.clear();
+    rearm();
+}
+
+void Debugger::
+clearAll()
+{
+    std::memset(breakpoints, 0, sizeof(breakpoints));
+    std::memset(watchpoints, 0, sizeof(watchpoints));
+    breakpointCount = 0;
+    watchpointCount = 0;
+    conditions.clear();
+    rearm();
+}
+
+void Debugger::
+pause()
+{
+    pendingStop = PAUSED;
+    rearm();
+}
+
+void Debugger::
+resume(unsigned long long steps)
+{
+    stopReason = RUNNING;
+    isResuming = true;
+    isStepping = steps != 0;
+    stepsLeft = steps;
+    rearm();
+}
+
+bool Debugger::
+isPaused() const
+{
+    return stopReason != RUNNING;
+}
+
+Debugger::StopReason Debugger::
+getStopReason() const
+{
+    return stopReason;
+}
+
+unsigned short Debugger::
+getLastWrite() const
+{
+    return lastWrite;
+}
+
+bool Debugger::
+interact(std::istream& in, std::ostream& out)
+{
+    out << describeStop() << "\n" << dumpRegisters() << std::flush;
+    std::string lastLine;
+
+    while (isPaused())
+    {
+        out << "(imit8) " << std::flush;
+        std::string line;
+        if (!std::getline(in, line))
+        {
+            return false;
+        }
+        if (line.empty())
+        {
+            line = lastLine;
+        }
+        lastLine = line;
+
+        std::istringstream words(line);
+        std::string command, first, second, third;
+        words >> command >> first >> second >> third;
+        unsigned int number = 0;
+        unsigned int length = 0;
+        bool hasNumber = parseNumber(first, number);
+        bool hasLength = parseNumber(second, length);
+
+        if (command == "s")
+        {
+            resume(hasNumber ? number : 1);
+        }
+        else if (command == "c")
+        {
+            resume(0);
+        }
+        else if ((command == "b" || command == "d") && hasNumber && number < MEMORY_SIZE)
+        {
+            setBreakpoint(static_cast<unsigned short>(number), command == "b");
+        }
+        else if ((command == "w" || command == "uw") && hasNumber && number < MEMORY_SIZE)
+        {
+            setWatchpoint(static_cast<unsigned short>(number), static_cast<unsigned short>(hasLength ? length : 1),
+                          command == "w");
+        }
+        else if (command == "v" && hasNumber && number < NUMBER_OF_REGISTERS && parseNumber(third, length) &&
+                 (second == "==" || second == "!=" || second == "<" || second == ">"))
+        {
+            Comparison comparison = second == "==" ? EQUAL : second == "!=" ? NOT_EQUAL : second == "<" ? LESS : GREATER;
+            addCondition(static_cast<unsigned char>(number), comparison, static_cast<unsigned char>(length));
+        }
+        else if (command == "vc")
+        {
+            clearConditions();
+        }
+        else if (command == "r")
+        {
+            out << dumpRegisters();
+        }
+        else if (command == "m" && hasNumber && number < MEMORY_SIZE)
+        {
+            out << dumpMemory(static_cast<unsigned short>(number), static_cast<unsigned short>(hasLength ? length : 0x40));
+        }
+        else if (command == "l")
+        {
+            const Chip8State& state = cpu->getState();
+            unsigned int count = hasNumber ? number : 8;
+            for (unsigned int address = state.progCounter; address + 1 < MEMORY_SIZE && count > 0; address += 2, --count)
+            {
+                unsigned short opCode = state.memory[address] << 8 | state.memory[address + 1];
+                out << (isBitSet(breakpoints, address) ? "* " : "  ") << hex(address, 3) << "  "
+                    << hex(opCode, 4).substr(2) << "  " << Disassembler::toString(opCode) << "\n";
+            }
+        }
+        else if (command == "q")
+        {
+            return false;
+        }
+        else
+        {
+            printHelp(out);
+        }
+    }
+    return true;
+}
+
+std::string Debugger::
+dumpRegisters() const
+{
+    const Chip8State& state = cpu->getState();
+    std::stringstream out;
+    out << "PC " << hex(state.progCounter, 3) << "  I " << hex(state.index, 3)
+        << "  SP " << static_cast<int>(state.stackPointer)
+        << "  DT " << hex(state.delayInterruptTimer, 2) << "  ST " << hex(state.soundInterruptTimer, 2) << "\n";
+    for (int i = 0; i < NUMBER_OF_REGISTERS; ++i)
+    {
+        out << "V" << std::uppercase << std::hex << i << std::dec << " " << hex(state.registers[i], 2)
+            << (i % 8 == 7 ? "\n" : "  ");
+    }
+    if (state.progCounter + 1 < MEMORY_SIZE)
+    {
+        unsigned short opCode = state.memory[state.progCounter] << 8 | state.memory[state.progCounter + 1];
+        out << hex(state.progCounter, 3) << "  " << Disassembler::toString(opCode) << "\n";
+    }
+    return out.str();
+}
+
+std::string Debugger::
+dumpMemory(unsigned short address, unsigned short length) const
+{
+    const Chip8State& state = cpu->getState();
+    std::stringstream out;
+    unsigned int end = std::min<unsigned int>(static_cast<unsigned int>(address) + length, MEMORY_SIZE);
+    for (unsigned int line = address; line < end; line += 16)
+    {
+        out << hex(line, 3) << " ";
+        for (unsigned int i = line; i < line + 16 && i < end; ++i)
+        {
+            out << " " << hex(state.memory[i], 2).substr(2);
+        }
+        out << "\n";
+    }
+    return out.str();
+}
+
+bool Debugger::
+isBitSet(const unsigned long long* bitmap, unsigned int address)
+{
+    return (bitmap[address / 64] >> (address % 64)) & 1;
+}
+
+void Debugger::
+setBit(unsigned long long* bitmap, unsigned int address, bool isSet)
+{
+    if (isSet)
+    {
+        bitmap[address / 64] |= 1ULL << (address % 64);
+    }
+    else
+    {
+        bitmap[address / 64] &= ~(1ULL << (address % 64));
+    }
+}
+
+bool Debugger::
+evaluate(const Condition& condition, const Chip8State& state)
+{
+    unsigned char value = state.registers[condition.reg];
+    switch (condition.comparison)
+    {
+        case EQUAL:
+            return value == condition.value;
+        case NOT_EQUAL:
+            return value != condition.value;
+        case LESS:
+            return value < condition.value;
+        default:
+            return value > condition.value;
+    }
+}
+
+void Debugger::
+rearm()
+{
+    bool isArmed = breakpointCount != 0 || watchpointCount != 0 || !conditions.empty() || isStepping ||
+                   pendingStop != RUNNING;
+    cpu->setDebugHook(isArmed ? this : nullptr);
+}
+
+void Debugger::
+stop(StopReason reason)
+{
+    stopReason = reason;
+    isStepping = false;
+    stepsLeft = 0;
+    rearm();
+    logWriter->log(LogWriter::LogLevel::INFO, "Debugger: " + describeStop());
+}
+
+std::string Debugger::
+describeStop() const
+{
+    unsigned short pc = cpu->getState().progCounter;
+    switch (stopReason)
+    {
+        case STEPPED:
+            return "Stepped to " + hex(pc, 3);
+        case BREAKPOINT:
+            return "Breakpoint at " + hex(pc, 3);
+        case WATCHPOINT:
+            return "Watchpoint: memory " + hex(lastWrite, 3) + " written, stopped at " + hex(pc, 3);
+        case CONDITION:
+            return "Register condition met at " + hex(pc, 3);
+        default:
+            return "Paused at " + hex(pc, 3);
+    }
+}
@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Debugger
+ * Breakpoints, memory watchpoints, register conditions and single-stepping for the Chip8 interpreter.
+ * The debugger only hooks itself into the CPU while something is armed, so an idle debugger costs
+ * runCycle() one null-pointer test.
+ */
+
+#ifndef IMIT8_CHIP8_DEBUGGER_H
+#define IMIT8_CHIP8_DEBUGGER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+
+#define DEBUGGER_BITMAP_WORDS (MEMORY_SIZE / 64)
+
+class Debugger : public DebugHook
+{
+    public:
+        enum StopReason
+        {
+            RUNNING,
+            PAUSED,      // asked to stop, e.g. at startup
+            STEPPED,
+            BREAKPOINT,
+            WATCHPOINT,
+            CONDITION,
+        };
+
+        // How a register condition compares
+        enum Comparison
+        {
+            EQUAL,
+            NOT_EQUAL,
+            LESS,
+            GREATER,
+        };
+
+        Debugger(Chip8* cpu, LogWriter* logWriter);
+        ~Debugger();
+
+        // DebugHook
+        bool beforeInstruction(const Chip8State& state) override;
+        void afterStore(unsigned int address, unsigned int length) override;
+
+        void setBreakpoint(unsigned short address, bool isSet);
+        void setWatchpoint(unsigned short address, unsigned short length, bool isSet);
+
+        // Stop when the comparison between register and value becomes true
+        void addCondition(unsigned char reg, Comparison comparison, unsigned char value);
+        void clearConditions();
+
+        // Remove every breakpoint, watchpoint and condition
+        void clearAll();
+
+        // Stop before the next instruction
+        void pause();
+
+        // Run on; stop again after `steps` instructions (0 = only at a breakpoint)
+        void resume(unsigned long long steps);
+
+        bool isPaused() const;
+        StopReason getStopReason() const;
+
+        // Address whose write raised the last WATCHPOINT stop
+        unsigned short getLastWrite() const;
+
+        // Read commands from in until one resumes the machine. Returns false if the user quits.
+        bool interact(std::istream& in, std::ostream& out);
+
+        std::string dumpRegisters() const;
+        std::string dumpMemory(unsigned short address, unsigned short length) const;
+
+    private:
+        struct Condition
+        {
+            unsigned char reg;
+            Comparison comparison;
+            unsigned char value;
+            bool wasTrue; // conditions stop on becoming true, not on every instruction while true
+        };
+
+        Chip8* cpu;
+        LogWriter* logWriter;
+
+        unsigned long long breakpoints[DEBUGGER_BITMAP_WORDS];
+        unsigned long long watchpoints[DEBUGGER_BITMAP_WORDS];
+        unsigned int breakpointCount;
+        unsigned int watchpointCount;
+        std::vector<Condition> conditions;
+
+        StopReason stopReason;
+        StopReason pendingStop;       // raised after an instruction, reported before the next one
+        bool isStepping;
+        unsigned long long stepsLeft; // instructions to run before stopping, while stepping
+        bool isResuming;              // don't stop again at the instruction we stopped before
+        unsigned short lastWrite;
+
+        static bool isBitSet(const unsigned long long* bitmap, unsigned int address);
+        static void setBit(unsigned long long* bitmap, unsigned int address, bool isSet);
+        static bool evaluate(const Condition& condition, const Chip8State& state);
+
+        // Hook into the CPU only while something can stop it
+        void rearm();
+        void stop(StopReason reason);
+        std::string describeStop() const;
+};
+
+#endif //IMIT8_CHIP8_DEBUGGER_H
@@ -0,0 +1,232 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Disassembler
+ * Turns Chip-8 opCodes into readable mnemonics and classifies their control flow.
+ */
+
+#include <iomanip>
+#include <sstream>
+#include "Disassembler.h"
+
+static std::string
+hex(unsigned short number, int width)
+{
+    std::stringstream sstream;
+    sstream << "0x" << std::uppercase << std::setfill('0') << std::setw(width) << std::hex << number;
+    return sstream.str();
+}
+
+static std::string
+reg(unsigned short number)
+{
+    std::stringstream sstream;
+    sstream << "V" << std::uppercase << std::hex << (number & 0xF);
+    return sstream.str();
+}
+
+std::string Disassembler::
+toString(unsigned short opCode)
+{
+    unsigned short x = (opCode >> 8) & 0xF;
+    unsigned short y = (opCode >> 4) & 0xF;
+    unsigned short n = opCode & 0xF;
+    unsigned short nn = opCode & 0xFF;
+    unsigned short nnn = opCode & 0xFFF;
+
+    switch (opCode >> 12)
+    {
+        case 0x0:
+            if (opCode == 0x00E0)
+            {
+                return "CLS";
+            }
+            if (opCode == 0x00EE)
+            {
+                return "RET";
+            }
+            break;
+        case 0x1:
+            return "JP " + hex(nnn, 3);
+        case 0x2:
+            return "CALL " + hex(nnn, 3);
+        case 0x3:
+            return "SE " + reg(x) + ", " + hex(nn, 2);
+        case 0x4:
+            return "SNE " + reg(x) + ", " + hex(nn, 2);
+        case 0x5:
+            if (n == 0)
+            {
+                return "SE " + reg(x) + ", " + reg(y);
+            }
+            break;
+        case 0x6:
+            return "LD " + reg(x) + ", " + hex(nn, 2);
+        case 0x7:
+            return "ADD " + reg(x) + ", " + hex(nn, 2);
+        case 0x8:
+            switch (n)
+            {
+                case 0x0:
+                    return "LD " + reg(x) + ", " + reg(y);
+                case 0x1:
+                    return "OR " + reg(x) + ", " + reg(y);
+                case 0x2:
+                    return "AND " + reg(x) + ", " + reg(y);
+                case 0x3:
+                    return "XOR " + reg(x) + ", " + reg(y);
+                case 0x4:
+                    return "ADD " + reg(x) + ", " + reg(y);
+                case 0x5:
+                    return "SUB " + reg(x) + ", " + reg(y);
+                case 0x6:
+                    return "SHR " + reg(x);
+                case 0x7:
+                    return "SUBN " + reg(x) + ", " + reg(y);
+                case 0xE:
+                    return "SHL " + reg(x);
+                default:
+                    break;
+            }
+            break;
+        case 0x9:
+            if (n == 0)
+            {
+                return "SNE " + reg(x) + ", " + reg(y);
+            }
+            break;
+        case 0xA:
+            return "LD I, " + hex(nnn, 3);
+        case 0xB:
+            return "JP V0, " + hex(nnn, 3);
+        case 0xC:
+            return "RND " + reg(x) + ", " + hex(nn, 2);
+        case 0xD:
+            return "DRW " + reg(x) + ", " + reg(y) + ", " + std::to_string(n);
+        case 0xE:
+            if (nn == 0x9E)
+            {
+                return "SKP " + reg(x);
+            }
+            if (nn == 0xA1)
+            {
+                return "SKNP " + reg(x);
+            }
+            break;
+        case 0xF:
+            switch (nn)
+            {
+                case 0x07:
+                    return "LD " + reg(x) + ", DT";
+                case 0x0A:
+                    return "LD " + reg(x) + ", K";
+                case 0x15:
+                    return "LD DT, " + reg(x);
+                case 0x18:
+                    return "LD ST, " + reg(x);
+                case 0x1E:
+                    return "ADD I, " + reg(x);
+                case 0x29:
+                    return "LD F, " + reg(x);
+                case 0x33:
+                    return "LD B, " + reg(x);
+                case 0x55:
+                    return "LD [I], " + reg(x);
+                case 0x65:
+                    return "LD " + reg(x) + ", [I]";
+                default:
+                    break;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return "DW " + hex(opCode, 4);
+}
+
+Disassembler::FlowType Disassembler::
+getFlowType(unsigned short opCode)
+{
+    unsigned short n = opCode & 0xF;
+    unsigned short nn = opCode & 0xFF;
+
+    switch (opCode >> 12)
+    {
+        case 0x0:
+            if (opCode == 0x00E0)
+            {
+                return NEXT;
+            }
+            return opCode == 0x00EE ? RETURN : INVALID;
+        case 0x1:
+            return JUMP;
+        case 0x2:
+            return CALL;
+        case 0x3:
+        case 0x4:
+            return SKIP;
+        case 0x5:
+        case 0x9:
+            return n == 0 ? SKIP : INVALID;
+        case 0x8:
+            return (n <= 0x7 || n == 0xE) ? NEXT : INVALID;
+        case 0xB:
+            return COMPUTED;
+        case 0xE:
+            return (nn == 0x9E || nn == 0xA1) ? SKIP : INVALID;
+        case 0xF:
+            switch (nn)
+            {
+                case 0x07:
+                case 0x0A:
+                case 0x15:
+                case 0x18:
+                case 0x1E:
+                case 0x29:
+                case 0x33:
+                case 0x55:
+                case 0x65:
+                    return NEXT;
+                default:
+                    return INVALID;
+            }
+        default:
+            return NEXT;
+    }
+}
+
+bool Disassembler::
+isStore(unsigned short opCode)
+{
+    return (opCode & 0xF0FF) == 0xF033 || (opCode & 0xF0FF) == 0xF055;
+}
+
+bool Disassembler::
+needsInterpreter(unsigned short address, unsigned short opCode)
+{
+    switch (getFlowType(opCode))
+    {
+        case NEXT:
+            return (opCode & 0xF0FF) == 0xF00A || isStore(opCode);
+        case JUMP:
+            return getTarget(opCode) == address;
+        case CALL:
+        case RETURN:
+        case SKIP:
+            return false;
+        default:
+            return true;
+    }
+}
+
+unsigned short Disassembler::
+getTarget(unsigned short opCode)
+{
+    return opCode & 0x0FFF;
+}
@@ -0,0 +1,50 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Disassembler
+ * Turns Chip-8 opCodes into readable mnemonics and classifies their control flow.
+ */
+
+#ifndef IMIT8_CHIP8_DISASSEMBLER_H
+#define IMIT8_CHIP8_DISASSEMBLER_H
+
+#include <string>
+
+class Disassembler
+{
+    public:
+        // How an instruction affects the flow of control
+        enum FlowType
+        {
+            NEXT,       // continues with the next instruction
+            JUMP,       // 0x1NNN
+            CALL,       // 0x2NNN
+            RETURN,     // 0x00EE
+            SKIP,       // 0x3XNN, 0x4XNN, 0x5XY0, 0x9XY0, 0xEX9E, 0xEXA1
+            COMPUTED,   // 0xBNNN, target only known at run time
+            INVALID,    // not an implemented opCode
+        };
+
+        // Mnemonic for the opCode, e.g. "LD V3, 0x2A"
+        static std::string toString(unsigned short opCode);
+
+        static FlowType getFlowType(unsigned short opCode);
+
+        // Does the opCode write to memory? (0xFX33, 0xFX55)
+        static bool isStore(unsigned short opCode);
+
+        // Must this instruction always go through the interpreter, even when surrounding code is recompiled?
+        // True for key waits, stores (they may modify code), jumps to themselves (they halt), computed
+        // jumps and invalid opCodes.
+        static bool needsInterpreter(unsigned short address, unsigned short opCode);
+
+        // Target address of a JUMP or CALL
+        static unsigned short getTarget(unsigned short opCode);
+};
+
+#endif //IMIT8_CHIP8_DISASSEMBLER_H
@@ -14,7 +14,7 @@
 #include "LogWriter.h"
 
 Display::
-Display(unsigned char * scrn, LogWriter * logWrit, unsigned short height, unsigned short width)
+Display(const unsigned char * scrn, LogWriter * logWrit, unsigned short height, unsigned short width)
 {
     setHeight(height);
     setWidth(width);
@@ -49,6 +49,37 @@ drawDisplay()
     clearFrame();
 }
 
+// Each run of dirty bytes is one cursor move (ANSI CUP) and its pixels; the cursor ends up below the screen,
+// where drawDisplay leaves it
+void Display::
+drawRows(const DirtyRegion& dirty)
+{
+    for(int row = 0; row < getHeight(); ++row)
+    {
+        if(!(dirty.rows & (1u << row)))
+        {
+            continue;
+        }
+        for(int columnOf8 = 0; columnOf8 < getWidth() / 8; ++columnOf8)
+        {
+            if(!(dirty.columns[row] & (1u << columnOf8)))
+            {
+                continue;
+            }
+            if(columnOf8 == 0 || !(dirty.columns[row] & (1u << (columnOf8 - 1))))
+            {
+                frame += "\x1b[" + std::to_string(row + 1) + ";" + std::to_string(columnOf8 * 8 + 1) + "H";
+            }
+            printChar(screen[row * 8 + columnOf8]);
+        }
+    }
+    frame += "\x1b[" + std::to_string(getHeight() + 2) + ";1H";
+
+    std::cout << frame;
+    std::flush(std::cout);
+    clearFrame();
+}
+
 void Display::
 clearScreen()
 {
@@ -61,6 +92,12 @@ clearScreen()
     #endif
 }
 
+void Display::
+homeCursor()
+{
+    std::cout << "\x1b[H";
+}
+
 void Display::
 printChar(unsigned char toPrint)
 {
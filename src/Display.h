@@ -14,19 +14,27 @@
 #define IMIT8_CHIP8_DISPLAY_H
 
 #include <iostream>
+#include "Core.h"
 #include "LogWriter.h"
 
 class Display
 {
     public:
-        Display(unsigned char * screen, LogWriter * logWriter, unsigned short height = 32, unsigned short width = 64);
+        Display(const unsigned char * screen, LogWriter * logWriter, unsigned short height = 32, unsigned short width = 64);
         void drawDisplay();
+
+        // Redraw only the dirty bytes in place over a screen drawDisplay put at the top of the terminal
+        void drawRows(const DirtyRegion& dirty);
+
         static void clearScreen();
 
+        // Move the cursor to the top left corner, where drawDisplay then draws over the last screen
+        static void homeCursor();
+
     private:
         int height;
         int width;
-        unsigned char* screen;
+        const unsigned char* screen;
         std::string frame;
         LogWriter* logWriter;
 
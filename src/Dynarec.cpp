@@ -0,0 +1,838 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Dynarec
+ * Dynamic recompiler that translates Chip-8 basic blocks to x86-64 machine code at run time,
+ * falling back to the Chip8 interpreter for anything it does not translate.
+ *
+ * Translated code runs with rdi = Chip8State*, esi = cycles left, and keeps the V registers a block
+ * uses in host registers from its entry until it exits. rax, rcx and rdx are scratch.
+ */
+
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <sys/mman.h>
+#include "Disassembler.h"
+#include "Dynarec.h"
+
+using namespace std::chrono;
+
+// x86-64 register numbers
+#define RAX 0
+#define RDX 2
+#define RBX 3
+#define RBP 5
+#define RSI 6
+#define RDI 7
+
+// progCounter already holds the exit address (0x00EE)
+#define DYNAMIC_TARGET 0xFFFF
+
+// Host registers available for caching V registers; all but rbx and rbp are callee-saved by the trampoline.
+static const int REGISTER_POOL[] = {RBX, RBP, 8, 9, 10, 11, 12, 13, 14, 15};
+static const int REGISTER_POOL_SIZE = sizeof(REGISTER_POOL) / sizeof(REGISTER_POOL[0]);
+
+// Condition codes for 0x0F 0x8? (jcc rel32)
+#define JE 0x84
+#define JNE 0x85
+#define JAE 0x83
+
+#define OFFSET(field) static_cast<unsigned int>(offsetof(Chip8State, field))
+
+// Helpers called from translated code for instructions that are not worth open-coding. A non-zero
+// return means "do not run this one here": nothing has been changed and the interpreter takes over.
+static int
+helperClearScreen(Chip8State* state, unsigned int)
+{
+    Chip8::clearScreen(*state);
+    return 0;
+}
+
+static int
+helperDraw(Chip8State* state, unsigned int argument)
+{
+    unsigned char h = static_cast<unsigned char>(argument >> 8);
+    if (state->index + h > MEMORY_SIZE)
+    {
+        return 1;
+    }
+    Chip8::drawSprite(*state, argument & 0xF, (argument >> 4) & 0xF, h);
+    state->isDirty = true;
+    return 0;
+}
+
+static int
+helperRandom(Chip8State* state, unsigned int argument)
+{
+    state->registers[argument & 0xF] = Chip8::nextRandom(*state) & (argument >> 8);
+    return 0;
+}
+
+static int
+helperLoadRegisters(Chip8State* state, unsigned int count)
+{
+    if (state->index + count > MEMORY_SIZE)
+    {
+        return 1;
+    }
+    std::memcpy(state->registers, state->memory + state->index, count);
+    return 0;
+}
+
+// V registers an instruction reads or writes (and so wants in host registers)
+static unsigned short
+registersUsed(unsigned short opCode)
+{
+    unsigned short x = 1 << ((opCode >> 8) & 0xF);
+    unsigned short y = 1 << ((opCode >> 4) & 0xF);
+    switch (opCode >> 12)
+    {
+        case 0x3:
+        case 0x4:
+        case 0x6:
+        case 0x7:
+        case 0xE:
+            return x;
+        case 0x5:
+        case 0x9:
+            return x | y;
+        case 0x8:
+            return x | y | ((opCode & 0xF) >= 0x4 ? 1 << 0xF : 0);
+        case 0xF:
+            return (opCode & 0xFF) == 0x65 ? 0 : x;
+        default:
+            return 0;
+    }
+}
+
+static int
+countBits(unsigned short bits)
+{
+    int count = 0;
+    for (; bits != 0; bits &= bits - 1)
+    {
+        ++count;
+    }
+    return count;
+}
+
+Dynarec::
+Dynarec(Chip8* chip8, LogWriter* logWrit)
+{
+    cpu = chip8;
+    logWriter = logWrit;
+    std::memset(&statistics, 0, sizeof(statistics));
+    isDirty = false;
+    compiling = nullptr;
+    cachedRegisters = 0;
+    std::fill_n(blockAt, MEMORY_SIZE, nullptr);
+
+    void* buffer = mmap(nullptr, DYNAREC_CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    codeBuffer = buffer == MAP_FAILED ? nullptr : static_cast<unsigned char*>(buffer);
+    if (codeBuffer == nullptr)
+    {
+        logWriter->log(LogWriter::LogLevel::WARNING, "Dynarec: no executable memory, interpreting everything.");
+        return;
+    }
+    code = codeBuffer;
+    emitTrampoline();
+}
+
+Dynarec::
+~Dynarec()
+{
+    for (Block* block : blocks)
+    {
+        delete block;
+    }
+    if (codeBuffer != nullptr)
+    {
+        munmap(codeBuffer, DYNAREC_CODE_BUFFER_SIZE);
+    }
+}
+
+bool Dynarec::
+isAvailable() const
+{
+    return codeBuffer != nullptr;
+}
+
+bool Dynarec::
+runCycles(int cycles)
+{
+    steady_clock::time_point runStart = steady_clock::now();
+    unsigned long long compileBefore = statistics.compileNanoseconds;
+    Chip8State& state = cpu->getState();
+    isDirty = false;
+    bool isRunning = true;
+
+    while (cycles > 0)
+    {
+        unsigned short pc = state.progCounter;
+        if (codeBuffer != nullptr && pc < MEMORY_SIZE - 1)
+        {
+            Block* block = blockAt[pc];
+            if (block == nullptr)
+            {
+                block = compileBlock(pc);
+            }
+            if (block != nullptr)
+            {
+                state.isDirty = false;
+                int left = enter(&state, cycles, block->entry);
+                isDirty |= state.isDirty;
+                statistics.compiledInstructions += cycles - left;
+                bool hasRun = left != cycles;
+                cycles = left;
+                if (hasRun)
+                {
+                    continue;
+                }
+            }
+        }
+
+        // not translatable, or the block handed this instruction back
+        unsigned short opCode = pc < MEMORY_SIZE - 1 ? (state.memory[pc] << 8 | state.memory[pc + 1]) : 0;
+        isRunning = cpu->runCycle();
+        isDirty |= cpu->isDirtyScreen();
+        ++statistics.interpretedInstructions;
+        --cycles;
+        if (!isRunning)
+        {
+            break;
+        }
+        if (Disassembler::isStore(opCode))
+        {
+            unsigned int length = (opCode & 0xFF) == 0x33 ? 3 : ((opCode >> 8) & 0xF) + 1u;
+            invalidate(state.index, std::min<unsigned int>(state.index + length, MEMORY_SIZE));
+        }
+    }
+
+    unsigned long long elapsed = duration_cast<nanoseconds>(steady_clock::now() - runStart).count();
+    statistics.runNanoseconds += elapsed - (statistics.compileNanoseconds - compileBefore);
+    return isRunning;
+}
+
+bool Dynarec::
+isDirtyScreen()
+{
+    return isDirty;
+}
+
+void Dynarec::
+flush()
+{
+    for (Block* block : blocks)
+    {
+        delete block;
+    }
+    blocks.clear();
+    std::fill_n(blockAt, MEMORY_SIZE, nullptr);
+    for (std::vector<Block*>& page : blocksOnPage)
+    {
+        page.clear();
+    }
+    for (std::vector<unsigned char*>& exits : exitsTo)
+    {
+        exits.clear();
+    }
+    if (codeBuffer != nullptr)
+    {
+        code = codeBuffer;
+        emitTrampoline();
+    }
+    ++statistics.cacheFlushes;
+}
+
+const Dynarec::Statistics& Dynarec::
+getStatistics() const
+{
+    return statistics;
+}
+
+// int enter(Chip8State* state, int budget, const unsigned char* block)
+void Dynarec::
+emitTrampoline()
+{
+    enter = reinterpret_cast<EntryFunction>(code);
+    emit8(0x53);                                  // push rbx
+    emit8(0x55);                                  // push rbp
+    emit8(0x41); emit8(0x54);                     // push r12
+    emit8(0x41); emit8(0x55);                     // push r13
+    emit8(0x41); emit8(0x56);                     // push r14
+    emit8(0x41); emit8(0x57);                     // push r15
+    emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08); // sub rsp, 8 (keep the stack 16-byte aligned)
+    emit8(0xFF); emit8(0xD2);                     // call rdx
+    emit8(0x89); emit8(0xF0);                     // mov eax, esi
+    emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08); // add rsp, 8
+    emit8(0x41); emit8(0x5F);                     // pop r15
+    emit8(0x41); emit8(0x5E);                     // pop r14
+    emit8(0x41); emit8(0x5D);                     // pop r13
+    emit8(0x41); emit8(0x5C);                     // pop r12
+    emit8(0x5D);                                  // pop rbp
+    emit8(0x5B);                                  // pop rbx
+    emit8(0xC3);                                  // ret
+
+    returnStub = code;
+    emit8(0xC3);                                  // ret
+}
+
+Dynarec::Block* Dynarec::
+compileBlock(unsigned short start)
+{
+    const Chip8State& state = cpu->getState();
+
+    // decide how far the block goes and which V registers it keeps in host registers
+    unsigned short end = start;
+    unsigned short used = 0;
+    int length = 0;
+    bool isTerminated = false;
+    while (end < MEMORY_SIZE - 1 && length < DYNAREC_MAX_BLOCK_INSTRUCTIONS && !isTerminated)
+    {
+        unsigned short opCode = state.memory[end] << 8 | state.memory[end + 1];
+        unsigned short withThis = used | registersUsed(opCode);
+        if (Disassembler::needsInterpreter(end, opCode) || countBits(withThis) > REGISTER_POOL_SIZE)
+        {
+            break;
+        }
+        used = withThis;
+        isTerminated = Disassembler::getFlowType(opCode) != Disassembler::NEXT;
+        end += 2;
+        ++length;
+    }
+    if (length == 0)
+    {
+        return nullptr;
+    }
+
+    // worst case is well under 256 bytes per instruction
+    if (code + length * 256 + 1024 > codeBuffer + DYNAREC_CODE_BUFFER_SIZE)
+    {
+        logWriter->log(LogWriter::LogLevel::INFO, "Dynarec: code buffer full, flushing.");
+        flush();
+    }
+
+    steady_clock::time_point compileStart = steady_clock::now();
+    Block* block = new Block();
+    block->start = start;
+    block->end = end;
+    block->entry = code;
+    compiling = block;
+    stubs.clear();
+
+    cachedRegisters = used;
+    int next = 0;
+    for (int v = 0; v < NUMBER_OF_REGISTERS; ++v)
+    {
+        hostRegister[v] = (used >> v) & 1 ? REGISTER_POOL[next++] : -1;
+    }
+
+    unsigned short dirty = 0;
+    emitJumpIfBudgetSpent(start, dirty); // linked blocks arrive here without asking the dispatcher
+    emitReload();
+    for (unsigned short address = start; address < end; address += 2)
+    {
+        unsigned short opCode = state.memory[address] << 8 | state.memory[address + 1];
+        if (address != start)
+        {
+            emitJumpIfBudgetSpent(address, dirty);
+        }
+        emitInstruction(address, opCode, dirty);
+    }
+    if (!isTerminated)
+    {
+        emitExit(end, dirty, true);
+    }
+    emitStubs();
+    compiling = nullptr;
+
+    blocks.push_back(block);
+    blockAt[start] = block;
+    for (unsigned int page = start / DYNAREC_PAGE_SIZE; page <= (end - 1u) / DYNAREC_PAGE_SIZE; ++page)
+    {
+        blocksOnPage[page].push_back(block);
+    }
+    for (const std::pair<unsigned short, unsigned char*>& exit : block->exits)
+    {
+        exitsTo[exit.first].push_back(exit.second);
+        if (blockAt[exit.first] != nullptr)
+        {
+            link(exit.second, blockAt[exit.first]->entry);
+        }
+    }
+    for (unsigned char* jump : exitsTo[start])
+    {
+        link(jump, block->entry);
+    }
+
+    ++statistics.blocksCompiled;
+    statistics.compileNanoseconds += duration_cast<nanoseconds>(steady_clock::now() - compileStart).count();
+    return block;
+}
+
+void Dynarec::
+removeBlock(Block* block)
+{
+    if (blockAt[block->start] == block)
+    {
+        blockAt[block->start] = nullptr;
+        for (unsigned char* jump : exitsTo[block->start])
+        {
+            link(jump, returnStub);
+        }
+    }
+    for (const std::pair<unsigned short, unsigned char*>& exit : block->exits)
+    {
+        std::vector<unsigned char*>& exits = exitsTo[exit.first];
+        exits.erase(std::remove(exits.begin(), exits.end(), exit.second), exits.end());
+    }
+    for (unsigned int page = block->start / DYNAREC_PAGE_SIZE; page <= (block->end - 1u) / DYNAREC_PAGE_SIZE; ++page)
+    {
+        std::vector<Block*>& onPage = blocksOnPage[page];
+        onPage.erase(std::remove(onPage.begin(), onPage.end(), block), onPage.end());
+    }
+    blocks.erase(std::remove(blocks.begin(), blocks.end(), block), blocks.end());
+    delete block;
+    ++statistics.blocksInvalidated;
+}
+
+// Memory in [from, to) was written: drop any translation made from those bytes
+void Dynarec::
+invalidate(unsigned int from, unsigned int to)
+{
+    if (from >= to)
+    {
+        return;
+    }
+    for (unsigned int page = from / DYNAREC_PAGE_SIZE; page <= (to - 1) / DYNAREC_PAGE_SIZE; ++page)
+    {
+        std::vector<Block*> onPage = blocksOnPage[page];
+        for (Block* block : onPage)
+        {
+            if (block->start < to && block->end > from)
+            {
+                removeBlock(block);
+            }
+        }
+    }
+}
+
+// Point a `jmp rel32` at a new target
+void Dynarec::
+link(unsigned char* jump, unsigned char* target)
+{
+    int displacement = static_cast<int>(target - (jump + 5));
+    std::memcpy(jump + 1, &displacement, sizeof(displacement));
+    if (target != returnStub)
+    {
+        ++statistics.blocksLinked;
+    }
+}
+
+void Dynarec::
+emitInstruction(unsigned short address, unsigned short opCode, unsigned short& dirty)
+{
+    int x = (opCode >> 8) & 0xF;
+    int y = (opCode >> 4) & 0xF;
+    unsigned char nn = opCode & 0xFF;
+    unsigned short nnn = opCode & 0xFFF;
+    int vx = hostRegister[x];
+    int vy = hostRegister[y];
+    int vf = hostRegister[0xF];
+    unsigned short next = address + 2;
+    unsigned short skip = address + 4;
+
+    switch (opCode >> 12)
+    {
+        case 0x0:
+            if (opCode == 0x00E0)
+            {
+                emitHelperCall(reinterpret_cast<void*>(helperClearScreen), 0, address, false, dirty);
+                break;
+            }
+            // 0x00EE
+            emit8(0x0F); emit8(0xB6); emit8(0x87); emit32(OFFSET(stackPointer)); // movzx eax, byte [sp]
+            emit8(0x85); emit8(0xC0);                                         // test eax, eax
+            emitBranchToStub(JE, address, dirty, false);
+            emit8(0xFF); emit8(0xC8);                                         // dec eax
+            emit8(0x88); emit8(0x87); emit32(OFFSET(stackPointer));           // mov [sp], al
+            emit8(0x0F); emit8(0xB7); emit8(0x84); emit8(0x47); emit32(OFFSET(callStack)); // movzx eax, word [stack + rax*2]
+            emit8(0x66); emit8(0x89); emit8(0x87); emit32(OFFSET(progCounter)); // mov [pc], ax
+            emit8(0xFF); emit8(0xCE);                                         // dec esi
+            emitExit(DYNAMIC_TARGET, dirty, false);
+            return;
+
+        case 0x1:
+            emit8(0xFF); emit8(0xCE);
+            emitExit(nnn, dirty, true);
+            return;
+
+        case 0x2:
+            emit8(0x0F); emit8(0xB6); emit8(0x87); emit32(OFFSET(stackPointer)); // movzx eax, byte [sp]
+            emit8(0x83); emit8(0xF8); emit8(STACK_DEPTH);                     // cmp eax, STACK_DEPTH
+            emitBranchToStub(JAE, address, dirty, false);
+            emit8(0x66); emit8(0xC7); emit8(0x84); emit8(0x47); emit32(OFFSET(callStack)); emit16(next);
+            emit8(0xFE); emit8(0x87); emit32(OFFSET(stackPointer));           // inc byte [sp]
+            emit8(0xFF); emit8(0xCE);
+            emitExit(nnn, dirty, true);
+            return;
+
+        case 0x3:
+        case 0x4:
+            emit8(0xFF); emit8(0xCE);
+            emitByteImmediate(7, vx, nn);                                      // cmp vx, nn
+            emitBranchToStub((opCode >> 12) == 0x3 ? JE : JNE, skip, dirty, true);
+            emitExit(next, dirty, true);
+            return;
+
+        case 0x5:
+        case 0x9:
+            emit8(0xFF); emit8(0xCE);
+            emitByteOp(0x38, vx, vy);                                         // cmp vx, vy
+            emitBranchToStub((opCode >> 12) == 0x5 ? JE : JNE, skip, dirty, true);
+            emitExit(next, dirty, true);
+            return;
+
+        case 0x6:
+            emitMoveImmediate(vx, nn);
+            dirty |= 1 << x;
+            break;
+
+        case 0x7:
+            emitByteImmediate(0, vx, nn);                                      // add vx, nn
+            dirty |= 1 << x;
+            break;
+
+        case 0x8:
+            switch (opCode & 0xF)
+            {
+                case 0x0:
+                    emitByteOp(0x88, vx, vy);
+                    break;
+                case 0x1:
+                    emitByteOp(0x08, vx, vy);
+                    break;
+                case 0x2:
+                    emitByteOp(0x20, vx, vy);
+                    break;
+                case 0x3:
+                    emitByteOp(0x30, vx, vy);
+                    break;
+                case 0x4:
+                    emitByteOp(0x00, vx, vy);
+                    emitSetCarry(true, vf);
+                    break;
+                case 0x5:
+                    emitByteOp(0x28, vx, vy);
+                    emitSetCarry(false, vf);
+                    break;
+                case 0x6:
+                    emitShift(5, vx);                                          // shr vx, 1
+                    if (x != 0xF)
+                    {
+                        emitSetCarry(true, vf);
+                    }
+                    break;
+                case 0x7:
+                    emitByteOp(0x88, RAX, vy);                                 // al = vy
+                    emitByteOp(0x28, RAX, vx);                                 // al -= vx
+                    emitByteOp(0x88, vx, RAX);
+                    emitSetCarry(false, vf);
+                    break;
+                default: // 0xE
+                    emitShift(4, vx);                                          // shl vx, 1
+                    if (x != 0xF)
+                    {
+                        emitSetCarry(true, vf);
+                    }
+                    break;
+            }
+            dirty |= 1 << x;
+            if ((opCode & 0xF) >= 0x4)
+            {
+                dirty |= 1 << 0xF;
+            }
+            break;
+
+        case 0xA:
+            emitStoreWordImmediate(OFFSET(index), nnn);
+            break;
+
+        case 0xC:
+            emitHelperCall(reinterpret_cast<void*>(helperRandom), static_cast<unsigned int>(x | nn << 8), address,
+                           false, dirty);
+            break;
+
+        case 0xD:
+            emitHelperCall(reinterpret_cast<void*>(helperDraw), static_cast<unsigned int>(x | y << 4 | (opCode & 0xF) << 8),
+                           address, true, dirty);
+            break;
+
+        case 0xE:
+            emit8(0xFF); emit8(0xCE);
+            emitZeroExtend(vx);
+            emit8(0x83); emit8(0xE0); emit8(0x0F);                             // and eax, 0xF
+            emit8(0x80); emit8(0xBC); emit8(0x07); emit32(OFFSET(keypad)); emit8(0x00); // cmp byte [keypad + rax], 0
+            emitBranchToStub(nn == 0x9E ? JNE : JE, skip, dirty, true);
+            emitExit(next, dirty, true);
+            return;
+
+        default: // 0xF
+            switch (nn)
+            {
+                case 0x07:
+                    emitLoadByte(vx, OFFSET(delayInterruptTimer));
+                    dirty |= 1 << x;
+                    break;
+                case 0x15:
+                    emitStoreByte(OFFSET(delayInterruptTimer), vx);
+                    break;
+                case 0x18:
+                    emitStoreByte(OFFSET(soundInterruptTimer), vx);
+                    break;
+                case 0x1E:
+                    emitZeroExtend(vx);
+                    emit8(0x66); emit8(0x01); emit8(0x87); emit32(OFFSET(index)); // add [index], ax
+                    break;
+                case 0x29:
+                    emitZeroExtend(vx);
+                    emit8(0x8D); emit8(0x04); emit8(0x80);                     // lea eax, [rax + rax*4]
+                    emit8(0x66); emit8(0x89); emit8(0x87); emit32(OFFSET(index)); // mov [index], ax
+                    break;
+                default: // 0x65
+                    emitHelperCall(reinterpret_cast<void*>(helperLoadRegisters), static_cast<unsigned int>(x + 1),
+                                   address, true, dirty);
+                    break;
+            }
+            break;
+    }
+
+    emit8(0xFF); emit8(0xCE); // dec esi
+}
+
+// Leave the block: write back, set progCounter, then return to the dispatcher or jump to a linked block
+void Dynarec::
+emitExit(unsigned short target, unsigned short dirty, bool isLinkable)
+{
+    emitWriteBack(dirty);
+    if (target != DYNAMIC_TARGET)
+    {
+        emitStoreWordImmediate(OFFSET(progCounter), target);
+    }
+    if (isLinkable)
+    {
+        compiling->exits.push_back(std::make_pair(target, code));
+        emit8(0xE9);
+        emit32(static_cast<unsigned int>(returnStub - (code + 4)));
+    }
+    else
+    {
+        emit8(0xC3);
+    }
+}
+
+void Dynarec::
+emitWriteBack(unsigned short dirty)
+{
+    for (int v = 0; v < NUMBER_OF_REGISTERS; ++v)
+    {
+        if ((dirty >> v) & 1)
+        {
+            emitStoreByte(OFFSET(registers) + v, hostRegister[v]);
+        }
+    }
+}
+
+void Dynarec::
+emitReload()
+{
+    for (int v = 0; v < NUMBER_OF_REGISTERS; ++v)
+    {
+        if ((cachedRegisters >> v) & 1)
+        {
+            emitLoadByte(hostRegister[v], OFFSET(registers) + v);
+        }
+    }
+}
+
+// Call helper(state, argument) with all V registers in memory, then pick them up again
+void Dynarec::
+emitHelperCall(void* helper, unsigned int argument, unsigned short address, bool canFail, unsigned short& dirty)
+{
+    emitWriteBack(dirty);
+    dirty = 0;
+    emit8(0x57);                                              // push rdi
+    emit8(0x56);                                              // push rsi
+    emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08);       // sub rsp, 8
+    emit8(0xBE); emit32(argument);                            // mov esi, argument
+    emit8(0x48); emit8(0xB8); emit64(reinterpret_cast<unsigned long long>(helper)); // mov rax, helper
+    emit8(0xFF); emit8(0xD0);                                 // call rax
+    emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08);       // add rsp, 8
+    emit8(0x5E);                                              // pop rsi
+    emit8(0x5F);                                              // pop rdi
+    emitReload();
+    if (canFail)
+    {
+        emit8(0x85); emit8(0xC0);                             // test eax, eax
+        emitBranchToStub(JNE, address, 0, false);
+    }
+}
+
+void Dynarec::
+emitBranchToStub(unsigned char condition, unsigned short target, unsigned short dirty, bool isLinkable)
+{
+    emit8(0x0F);
+    emit8(condition);
+    Stub stub = {code, target, dirty, isLinkable};
+    stubs.push_back(stub);
+    emit32(0);
+}
+
+void Dynarec::
+emitStubs()
+{
+    for (const Stub& stub : stubs)
+    {
+        int displacement = static_cast<int>(code - (stub.branch + 4));
+        std::memcpy(stub.branch, &displacement, sizeof(displacement));
+        emitExit(stub.target, stub.dirty, stub.isLinkable);
+    }
+    stubs.clear();
+}
+
+void Dynarec::
+emit8(unsigned int byte)
+{
+    *code++ = static_cast<unsigned char>(byte);
+}
+
+void Dynarec::
+emit16(unsigned int word)
+{
+    emit8(word);
+    emit8(word >> 8);
+}
+
+void Dynarec::
+emit32(unsigned int dword)
+{
+    emit16(dword);
+    emit16(dword >> 16);
+}
+
+void Dynarec::
+emit64(unsigned long long qword)
+{
+    emit32(static_cast<unsigned int>(qword));
+    emit32(static_cast<unsigned int>(qword >> 32));
+}
+
+// Always emitted for byte operations, so that registers 4-7 mean spl/bpl/sil/dil rather than ah/ch/dh/bh
+void Dynarec::
+emitRex(int reg, int rm)
+{
+    emit8(0x40 | ((reg >> 3) & 1) << 2 | ((rm >> 3) & 1));
+}
+
+// op r/m8, r8 with both operands registers
+void Dynarec::
+emitByteOp(unsigned char opCode, int destination, int source)
+{
+    emitRex(source, destination);
+    emit8(opCode);
+    emit8(0xC0 | (source & 7) << 3 | (destination & 7));
+}
+
+// group 1 (add = 0, cmp = 7) r/m8, imm8
+void Dynarec::
+emitByteImmediate(unsigned char extension, int destination, unsigned char immediate)
+{
+    emitRex(0, destination);
+    emit8(0x80);
+    emit8(0xC0 | extension << 3 | (destination & 7));
+    emit8(immediate);
+}
+
+void Dynarec::
+emitMoveImmediate(int destination, unsigned char immediate)
+{
+    emitRex(0, destination);
+    emit8(0xB0 + (destination & 7));
+    emit8(immediate);
+}
+
+// mov r8, [rdi + offset]
+void Dynarec::
+emitLoadByte(int destination, unsigned int offset)
+{
+    emitRex(destination, RDI);
+    emit8(0x8A);
+    emit8(0x80 | (destination & 7) << 3 | RDI);
+    emit32(offset);
+}
+
+// mov [rdi + offset], r8
+void Dynarec::
+emitStoreByte(unsigned int offset, int source)
+{
+    emitRex(source, RDI);
+    emit8(0x88);
+    emit8(0x80 | (source & 7) << 3 | RDI);
+    emit32(offset);
+}
+
+// group 2 (shl = 4, shr = 5) r/m8, 1
+void Dynarec::
+emitShift(unsigned char extension, int destination)
+{
+    emitRex(0, destination);
+    emit8(0xD0);
+    emit8(0xC0 | extension << 3 | (destination & 7));
+}
+
+// setc / setnc r8
+void Dynarec::
+emitSetCarry(bool isCarry, int destination)
+{
+    emitRex(0, destination);
+    emit8(0x0F);
+    emit8(isCarry ? 0x92 : 0x93);
+    emit8(0xC0 | (destination & 7));
+}
+
+// movzx eax, r8
+void Dynarec::
+emitZeroExtend(int source)
+{
+    emitRex(0, source);
+    emit8(0x0F);
+    emit8(0xB6);
+    emit8(0xC0 | (source & 7));
+}
+
+// mov word [rdi + offset], immediate
+void Dynarec::
+emitStoreWordImmediate(unsigned int offset, unsigned short immediate)
+{
+    emit8(0x66);
+    emit8(0xC7);
+    emit8(0x87);
+    emit32(offset);
+    emit16(immediate);
+}
+
+// test esi, esi / jz -> hand `address` back to the dispatcher
+void Dynarec::
+emitJumpIfBudgetSpent(unsigned short address, unsigned short dirty)
+{
+    emit8(0x85);
+    emit8(0xF6);
+    emitBranchToStub(JE, address, dirty, false);
+}
@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Dynarec
+ * Dynamic recompiler that translates Chip-8 basic blocks to x86-64 machine code at run time,
+ * falling back to the Chip8 interpreter for anything it does not translate.
+ * Only built for x86-64 POSIX hosts (IMIT8_DYNAREC).
+ */
+
+#ifndef IMIT8_CHIP8_DYNAREC_H
+#define IMIT8_CHIP8_DYNAREC_H
+
+#include <vector>
+#include "Chip8.h"
+
+#define DYNAREC_CODE_BUFFER_SIZE (4 * 1024 * 1024)
+#define DYNAREC_MAX_BLOCK_INSTRUCTIONS 32
+#define DYNAREC_PAGE_SIZE 256
+
+class Dynarec
+{
+    public:
+        struct Statistics
+        {
+            unsigned long long blocksCompiled;
+            unsigned long long blocksInvalidated;
+            unsigned long long blocksLinked;
+            unsigned long long cacheFlushes;
+            unsigned long long compiledInstructions;    // run as native code
+            unsigned long long interpretedInstructions; // run by the Chip8 interpreter
+            unsigned long long compileNanoseconds;      // spent translating
+            unsigned long long runNanoseconds;          // spent running, translation excluded
+        };
+
+        Dynarec(Chip8* cpu, LogWriter* logWriter);
+        ~Dynarec();
+
+        // Could the executable code buffer be set up? If not, runCycles() only interprets.
+        bool isAvailable() const;
+
+        // Run up to `cycles` instructions. Returns false once the machine halts.
+        bool runCycles(int cycles);
+
+        // Did anything run by the last runCycles() touch the screen?
+        bool isDirtyScreen();
+
+        // Drop every translation, e.g. after memory was changed from outside the machine
+        void flush();
+
+        const Statistics& getStatistics() const;
+
+    private:
+        // Signature of the trampoline that enters translated code. Returns the cycles left over.
+        typedef int (*EntryFunction)(Chip8State* state, int budget, const unsigned char* block);
+
+        struct Block
+        {
+            unsigned short start;
+            unsigned short end;
+            unsigned char* entry;
+            // (target address, jmp instruction) for each exit that can be linked to another block
+            std::vector<std::pair<unsigned short, unsigned char*>> exits;
+        };
+
+        // An exit path whose code is emitted after the block body
+        struct Stub
+        {
+            unsigned char* branch;   // rel32 to patch with the stub's address
+            unsigned short target;   // progCounter on leaving
+            unsigned short dirty;    // registers to write back
+            bool isLinkable;
+        };
+
+        Chip8* cpu;
+        LogWriter* logWriter;
+        Statistics statistics;
+        bool isDirty;
+
+        unsigned char* codeBuffer;
+        unsigned char* code;         // next free byte
+        unsigned char* returnStub;   // a lone `ret`, where unlinked exits jump
+        EntryFunction enter;
+
+        std::vector<Block*> blocks;
+        Block* blockAt[MEMORY_SIZE];
+        std::vector<Block*> blocksOnPage[MEMORY_SIZE / DYNAREC_PAGE_SIZE];
+        // jmp instructions that want to go to each address once it has a block
+        std::vector<unsigned char*> exitsTo[MEMORY_SIZE];
+
+        // Register allocation for the block being compiled: host register for each V register
+        int hostRegister[NUMBER_OF_REGISTERS];
+        unsigned short cachedRegisters;
+        std::vector<Stub> stubs;
+        Block* compiling;
+
+        void emitTrampoline();
+        Block* compileBlock(unsigned short start);
+        void removeBlock(Block* block);
+        void invalidate(unsigned int from, unsigned int to);
+        void link(unsigned char* jump, unsigned char* target);
+
+        // Code generation
+        void emitInstruction(unsigned short address, unsigned short opCode, unsigned short& dirty);
+        void emitExit(unsigned short target, unsigned short dirty, bool isLinkable);
+        void emitWriteBack(unsigned short dirty);
+        void emitReload();
+        void emitHelperCall(void* helper, unsigned int argument, unsigned short address, bool canFail,
+                            unsigned short& dirty);
+        void emitBranchToStub(unsigned char condition, unsigned short target, unsigned short dirty, bool isLinkable);
+        void emitStubs();
+
+        // x86-64 encoding
+        void emit8(unsigned int byte);
+        void emit16(unsigned int word);
+        void emit32(unsigned int dword);
+        void emit64(unsigned long long qword);
+        void emitRex(int reg, int rm);
+        void emitByteOp(unsigned char opCode, int destination, int source);
+        void emitByteImmediate(unsigned char extension, int destination, unsigned char immediate);
+        void emitMoveImmediate(int destination, unsigned char immediate);
+        void emitLoadByte(int destination, unsigned int offset);
+        void emitStoreByte(unsigned int offset, int source);
+        void emitShift(unsigned char extension, int destination);
+        void emitSetCarry(bool isCarry, int destination);
+        void emitZeroExtend(int source);
+        void emitStoreWordImmediate(unsigned int offset, unsigned short immediate);
+        void emitJumpIfBudgetSpent(unsigned short address, unsigned short dirty);
+};
+
+#endif //IMIT8_CHIP8_DYNAREC_H
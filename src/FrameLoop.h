@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * FrameLoop
+ * One frame of emulation: run a core for up to OPCODES_PER_FRAME instructions, then hand the screen to a
+ * sink if it changed. Templated on both so that with concrete types (e.g. a final Chip8) the calls made for
+ * every instruction are direct and can be inlined. With SinkType = FrameSink the sink is reached through
+ * its vtable, but only once per frame.
+ */
+
+#ifndef IMIT8_CHIP8_FRAMELOOP_H
+#define IMIT8_CHIP8_FRAMELOOP_H
+
+#include "Core.h"
+
+template <class CoreType, class SinkType>
+class FrameLoop
+{
+    public:
+        FrameLoop(CoreType& core, SinkType& sink) : core(core), sink(sink), frame(0), idleSkipped(0)
+        {
+        }
+
+        // Run up to `cycles` instructions, stopping early once the core halts or sits in a wait loop.
+        // toDraw is set if any of them changed the screen. Returns false once the core has halted.
+        bool runCycles(int cycles, bool& toDraw)
+        {
+            bool isRunning = true;
+            unsigned int executed = 1;
+            for (int i = 0; i < cycles && isRunning; i += static_cast<int>(executed))
+            {
+                isRunning = core.runStep(static_cast<unsigned int>(cycles - i), executed);
+                toDraw |= core.isDirtyScreen();
+                if (core.isIdle())
+                {
+                    idleSkipped += cycles - i - executed;
+                    break;
+                }
+            }
+            return isRunning;
+        }
+
+        // Give the sink the current screen if any of it changed, and count the frame. dirty is what the core
+        // has drawn since the last call, from takeDirtyRegion.
+        void present(const DirtyRegion& dirty)
+        {
+            if (dirty.rows != 0)
+            {
+                sink.present(core.getScreen(), dirty, frame);
+            }
+            ++frame;
+        }
+
+        // Instructions skipped in wait loops since the last call
+        unsigned long long takeIdleSkipped()
+        {
+            unsigned long long skipped = idleSkipped;
+            idleSkipped = 0;
+            return skipped;
+        }
+
+    private:
+        CoreType& core;
+        SinkType& sink;
+        unsigned long long frame;
+        unsigned long long idleSkipped;
+};
+
+#endif //IMIT8_CHIP8_FRAMELOOP_H
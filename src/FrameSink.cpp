@@ -0,0 +1,239 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * FrameSink
+ * Destinations for finished frames.
+ */
+
+#include <cstring>
+#include <dlfcn.h>
+#include "Chip8.h"
+#include "FrameSink.h"
+
+bool NullSink::
+open(const std::string&)
+{
+    return true;
+}
+
+void NullSink::
+present(const unsigned char*, const DirtyRegion&, unsigned long long)
+{
+}
+
+bool NullSink::
+close()
+{
+    return true;
+}
+
+TerminalSink::
+TerminalSink(LogWriter* logWrit)
+{
+    logWriter = logWrit;
+    screen = nullptr;
+}
+
+bool TerminalSink::
+open(const std::string&)
+{
+    Display::clearScreen();
+    return true;
+}
+
+void TerminalSink::
+present(const unsigned char* newScreen, const DirtyRegion& dirty, unsigned long long)
+{
+    if (display == nullptr || newScreen != screen)
+    {
+        screen = newScreen;
+        display.reset(new Display(screen, logWriter));
+        Display::homeCursor();
+        display->drawDisplay();
+        return;
+    }
+    display->drawRows(dirty);
+}
+
+bool TerminalSink::
+close()
+{
+    return true;
+}
+
+FileSink::
+FileSink(LogWriter* logWrit)
+{
+    logWriter = logWrit;
+    file = nullptr;
+    hasFailed = false;
+}
+
+FileSink::
+~FileSink()
+{
+    close();
+}
+
+bool FileSink::
+open(const std::string& path)
+{
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not open frame file (" + path + ")");
+        return false;
+    }
+    hasFailed = false;
+    return true;
+}
+
+void FileSink::
+present(const unsigned char* screen, const DirtyRegion&, unsigned long long frame)
+{
+    if (file == nullptr || hasFailed)
+    {
+        return;
+    }
+    // PBM rows are packed most significant bit first like the screen, with 1 meaning a black pixel
+    hasFailed = std::fprintf(file, "P4\n# frame %llu\n%d %d\n", frame, SCREEN_WIDTH, SCREEN_HEIGHT) < 0 ||
+                std::fwrite(screen, 1, SCREEN_SIZE, file) != SCREEN_SIZE;
+}
+
+bool FileSink::
+close()
+{
+    if (file == nullptr)
+    {
+        return true;
+    }
+    bool isGood = std::fclose(file) == 0 && !hasFailed;
+    file = nullptr;
+    if (!isGood)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Writing frames failed");
+    }
+    return isGood;
+}
+
+SharedMemorySink::
+SharedMemorySink(LogWriter* logWriter) : sharedFrame(logWriter)
+{
+    isOpen = false;
+}
+
+bool SharedMemorySink::
+open(const std::string& name)
+{
+    isOpen = sharedFrame.create(name);
+    return isOpen;
+}
+
+void SharedMemorySink::
+present(const unsigned char* screen, const DirtyRegion& dirty, unsigned long long frame)
+{
+    if (isOpen)
+    {
+        sharedFrame.publish(screen, frame, dirty.rows);
+    }
+}
+
+bool SharedMemorySink::
+close()
+{
+    sharedFrame.close();
+    isOpen = false;
+    return true;
+}
+
+PluginSink::
+PluginSink(LogWriter* logWrit)
+{
+    logWriter = logWrit;
+    library = nullptr;
+    std::memset(&sink, 0, sizeof(sink));
+    isOpen = false;
+}
+
+PluginSink::
+~PluginSink()
+{
+    close();
+}
+
+bool PluginSink::
+open(const std::string& specification)
+{
+    size_t colon = specification.find(':');
+    std::string path = specification.substr(0, colon);
+    std::string argument = colon == std::string::npos ? "" : specification.substr(colon + 1);
+
+    library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library == nullptr)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not load frame sink (" + std::string(dlerror()) + ")");
+        return false;
+    }
+    imit8_frame_sink_create_function create =
+            reinterpret_cast<imit8_frame_sink_create_function>(dlsym(library, IMIT8_FRAME_SINK_CREATE));
+    bool isCreated = create != nullptr && create(&sink, IMIT8_FRAME_SINK_ABI_VERSION);
+    if (create != nullptr && !isCreated)
+    {
+        std::memset(&sink, 0, sizeof(sink));
+        isCreated = create(&sink, 1);
+    }
+    if (!isCreated || sink.open == nullptr || sink.present == nullptr || sink.close == nullptr)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Not a version 1 or " + std::to_string(IMIT8_FRAME_SINK_ABI_VERSION) +
+                       " frame sink (" + path + ")");
+        close();
+        return false;
+    }
+    if (!sink.open(sink.context, argument.c_str()))
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Frame sink " + path + " could not open (" + argument + ")");
+        sink.close(sink.context);
+        close();
+        return false;
+    }
+    isOpen = true;
+    return true;
+}
+
+void PluginSink::
+present(const unsigned char* screen, const DirtyRegion& dirty, unsigned long long frame)
+{
+    if (!isOpen)
+    {
+        return;
+    }
+    if (sink.present_dirty != nullptr)
+    {
+        sink.present_dirty(sink.context, screen, SCREEN_WIDTH, SCREEN_HEIGHT, dirty.columns, frame);
+    }
+    else
+    {
+        sink.present(sink.context, screen, SCREEN_WIDTH, SCREEN_HEIGHT, frame);
+    }
+}
+
+bool PluginSink::
+close()
+{
+    if (isOpen)
+    {
+        sink.close(sink.context);
+        isOpen = false;
+    }
+    if (library != nullptr)
+    {
+        dlclose(library);
+        library = nullptr;
+    }
+    return true;
+}
@@ -0,0 +1,146 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * FrameSink
+ * Destinations for finished frames: nowhere, the terminal, a file of PBM images, or a sink in a shared
+ * library loaded at run time through a small C ABI.
+ */
+
+#ifndef IMIT8_CHIP8_FRAMESINK_H
+#define IMIT8_CHIP8_FRAMESINK_H
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include "Core.h"
+#include "Display.h"
+#include "LogWriter.h"
+#include "SharedFrame.h"
+
+// C ABI for frame sinks in shared libraries. A plugin exports
+//     extern "C" int imit8_frame_sink_create(struct imit8_frame_sink* sink, unsigned int abiVersion);
+// which fills in sink and returns non-zero, or returns 0 if it cannot serve abiVersion. Screens passed to
+// present are width x height pixels, 1 bit per pixel packed into bytes, most significant bit leftmost.
+// Version 2 adds present_dirty at the end. A plugin that turns version 2 down is asked again for version 1.
+extern "C"
+{
+#define IMIT8_FRAME_SINK_ABI_VERSION 2
+#define IMIT8_FRAME_SINK_CREATE "imit8_frame_sink_create"
+
+    struct imit8_frame_sink
+    {
+        void* context;
+
+        // Called once before the first frame with the text after the library path ("" if none); non-zero is success
+        int (*open)(void* context, const char* argument);
+
+        // Called for each frame that changed the screen
+        void (*present)(void* context, const unsigned char* screen, unsigned int width, unsigned int height,
+                        unsigned long long frame);
+
+        // Called once at the end; the sink frees context here
+        void (*close)(void* context);
+
+        // Version 2, optional: called instead of present when set. columns[r] has bit c set if byte c of row r
+        // changed; every other byte is as it was in the last frame presented.
+        void (*present_dirty)(void* context, const unsigned char* screen, unsigned int width, unsigned int height,
+                              const unsigned char* columns, unsigned long long frame);
+    };
+
+    typedef int (*imit8_frame_sink_create_function)(struct imit8_frame_sink* sink, unsigned int abiVersion);
+}
+
+class FrameSink
+{
+    public:
+        virtual ~FrameSink() {}
+
+        virtual bool open(const std::string& argument) = 0;
+        // dirty covers everything that changed since the last frame presented
+        virtual void present(const unsigned char* screen, const DirtyRegion& dirty, unsigned long long frame) = 0;
+        virtual bool close() = 0;
+};
+
+// Discards every frame, for headless runs
+class NullSink : public FrameSink
+{
+    public:
+        bool open(const std::string& argument) override;
+        void present(const unsigned char* screen, const DirtyRegion& dirty, unsigned long long frame) override;
+        bool close() override;
+};
+
+// Draws to the terminal through Display: the whole screen the first time, then only what changed
+class TerminalSink : public FrameSink
+{
+    public:
+        explicit TerminalSink(LogWriter* logWriter);
+
+        bool open(const std::string& argument) override;
+        void present(const unsigned char* screen, const DirtyRegion& dirty, unsigned long long frame) override;
+        bool close() override;
+
+    private:
+        LogWriter* logWriter;
+        std::unique_ptr<Display> display;
+        const unsigned char* screen;
+};
+
+// Appends each frame to a file as a binary PBM image (a stream that netpbm tools read frame by frame), with
+// the frame number in a comment
+class FileSink : public FrameSink
+{
+    public:
+        explicit FileSink(LogWriter* logWriter);
+        ~FileSink() override;
+
+        bool open(const std::string& path) override;
+        void present(const unsigned char* screen, const DirtyRegion& dirty, unsigned long long frame) override;
+        bool close() override;
+
+    private:
+        LogWriter* logWriter;
+        FILE* file;
+        bool hasFailed;
+};
+
+// Publishes each frame to shared memory for imit8_view and other readers (see SharedFrame)
+class SharedMemorySink : public FrameSink
+{
+    public:
+        explicit SharedMemorySink(LogWriter* logWriter);
+
+        bool open(const std::string& name) override;
+        void present(const unsigned char* screen, const DirtyRegion& dirty, unsigned long long frame) override;
+        bool close() override;
+
+    private:
+        SharedFrame sharedFrame;
+        bool isOpen;
+};
+
+// Forwards to an imit8_frame_sink from a shared library
+class PluginSink : public FrameSink
+{
+    public:
+        explicit PluginSink(LogWriter* logWriter);
+        ~PluginSink() override;
+
+        // "library.so" or "library.so:argument"
+        bool open(const std::string& specification) override;
+        void present(const unsigned char* screen, const DirtyRegion& dirty, unsigned long long frame) override;
+        bool close() override;
+
+    private:
+        LogWriter* logWriter;
+        void* library;
+        imit8_frame_sink sink;
+        bool isOpen;
+};
+
+#endif //IMIT8_CHIP8_FRAMESINK_H
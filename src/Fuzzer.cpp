@@ -0,0 +1,552 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Fuzzer
+ * Coverage-guided, in-process fuzzing of ROMs and keypad input against the Chip8 core.
+ */
+
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Fuzzer.h"
+#ifdef IMIT8_FUZZ_SANITIZE
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+using namespace std::chrono;
+
+// The signal handler needs to know what was running when the process died. These are set once per exec.
+static const Fuzzer::TestCase* volatile currentTestCase = nullptr;
+static char crashRomPath[512];
+static char crashKeysPath[512];
+
+static bool
+writeAll(const char* path, const void* data, size_t length)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    const char* bytes = static_cast<const char*>(data);
+    while (length > 0)
+    {
+        ssize_t written = write(fd, bytes, length);
+        if (written <= 0)
+        {
+            break;
+        }
+        bytes += written;
+        length -= static_cast<size_t>(written);
+    }
+    return close(fd) == 0 && length == 0;
+}
+
+// Only async-signal-safe calls in here.
+static void
+saveCrash()
+{
+    const Fuzzer::TestCase* testCase = currentTestCase;
+    if (testCase != nullptr)
+    {
+        currentTestCase = nullptr; // once, even if saving it crashes too
+        bool isSaved = writeAll(crashRomPath, testCase->rom.data(), testCase->rom.size()) &&
+                       writeAll(crashKeysPath, testCase->keys.data(), testCase->keys.size() * sizeof(unsigned short));
+        const char saved[] = "\nimit8_fuzz: crashed, input saved as crash.ch8\n";
+        const char unsaved[] = "\nimit8_fuzz: crashed, and the input could not be saved as crash.ch8\n";
+        ssize_t ignored = isSaved ? write(STDERR_FILENO, saved, sizeof(saved) - 1) :
+                          write(STDERR_FILENO, unsaved, sizeof(unsaved) - 1);
+        (void) ignored;
+    }
+}
+
+static void
+onCrashSignal(int signalNumber)
+{
+    saveCrash();
+    signal(signalNumber, SIG_DFL);
+    raise(signalNumber);
+}
+
+#ifdef IMIT8_FUZZ_SANITIZE
+// The sanitizers end the process with _exit() after a report rather than with a signal
+extern "C" const char*
+__asan_default_options()
+{
+    return "abort_on_error=1";
+}
+
+extern "C" const char*
+__ubsan_default_options()
+{
+    return "abort_on_error=1:print_stacktrace=1";
+}
+#endif
+
+Fuzzer::
+Fuzzer(unsigned int seed, int frames, const std::string& outputDir)
+        : logWriter("fuzz_log.txt", LogWriter::LogLevel::OFF), cpu(&logWriter)
+{
+    framesPerExec = frames;
+    outputDirectory = outputDir;
+    randomState = seed ? seed : 0x9E3779B97F4A7C15ULL;
+    execs = 0;
+    halts = 0;
+    crashes = 0;
+    saveErrors = 0;
+    edgesSeen = 0;
+
+    cpu.setKeyWaitBlocking(false);
+    pristine = cpu.getState();
+    pristine.randomState = 0x2545F491; // reproducible 0xCRXX results
+
+    std::memset(coverage, 0, sizeof(coverage));
+    std::memset(virginMap, 0xFF, sizeof(virginMap));
+
+    std::string prefix = outputDirectory.empty() ? "" : outputDirectory + "/";
+    std::string crashRom = prefix + "crash.ch8";
+    std::string crashKeys = prefix + "crash.keys";
+    std::strncpy(crashRomPath, crashRom.c_str(), sizeof(crashRomPath) - 1);
+    std::strncpy(crashKeysPath, crashKeys.c_str(), sizeof(crashKeysPath) - 1);
+    signal(SIGSEGV, onCrashSignal);
+    signal(SIGBUS, onCrashSignal);
+    signal(SIGFPE, onCrashSignal);
+    signal(SIGILL, onCrashSignal);
+    signal(SIGABRT, onCrashSignal);
+#ifdef IMIT8_FUZZ_SANITIZE
+    __sanitizer_set_death_callback(saveCrash);
+#endif
+}
+
+bool Fuzzer::
+addSeedFile(const std::string& romFile)
+{
+    TestCase testCase;
+    std::ifstream romIn(romFile, std::ios::in | std::ios::binary);
+    testCase.rom.assign(std::istreambuf_iterator<char>(romIn), std::istreambuf_iterator<char>());
+    if (testCase.rom.empty() || testCase.rom.size() > FUZZ_MAX_ROM_SIZE)
+    {
+        return false;
+    }
+
+    std::string keysFile = romFile.substr(0, romFile.rfind('.')) + ".keys";
+    std::ifstream keysIn(keysFile, std::ios::in | std::ios::binary);
+    unsigned short mask;
+    while (keysIn.read(reinterpret_cast<char*>(&mask), sizeof(mask)))
+    {
+        testCase.keys.push_back(mask);
+    }
+
+    corpus.push_back(testCase);
+    return true;
+}
+
+void Fuzzer::
+run(unsigned long long maxExecs, unsigned int maxSeconds)
+{
+    if (corpus.empty())
+    {
+        // Nothing to start from: a screen clear followed by random bytes is as good as anything.
+        TestCase testCase;
+        testCase.rom.push_back(0x00);
+        testCase.rom.push_back(0xE0);
+        for (int i = 0; i < 62; ++i)
+        {
+            testCase.rom.push_back(static_cast<unsigned char>(nextRandom()));
+        }
+        corpus.push_back(testCase);
+    }
+
+    // Run the seeds once so their coverage counts as known.
+    for (const TestCase& seed : corpus)
+    {
+        execute(seed);
+    }
+
+    steady_clock::time_point start = steady_clock::now();
+    steady_clock::time_point lastStatus = start;
+    unsigned long long execsAtLastStatus = execs;
+    TestCase candidate;
+
+    while (maxExecs == 0 || execs < maxExecs)
+    {
+        candidate = corpus[randomBelow(static_cast<unsigned int>(corpus.size()))];
+        mutate(candidate);
+
+        if (execute(candidate))
+        {
+            corpus.push_back(candidate);
+            if (!outputDirectory.empty())
+            {
+                saveTestCase(candidate, "cov-" + std::to_string(corpus.size()));
+            }
+        }
+
+        if ((execs & 0x3FF) == 0)
+        {
+            steady_clock::time_point now = steady_clock::now();
+            if (now - lastStatus >= seconds(1))
+            {
+                double elapsed = duration_cast<duration<double>>(now - lastStatus).count();
+                printStatus(static_cast<unsigned long long>((execs - execsAtLastStatus) / elapsed));
+                lastStatus = now;
+                execsAtLastStatus = execs;
+            }
+            if (maxSeconds != 0 && now - start >= seconds(maxSeconds))
+            {
+                break;
+            }
+        }
+    }
+
+    double elapsed = duration_cast<duration<double>>(steady_clock::now() - start).count();
+    printStatus(elapsed > 0 ? static_cast<unsigned long long>(execs / elapsed) : 0);
+}
+
+bool Fuzzer::
+execute(const TestCase& testCase)
+{
+    currentTestCase = &testCase;
+    ++execs;
+
+    // reset by copying the pristine machine instead of init() + loadFile()
+    Chip8State& state = cpu.getState();
+    state = pristine;
+    cpu.loadBuffer(testCase.rom.data(), testCase.rom.size());
+
+    std::memset(coverage, 0, sizeof(coverage));
+    unsigned short keysDown = 0;
+    bool isRunning = true;
+    bool isBroken = false;
+    bool isLowMemoryStored = false;
+
+    for (int frame = 0; frame < framesPerExec && isRunning; ++frame)
+    {
+        unsigned short keys = frame < static_cast<int>(testCase.keys.size()) ? testCase.keys[frame] : 0;
+        if (keys != keysDown)
+        {
+            for (unsigned char key = 0; key < NUMBER_OF_KEYPAD_BUTTONS; ++key)
+            {
+                cpu.setKey(key, (keys >> key) & 1);
+            }
+            keysDown = keys;
+        }
+
+        for (int i = 0; i < OPCODES_PER_FRAME && isRunning; ++i)
+        {
+            unsigned short prevProgCounter = state.progCounter;
+            isRunning = cpu.runCycle();
+            if (isRunning && !checkCycle(prevProgCounter, isLowMemoryStored))
+            {
+                isBroken = true;
+            }
+            unsigned int edge = ((prevProgCounter << 3) ^ state.progCounter) & (COVERAGE_MAP_SIZE - 1);
+            if (coverage[edge] != 0xFF)
+            {
+                ++coverage[edge];
+            }
+        }
+        cpu.updateTimers();
+    }
+
+    if (!isRunning)
+    {
+        ++halts;
+    }
+    if (isBroken || !checkInvariants(isLowMemoryStored))
+    {
+        ++crashes;
+        saveTestCase(testCase, "invariant-" + std::to_string(execs));
+    }
+
+    currentTestCase = nullptr;
+    return hasNewCoverage();
+}
+
+// Bucket hit counts the way AFL does (1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+) and compare against
+// what has been seen before. Scans a word at a time since most of the map is zero.
+bool Fuzzer::
+hasNewCoverage()
+{
+    static const unsigned char buckets[256] = {
+        0, 1, 2, 4, 8, 8, 8, 8, 16, 16, 16, 16, 16, 16, 16, 16,
+        32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32,
+        64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+        64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+        64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+        64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+        64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+        64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
+        128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+        128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+        128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+        128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+        128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+        128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+        128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128,
+        128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128};
+
+    bool isNew = false;
+    for (int word = 0; word < COVERAGE_MAP_SIZE; word += 8)
+    {
+        unsigned long long counts;
+        std::memcpy(&counts, coverage + word, sizeof(counts));
+        if (counts == 0)
+        {
+            continue;
+        }
+        for (int i = word; i < word + 8; ++i)
+        {
+            unsigned char bucket = buckets[coverage[i]];
+            if (virginMap[i] & bucket)
+            {
+                if (virginMap[i] == 0xFF)
+                {
+                    ++edgesSeen;
+                }
+                virginMap[i] &= ~bucket;
+                isNew = true;
+            }
+        }
+    }
+    return isNew;
+}
+
+// Things that must hold after every instruction that ran, however broken the ROM: it was fetched from inside
+// memory, the call stack is within bounds and the carry flag of 8XY4-8XYE (X not F) is 0 or 1. Also notes
+// stores into the interpreter's area below CODE_START.
+bool Fuzzer::
+checkCycle(unsigned short address, bool& isLowMemoryStored)
+{
+    const Chip8State& state = cpu.getState();
+    unsigned short opCode = state.opCode;
+    if (((opCode & 0xF0FF) == 0xF033 || (opCode & 0xF0FF) == 0xF055) && state.index < CODE_START)
+    {
+        isLowMemoryStored = true;
+    }
+    unsigned char aluOp = opCode & 0xF;
+    bool isCarrying = (opCode & 0xF000) == 0x8000 && (opCode & 0x0F00) != 0x0F00 &&
+                      (aluOp == 0x4 || aluOp == 0x5 || aluOp == 0x6 || aluOp == 0x7 || aluOp == 0xE);
+    return address <= MEMORY_SIZE - 2 && state.stackPointer <= STACK_DEPTH &&
+           (!isCarrying || state.registers[0xF] <= 1);
+}
+
+// Things that must hold after any exec: the font and the rest of the interpreter's area are only changed by
+// a store the ROM made there.
+bool Fuzzer::
+checkInvariants(bool isLowMemoryStored)
+{
+    const Chip8State& state = cpu.getState();
+    return isLowMemoryStored || std::equal(state.memory, state.memory + CODE_START, pristine.memory);
+}
+
+void Fuzzer::
+mutate(TestCase& testCase)
+{
+    std::vector<unsigned char>& rom = testCase.rom;
+    int mutations = 1 + static_cast<int>(randomBelow(4));
+
+    for (int m = 0; m < mutations; ++m)
+    {
+        unsigned int romLength = static_cast<unsigned int>(rom.size());
+        switch (randomBelow(9))
+        {
+            // flip one bit
+            case 0:
+                rom[randomBelow(romLength)] ^= static_cast<unsigned char>(1 << randomBelow(8));
+                break;
+
+            // random byte
+            case 1:
+                rom[randomBelow(romLength)] = static_cast<unsigned char>(nextRandom());
+                break;
+
+            // overwrite an instruction with a plausible one
+            case 2:
+            {
+                unsigned int at = randomBelow(romLength) & ~1u;
+                unsigned short op = randomOpCode(static_cast<unsigned short>(romLength));
+                rom[at] = static_cast<unsigned char>(op >> 8);
+                if (at + 1 < romLength)
+                {
+                    rom[at + 1] = static_cast<unsigned char>(op);
+                }
+                break;
+            }
+
+            // insert a plausible instruction
+            case 3:
+                if (romLength + 2 <= FUZZ_MAX_ROM_SIZE)
+                {
+                    unsigned int at = randomBelow(romLength + 1) & ~1u;
+                    unsigned short op = randomOpCode(static_cast<unsigned short>(romLength));
+                    rom.insert(rom.begin() + at, static_cast<unsigned char>(op));
+                    rom.insert(rom.begin() + at, static_cast<unsigned char>(op >> 8));
+                }
+                break;
+
+            // delete an instruction
+            case 4:
+                if (romLength > 2)
+                {
+                    unsigned int at = randomBelow(romLength - 1) & ~1u;
+                    rom.erase(rom.begin() + at, rom.begin() + at + 2);
+                }
+                break;
+
+            // copy a chunk of the ROM over another part of itself
+            case 5:
+            {
+                unsigned int length = 1 + randomBelow(std::min(romLength, 32u));
+                unsigned int from = randomBelow(romLength - length + 1);
+                unsigned int to = randomBelow(romLength - length + 1);
+                std::memmove(rom.data() + to, rom.data() + from, length);
+                break;
+            }
+
+            // splice in the tail of another corpus entry
+            case 6:
+            {
+                const std::vector<unsigned char>& other = corpus[randomBelow(static_cast<unsigned int>(corpus.size()))].rom;
+                unsigned int cut = randomBelow(romLength);
+                unsigned int otherCut = randomBelow(static_cast<unsigned int>(other.size()));
+                rom.resize(cut);
+                rom.insert(rom.end(), other.begin() + otherCut, other.end());
+                if (rom.size() > FUZZ_MAX_ROM_SIZE)
+                {
+                    rom.resize(FUZZ_MAX_ROM_SIZE);
+                }
+                if (rom.empty())
+                {
+                    rom.push_back(0x00);
+                }
+                break;
+            }
+
+            // press or release a key on some frame
+            case 7:
+            {
+                unsigned int frame = randomBelow(static_cast<unsigned int>(framesPerExec));
+                if (testCase.keys.size() <= frame)
+                {
+                    testCase.keys.resize(frame + 1, 0);
+                }
+                testCase.keys[frame] ^= static_cast<unsigned short>(1 << randomBelow(NUMBER_OF_KEYPAD_BUTTONS));
+                break;
+            }
+
+            // values that tend to sit on boundaries
+            default:
+            {
+                static const unsigned char interesting[] = {0x00, 0x01, 0x02, 0x0F, 0x10, 0x1F, 0x20, 0x3F,
+                                                            0x40, 0x7F, 0x80, 0xF0, 0xFE, 0xFF};
+                rom[randomBelow(romLength)] = interesting[randomBelow(sizeof(interesting))];
+                break;
+            }
+        }
+    }
+}
+
+// A random opCode from the implemented instruction set, with addresses pointing into the ROM.
+unsigned short Fuzzer::
+randomOpCode(unsigned short romLength)
+{
+    static const unsigned char aluOps[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+    static const unsigned char fOps[] = {0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65};
+
+    unsigned short x = static_cast<unsigned short>(randomBelow(16) << 8);
+    unsigned short y = static_cast<unsigned short>(randomBelow(16) << 4);
+    unsigned short address = static_cast<unsigned short>(CODE_START + (randomBelow(romLength) & ~1u));
+    unsigned short byte = static_cast<unsigned short>(randomBelow(256));
+
+    switch (randomBelow(16))
+    {
+        case 0x0:
+            return randomBelow(2) ? 0x00E0 : 0x00EE;
+        case 0x1:
+            return 0x1000 | address;
+        case 0x2:
+            return 0x2000 | address;
+        case 0x5:
+            return 0x5000 | x | y;
+        case 0x8:
+            return 0x8000 | x | y | aluOps[randomBelow(sizeof(aluOps))];
+        case 0x9:
+            return 0x9000 | x | y;
+        case 0xA:
+            return 0xA000 | static_cast<unsigned short>(randomBelow(MEMORY_SIZE));
+        case 0xD:
+            return 0xD000 | x | y | static_cast<unsigned short>(randomBelow(16));
+        case 0xE:
+            return 0xE000 | x | (randomBelow(2) ? 0x9E : 0xA1);
+        case 0xF:
+            return 0xF000 | x | fOps[randomBelow(sizeof(fOps))];
+        default:
+        {
+            unsigned short digit1 = static_cast<unsigned short>(randomBelow(16) << 12);
+            return digit1 | x | byte;
+        }
+    }
+}
+
+unsigned long long Fuzzer::
+nextRandom()
+{
+    // xorshift64 (Marsaglia)
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    return randomState;
+}
+
+unsigned int Fuzzer::
+randomBelow(unsigned int limit)
+{
+    return limit ? static_cast<unsigned int>(nextRandom() % limit) : 0;
+}
+
+bool Fuzzer::
+saveTestCase(const TestCase& testCase, const std::string& name)
+{
+    std::string base = outputDirectory.empty() ? name : outputDirectory + "/" + name;
+    std::ofstream romOut(base + ".ch8", std::ios::out | std::ios::binary);
+    romOut.write(reinterpret_cast<const char*>(testCase.rom.data()), testCase.rom.size());
+    romOut.close();
+    bool isSaved = !romOut.fail();
+    if (!testCase.keys.empty())
+    {
+        std::ofstream keysOut(base + ".keys", std::ios::out | std::ios::binary);
+        keysOut.write(reinterpret_cast<const char*>(testCase.keys.data()),
+                      testCase.keys.size() * sizeof(unsigned short));
+        keysOut.close();
+        isSaved = isSaved && !keysOut.fail();
+    }
+    if (!isSaved)
+    {
+        if (saveErrors == 0)
+        {
+            std::cerr << "ERROR: Could not save " << base << ".ch8; further failures are only counted." << std::endl;
+        }
+        ++saveErrors;
+    }
+    return isSaved;
+}
+
+void Fuzzer::
+printStatus(unsigned long long execsPerSecond)
+{
+    std::cout << "execs: " << execs << "  exec/s: " << execsPerSecond << "  corpus: " << corpus.size()
+              << "  edges: " << edgesSeen << "  halts: " << halts << "  crashes: " << crashes;
+    if (saveErrors != 0)
+    {
+        std::cout << "  unsaved: " << saveErrors;
+    }
+    std::cout << std::endl;
+}
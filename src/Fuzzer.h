@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Fuzzer
+ * Coverage-guided, in-process fuzzing of ROMs and keypad input against the Chip8 core.
+ */
+
+#ifndef IMIT8_CHIP8_FUZZER_H
+#define IMIT8_CHIP8_FUZZER_H
+
+#include <string>
+#include <vector>
+#include "Chip8.h"
+#include "LogWriter.h"
+
+#define COVERAGE_MAP_SIZE (1 << 14)
+#define FUZZ_MAX_ROM_SIZE (MEMORY_SIZE - CODE_START)
+
+class Fuzzer
+{
+    public:
+        // One fuzzing input: a ROM image and the keypad state (one bit per key) for each frame.
+        struct TestCase
+        {
+            std::vector<unsigned char> rom;
+            std::vector<unsigned short> keys;
+        };
+
+        Fuzzer(unsigned int seed, int framesPerExec, const std::string& outputDirectory);
+
+        // Add a ROM file (and its .keys file, if there is one) to the starting corpus
+        bool addSeedFile(const std::string& romFile);
+
+        // Fuzz until either limit is reached (0 means no limit)
+        void run(unsigned long long maxExecs, unsigned int maxSeconds);
+
+    private:
+        LogWriter logWriter;
+        Chip8 cpu;
+
+        // Machine state straight after construction; every exec starts from a copy of it.
+        Chip8State pristine;
+
+        int framesPerExec;
+        std::string outputDirectory;
+        unsigned long long randomState;
+
+        std::vector<TestCase> corpus;
+
+        // Edge hit counts for the current exec, and the (bucketed) edges never seen so far.
+        unsigned char coverage[COVERAGE_MAP_SIZE];
+        unsigned char virginMap[COVERAGE_MAP_SIZE];
+
+        unsigned long long execs;
+        unsigned long long halts;
+        unsigned long long crashes;
+        unsigned long long saveErrors;      // test cases that could not be written to outputDirectory
+        unsigned int edgesSeen;
+
+        // Run one test case from the pristine state. Returns true if it reached new coverage.
+        bool execute(const TestCase& testCase);
+        bool hasNewCoverage();
+        bool checkCycle(unsigned short address, bool& isLowMemoryStored);
+        bool checkInvariants(bool isLowMemoryStored);
+
+        void mutate(TestCase& testCase);
+        unsigned short randomOpCode(unsigned short romLength);
+
+        unsigned long long nextRandom();
+        unsigned int randomBelow(unsigned int limit);
+
+        bool saveTestCase(const TestCase& testCase, const std::string& name);
+        void printStatus(unsigned long long execsPerSecond);
+};
+
+#endif //IMIT8_CHIP8_FUZZER_H
@@ -0,0 +1,182 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * HangDetector
+ * Frame boundary state hashing and loop confirmation.
+ */
+
+#include <cstring>
+#include "HangDetector.h"
+
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
+
+// Arbitrary odd constants keeping zero words from zeroing the products in hashKey
+#define HASH_KEY_0 0xA0761D6478BD642FULL
+#define HASH_KEY_1 0xE7037ED1A0B428DBULL
+#define HASH_KEY_2 0x8EBC6AF09C88C6E3ULL
+#define HASH_KEY_3 0x589965CC75374CC3ULL
+#define HASH_KEY_4 0x1D8E4E27C47D124FULL
+#define HASH_KEY_5 0xC2B2AE3D27D4EB4FULL
+
+static unsigned long long
+mix(unsigned long long hash, unsigned long long value)
+{
+    hash = (hash ^ value) * HASH_MULTIPLIER;
+    return hash ^ (hash >> 29);
+}
+
+HangDetector::
+HangDetector()
+{
+    inputs = 0;
+    loopStart = 0;
+    loopEnd = 0;
+    reset();
+}
+
+void HangDetector::
+reset()
+{
+    std::memset(table, 0, sizeof(table));
+    anchor.key = 0;
+    anchor.frame = 0;
+    frame = 0;
+    isSuspect = false;
+    period = 0;
+}
+
+bool HangDetector::
+checkFrame(const Chip8State& state, unsigned long long inputCount)
+{
+    if (inputCount != inputs)
+    {
+        reset();
+        inputs = inputCount;
+    }
+    ++frame;
+    unsigned long long key = hashKey(state);
+    if (isSuspect && frame == suspectFrame + period)
+    {
+        if (key == suspectKey && hashMemory(state) == suspectMemory)
+        {
+            return true;
+        }
+        isSuspect = false; // memory moved on, or the loop was a coincidence of the table
+    }
+
+    Entry& entry = table[key & (HANG_TABLE_SIZE - 1)];
+    unsigned long long seen = entry.frame != 0 && entry.key == key ? entry.frame :
+                              anchor.frame != 0 && anchor.key == key ? anchor.frame : 0;
+    if (!isSuspect && seen != 0)
+    {
+        isSuspect = true;
+        suspectKey = key;
+        suspectMemory = hashMemory(state);
+        suspectFrame = frame;
+        period = frame - seen;
+    }
+    entry.key = key;
+    entry.frame = frame;
+    if ((frame & (frame - 1)) == 0)
+    {
+        anchor = entry;
+    }
+    return false;
+}
+
+unsigned long long HangDetector::
+getPeriod() const
+{
+    return period;
+}
+
+// The loop is entered at every frame boundary of it, so a period of frames run as the frame loop runs them
+// (ending early in a wait loop) covers all of it
+void HangDetector::
+traceLoop(Chip8& cpu)
+{
+    Chip8State saved = cpu.getState();
+    loopStart = MEMORY_SIZE - 1;
+    loopEnd = 0;
+    bool isRunning = true;
+    for (unsigned long long f = 0; f < period && isRunning; ++f)
+    {
+        for (int i = 0; i < OPCODES_PER_FRAME && isRunning; ++i)
+        {
+            unsigned short address = cpu.getState().progCounter;
+            loopStart = std::min(loopStart, address);
+            loopEnd = std::max(loopEnd, address);
+            isRunning = cpu.runCycle();
+            if (cpu.isIdle())
+            {
+                break;
+            }
+        }
+        cpu.updateTimers();
+    }
+    cpu.getState() = saved;
+}
+
+unsigned short HangDetector::
+getLoopStart() const
+{
+    return loopStart;
+}
+
+unsigned short HangDetector::
+getLoopEnd() const
+{
+    return loopEnd;
+}
+
+// Fold the 128-bit product of a and b: a strong mix whose multiplies do not wait on each other
+static unsigned long long
+fold(unsigned long long a, unsigned long long b)
+{
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    return static_cast<unsigned long long>(product) ^ static_cast<unsigned long long>(product >> 64);
+}
+
+// Only the live part of the call stack counts: entries above the stack pointer are never read again
+unsigned long long HangDetector::
+hashKey(const Chip8State& state)
+{
+    unsigned long long words[NUMBER_OF_REGISTERS / 8 + NUMBER_OF_KEYPAD_BUTTONS / 8];
+    std::memcpy(words, state.registers, NUMBER_OF_REGISTERS);
+    std::memcpy(words + NUMBER_OF_REGISTERS / 8, state.keypad, NUMBER_OF_KEYPAD_BUTTONS);
+    unsigned long long counters = state.index | static_cast<unsigned long long>(state.progCounter) << 16 |
+                                  static_cast<unsigned long long>(state.stackPointer) << 32 |
+                                  static_cast<unsigned long long>(state.delayInterruptTimer) << 40 |
+                                  static_cast<unsigned long long>(state.soundInterruptTimer) << 48;
+    unsigned long long hash = fold(words[0] ^ HASH_KEY_0, words[1] ^ HASH_KEY_1) ^
+                              fold(words[2] ^ HASH_KEY_2, words[3] ^ HASH_KEY_3) ^
+                              fold(counters ^ HASH_KEY_4, state.randomState ^ HASH_KEY_5);
+    for (unsigned char i = 0; i < state.stackPointer && i < STACK_DEPTH; ++i)
+    {
+        hash = mix(hash, state.callStack[i]);
+    }
+    return mix(hash, 0);
+}
+
+unsigned long long HangDetector::
+hashMemory(const Chip8State& state)
+{
+    unsigned long long hash = HASH_MULTIPLIER;
+    unsigned long long word;
+    for (size_t i = 0; i < MEMORY_SIZE; i += 8)
+    {
+        std::memcpy(&word, state.memory + i, 8);
+        hash = mix(hash, word);
+    }
+    for (size_t i = 0; i < SCREEN_SIZE; i += 8)
+    {
+        std::memcpy(&word, state.graphicsBuffer + i, 8);
+        hash = mix(hash, word);
+    }
+    return hash;
+}
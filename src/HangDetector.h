@@ -0,0 +1,75 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * HangDetector
+ * Spots a program that has settled into an endless loop, however many instructions long. At each frame
+ * boundary it hashes the small part of the machine state (registers, index, program counter, timers, keypad,
+ * call stack and random number generator) into a table of HANG_TABLE_SIZE entries. When that hash comes
+ * round again the loop is suspected, and memory and screen are hashed too; if the whole state is the same
+ * another period later, nothing can ever change without outside input. The table catches short loops
+ * quickly; for long ones the hash at each frame numbered a power of two is kept as well (Brent's method), so
+ * a loop of any period is caught by about twice the frame it began on plus two periods. Costs a few
+ * independent multiplies a frame while nothing repeats.
+ */
+
+#ifndef IMIT8_CHIP8_HANGDETECTOR_H
+#define IMIT8_CHIP8_HANGDETECTOR_H
+
+#include "Chip8.h"
+
+#define HANG_TABLE_SIZE 64   // a power of two
+
+class HangDetector
+{
+    public:
+        HangDetector();
+
+        // Forget every state seen so far
+        void reset();
+
+        // Call at each frame boundary, after the timers have ticked. inputs counts the input that has reached
+        // the machine so far; when it changes everything seen before is forgotten. Returns true once the
+        // machine is known to repeat the same getPeriod() frames forever.
+        bool checkFrame(const Chip8State& state, unsigned long long inputs);
+
+        unsigned long long getPeriod() const;
+
+        // Run one more period of the loop on cpu to find the addresses it covers, then put cpu back as it was
+        void traceLoop(Chip8& cpu);
+
+        // Lowest and highest instruction address of the loop, after traceLoop
+        unsigned short getLoopStart() const;
+        unsigned short getLoopEnd() const;
+
+    private:
+        struct Entry
+        {
+            unsigned long long key;       // hash of everything but memory and the screen
+            unsigned long long frame;     // 0 for none
+        };
+
+        Entry table[HANG_TABLE_SIZE];
+        Entry anchor;                     // the last frame numbered a power of two
+        unsigned long long frame;
+        unsigned long long inputs;
+
+        // A suspected loop: the state at suspectFrame, expected again period frames later
+        bool isSuspect;
+        unsigned long long suspectKey;
+        unsigned long long suspectMemory;
+        unsigned long long suspectFrame;
+        unsigned long long period;
+
+        unsigned short loopStart;
+        unsigned short loopEnd;
+
+        static unsigned long long hashKey(const Chip8State& state);
+        static unsigned long long hashMemory(const Chip8State& state);
+};
+
+#endif //IMIT8_CHIP8_HANGDETECTOR_H
@@ -0,0 +1,417 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Lockstep
+ * Differential testing of two engines by state hashes at checkpoints, bisecting on a mismatch.
+ */
+
+#include <cstring>
+#include "Disassembler.h"
+#include "Lockstep.h"
+
+#define HASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
+#define MAX_LISTED_DIFFERENCES 16
+
+static unsigned long long
+mix(unsigned long long hash, unsigned long long value)
+{
+    hash = (hash ^ value) * HASH_MULTIPLIER;
+    return hash ^ (hash >> 29);
+}
+
+static unsigned long long
+hashBytes(unsigned long long hash, const unsigned char* bytes, size_t length)
+{
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        unsigned long long word;
+        std::memcpy(&word, bytes + i, 8);
+        hash = mix(hash, word);
+    }
+    for (; i < length; ++i)
+    {
+        hash = mix(hash, bytes[i]);
+    }
+    return hash;
+}
+
+static std::string
+hex(unsigned int value, int width)
+{
+    std::stringstream out;
+    out << std::hex << std::uppercase << std::setfill('0') << std::setw(width) << value;
+    return out.str();
+}
+
+InterpreterEngine::
+InterpreterEngine(LogWriter* logWriter)
+        : cpu(logWriter)
+{
+    cpu.setKeyWaitBlocking(false);
+}
+
+std::string InterpreterEngine::
+getName() const
+{
+    return "interpreter";
+}
+
+Chip8& InterpreterEngine::
+getCpu()
+{
+    return cpu;
+}
+
+bool InterpreterEngine::
+run(int cycles)
+{
+    for (int i = 0; i < cycles; ++i)
+    {
+        if (!cpu.runCycle())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void InterpreterEngine::
+restore(const Chip8State& state)
+{
+    cpu.getState() = state;
+}
+
+CompactEngine::
+CompactEngine(LogWriter* logWrit)
+        : cpu(logWrit)
+{
+    logWriter = logWrit;
+}
+
+std::string CompactEngine::
+getName() const
+{
+    return "compact";
+}
+
+Chip8& CompactEngine::
+getCpu()
+{
+    return cpu;
+}
+
+bool CompactEngine::
+run(int cycles)
+{
+    Chip8State& state = cpu.getState();
+    if (compact == nullptr)
+    {
+        image.load(state.memory + CODE_START, state.romBytes);
+        compact.reset(new CompactChip8(logWriter, &image));
+    }
+    compact->importState(state);
+    bool isRunning = true;
+    for (int i = 0; i < cycles && isRunning; ++i)
+    {
+        isRunning = compact->runCycle();
+    }
+    compact->exportState(state);
+    return isRunning;
+}
+
+void CompactEngine::
+restore(const Chip8State& state)
+{
+    cpu.getState() = state;
+}
+
+#ifdef IMIT8_DYNAREC
+DynarecEngine::
+DynarecEngine(LogWriter* logWriter)
+        : cpu(logWriter), dynarec(&cpu, logWriter)
+{
+    cpu.setKeyWaitBlocking(false);
+}
+
+std::string DynarecEngine::
+getName() const
+{
+    return "dynarec";
+}
+
+Chip8& DynarecEngine::
+getCpu()
+{
+    return cpu;
+}
+
+bool DynarecEngine::
+run(int cycles)
+{
+    return dynarec.runCycles(cycles);
+}
+
+void DynarecEngine::
+restore(const Chip8State& state)
+{
+    cpu.getState() = state;
+    dynarec.flush(); // translations may be of code that the restored memory no longer holds
+}
+#endif
+
+Lockstep::
+Lockstep(LockstepEngine& referenceEngine, LockstepEngine& candidateEngine, unsigned long long checkInterval)
+        : reference(referenceEngine), candidate(candidateEngine)
+{
+    interval = std::max(1ULL, checkInterval);
+    keys = nullptr;
+    instructions = 0;
+    checkpoints = 0;
+    traceHash = 0;
+    isHalted = false;
+    std::memset(&divergence, 0, sizeof(divergence));
+}
+
+bool Lockstep::
+load(const std::vector<unsigned char>& rom)
+{
+    if (!reference.getCpu().loadBuffer(rom.data(), rom.size()) || !candidate.getCpu().loadBuffer(rom.data(), rom.size()))
+    {
+        return false;
+    }
+    candidate.getCpu().getState().randomState = reference.getCpu().getState().randomState;
+    return true;
+}
+
+bool Lockstep::
+run(unsigned long long frames, const std::vector<unsigned short>& keyFrames)
+{
+    keys = &keyFrames;
+    unsigned long long total = frames * OPCODES_PER_FRAME;
+    bool isReferenceRunning = true;
+    bool isCandidateRunning = true;
+    while (instructions < total && (isReferenceRunning || isCandidateRunning))
+    {
+        Chip8State referenceStart = reference.getCpu().getState();
+        Chip8State candidateStart = candidate.getCpu().getState();
+        unsigned long long count = std::min(interval, total - instructions);
+        isReferenceRunning = advance(reference, instructions, count);
+        isCandidateRunning = advance(candidate, instructions, count);
+        ++checkpoints;
+
+        unsigned long long hash = hashState(reference.getCpu().getState());
+        if (isReferenceRunning != isCandidateRunning || hash != hashState(candidate.getCpu().getState()))
+        {
+            bisect(referenceStart, candidateStart, instructions, count);
+            return false;
+        }
+        traceHash = mix(traceHash, hash);
+        instructions += count;
+    }
+    isHalted = !isReferenceRunning;
+    return true;
+}
+
+bool Lockstep::
+advance(LockstepEngine& engine, unsigned long long from, unsigned long long count)
+{
+    Chip8& cpu = engine.getCpu();
+    unsigned long long end = from + count;
+    while (from < end)
+    {
+        unsigned long long frame = from / OPCODES_PER_FRAME;
+        if (from % OPCODES_PER_FRAME == 0)
+        {
+            unsigned short down = frame < keys->size() ? (*keys)[frame] : 0;
+            for (unsigned char key = 0; key < NUMBER_OF_KEYPAD_BUTTONS; ++key)
+            {
+                cpu.setKey(key, (down >> key) & 1);
+            }
+        }
+        unsigned long long frameEnd = (frame + 1) * OPCODES_PER_FRAME;
+        unsigned long long cycles = std::min(end, frameEnd) - from;
+        if (!engine.run(static_cast<int>(cycles)))
+        {
+            return false;
+        }
+        from += cycles;
+        if (from == frameEnd)
+        {
+            cpu.updateTimers();
+        }
+    }
+    return true;
+}
+
+void Lockstep::
+bisect(const Chip8State& referenceStart, const Chip8State& candidateStart, unsigned long long from,
+       unsigned long long count)
+{
+    // after `low` instructions the engines still agree; after `high` they do not
+    unsigned long long low = 0;
+    unsigned long long high = count;
+    while (high - low > 1)
+    {
+        unsigned long long middle = low + (high - low) / 2;
+        reference.restore(referenceStart);
+        candidate.restore(candidateStart);
+        bool isReferenceRunning = advance(reference, from, middle);
+        bool isCandidateRunning = advance(candidate, from, middle);
+        if (isReferenceRunning == isCandidateRunning &&
+            isSameState(reference.getCpu().getState(), candidate.getCpu().getState()))
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    reference.restore(referenceStart);
+    candidate.restore(candidateStart);
+    advance(reference, from, low);
+    advance(candidate, from, low);
+    divergence.instruction = from + low;
+    divergence.before = reference.getCpu().getState();
+    divergence.isReferenceRunning = advance(reference, from + low, 1);
+    divergence.isCandidateRunning = advance(candidate, from + low, 1);
+    divergence.reference = reference.getCpu().getState();
+    divergence.candidate = candidate.getCpu().getState();
+    instructions = from + low;
+}
+
+const Lockstep::Divergence& Lockstep::
+getDivergence() const
+{
+    return divergence;
+}
+
+unsigned long long Lockstep::
+getInstructions() const
+{
+    return instructions;
+}
+
+unsigned long long Lockstep::
+getCheckpoints() const
+{
+    return checkpoints;
+}
+
+bool Lockstep::
+hasHalted() const
+{
+    return isHalted;
+}
+
+unsigned long long Lockstep::
+getTraceHash() const
+{
+    return traceHash;
+}
+
+void Lockstep::
+printDivergence(std::ostream& out) const
+{
+    const Divergence& d = divergence;
+    unsigned short pc = d.before.progCounter;
+    unsigned short opCode = pc < MEMORY_SIZE - 1 ? (d.before.memory[pc] << 8 | d.before.memory[pc + 1]) : 0;
+    out << "First divergence at instruction " << d.instruction << " (frame " << d.instruction / OPCODES_PER_FRAME
+        << "): " << hex(pc, 3) << "  " << hex(opCode, 4) << "  " << Disassembler::toString(opCode) << "\n";
+    out << "    " << std::left << std::setw(12) << "" << std::setw(12) << "before" << std::setw(12) << reference.getName()
+        << candidate.getName() << std::right << "\n";
+
+    // one line per field, marked where the engines disagree
+    struct Field
+    {
+        std::string name;
+        unsigned int before;
+        unsigned int reference;
+        unsigned int candidate;
+        int width;
+    };
+    std::vector<Field> fields;
+    for (int i = 0; i < NUMBER_OF_REGISTERS; ++i)
+    {
+        fields.push_back({"V" + hex(i, 1), d.before.registers[i], d.reference.registers[i], d.candidate.registers[i], 2});
+    }
+    fields.push_back({"I", d.before.index, d.reference.index, d.candidate.index, 3});
+    fields.push_back({"PC", d.before.progCounter, d.reference.progCounter, d.candidate.progCounter, 3});
+    fields.push_back({"SP", d.before.stackPointer, d.reference.stackPointer, d.candidate.stackPointer, 2});
+    for (int i = 0; i < STACK_DEPTH; ++i)
+    {
+        if (i < d.before.stackPointer || i < d.reference.stackPointer || i < d.candidate.stackPointer)
+        {
+            fields.push_back({"S" + hex(i, 1), d.before.callStack[i], d.reference.callStack[i], d.candidate.callStack[i], 3});
+        }
+    }
+    fields.push_back({"DT", d.before.delayInterruptTimer, d.reference.delayInterruptTimer,
+                      d.candidate.delayInterruptTimer, 2});
+    fields.push_back({"ST", d.before.soundInterruptTimer, d.reference.soundInterruptTimer,
+                      d.candidate.soundInterruptTimer, 2});
+    fields.push_back({"RNG", d.before.randomState, d.reference.randomState, d.candidate.randomState, 8});
+    fields.push_back({"running", 1, d.isReferenceRunning, d.isCandidateRunning, 1});
+    for (const Field& field : fields)
+    {
+        out << (field.reference != field.candidate ? "  * " : "    ") << std::left << std::setw(12) << field.name
+            << std::setw(12) << hex(field.before, field.width) << std::setw(12) << hex(field.reference, field.width)
+            << hex(field.candidate, field.width) << std::right << "\n";
+    }
+
+    int listed = 0;
+    for (int i = 0; i < MEMORY_SIZE && listed < MAX_LISTED_DIFFERENCES; ++i)
+    {
+        if (d.reference.memory[i] != d.candidate.memory[i])
+        {
+            out << "  * " << std::left << std::setw(12) << "[" + hex(i, 3) + "]" << std::setw(12) << hex(d.before.memory[i], 2)
+                << std::setw(12) << hex(d.reference.memory[i], 2) << hex(d.candidate.memory[i], 2) << std::right << "\n";
+            ++listed;
+        }
+    }
+    for (int i = 0; i < SCREEN_SIZE && listed < MAX_LISTED_DIFFERENCES; ++i)
+    {
+        if (d.reference.graphicsBuffer[i] != d.candidate.graphicsBuffer[i])
+        {
+            std::string where = "screen " + std::to_string(i % SCREEN_WIDTH_SIZE * 8) + "," + std::to_string(i / SCREEN_WIDTH_SIZE);
+            out << "  * " << std::left << std::setw(12) << where << std::setw(12) << hex(d.before.graphicsBuffer[i], 2)
+                << std::setw(12) << hex(d.reference.graphicsBuffer[i], 2) << hex(d.candidate.graphicsBuffer[i], 2)
+                << std::right << "\n";
+            ++listed;
+        }
+    }
+    if (listed == MAX_LISTED_DIFFERENCES)
+    {
+        out << "    (more differences not shown)\n";
+    }
+}
+
+unsigned long long Lockstep::
+hashState(const Chip8State& state)
+{
+    unsigned long long hash = hashBytes(HASH_MULTIPLIER, state.memory, MEMORY_SIZE);
+    hash = hashBytes(hash, state.registers, NUMBER_OF_REGISTERS);
+    hash = hashBytes(hash, state.graphicsBuffer, SCREEN_SIZE);
+    hash = mix(hash, static_cast<unsigned long long>(state.index) << 48 | static_cast<unsigned long long>(state.progCounter) << 32 |
+                     state.stackPointer << 16 | state.delayInterruptTimer << 8 | state.soundInterruptTimer);
+    hash = mix(hash, state.randomState);
+    return hashBytes(hash, reinterpret_cast<const unsigned char*>(state.callStack), state.stackPointer * sizeof(unsigned short));
+}
+
+bool Lockstep::
+isSameState(const Chip8State& a, const Chip8State& b)
+{
+    return std::memcmp(a.memory, b.memory, MEMORY_SIZE) == 0 &&
+           std::memcmp(a.registers, b.registers, NUMBER_OF_REGISTERS) == 0 &&
+           std::memcmp(a.graphicsBuffer, b.graphicsBuffer, SCREEN_SIZE) == 0 &&
+           a.index == b.index && a.progCounter == b.progCounter && a.stackPointer == b.stackPointer &&
+           std::memcmp(a.callStack, b.callStack, a.stackPointer * sizeof(unsigned short)) == 0 &&
+           a.delayInterruptTimer == b.delayInterruptTimer && a.soundInterruptTimer == b.soundInterruptTimer &&
+           a.randomState == b.randomState;
+}
@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Lockstep
+ * Runs a reference and a candidate engine side by side on the same ROM and keypad input. Every N
+ * instructions it compares hashes of the two machine states. On a mismatch it rewinds both to the last
+ * matching checkpoint and bisects down to the first instruction after which they differ.
+ */
+
+#ifndef IMIT8_CHIP8_LOCKSTEP_H
+#define IMIT8_CHIP8_LOCKSTEP_H
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+#include "CompactChip8.h"
+#include "LogWriter.h"
+#ifdef IMIT8_DYNAREC
+#include "Dynarec.h"
+#endif
+
+// One way of running a Chip8 machine that the harness can drive and rewind
+class LockstepEngine
+{
+    public:
+        virtual ~LockstepEngine() {}
+
+        virtual std::string getName() const = 0;
+
+        // The machine being run: state, keypad and timers
+        virtual Chip8& getCpu() = 0;
+
+        // Run exactly `cycles` instructions, or fewer if the machine halts. Returns false once it has halted.
+        virtual bool run(int cycles) = 0;
+
+        // Replace the machine state, e.g. to go back to a checkpoint
+        virtual void restore(const Chip8State& state) = 0;
+};
+
+// The reference: Chip8::runCycle, one instruction at a time
+class InterpreterEngine : public LockstepEngine
+{
+    public:
+        explicit InterpreterEngine(LogWriter* logWriter);
+        std::string getName() const override;
+        Chip8& getCpu() override;
+        bool run(int cycles) override;
+        void restore(const Chip8State& state) override;
+
+    private:
+        Chip8 cpu;
+};
+
+// CompactChip8, run from the state of a Chip8 that the harness drives and copied back after each run
+class CompactEngine : public LockstepEngine
+{
+    public:
+        explicit CompactEngine(LogWriter* logWriter);
+        std::string getName() const override;
+        Chip8& getCpu() override;
+        bool run(int cycles) override;
+        void restore(const Chip8State& state) override;
+
+    private:
+        Chip8 cpu;
+        RomImage image;
+        std::unique_ptr<CompactChip8> compact; // made on the first run, once the ROM is loaded
+        LogWriter* logWriter;
+};
+
+#ifdef IMIT8_DYNAREC
+class DynarecEngine : public LockstepEngine
+{
+    public:
+        explicit DynarecEngine(LogWriter* logWriter);
+        std::string getName() const override;
+        Chip8& getCpu() override;
+        bool run(int cycles) override;
+        void restore(const Chip8State& state) override;
+
+    private:
+        Chip8 cpu;
+        Dynarec dynarec;
+};
+#endif
+
+class Lockstep
+{
+    public:
+        // Where the engines first disagree
+        struct Divergence
+        {
+            unsigned long long instruction;   // 0-based number of the instruction that differed
+            Chip8State before;                // common state before it ran
+            Chip8State reference;             // states after it ran
+            Chip8State candidate;
+            bool isReferenceRunning;
+            bool isCandidateRunning;
+        };
+
+        Lockstep(LockstepEngine& reference, LockstepEngine& candidate, unsigned long long interval);
+
+        // Load the ROM into both engines and give them the same random number generator state
+        bool load(const std::vector<unsigned char>& rom);
+
+        // Run both for up to `frames` frames of OPCODES_PER_FRAME instructions. keys[f] holds the buttons
+        // down during frame f, one bit per key; frames past the end have none. Stops early when both halt.
+        // Returns false if the engines diverged.
+        bool run(unsigned long long frames, const std::vector<unsigned short>& keys);
+
+        const Divergence& getDivergence() const;
+        unsigned long long getInstructions() const;
+        unsigned long long getCheckpoints() const;
+
+        // Did both engines halt (at the same point) before the frames ran out?
+        bool hasHalted() const;
+
+        // Hashes of the reference state at every checkpoint folded together: a fingerprint of the whole run
+        unsigned long long getTraceHash() const;
+
+        // Describe the divergence: the instruction, both states and where they differ
+        void printDivergence(std::ostream& out) const;
+
+        static unsigned long long hashState(const Chip8State& state);
+
+        // Do the states match in everything an engine is responsible for? (The last opCode fetched and the
+        // dirty flag are bookkeeping and are left out.)
+        static bool isSameState(const Chip8State& a, const Chip8State& b);
+
+    private:
+        LockstepEngine& reference;
+        LockstepEngine& candidate;
+        unsigned long long interval;
+        const std::vector<unsigned short>* keys;
+
+        unsigned long long instructions;
+        unsigned long long checkpoints;
+        unsigned long long traceHash;
+        bool isHalted;
+        Divergence divergence;
+
+        // Run engine over instructions [from, from + count), applying keys at the start of each frame and
+        // ticking the timers at its end. Returns false once the machine has halted.
+        bool advance(LockstepEngine& engine, unsigned long long from, unsigned long long count);
+
+        // Both engines are at the checkpoint states and differ within the next count instructions
+        void bisect(const Chip8State& referenceStart, const Chip8State& candidateStart, unsigned long long from,
+                    unsigned long long count);
+};
+
+#endif //IMIT8_CHIP8_LOCKSTEP_H
@@ -10,21 +10,145 @@
  * "It writes logs."
  */
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#ifdef IMIT8_ZLIB
+#include <zlib.h>
+#endif
 #include "LogWriter.h"
+#include "Metrics.h"
+#include "Tracer.h"
+
+#define LOG_COPY_CHUNK 65536
+// Longest segment number taken from an existing file name: 19 digits, so the next one cannot overflow
+#define LOG_SEGMENT_MAX_DIGITS 19
+
+// Make text safe inside a JSON string
+static std::string
+escapeJson(const std::string& text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (unsigned char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+            escaped += static_cast<char>(c);
+        }
+        else if (c < 0x20)
+        {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        }
+        else
+        {
+            escaped += static_cast<char>(c);
+        }
+    }
+    return escaped;
+}
+
+#ifdef IMIT8_ZLIB
+// Write path as gzip to gzipPath, going through a temporary file so a half-written one is never left behind
+static bool
+gzipFile(const std::string& path, const std::string& gzipPath)
+{
+    FILE* input = std::fopen(path.c_str(), "rb");
+    if (input == nullptr)
+    {
+        return false;
+    }
+    std::string temporary = gzipPath + ".tmp";
+    gzFile output = gzopen(temporary.c_str(), "wb6");
+    bool isGood = output != nullptr;
+    std::vector<char> chunk(LOG_COPY_CHUNK);
+    while (isGood)
+    {
+        size_t read = std::fread(chunk.data(), 1, chunk.size(), input);
+        if (read == 0)
+        {
+            isGood = !std::ferror(input);
+            break;
+        }
+        isGood = gzwrite(output, chunk.data(), static_cast<unsigned int>(read)) == static_cast<int>(read);
+    }
+    std::fclose(input);
+    if (output != nullptr && gzclose(output) != Z_OK)
+    {
+        isGood = false;
+    }
+    if (!isGood || std::rename(temporary.c_str(), gzipPath.c_str()) != 0)
+    {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+#endif
+
+bool LogWriter::LogLevel::
+parse(const std::string& name, Level& level)
+{
+    std::string upper = name;
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    for (Level candidate : {OFF, ERROR, WARNING, INFO, DEBUG})
+    {
+        if (to_string(candidate) == upper)
+        {
+            level = candidate;
+            return true;
+        }
+    }
+    return false;
+}
 
 LogWriter::
 LogWriter(std::string fileToOpen, LogLevel::Level level)
 {
     isFreshLog = true;
-    setOutputFileName("./" + fileToOpen);
-    setCurrentLoggingLevel(level);
-    openFile(outputFileName);
+    metrics = nullptr;
+    tracer = nullptr;
+    format = TEXT;
+    startTime = std::chrono::steady_clock::now();
+    fileOpened = startTime;
+    fileBytes = 0;
+    maxBytes = LOG_DEFAULT_MAX_BYTES;
+    maxSeconds = 0;
+    keep = LOG_DEFAULT_KEEP;
+    nextSegment = 0;
+    isStopping = false;
+    frame.store(~0ULL);
+    setOutputFileName(fileToOpen);
+    setLevel(level);
+    if (level != LogLevel::OFF)
+    {
+        openFile(outputFileName);
+    }
 }
 
 LogWriter::
 ~LogWriter()
 {
     closeFile();
+    if (compressor.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(compressMutex);
+            isStopping = true;
+        }
+        compressCondition.notify_one();
+        compressor.join(); // finishes the segments still queued
+    }
 }
 
 std::string& LogWriter::
@@ -43,6 +167,9 @@ bool LogWriter::
 openFile(std::string fileToOpen)
 {
     outputStream.open(fileToOpen, std::ofstream::app);
+    struct stat status;
+    fileBytes = stat(fileToOpen.c_str(), &status) == 0 ? static_cast<unsigned long long>(status.st_size) : 0;
+    fileOpened = std::chrono::steady_clock::now();
     return outputStream.good();
 }
 
@@ -54,24 +181,14 @@ closeFile()
 }
 
 bool LogWriter::
-writeToFile(std::string levelOfMessage, std::string& stringToWriteToLogfile)
+writeToFile(const std::string& line)
 {
+    TraceScope scope(tracer, "log write");
     if (outputStream.is_open() && outputStream.good())
     {
-        if (isFreshLog)
-        {
-            outputStream.write("------------------------------------------------------------\n", 61);
-            isFreshLog = false;
-        }
-        time_t now = time(nullptr);
-        std::string logTime = ctime(&now);
-        outputStream.write(logTime.c_str(), logTime.length() - 1); // -1 to remove newline
-        outputStream.write("  [", 3);
-        outputStream.write(levelOfMessage.c_str(), levelOfMessage.length());
-        outputStream.write("]  ", 3);
-        outputStream.write(stringToWriteToLogfile.c_str(), stringToWriteToLogfile.length());
-        outputStream.write("\n", 1);
+        outputStream.write(line.c_str(), static_cast<std::streamsize>(line.length()));
         outputStream.flush();
+        fileBytes += line.length();
         return true;
     }
 
@@ -82,21 +199,252 @@ writeToFile(std::string levelOfMessage, std::string& stringToWriteToLogfile)
 bool LogWriter::
 log(LogLevel::Level levelOfMessage, std::string stringToWrite)
 {
-    if (levelOfMessage <= getCurrentLoggingLevel())
+    return log(levelOfMessage, stringToWrite, {});
+}
+
+bool LogWriter::
+log(LogLevel::Level levelOfMessage, std::string stringToWrite, std::initializer_list<Field> fields)
+{
+    if (isLogging(levelOfMessage))
     {
-        return writeToFile(LogLevel::to_string(levelOfMessage), stringToWrite);
+        if (metrics != nullptr)
+        {
+            metrics->countLogRecord(levelOfMessage);
+        }
+        return writeRecord(levelOfMessage, stringToWrite, fields);
     }
     return false;
 }
 
+bool LogWriter::
+writeRecord(LogLevel::Level levelOfMessage, const std::string& message, std::initializer_list<Field> fields)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!outputStream.is_open())
+    {
+        openFile(outputFileName); // logging was switched on after starting OFF
+    }
+    else if ((maxBytes != 0 && fileBytes >= maxBytes) ||
+             (maxSeconds != 0 && now - fileOpened >= std::chrono::seconds(maxSeconds)))
+    {
+        rotate();
+    }
+
+    std::string line;
+    if (format == JSON_LINES)
+    {
+        char seconds[32];
+        std::snprintf(seconds, sizeof(seconds), "%.6f",
+                      std::chrono::duration<double>(now - startTime).count());
+        if (isFreshLog)
+        {
+            // ties the monotonic clock to the wall clock once per file
+            line += "{\"t\":" + std::string(seconds) + ",\"level\":\"INFO\",\"msg\":\"log opened\",\"epoch\":" +
+                    std::to_string(static_cast<long long>(std::time(nullptr))) + "}\n";
+            isFreshLog = false;
+        }
+        line += "{\"t\":" + std::string(seconds) + ",\"level\":\"" + LogLevel::to_string(levelOfMessage) + "\"";
+        unsigned long long currentFrame = frame.load(std::memory_order_relaxed);
+        if (currentFrame != ~0ULL)
+        {
+            line += ",\"frame\":" + std::to_string(currentFrame);
+        }
+        line += ",\"msg\":\"" + escapeJson(message) + "\"";
+        for (const Field& field : fields)
+        {
+            line += ",\"" + escapeJson(field.name) + "\":" + std::to_string(field.value);
+        }
+        line += "}\n";
+    }
+    else
+    {
+        if (isFreshLog)
+        {
+            line += "------------------------------------------------------------\n";
+            isFreshLog = false;
+        }
+        // ctime_r, not ctime: writers on other threads do not share writeMutex, and ctime's buffer is shared
+        time_t wallTime = time(nullptr);
+        char logTime[32];
+        if (ctime_r(&wallTime, logTime) != nullptr)
+        {
+            line.append(logTime, std::strlen(logTime) - 1); // remove the newline
+        }
+        line += "  [" + LogLevel::to_string(levelOfMessage) + "]  " + message;
+        const char* separator = " (";
+        for (const Field& field : fields)
+        {
+            char value[32];
+            std::snprintf(value, sizeof(value), field.isHex ? "0x%04llX" : "%llu", field.value);
+            line += separator + std::string(field.name) + " " + value;
+            separator = ", ";
+        }
+        if (fields.size() != 0)
+        {
+            line += ")";
+        }
+        line += "\n";
+    }
+    return writeToFile(line);
+}
+
+void LogWriter::
+setMetrics(Metrics* metrics)
+{
+    LogWriter::metrics = metrics;
+}
+
+void LogWriter::
+setTracer(Tracer* tracer)
+{
+    LogWriter::tracer = tracer;
+}
+
+void LogWriter::
+setLevel(LogLevel::Level level)
+{
+    currentLoggingLevel.store(level, std::memory_order_relaxed);
+}
+
 LogWriter::LogLevel::Level LogWriter::
-getCurrentLoggingLevel() const
+getLevel() const
+{
+    return static_cast<LogLevel::Level>(currentLoggingLevel.load(std::memory_order_relaxed));
+}
+
+void LogWriter::
+setFormat(Format newFormat)
+{
+    std::lock_guard<std::mutex> lock(writeMutex);
+    format = newFormat;
+}
+
+void LogWriter::
+setRotation(unsigned long long newMaxBytes, unsigned long long newMaxSeconds, unsigned int newKeep)
 {
-    return currentLoggingLevel;
+    std::lock_guard<std::mutex> lock(writeMutex);
+    maxBytes = newMaxBytes;
+    maxSeconds = newMaxSeconds;
+    std::lock_guard<std::mutex> compressLock(compressMutex);
+    keep = newKeep;
 }
 
 void LogWriter::
-setCurrentLoggingLevel(LogWriter::LogLevel::Level currentLoggingLevel)
+setFrame(unsigned long long newFrame)
 {
-    LogWriter::currentLoggingLevel = currentLoggingLevel;
+    frame.store(newFrame, std::memory_order_relaxed);
+}
+
+// With writeMutex held: move the file aside as the next segment and start a fresh one
+void LogWriter::
+rotate()
+{
+    if (nextSegment == 0)
+    {
+        findSegments();
+    }
+    closeFile();
+    std::string segment = outputFileName + "." + std::to_string(nextSegment++);
+    if (std::rename(outputFileName.c_str(), segment.c_str()) != 0)
+    {
+        std::cerr << "ERROR:  Could not rotate " << outputFileName << ": " << std::strerror(errno) << std::endl;
+        openFile(outputFileName);
+        maxBytes = 0; // rather than trying again on every record
+        maxSeconds = 0;
+        return;
+    }
+    openFile(outputFileName);
+    isFreshLog = true;
+    {
+        std::lock_guard<std::mutex> lock(compressMutex);
+        pending.push_back(segment);
+    }
+    if (!compressor.joinable())
+    {
+        compressor = std::thread(&LogWriter::compress, this);
+    }
+    compressCondition.notify_one();
+}
+
+// Before the compressor starts: list the segments earlier runs left, oldest first, and continue their numbering
+void LogWriter::
+findSegments()
+{
+    size_t slash = outputFileName.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : outputFileName.substr(0, slash);
+    std::string prefix = (slash == std::string::npos ? outputFileName : outputFileName.substr(slash + 1)) + ".";
+    std::vector<std::pair<unsigned long long, std::string>> found;
+    DIR* listing = opendir(directory.c_str());
+    while (listing != nullptr)
+    {
+        dirent* entry = readdir(listing);
+        if (entry == nullptr)
+        {
+            break;
+        }
+        std::string name = entry->d_name;
+        if (name.compare(0, prefix.size(), prefix) != 0)
+        {
+            continue;
+        }
+        std::string suffix = name.substr(prefix.size());
+        size_t digits = std::min(suffix.find_first_not_of("0123456789"), suffix.size());
+        std::string rest = suffix.substr(digits);
+        if (digits == 0 || digits > LOG_SEGMENT_MAX_DIGITS || (!rest.empty() && rest != ".gz"))
+        {
+            continue; // not one of ours, e.g. "log.txt." or a number too long to continue from
+        }
+        errno = 0;
+        unsigned long long number = std::strtoull(suffix.c_str(), nullptr, 10);
+        if (errno != ERANGE)
+        {
+            found.push_back(std::make_pair(number, slash == std::string::npos ? name : directory + "/" + name));
+        }
+    }
+    if (listing != nullptr)
+    {
+        closedir(listing);
+    }
+    std::sort(found.begin(), found.end());
+    nextSegment = found.empty() ? 1 : found.back().first + 1;
+    for (const std::pair<unsigned long long, std::string>& segment : found)
+    {
+        segments.push_back(segment.second);
+    }
+}
+
+// Compressor thread: gzip each rotated segment, then drop the oldest beyond `keep`
+void LogWriter::
+compress()
+{
+    for (;;)
+    {
+        std::string segment;
+        unsigned int kept;
+        {
+            std::unique_lock<std::mutex> lock(compressMutex);
+            compressCondition.wait(lock, [this] { return !pending.empty() || isStopping; });
+            if (pending.empty())
+            {
+                return;
+            }
+            segment = pending.front();
+            pending.pop_front();
+            kept = keep;
+        }
+#ifdef IMIT8_ZLIB
+        if (gzipFile(segment, segment + ".gz"))
+        {
+            unlink(segment.c_str());
+            segment += ".gz";
+        }
+#endif
+        segments.push_back(segment);
+        while (segments.size() > kept)
+        {
+            unlink(segments.front().c_str());
+            segments.pop_front();
+        }
+    }
 }
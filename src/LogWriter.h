@@ -7,7 +7,8 @@
 
  /*
  * LogWriter
- * "It writes logs."
+ * "It writes logs." As text lines or as JSON lines with monotonic timestamps and numeric fields, to a file
+ * that is rotated by size or age. Any thread may log; the level can be changed while running.
  */
 
 #ifndef IMIT8_CHIP8_LOGWRITER_H
@@ -17,6 +18,18 @@
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+
+#define LOG_DEFAULT_MAX_BYTES (64ULL << 20)
+#define LOG_DEFAULT_KEEP 4
+
+class Metrics;
+class Tracer;
 
 class LogWriter
 {
@@ -25,13 +38,15 @@ class LogWriter
         {
             enum Level
             {
-                ERROR, WARNING, INFO, DEBUG,
+                OFF, ERROR, WARNING, INFO, DEBUG,
             };
 
             inline static std::string to_string(Level l)
             {
                 switch (l)
                 {
+                    case OFF:
+                        return "OFF";
                     case ERROR:
                         return "ERROR";
                     case WARNING:
@@ -44,6 +59,23 @@ class LogWriter
                         return "UNKNOWN";
                 }
             }
+
+            // Level named by to_string, in any case
+            static bool parse(const std::string& name, Level& level);
+        };
+
+        enum Format
+        {
+            TEXT,           // ctime  [LEVEL]  message (name 0x1F, ...)
+            JSON_LINES      // {"t":seconds since start,"level":"...","frame":n,"msg":"...","name":31,...}
+        };
+
+        // A number attached to a record: a field of its own in JSON, appended to the message in text
+        struct Field
+        {
+            const char* name;
+            unsigned long long value;
+            bool isHex;     // written in hex in text records
         };
 
         explicit LogWriter(std::string fileToOpen = "log.txt", LogLevel::Level level = LogLevel::Level::INFO);
@@ -51,20 +83,69 @@ class LogWriter
 
         std::string& getOutputFileName();
         bool log(LogLevel::Level levelOfMessage, std::string stringToWrite);
+        bool log(LogLevel::Level levelOfMessage, std::string stringToWrite, std::initializer_list<Field> fields);
+
+        // Count every record written in metrics (may be nullptr)
+        void setMetrics(Metrics* metrics);
+
+        // Mark each write to the file in tracer's timeline (may be nullptr)
+        void setTracer(Tracer* tracer);
+
+        // Would a message at this level be written? Cheap enough to guard expensive messages with.
+        inline bool isLogging(LogLevel::Level levelOfMessage) const
+        {
+            return levelOfMessage <= currentLoggingLevel.load(std::memory_order_relaxed);
+        }
+
+        // Safe from any thread and from signal handlers. Raising the level from OFF opens the file.
+        void setLevel(LogLevel::Level level);
+        LogLevel::Level getLevel() const;
+
+        void setFormat(Format format);
+
+        // Start a new file when this one reaches maxBytes or is maxSeconds old (0 turns either check off).
+        // The old one becomes PATH.N, N counting up across runs, and is compressed to PATH.N.gz in the
+        // background when built with zlib. Only the newest `keep` of them are kept.
+        void setRotation(unsigned long long maxBytes, unsigned long long maxSeconds, unsigned int keep);
+
+        // Frame number for the JSON records that follow. Cheap enough to call every frame.
+        void setFrame(unsigned long long frame);
 
     private:
         std::string outputFileName = "";
         std::ofstream outputStream;
-        LogLevel::Level currentLoggingLevel;
+        std::atomic<int> currentLoggingLevel;
+        std::atomic<unsigned long long> frame;
         bool isFreshLog;
+        Metrics* metrics;
+        Tracer* tracer;
+
+        std::mutex writeMutex;              // guards the stream and everything below
+        Format format;
+        std::chrono::steady_clock::time_point startTime;
+        std::chrono::steady_clock::time_point fileOpened;
+        unsigned long long fileBytes;
+        unsigned long long maxBytes;
+        unsigned long long maxSeconds;
+        unsigned int keep;
+        unsigned long long nextSegment;     // 0 until the existing segments have been looked for
+
+        // Compresses rotated segments and removes the oldest, started at the first rotation
+        std::thread compressor;
+        std::mutex compressMutex;           // guards pending and isStopping
+        std::condition_variable compressCondition;
+        std::deque<std::string> pending;
+        std::deque<std::string> segments;   // compressor thread only, after the first rotation: oldest first
+        bool isStopping;
 
         void setOutputFileName(const std::string& outputFileName);
         bool openFile(std::string fileToOpen);
         bool closeFile();
-        bool writeToFile(std::string levelOfMessage, std::string& stringToWriteToLogfile);
-
-        LogLevel::Level getCurrentLoggingLevel() const;
-        void setCurrentLoggingLevel(LogLevel::Level currentLoggingLevel);
+        bool writeToFile(const std::string& line);
+        bool writeRecord(LogLevel::Level levelOfMessage, const std::string& message, std::initializer_list<Field> fields);
+        void rotate();
+        void findSegments();
+        void compress();
 };
 
 #endif //IMIT8_CHIP8_LOGWRITER_H
@@ -0,0 +1,212 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Metrics
+ * Counters and gauges describing a running machine, exported in the Prometheus text format to a
+ * file or to whoever connects to a Unix domain socket.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Metrics.h"
+
+// How often the server thread checks whether it should stop
+#define METRICS_POLL_MILLISECONDS 200
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static void
+writeHeader(std::ostream& out, const char* name, const char* help, const char* type)
+{
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+}
+
+Metrics::
+Metrics()
+{
+    for (std::atomic<unsigned long long>& counter : opCodes)
+    {
+        counter.store(0);
+    }
+    for (std::atomic<unsigned long long>& counter : logRecords)
+    {
+        counter.store(0);
+    }
+    nativeInstructions.store(0);
+    idleSkipped.store(0);
+    frames.store(0);
+    lateFrames.store(0);
+    dirtyFrames.store(0);
+    drawCalls.store(0);
+    lastFrameMicroseconds.store(0);
+    startTime = static_cast<long long>(time(nullptr));
+    isServing.store(false);
+    serverSocket = -1;
+}
+
+Metrics::
+~Metrics()
+{
+    stopServer();
+}
+
+std::string Metrics::
+render() const
+{
+    std::stringstream out;
+    unsigned long long interpreted = 0;
+    for (const std::atomic<unsigned long long>& counter : opCodes)
+    {
+        interpreted += counter.load(std::memory_order_relaxed);
+    }
+
+    writeHeader(out, "imit8_instructions_total", "Chip-8 instructions executed.", "counter");
+    out << "imit8_instructions_total{tier=\"interpreter\"} " << interpreted << "\n";
+    out << "imit8_instructions_total{tier=\"native\"} " << nativeInstructions.load(std::memory_order_relaxed) << "\n";
+
+    writeHeader(out, "imit8_idle_skipped_instructions_total",
+                "Instruction slots skipped at the end of frames spent in a wait loop.", "counter");
+    out << "imit8_idle_skipped_instructions_total " << idleSkipped.load(std::memory_order_relaxed) << "\n";
+
+    writeHeader(out, "imit8_opcodes_total", "Interpreted instructions by opCode class (first hex digit).", "counter");
+    for (int i = 0; i < METRICS_OPCODE_CLASSES; ++i)
+    {
+        out << "imit8_opcodes_total{class=\"" << std::uppercase << std::hex << i << std::dec << "\"} "
+            << opCodes[i].load(std::memory_order_relaxed) << "\n";
+    }
+
+    writeHeader(out, "imit8_frames_total", "Frames run.", "counter");
+    out << "imit8_frames_total " << frames.load(std::memory_order_relaxed) << "\n";
+    writeHeader(out, "imit8_frames_late_total", "Frames that took longer than their 1/60 s slot.", "counter");
+    out << "imit8_frames_late_total " << lateFrames.load(std::memory_order_relaxed) << "\n";
+    writeHeader(out, "imit8_dirty_frames_total", "Frames that changed the screen.", "counter");
+    out << "imit8_dirty_frames_total " << dirtyFrames.load(std::memory_order_relaxed) << "\n";
+    writeHeader(out, "imit8_draw_calls_total", "Times the display was redrawn.", "counter");
+    out << "imit8_draw_calls_total " << drawCalls.load(std::memory_order_relaxed) << "\n";
+
+    writeHeader(out, "imit8_log_records_total", "Records written to the log.", "counter");
+    for (int i = LogWriter::LogLevel::ERROR; i < METRICS_LOG_LEVELS; ++i)
+    {
+        out << "imit8_log_records_total{level=\""
+            << LogWriter::LogLevel::to_string(static_cast<LogWriter::LogLevel::Level>(i)) << "\"} "
+            << logRecords[i].load(std::memory_order_relaxed) << "\n";
+    }
+
+    writeHeader(out, "imit8_frame_duration_microseconds", "Time spent on the last frame, sleep excluded.", "gauge");
+    out << "imit8_frame_duration_microseconds " << lastFrameMicroseconds.load(std::memory_order_relaxed) << "\n";
+    writeHeader(out, "imit8_start_time_seconds", "Start time of the emulator since the Unix epoch.", "gauge");
+    out << "imit8_start_time_seconds " << startTime << "\n";
+    return out.str();
+}
+
+bool Metrics::
+writeTextfile(const std::string& path) const
+{
+    std::string temporaryPath = path + ".tmp";
+    std::ofstream outputStream(temporaryPath, std::ofstream::trunc);
+    if (!outputStream.good())
+    {
+        return false;
+    }
+    outputStream << render();
+    outputStream.close();
+    if (!outputStream.good())
+    {
+        return false;
+    }
+    return std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+}
+
+bool Metrics::
+startServer(const std::string& path, LogWriter* logWriter)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Metrics socket path is too long (" + path + ")");
+        return false;
+    }
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    serverSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (serverSocket < 0)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, std::string("Metrics socket: ") + std::strerror(errno));
+        return false;
+    }
+    unlink(path.c_str()); // a socket left behind by an earlier run
+    if (bind(serverSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(serverSocket, 8) != 0)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Metrics socket (" + path + "): " + std::strerror(errno));
+        close(serverSocket);
+        serverSocket = -1;
+        return false;
+    }
+
+    serverPath = path;
+    isServing.store(true);
+    server = std::thread(&Metrics::serve, this);
+    logWriter->log(LogWriter::LogLevel::INFO, "Serving metrics on " + path);
+    return true;
+}
+
+void Metrics::
+stopServer()
+{
+    if (!isServing.exchange(false))
+    {
+        return;
+    }
+    server.join();
+    close(serverSocket);
+    serverSocket = -1;
+    unlink(serverPath.c_str());
+}
+
+// Server thread: hand every client the current metrics, then hang up
+void Metrics::
+serve()
+{
+    while (isServing.load())
+    {
+        pollfd listening = {serverSocket, POLLIN, 0};
+        if (poll(&listening, 1, METRICS_POLL_MILLISECONDS) <= 0)
+        {
+            continue;
+        }
+        int client = accept(serverSocket, nullptr, nullptr);
+        if (client < 0)
+        {
+            continue;
+        }
+        std::string text = render();
+        size_t written = 0;
+        while (written < text.size())
+        {
+            ssize_t result = send(client, text.data() + written, text.size() - written, MSG_NOSIGNAL);
+            if (result <= 0)
+            {
+                break;
+            }
+            written += static_cast<size_t>(result);
+        }
+        close(client);
+    }
+}
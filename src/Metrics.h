@@ -0,0 +1,108 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Metrics
+ * Counters and gauges describing a running machine, exported in the Prometheus text format to a
+ * file or to whoever connects to a Unix domain socket.
+ */
+
+#ifndef IMIT8_CHIP8_METRICS_H
+#define IMIT8_CHIP8_METRICS_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include "LogWriter.h"
+
+#define METRICS_OPCODE_CLASSES 16
+#define METRICS_LOG_LEVELS 5
+
+class Metrics
+{
+    public:
+        Metrics();
+        ~Metrics();
+
+        // Hot path. Each counter has a single writer (the emulation thread), so an increment is a relaxed
+        // load and store rather than a locked read-modify-write; exporters only ever read.
+        inline void countOpCode(unsigned short opCode)
+        {
+            add(opCodes[opCode >> 12], 1);
+        }
+
+        inline void countNativeInstructions(unsigned long long count)
+        {
+            add(nativeInstructions, count);
+        }
+
+        inline void countIdleSkipped(unsigned long long count)
+        {
+            add(idleSkipped, count);
+        }
+
+        inline void countFrame(bool isLate, bool isDirty, long long frameMicroseconds)
+        {
+            add(frames, 1);
+            if (isLate)
+            {
+                add(lateFrames, 1);
+            }
+            if (isDirty)
+            {
+                add(dirtyFrames, 1);
+            }
+            lastFrameMicroseconds.store(frameMicroseconds, std::memory_order_relaxed);
+        }
+
+        inline void countDrawCall()
+        {
+            add(drawCalls, 1);
+        }
+
+        // May be called from any thread that logs
+        inline void countLogRecord(LogWriter::LogLevel::Level level)
+        {
+            logRecords[level].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // All metrics in the Prometheus text exposition format
+        std::string render() const;
+
+        // Write render() to path, replacing it atomically (write to path.tmp, then rename)
+        bool writeTextfile(const std::string& path) const;
+
+        // Serve render() to every client that connects to a Unix domain socket at path
+        bool startServer(const std::string& path, LogWriter* logWriter);
+        void stopServer();
+
+    private:
+        std::atomic<unsigned long long> opCodes[METRICS_OPCODE_CLASSES];
+        std::atomic<unsigned long long> nativeInstructions;
+        std::atomic<unsigned long long> idleSkipped;
+        std::atomic<unsigned long long> frames;
+        std::atomic<unsigned long long> lateFrames;
+        std::atomic<unsigned long long> dirtyFrames;
+        std::atomic<unsigned long long> drawCalls;
+        std::atomic<unsigned long long> logRecords[METRICS_LOG_LEVELS];
+        std::atomic<long long> lastFrameMicroseconds;
+        long long startTime; // seconds since the epoch
+
+        std::thread server;
+        std::atomic<bool> isServing;
+        int serverSocket;
+        std::string serverPath;
+
+        inline static void add(std::atomic<unsigned long long>& counter, unsigned long long amount)
+        {
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+
+        void serve();
+};
+
+#endif //IMIT8_CHIP8_METRICS_H
@@ -0,0 +1,329 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * PerfCounters
+ * Counter groups from perf_event_open, bracketed reads and the report.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include "PerfCounters.h"
+
+static const char* EVENT_NAMES[PERF_EVENTS] = {"cycles", "instructions", "branches", "branch misses", "cache misses",
+                                               "ns"};
+
+PerfCounters::
+PerfCounters(LogWriter* logWrit)
+{
+    logWriter = logWrit;
+    leader = -1;
+    for (int i = 0; i < PERF_EVENTS; ++i)
+    {
+        descriptors[i] = -1;
+        slots[i] = -1;
+    }
+    openEvents = 0;
+    instructions = 0;
+    sampleInterval = 0;
+    untilSample = 0;
+    gapState = PERF_SAMPLE_SEED;
+    samplesTaken = 0;
+    std::memset(&overhead, 0, sizeof(overhead));
+    std::memset(sectionStart, 0, sizeof(sectionStart));
+    std::memset(sections, 0, sizeof(sections));
+    std::memset(&sampleStart, 0, sizeof(sampleStart));
+    std::memset(classes, 0, sizeof(classes));
+}
+
+PerfCounters::
+~PerfCounters()
+{
+    for (int descriptor : descriptors)
+    {
+        if (descriptor >= 0)
+        {
+            close(descriptor);
+        }
+    }
+}
+
+bool PerfCounters::
+open(unsigned int interval)
+{
+#ifdef __linux__
+    static const unsigned int TYPES[PERF_EVENTS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+                                                    PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE};
+    static const unsigned long long CONFIGS[PERF_EVENTS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                            PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+                                                            PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES,
+                                                            PERF_COUNT_SW_TASK_CLOCK};
+    for (int event = 0; event < PERF_EVENTS; ++event)
+    {
+        perf_event_attr attributes;
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = TYPES[event];
+        attributes.config = CONFIGS[event];
+        attributes.disabled = leader < 0;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        attributes.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        int descriptor = static_cast<int>(syscall(__NR_perf_event_open, &attributes, 0, -1, leader,
+                                                  PERF_FLAG_FD_CLOEXEC));
+        if (descriptor < 0)
+        {
+            refused += std::string(refused.empty() ? "" : ", ") + EVENT_NAMES[event] + " (" + std::strerror(errno) + ")";
+            continue;
+        }
+        if (leader < 0)
+        {
+            leader = descriptor;
+        }
+        descriptors[event] = descriptor;
+        slots[event] = openEvents++;
+    }
+#else
+    refused = "perf_event_open is Linux only";
+#endif
+    if (leader < 0)
+    {
+        logWriter->log(LogWriter::LogLevel::WARNING, "Host counters are not available: " + refused);
+        return false;
+    }
+#ifdef __linux__
+    ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    calibrate();
+    sampleInterval = interval;
+    untilSample = interval == 0 ? 0 : nextGap();
+    if (!refused.empty())
+    {
+        logWriter->log(LogWriter::LogLevel::WARNING, "Some host counters are not available: " + refused);
+    }
+    return true;
+}
+
+bool PerfCounters::
+isOpen() const
+{
+    return leader >= 0;
+}
+
+// Instructions until the next sample: sampleInterval, give or take up to half of it at random. A fixed gap
+// would alias with loops whose length divides it, sampling the same few instructions of them every time.
+unsigned int PerfCounters::
+nextGap()
+{
+    // xorshift32 (Marsaglia), as for the emulated random numbers
+    unsigned int x = gapState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    gapState = x;
+    unsigned int jitter = sampleInterval / 2;
+    return sampleInterval - jitter + x % (2 * jitter + 1);
+}
+
+// Time enabled and running come first in a group read, then the counts in the order the events were opened
+bool PerfCounters::
+read(Reading& reading) const
+{
+    unsigned long long buffer[3 + PERF_EVENTS];
+    ssize_t length = ::read(leader, buffer, sizeof(buffer));
+    reading.isValid = length >= static_cast<ssize_t>((3 + openEvents) * sizeof(buffer[0]));
+    if (!reading.isValid)
+    {
+        return false;
+    }
+    reading.enabled = buffer[1];
+    reading.running = buffer[2];
+    for (int event = 0; event < PERF_EVENTS; ++event)
+    {
+        reading.values[event] = slots[event] < 0 ? 0 : buffer[3 + slots[event]];
+    }
+    return true;
+}
+
+// Add what has been counted since start, scaled by enabled / running time in case the kernel multiplexed
+// the group with others. A start whose read failed holds the last good reading, not this bracket's, so
+// the bracket only counts as missed.
+bool PerfCounters::
+addDelta(const Reading& start, Totals& totals) const
+{
+    Reading now;
+    if (!start.isValid || !read(now))
+    {
+        ++totals.missed;
+        return false;
+    }
+    unsigned long long running = now.running - start.running;
+    if (running == 0)
+    {
+        ++totals.missed;
+        return false;
+    }
+    double scale = static_cast<double>(now.enabled - start.enabled) / running;
+    for (int event = 0; event < PERF_EVENTS; ++event)
+    {
+        totals.values[event] += static_cast<double>(now.values[event] - start.values[event]) * scale;
+    }
+    ++totals.brackets;
+    return true;
+}
+
+// The mean cost of a bracket around nothing: about one read() call
+void PerfCounters::
+calibrate()
+{
+    Totals totals;
+    std::memset(&totals, 0, sizeof(totals));
+    for (int i = 0; i < PERF_CALIBRATION_SAMPLES; ++i)
+    {
+        Reading start;
+        if (read(start))
+        {
+            addDelta(start, totals);
+        }
+    }
+    for (int event = 0; event < PERF_EVENTS; ++event)
+    {
+        overhead.values[event] = totals.brackets == 0 ? 0 : totals.values[event] / totals.brackets;
+    }
+    overhead.brackets = 1;
+}
+
+void PerfCounters::
+beginSection(Section section)
+{
+    if (leader >= 0)
+    {
+        read(sectionStart[section]);
+    }
+}
+
+void PerfCounters::
+endSection(Section section)
+{
+    if (leader >= 0)
+    {
+        addDelta(sectionStart[section], sections[section]);
+    }
+}
+
+void PerfCounters::
+addInstructions(unsigned long long count)
+{
+    instructions += count;
+}
+
+void PerfCounters::
+beginSample()
+{
+    read(sampleStart);
+}
+
+void PerfCounters::
+endSample(unsigned short opCode)
+{
+    ++samplesTaken;
+    addDelta(sampleStart, classes[opCode >> 12]);
+}
+
+// An event's total less lessCount brackets of overhead
+double PerfCounters::
+net(const Totals& totals, Event event, const double* less, double lessCount) const
+{
+    return totals.values[event] - (less != nullptr ? less[event] * lessCount : 0);
+}
+
+// "12.345 cycles, ..." for the open events: totals less lessCount brackets of overhead, over count. With
+// both branch events open, the share of branches mispredicted follows.
+std::string PerfCounters::
+describe(const Totals& totals, double count, const double* less, double lessCount) const
+{
+    std::stringstream text;
+    text << std::fixed << std::setprecision(3);
+    for (int event = 0; event < PERF_EVENTS; ++event)
+    {
+        if (slots[event] < 0)
+        {
+            continue;
+        }
+        double value = net(totals, static_cast<Event>(event), less, lessCount);
+        text << (text.tellp() == 0 ? "" : ", ") << (value > 0 && count > 0 ? value / count : 0) << ' '
+             << EVENT_NAMES[event];
+    }
+    if (slots[BRANCHES] >= 0 && slots[BRANCH_MISSES] >= 0)
+    {
+        double branches = net(totals, BRANCHES, less, lessCount);
+        double misses = net(totals, BRANCH_MISSES, less, lessCount);
+        text << std::setprecision(2) << ", " << (branches > 0 && misses > 0 ? misses * 100 / branches : 0)
+             << "% of branches mispredicted";
+    }
+    return text.str();
+}
+
+// Each sample's two reads fall inside the emulation section and cost about a bracket each, so twice the
+// calibrated bracket comes off the section per sample
+std::string PerfCounters::
+report() const
+{
+    std::stringstream text;
+    if (leader < 0)
+    {
+        text << "Host counters: not available (" << refused << ").";
+        return text.str();
+    }
+    const Totals& emulate = sections[EMULATE];
+    const Totals& present = sections[PRESENT];
+    text << "Host counters";
+    if (!refused.empty())
+    {
+        text << " (not available: " << refused << ")";
+    }
+    if (slots[BRANCHES] < 0 && slots[BRANCH_MISSES] >= 0)
+    {
+        text << " (branches are not counted, so branch misses are per instruction, not a mispredict rate)";
+    }
+    text << ":\n  emulating, per emulated instruction (" << instructions << " over " << emulate.brackets
+         << " frames): " << describe(emulate, static_cast<double>(instructions), overhead.values,
+                                                               2.0 * samplesTaken) << '\n';
+    text << "  presenting, per frame presented (" << present.brackets << "): "
+         << describe(present, static_cast<double>(present.brackets), nullptr, 0) << '\n';
+    if (emulate.missed + present.missed != 0)
+    {
+        text << "  " << emulate.missed + present.missed << " frames were not counted: the counters were not scheduled\n";
+    }
+    if (sampleInterval != 0)
+    {
+        text << "  per instruction by opCode class (1 in " << sampleInterval << " sampled, a bracket of "
+             << describe(overhead, 1, nullptr, 0) << " taken off each):";
+        for (int opClass = 0; opClass < PERF_OPCODE_CLASSES; ++opClass)
+        {
+            const Totals& sampled = classes[opClass];
+            if (sampled.brackets == 0)
+            {
+                continue;
+            }
+            text << "\n    " << std::hex << std::uppercase << opClass << std::dec << "XXX  " << std::setw(8)
+                 << sampled.brackets << " samples: "
+                 << describe(sampled, static_cast<double>(sampled.brackets), overhead.values,
+                             static_cast<double>(sampled.brackets));
+        }
+    }
+    return text.str();
+}
@@ -0,0 +1,134 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * PerfCounters
+ * Host hardware counters (cycles, instructions, branches, branch misses, cache misses, plus CPU time) read
+ * through perf_event_open, counting this thread in user space only. Two kinds of measurement:
+ *   - sections: the emulation part and the present part of each frame, bracketed by the frame loop
+ *   - samples: one instruction in every interval on average, bracketed inside Chip8::runCycle and filed by
+ *     opCode class, for costs per class. The gap between samples varies at random by up to half the interval
+ *     either way, so a loop whose length divides the interval is not always sampled at the same instructions.
+ * Each bracket is two read() calls on the counter group. Their own cost is measured once on open and taken
+ * off again, so samples do not inflate the numbers they are mixed into.
+ *
+ * Whatever the host does not allow (containers often have no PMU, or perf_event_paranoid forbids it) is
+ * simply left out of the report; if nothing opens at all the emulator runs on as if counters were never
+ * asked for.
+ */
+
+#ifndef IMIT8_CHIP8_PERFCOUNTERS_H
+#define IMIT8_CHIP8_PERFCOUNTERS_H
+
+#include <string>
+#include "LogWriter.h"
+
+#define PERF_EVENTS 6
+#define PERF_OPCODE_CLASSES 16
+#define PERF_DEFAULT_SAMPLE_INTERVAL 64
+#define PERF_CALIBRATION_SAMPLES 256
+#define PERF_SAMPLE_SEED 0x9E3779B9u  // xorshift32 must not start at 0
+
+class PerfCounters
+{
+    public:
+        enum Event
+        {
+            CYCLES,
+            INSTRUCTIONS,
+            BRANCHES,
+            BRANCH_MISSES,
+            CACHE_MISSES,
+            TASK_CLOCK        // nanoseconds on the CPU; a software event, so usually there even without a PMU
+        };
+
+        enum Section
+        {
+            EMULATE,
+            PRESENT,
+            SECTIONS
+        };
+
+        explicit PerfCounters(LogWriter* logWriter);
+        ~PerfCounters();
+
+        // Open every counter the host allows. sampleInterval is the mean number of instructions between
+        // samples, 0 for none. Returns false, having logged why, when none could be opened.
+        bool open(unsigned int sampleInterval);
+        bool isOpen() const;
+
+        // Bracket a section of the frame
+        void beginSection(Section section);
+        void endSection(Section section);
+
+        // Emulated instructions that ran as native code, so never passed through countInstruction
+        void addInstructions(unsigned long long count);
+
+        // Hot path, once per interpreted instruction. True when this instruction is to be sampled: the
+        // caller then brackets it with beginSample() and endSample().
+        inline bool countInstruction()
+        {
+            ++instructions;
+            if (untilSample == 0 || --untilSample != 0)
+            {
+                return false;
+            }
+            untilSample = nextGap();
+            return true;
+        }
+
+        void beginSample();
+        void endSample(unsigned short opCode);
+
+        // Per emulated instruction and per frame figures, and per opCode class ones from the samples
+        std::string report() const;
+
+    private:
+        // Counts from one read of the group, with the times it was enabled and actually counting
+        struct Reading
+        {
+            unsigned long long values[PERF_EVENTS];
+            unsigned long long enabled;
+            unsigned long long running;
+            bool isValid;                    // false after a failed read, so no delta is taken from it
+        };
+
+        struct Totals
+        {
+            double values[PERF_EVENTS];
+            unsigned long long brackets;     // how many were added up
+            unsigned long long missed;       // brackets during which the group was not scheduled at all
+        };
+
+        LogWriter* logWriter;
+        int leader;                         // group leader descriptor, -1 when closed
+        int descriptors[PERF_EVENTS];       // -1 for events the host refused
+        int slots[PERF_EVENTS];             // position of each event in a group read, -1 if absent
+        int openEvents;
+        std::string refused;                // "name (reason), ..." for the report
+
+        unsigned long long instructions;
+        unsigned int sampleInterval;
+        unsigned int untilSample;
+        unsigned int gapState;              // xorshift32 state for the gaps between samples
+
+        Totals overhead;                    // the mean cost of one bracket, from calibration
+        Reading sectionStart[SECTIONS];
+        Totals sections[SECTIONS];
+        unsigned long long samplesTaken;
+        Reading sampleStart;
+        Totals classes[PERF_OPCODE_CLASSES];
+
+        unsigned int nextGap();
+        bool read(Reading& reading) const;
+        bool addDelta(const Reading& start, Totals& totals) const;
+        void calibrate();
+        double net(const Totals& totals, Event event, const double* less, double lessCount) const;
+        std::string describe(const Totals& totals, double count, const double* less, double lessCount) const;
+};
+
+#endif //IMIT8_CHIP8_PERFCOUNTERS_H
@@ -0,0 +1,419 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Recompiler
+ * Ahead-of-time translation of a Chip-8 ROM into a C++ translation unit for AotRuntime.
+ */
+
+#include "Disassembler.h"
+#include "Recompiler.h"
+
+// Long straight-line runs are split so that no single generated function gets unreasonably large.
+#define MAX_BLOCK_INSTRUCTIONS 256
+
+static std::string
+hex(unsigned int number, int width = 3)
+{
+    std::stringstream sstream;
+    sstream << "0x" << std::uppercase << std::setfill('0') << std::setw(width) << std::hex << number;
+    return sstream.str();
+}
+
+static std::string
+reg(unsigned int number)
+{
+    return "s.registers[" + hex(number & 0xF, 1) + "]";
+}
+
+// Hand the instruction at `address` back to the interpreter without running it
+static std::string
+bailOut(unsigned short address)
+{
+    return "{ s.progCounter = " + hex(address) + "; return n; }";
+}
+
+Recompiler::
+Recompiler(const std::vector<unsigned char>& romImage)
+{
+    rom = romImage;
+    isReachable.assign(MEMORY_SIZE, false);
+    isLeader.assign(MEMORY_SIZE, false);
+    compiledInstructions = 0;
+    interpretedInstructions = 0;
+}
+
+void Recompiler::
+analyze()
+{
+    std::vector<unsigned short> workList;
+    workList.push_back(CODE_START);
+    isLeader[CODE_START] = true;
+
+    while (!workList.empty())
+    {
+        unsigned short address = workList.back();
+        workList.pop_back();
+        if (!isInRom(address) || isReachable[address])
+        {
+            continue;
+        }
+        isReachable[address] = true;
+
+        unsigned short opCode = fetch(address);
+        std::vector<unsigned short> successors;
+        switch (Disassembler::getFlowType(opCode))
+        {
+            case Disassembler::NEXT:
+                successors.push_back(address + 2);
+                if (Disassembler::needsInterpreter(address, opCode))
+                {
+                    isLeader[(address + 2) % MEMORY_SIZE] = true;
+                }
+                break;
+
+            case Disassembler::JUMP:
+                successors.push_back(Disassembler::getTarget(opCode));
+                isLeader[Disassembler::getTarget(opCode)] = true;
+                break;
+
+            case Disassembler::CALL:
+                successors.push_back(Disassembler::getTarget(opCode));
+                successors.push_back(address + 2);
+                isLeader[Disassembler::getTarget(opCode)] = true;
+                isLeader[(address + 2) % MEMORY_SIZE] = true;
+                break;
+
+            case Disassembler::SKIP:
+                successors.push_back(address + 2);
+                successors.push_back(address + 4);
+                isLeader[(address + 2) % MEMORY_SIZE] = true;
+                isLeader[(address + 4) % MEMORY_SIZE] = true;
+                break;
+
+            // RETURN lands after a CALL, which is already a leader. COMPUTED and INVALID are left to the
+            // interpreter, which finds their targets (or halts) at run time.
+            default:
+                break;
+        }
+        for (unsigned short successor : successors)
+        {
+            if (successor < MEMORY_SIZE)
+            {
+                workList.push_back(successor);
+            }
+        }
+    }
+
+    // Form blocks from each leader not already covered by an earlier block.
+    std::vector<bool> isCovered(MEMORY_SIZE, false);
+    for (unsigned int leader = CODE_START; leader < MEMORY_SIZE; ++leader)
+    {
+        if (!isLeader[leader] || !isReachable[leader] || isCovered[leader])
+        {
+            continue;
+        }
+
+        unsigned int address = leader;
+        int length = 0;
+        while (isInRom(address) && isReachable[address] && length < MAX_BLOCK_INSTRUCTIONS)
+        {
+            unsigned short opCode = fetch(address);
+            if (Disassembler::needsInterpreter(static_cast<unsigned short>(address), opCode))
+            {
+                break;
+            }
+            isCovered[address] = true;
+            address += 2;
+            ++length;
+            if (isTerminator(opCode))
+            {
+                break;
+            }
+        }
+        if (length > 0)
+        {
+            Block block = {static_cast<unsigned short>(leader), static_cast<unsigned short>(address)};
+            blocks.push_back(block);
+        }
+    }
+
+    for (unsigned int address = CODE_START; address < MEMORY_SIZE; ++address)
+    {
+        if (isReachable[address])
+        {
+            if (isCovered[address])
+            {
+                ++compiledInstructions;
+            }
+            else
+            {
+                ++interpretedInstructions;
+            }
+        }
+    }
+}
+
+void Recompiler::
+writeSource(std::ostream& out, const std::string& romName)
+{
+    out << "// Generated by imit8_recomp from " << romName << ". Do not edit.\n";
+    out << "// " << blocks.size() << " blocks, " << compiledInstructions << " recompiled instructions, "
+        << interpretedInstructions << " left to the interpreter.\n\n";
+    out << "#include <cstring>\n";
+    out << "#include \"AotRuntime.h\"\n\n";
+
+    out << "static const unsigned char romImage[] = {";
+    for (size_t i = 0; i < rom.size(); ++i)
+    {
+        out << (i % 16 == 0 ? "\n    " : " ") << hex(rom[i], 2) << ",";
+    }
+    out << "\n};\n";
+
+    for (const Block& block : blocks)
+    {
+        out << "\n// " << hex(block.start) << " - " << hex(block.end - 2u) << "\n";
+        out << "static int block_" << hex(block.start) << "(Chip8State& s, int budget)\n{\n";
+        out << "    int n = 0;\n";
+        out << "    switch (s.progCounter)\n    {\n";
+        out << "        default:\n            return 0;\n";
+
+        bool isTerminated = false;
+        for (unsigned short address = block.start; address < block.end; address += 2)
+        {
+            unsigned short opCode = fetch(address);
+            out << "        case " << hex(address) << ": // " << Disassembler::toString(opCode) << "\n";
+            out << "            if (n == budget) " << bailOut(address) << "\n";
+            out << emitInstruction(address, opCode);
+            isTerminated = isTerminator(opCode);
+            if (!isTerminated && address + 2 < block.end)
+            {
+                out << "            // fall through\n"; // into the next instruction; quiets -Wimplicit-fallthrough
+            }
+        }
+        out << "    }\n";
+        if (!isTerminated)
+        {
+            out << "    s.progCounter = " << hex(block.end) << ";\n";
+            out << "    return n;\n";
+        }
+        out << "}\n";
+    }
+
+    out << "\nstatic const AotBlock blocks[] = {\n";
+    for (const Block& block : blocks)
+    {
+        out << "    {" << hex(block.start) << ", " << hex(block.end) << ", block_" << hex(block.start) << "},\n";
+    }
+    if (blocks.empty())
+    {
+        out << "    {0, 0, nullptr},\n";
+    }
+    out << "};\n\n";
+    out << "extern const AotProgram imit8AotProgram = {romImage, " << rom.size() << ", blocks, " << blocks.size()
+        << "};\n";
+}
+
+void Recompiler::
+writeListing(std::ostream& out)
+{
+    for (const Block& block : blocks)
+    {
+        out << "block " << hex(block.start) << ":\n";
+        for (unsigned short address = block.start; address < block.end; address += 2)
+        {
+            out << "  " << hex(address) << "  " << hex(fetch(address), 4) << "  "
+                << Disassembler::toString(fetch(address)) << "\n";
+        }
+    }
+    for (unsigned int address = CODE_START; address < MEMORY_SIZE; ++address)
+    {
+        bool isInBlock = false;
+        for (const Block& block : blocks)
+        {
+            isInBlock |= address >= block.start && address < block.end && (address - block.start) % 2 == 0;
+        }
+        if (isReachable[address] && !isInBlock)
+        {
+            out << "interpreted " << hex(address) << "  " << hex(fetch(address), 4) << "  "
+                << Disassembler::toString(fetch(address)) << "\n";
+        }
+    }
+}
+
+size_t Recompiler::
+getBlockCount() const
+{
+    return blocks.size();
+}
+
+unsigned int Recompiler::
+getCompiledInstructions() const
+{
+    return compiledInstructions;
+}
+
+unsigned int Recompiler::
+getInterpretedInstructions() const
+{
+    return interpretedInstructions;
+}
+
+bool Recompiler::
+isInRom(unsigned int address) const
+{
+    return address >= CODE_START && address + 1 < CODE_START + rom.size();
+}
+
+unsigned short Recompiler::
+fetch(unsigned int address) const
+{
+    return static_cast<unsigned short>(rom[address - CODE_START] << 8 | rom[address - CODE_START + 1]);
+}
+
+bool Recompiler::
+isTerminator(unsigned short opCode)
+{
+    return Disassembler::getFlowType(opCode) != Disassembler::NEXT;
+}
+
+std::string Recompiler::
+emitInstruction(unsigned short address, unsigned short opCode)
+{
+    unsigned short x = (opCode >> 8) & 0xF;
+    unsigned short y = (opCode >> 4) & 0xF;
+    unsigned short n = opCode & 0xF;
+    std::string nn = hex(opCode & 0xFF, 2);
+    std::string nnn = hex(opCode & 0xFFF);
+    std::string skip = hex(address + 4u);
+    std::string next = hex(address + 2u);
+    std::string indent = "            ";
+    std::string code;
+
+    switch (opCode >> 12)
+    {
+        case 0x0:
+            if (opCode == 0x00E0)
+            {
+                code = "Chip8::clearScreen(s);";
+            }
+            else
+            {
+                code = "if (s.stackPointer == 0) " + bailOut(address) + "\n" + indent +
+                       "s.progCounter = s.callStack[--s.stackPointer];\n" + indent + "return n + 1;";
+            }
+            break;
+        case 0x1:
+            code = "s.progCounter = " + nnn + ";\n" + indent + "return n + 1;";
+            break;
+        case 0x2:
+            code = "if (s.stackPointer >= STACK_DEPTH) " + bailOut(address) + "\n" + indent +
+                   "s.callStack[s.stackPointer++] = " + next + ";\n" + indent +
+                   "s.progCounter = " + nnn + ";\n" + indent + "return n + 1;";
+            break;
+        case 0x3:
+            code = "s.progCounter = " + reg(x) + " == " + nn + " ? " + skip + " : " + next + ";\n" + indent + "return n + 1;";
+            break;
+        case 0x4:
+            code = "s.progCounter = " + reg(x) + " != " + nn + " ? " + skip + " : " + next + ";\n" + indent + "return n + 1;";
+            break;
+        case 0x5:
+            code = "s.progCounter = " + reg(x) + " == " + reg(y) + " ? " + skip + " : " + next + ";\n" + indent + "return n + 1;";
+            break;
+        case 0x6:
+            code = reg(x) + " = " + nn + ";";
+            break;
+        case 0x7:
+            code = reg(x) + " += " + nn + ";";
+            break;
+        case 0x8:
+        {
+            std::string a = "unsigned char a = " + reg(x) + ", b = " + reg(y) + "; ";
+            std::string shifted = "unsigned char a = " + reg(x) + "; "; // the shifts do not read VY
+            switch (n)
+            {
+                case 0x0:
+                    code = reg(x) + " = " + reg(y) + ";";
+                    break;
+                case 0x1:
+                    code = reg(x) + " |= " + reg(y) + ";";
+                    break;
+                case 0x2:
+                    code = reg(x) + " &= " + reg(y) + ";";
+                    break;
+                case 0x3:
+                    code = reg(x) + " ^= " + reg(y) + ";";
+                    break;
+                case 0x4:
+                    code = "{ " + a + reg(x) + " = a + b; s.registers[0xF] = a > 0xFF - b ? 1 : 0; }";
+                    break;
+                case 0x5:
+                    code = "{ " + a + reg(x) + " = a - b; s.registers[0xF] = b > a ? 0 : 1; }";
+                    break;
+                case 0x6:
+                    code = "{ " + shifted + "s.registers[0xF] = a & 0x1; " + reg(x) + " = a >> 1; }";
+                    break;
+                case 0x7:
+                    code = "{ " + a + reg(x) + " = b - a; s.registers[0xF] = a > b ? 0 : 1; }";
+                    break;
+                default: // 0xE
+                    code = "{ " + shifted + "s.registers[0xF] = a >> 7; " + reg(x) + " = a << 1; }";
+                    break;
+            }
+            break;
+        }
+        case 0x9:
+            code = "s.progCounter = " + reg(x) + " != " + reg(y) + " ? " + skip + " : " + next + ";\n" + indent + "return n + 1;";
+            break;
+        case 0xA:
+            code = "s.index = " + nnn + ";";
+            break;
+        case 0xC:
+            code = reg(x) + " = Chip8::nextRandom(s) & " + nn + ";";
+            break;
+        case 0xD:
+            code = "if (s.index + " + std::to_string(n) + " > MEMORY_SIZE) " + bailOut(address) + "\n" + indent +
+                   "Chip8::drawSprite(s, " + hex(x, 1) + ", " + hex(y, 1) + ", " + std::to_string(n) + ");\n" + indent +
+                   "s.isDirty = true;";
+            break;
+        case 0xE:
+            code = "s.progCounter = " + std::string((opCode & 0xFF) == 0x9E ? "" : "!") + "s.keypad[" + reg(x) +
+                   " & 0xF] ? " + skip + " : " + next + ";\n" + indent + "return n + 1;";
+            break;
+        default: // 0xF
+            switch (opCode & 0xFF)
+            {
+                case 0x07:
+                    code = reg(x) + " = s.delayInterruptTimer;";
+                    break;
+                case 0x15:
+                    code = "s.delayInterruptTimer = " + reg(x) + ";";
+                    break;
+                case 0x18:
+                    code = "s.soundInterruptTimer = " + reg(x) + ";";
+                    break;
+                case 0x1E:
+                    code = "s.index += " + reg(x) + ";";
+                    break;
+                case 0x29:
+                    code = "s.index = " + reg(x) + " * BYTES_PER_FONT_CHAR;";
+                    break;
+                default: // 0x65
+                    code = "if (s.index + " + std::to_string(x + 1) + " > MEMORY_SIZE) " + bailOut(address) + "\n" +
+                           indent + "std::memcpy(s.registers, s.memory + s.index, " + std::to_string(x + 1) + ");";
+                    break;
+            }
+            break;
+    }
+
+    code = indent + code + "\n";
+    if (!isTerminator(opCode))
+    {
+        code += indent + "++n;\n";
+    }
+    return code;
+}
@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Recompiler
+ * Ahead-of-time translation of a Chip-8 ROM into a C++ translation unit for AotRuntime.
+ */
+
+#ifndef IMIT8_CHIP8_RECOMPILER_H
+#define IMIT8_CHIP8_RECOMPILER_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+
+class Recompiler
+{
+    public:
+        explicit Recompiler(const std::vector<unsigned char>& rom);
+
+        // Recover the control-flow graph from 0x200 and split reachable code into basic blocks
+        void analyze();
+
+        // Emit the C++ source for the blocks found by analyze()
+        void writeSource(std::ostream& out, const std::string& romName);
+
+        // Readable listing of the reachable code, block by block
+        void writeListing(std::ostream& out);
+
+        size_t getBlockCount() const;
+        unsigned int getCompiledInstructions() const;
+        unsigned int getInterpretedInstructions() const;
+
+    private:
+        struct Block
+        {
+            unsigned short start;
+            unsigned short end;
+        };
+
+        std::vector<unsigned char> rom;
+        std::vector<bool> isReachable;
+        std::vector<bool> isLeader;
+        std::vector<Block> blocks;
+
+        unsigned int compiledInstructions;
+        unsigned int interpretedInstructions;
+
+        bool isInRom(unsigned int address) const;
+        unsigned short fetch(unsigned int address) const;
+
+        // Does this instruction end a block?
+        static bool isTerminator(unsigned short opCode);
+
+        // C++ statements for one instruction. Generated blocks count the instructions they have run in `n`.
+        static std::string emitInstruction(unsigned short address, unsigned short opCode);
+};
+
+#endif //IMIT8_CHIP8_RECOMPILER_H
@@ -0,0 +1,98 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * RunAhead
+ * Rewinding, the frame budget and the report.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include "RunAhead.h"
+
+RunAhead::
+RunAhead(Chip8& cpu, unsigned int frames, bool isAdapting) : cpu(cpu)
+{
+    maxFrames = std::min(frames, static_cast<unsigned int>(RUN_AHEAD_MAX_FRAMES));
+    RunAhead::frames = maxFrames;
+    RunAhead::isAdapting = isAdapting;
+    std::memset(presented, 0, sizeof(presented));
+    realFrames = 0;
+    aheadFrames = 0;
+    snapshotNanoseconds = 0;
+    emulateNanoseconds = 0;
+    longestNanoseconds = 0;
+}
+
+unsigned long long RunAhead::
+nanosecondsBetween(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+// Compared with what was last presented rather than taken from the core: the frames ahead are rewound, so
+// what they drew says nothing about what is on the screen
+DirtyRegion RunAhead::
+diffScreen()
+{
+    DirtyRegion dirty;
+    dirty.rows = 0;
+    const unsigned char* screen = cpu.getScreen();
+    for (unsigned int row = 0; row < SCREEN_HEIGHT; ++row)
+    {
+        dirty.columns[row] = 0;
+        for (unsigned int column = 0; column < SCREEN_WIDTH_SIZE; ++column)
+        {
+            unsigned int i = row * SCREEN_WIDTH_SIZE + column;
+            if (screen[i] != presented[i])
+            {
+                Chip8::markDirty(dirty, row, column);
+            }
+        }
+    }
+    std::memcpy(presented, screen, sizeof(presented));
+    return dirty;
+}
+
+void RunAhead::
+restore()
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    cpu.restoreSnapshot(snapshot);
+    cpu.setSpeculating(false);
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    snapshotNanoseconds += nanosecondsBetween(start, end);
+    ++realFrames;
+
+    unsigned long long spent = nanosecondsBetween(aheadStart, end);
+    longestNanoseconds = std::max(longestNanoseconds, spent);
+    unsigned long long budget = USECONDS_PER_FRAME * 1000ULL;
+    if (isAdapting && spent > budget / 4 && frames > 0)
+    {
+        --frames;
+    }
+    else if (isAdapting && spent < budget / 16 && frames < maxFrames)
+    {
+        ++frames;
+    }
+}
+
+std::string RunAhead::
+report() const
+{
+    std::stringstream text;
+    double frameCount = realFrames == 0 ? 1 : static_cast<double>(realFrames);
+    text << std::fixed << std::setprecision(2) << "Run-ahead: " << aheadFrames / frameCount
+         << " frames ahead on average (of " << maxFrames << ") over " << realFrames << " frames, "
+         << emulateNanoseconds / frameCount / 1000 << " us emulating ahead and "
+         << snapshotNanoseconds / frameCount / 1000 << " us snapshotting and restoring per frame ("
+         << (emulateNanoseconds + snapshotNanoseconds) / frameCount / (USECONDS_PER_FRAME * 10.0)
+         << "% of the frame time), " << longestNanoseconds / 1000.0 << " us at most.";
+    return text.str();
+}
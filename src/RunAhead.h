@@ -0,0 +1,89 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * RunAhead
+ * Hides a program's own input lag. Most programs react to a key a frame or more after they first see it
+ * down, so each frame, after the real one has run, the machine is snapshotted, run a few frames further
+ * with the keypad as it is now, and that future screen is the one shown; then it is rewound. What happens
+ * is unchanged, only shown earlier: audio, capture and everything else follow the real frames.
+ *
+ * Frames ahead cost emulation time every frame, so when they take more than a quarter of the frame
+ * budget one is dropped, and one is added back while they take under a sixteenth, up to the number asked
+ * for.
+ */
+
+#ifndef IMIT8_CHIP8_RUNAHEAD_H
+#define IMIT8_CHIP8_RUNAHEAD_H
+
+#include <chrono>
+#include <string>
+#include "Chip8.h"
+
+#define RUN_AHEAD_MAX_FRAMES 8
+
+class RunAhead
+{
+    public:
+        // Run up to frames ahead (at most RUN_AHEAD_MAX_FRAMES); isAdapting lets the frame budget lower it
+        RunAhead(Chip8& cpu, unsigned int frames, bool isAdapting);
+
+        // Snapshot the machine, run it the current number of frames ahead of the real one through loop, and
+        // leave it there to be presented. Returns what differs from the screen returned last time. A machine
+        // that has stopped is not run, so its last screen is what is shown.
+        template <class LoopType>
+        DirtyRegion runAhead(LoopType& loop, bool isRunning)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            cpu.saveSnapshot(snapshot);
+            cpu.setSpeculating(true);
+            std::chrono::steady_clock::time_point saved = std::chrono::steady_clock::now();
+            for (unsigned int i = 0; i < frames && isRunning; ++i)
+            {
+                if (i != 0)
+                {
+                    cpu.updateTimers(); // the real frame's timers have already ticked
+                }
+                bool toDraw = false;
+                isRunning = loop.runCycles(OPCODES_PER_FRAME, toDraw);
+                ++aheadFrames;
+            }
+            loop.takeIdleSkipped(); // not real either
+            aheadStart = start;
+            snapshotNanoseconds += nanosecondsBetween(start, saved);
+            emulateNanoseconds += nanosecondsBetween(saved, std::chrono::steady_clock::now());
+            return diffScreen();
+        }
+
+        // Back to the snapshot, and adjust how far ahead to run next time by what this frame's cost
+        void restore();
+
+        // Frames ahead on average, and their cost
+        std::string report() const;
+
+    private:
+        Chip8& cpu;
+        unsigned int maxFrames;
+        unsigned int frames;                // ahead this frame
+        bool isAdapting;
+        Chip8Snapshot snapshot;
+        unsigned char presented[SCREEN_SIZE];
+        std::chrono::steady_clock::time_point aheadStart;
+
+        unsigned long long realFrames;
+        unsigned long long aheadFrames;
+        unsigned long long snapshotNanoseconds;     // saving and restoring
+        unsigned long long emulateNanoseconds;
+        unsigned long long longestNanoseconds;      // of a whole frame's run-ahead
+
+        static unsigned long long nanosecondsBetween(std::chrono::steady_clock::time_point start,
+                                                     std::chrono::steady_clock::time_point end);
+
+        DirtyRegion diffScreen();
+};
+
+#endif //IMIT8_CHIP8_RUNAHEAD_H
@@ -0,0 +1,313 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Scheduler
+ * Timer wheels and work stealing for many paced machines.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include "Scheduler.h"
+
+static unsigned long long
+nowNanoseconds()
+{
+    return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+Scheduler::
+Scheduler(LogWriter* logWrit, LogWriter* cpuLogWrit, int workerCount)
+{
+    logWriter = logWrit;
+    cpuLogWriter = cpuLogWrit;
+    isCompact = false;
+    isRunning.store(false);
+    for (int i = 0; i < workerCount; ++i)
+    {
+        workers.push_back(std::unique_ptr<Worker>(new Worker()));
+        workers.back()->cursor = 0;
+        workers.back()->steals = 0;
+    }
+}
+
+Scheduler::
+~Scheduler()
+{
+    stop();
+}
+
+void Scheduler::
+setCompact(bool isCompacting)
+{
+    isCompact = isCompacting;
+}
+
+bool Scheduler::
+addInstance(const std::vector<unsigned char>& rom)
+{
+    std::unique_ptr<Instance> instance(new Instance());
+    instance->isCompact = isCompact;
+    if (isCompact)
+    {
+        // machines are usually added many at a time from the same ROM, so only the last image is reused
+        if (images.empty() || !images.back()->isSameRom(rom.data(), rom.size()))
+        {
+            std::unique_ptr<RomImage> image(new RomImage());
+            if (!image->load(rom.data(), rom.size()))
+            {
+                logWriter->log(LogWriter::LogLevel::ERROR, "Scheduler: the ROM does not fit in memory");
+                return false;
+            }
+            images.push_back(std::move(image));
+        }
+        CompactChip8* cpu = new CompactChip8(cpuLogWriter, images.back().get());
+        instance->cpu.reset(cpu);
+        cpu->setIdleDetection(true);
+    }
+    else
+    {
+        Chip8* cpu = new Chip8(cpuLogWriter);
+        instance->cpu.reset(cpu);
+        if (!cpu->loadBuffer(rom.data(), rom.size()))
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, "Scheduler: the ROM does not fit in memory");
+            return false;
+        }
+        cpu->setKeyWaitBlocking(false);
+        cpu->setIdleDetection(true);
+    }
+    instance->deadline = 0;
+    instance->stats = InstanceStats();
+    instances.push_back(std::move(instance));
+    return true;
+}
+
+bool Scheduler::
+start()
+{
+    if (workers.empty() || instances.empty())
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Scheduler: nothing to run, or nothing to run it on");
+        return false;
+    }
+    unsigned long long now = nowNanoseconds();
+    for (std::unique_ptr<Worker>& worker : workers)
+    {
+        worker->cursor = now / SCHEDULER_SLOT_NANOSECONDS;
+    }
+    for (size_t i = 0; i < instances.size(); ++i)
+    {
+        instances[i]->deadline = now + i * SCHEDULER_FRAME_NANOSECONDS / instances.size();
+        schedule(*workers[i % workers.size()], instances[i].get());
+    }
+    isRunning.store(true);
+    for (unsigned int i = 0; i < workers.size(); ++i)
+    {
+        workers[i]->thread = std::thread(&Scheduler::work, this, i);
+    }
+    logWriter->log(LogWriter::LogLevel::INFO, "Scheduler running " + std::to_string(instances.size()) +
+                   " machines on " + std::to_string(workers.size()) + " workers");
+    return true;
+}
+
+void Scheduler::
+stop()
+{
+    isRunning.store(false);
+    for (std::unique_ptr<Worker>& worker : workers)
+    {
+        if (worker->thread.joinable())
+        {
+            worker->thread.join();
+        }
+    }
+}
+
+std::vector<Scheduler::InstanceStats> Scheduler::
+getInstanceStats() const
+{
+    std::vector<InstanceStats> stats;
+    for (const std::unique_ptr<Instance>& instance : instances)
+    {
+        stats.push_back(instance->stats);
+    }
+    return stats;
+}
+
+unsigned long long Scheduler::
+getSteals() const
+{
+    unsigned long long steals = 0;
+    for (const std::unique_ptr<Worker>& worker : workers)
+    {
+        steals += worker->steals;
+    }
+    return steals;
+}
+
+size_t Scheduler::
+getMachineBytes() const
+{
+    size_t bytes = images.size() * sizeof(RomImage);
+    for (const std::unique_ptr<Instance>& instance : instances)
+    {
+        bytes += sizeof(Instance);
+        if (instance->isCompact)
+        {
+            bytes += sizeof(CompactChip8) + static_cast<const CompactChip8&>(*instance->cpu).getPrivateBytes();
+        }
+        else
+        {
+            bytes += sizeof(Chip8);
+        }
+    }
+    return bytes;
+}
+
+void Scheduler::
+work(unsigned int index)
+{
+    Worker& worker = *workers[index];
+    while (isRunning.load(std::memory_order_relaxed))
+    {
+        unsigned long long now = nowNanoseconds();
+        Instance* instance = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            advance(worker, now);
+            if (!worker.ready.empty())
+            {
+                instance = worker.ready.front();
+                worker.ready.pop_front();
+            }
+        }
+        if (instance == nullptr)
+        {
+            instance = steal(index, now);
+        }
+        if (instance == nullptr)
+        {
+            // nothing due anywhere: sleep to the next slot
+            std::this_thread::sleep_for(std::chrono::nanoseconds(
+                    SCHEDULER_SLOT_NANOSECONDS - now % SCHEDULER_SLOT_NANOSECONDS));
+            continue;
+        }
+
+        runFrame(*instance);
+        if (!instance->stats.isHalted)
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            schedule(worker, instance);
+        }
+    }
+}
+
+// Take the latest due machine of the first other worker that is falling behind: its oldest ready machine
+// has waited more than a slot. Stealing anything merely due would move machines between caches every frame.
+Scheduler::Instance* Scheduler::
+steal(unsigned int thief, unsigned long long now)
+{
+    for (unsigned int i = 1; i < workers.size(); ++i)
+    {
+        Worker& victim = *workers[(thief + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        advance(victim, now);
+        if (!victim.ready.empty() && victim.ready.front()->deadline + SCHEDULER_SLOT_NANOSECONDS < now)
+        {
+            Instance* instance = victim.ready.back();
+            victim.ready.pop_back();
+            ++instance->stats.migrations;
+            ++workers[thief]->steals; // only the thief writes its own count, and only reads it after stop()
+            return instance;
+        }
+    }
+    return nullptr;
+}
+
+// Run cpu for a frame, yielding early in a wait loop. Returns false once it has halted. A template so that
+// each core's instructions are called directly.
+template<class CoreType>
+static bool
+runCore(CoreType& cpu)
+{
+    bool isAlive = true;
+    for (int i = 0; i < OPCODES_PER_FRAME && isAlive; ++i)
+    {
+        isAlive = cpu.runCycle();
+        if (cpu.isIdle())
+        {
+            break; // waiting on the delay timer or a key: yield until the next frame
+        }
+    }
+    cpu.updateTimers();
+    return isAlive;
+}
+
+// One frame, then set the deadline of the next
+void Scheduler::
+runFrame(Instance& instance)
+{
+    bool isAlive = instance.isCompact ? runCore(static_cast<CompactChip8&>(*instance.cpu))
+                                      : runCore(static_cast<Chip8&>(*instance.cpu));
+    ++instance.stats.frames;
+    instance.stats.isHalted = !isAlive;
+
+    unsigned long long finished = nowNanoseconds();
+    if (finished > instance.deadline)
+    {
+        instance.stats.maxLateNanoseconds = std::max(instance.stats.maxLateNanoseconds, finished - instance.deadline);
+        if (finished > instance.deadline + SCHEDULER_FRAME_NANOSECONDS)
+        {
+            ++instance.stats.lateFrames;
+        }
+    }
+    instance.deadline += SCHEDULER_FRAME_NANOSECONDS;
+    if (instance.deadline + SCHEDULER_FRAME_NANOSECONDS < finished)
+    {
+        instance.deadline = finished; // more than a frame behind: carry on from now rather than in a burst
+    }
+}
+
+void Scheduler::
+schedule(Worker& worker, Instance* instance)
+{
+    unsigned long long slot = std::max(instance->deadline / SCHEDULER_SLOT_NANOSECONDS, worker.cursor);
+    worker.wheel[slot & (SCHEDULER_WHEEL_SLOTS - 1)].push_back(instance);
+}
+
+// Move every machine due by now from the wheel to the ready queue
+void Scheduler::
+advance(Worker& worker, unsigned long long now)
+{
+    unsigned long long nowSlot = now / SCHEDULER_SLOT_NANOSECONDS;
+    if (nowSlot < worker.cursor)
+    {
+        return;
+    }
+    // past one lap, every slot has been looked at once
+    unsigned long long last = std::min(nowSlot, worker.cursor + SCHEDULER_WHEEL_SLOTS - 1);
+    for (unsigned long long slot = worker.cursor; slot <= last; ++slot)
+    {
+        std::vector<Instance*>& bucket = worker.wheel[slot & (SCHEDULER_WHEEL_SLOTS - 1)];
+        size_t kept = 0;
+        for (Instance* instance : bucket)
+        {
+            if (instance->deadline / SCHEDULER_SLOT_NANOSECONDS <= nowSlot)
+            {
+                worker.ready.push_back(instance);
+            }
+            else
+            {
+                bucket[kept++] = instance; // due on a later lap of the wheel
+            }
+        }
+        bucket.resize(kept);
+    }
+    worker.cursor = nowSlot + 1;
+}
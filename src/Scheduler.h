@@ -0,0 +1,106 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Scheduler
+ * Paces thousands of Chip8 machines at 60 frames a second on a fixed set of worker threads. A machine runs
+ * one frame at a time and then yields (early, if it sits in a wait loop such as 0xFR0A). Each worker keeps
+ * its machines in a timer wheel of SCHEDULER_SLOT_NANOSECONDS slots, keyed by when their next frame is due.
+ * Due machines move to the worker's ready queue, which the worker takes from the front of; a worker with
+ * nothing due steals from the back of one that is falling behind, and keeps what it steals.
+ * Machines are Chip8s, or with setCompact() CompactChip8s sharing one read-only image of each ROM.
+ */
+
+#ifndef IMIT8_CHIP8_SCHEDULER_H
+#define IMIT8_CHIP8_SCHEDULER_H
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Chip8.h"
+#include "CompactChip8.h"
+#include "LogWriter.h"
+
+#define SCHEDULER_FRAME_NANOSECONDS (1000000000ULL / FRAMES_PER_SECOND)
+#define SCHEDULER_SLOT_NANOSECONDS 1000000ULL
+#define SCHEDULER_WHEEL_SLOTS 64   // a power of two spanning more than a frame
+
+class Scheduler
+{
+    public:
+        struct InstanceStats
+        {
+            unsigned long long frames;
+            unsigned long long lateFrames;        // finished after the next frame was due
+            unsigned long long maxLateNanoseconds; // worst finish time past the frame's own deadline
+            unsigned long long migrations;        // times another worker stole it
+            bool isHalted;
+        };
+
+        // Machines log through cpuLogWriter, e.g. a quiet one so thousands of them do not flood the log
+        Scheduler(LogWriter* logWriter, LogWriter* cpuLogWriter, int workers);
+        ~Scheduler();
+
+        // Run the machines added from now on on CompactChip8 (off by default)
+        void setCompact(bool isCompact);
+
+        // Add a machine running rom. Only before start().
+        bool addInstance(const std::vector<unsigned char>& rom);
+
+        // Start pacing, with the first frames spread evenly over one frame period
+        bool start();
+
+        // Stop after the frames in progress
+        void stop();
+
+        // Only after stop()
+        std::vector<InstanceStats> getInstanceStats() const;
+        unsigned long long getSteals() const;
+
+        // Bytes held by the machines: the machines themselves, the pages they own and the shared ROM images
+        size_t getMachineBytes() const;
+
+    private:
+        struct Instance
+        {
+            std::unique_ptr<Core> cpu;
+            bool isCompact;                       // cpu is a CompactChip8, otherwise a Chip8
+            unsigned long long deadline;          // steady clock nanoseconds when the next frame is due
+            InstanceStats stats;
+        };
+
+        struct Worker
+        {
+            std::thread thread;
+            std::mutex mutex;                     // guards everything below
+            std::vector<Instance*> wheel[SCHEDULER_WHEEL_SLOTS];
+            unsigned long long cursor;            // first slot (in absolute slot numbers) not yet moved to ready
+            std::deque<Instance*> ready;
+            unsigned long long steals;
+        };
+
+        LogWriter* logWriter;
+        LogWriter* cpuLogWriter;
+        std::vector<std::unique_ptr<Instance>> instances;
+        std::vector<std::unique_ptr<RomImage>> images;
+        bool isCompact;
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<bool> isRunning;
+
+        void work(unsigned int index);
+        Instance* steal(unsigned int thief, unsigned long long now);
+        void runFrame(Instance& instance);
+
+        // Both with worker.mutex held
+        static void schedule(Worker& worker, Instance* instance);
+        static void advance(Worker& worker, unsigned long long now);
+};
+
+#endif //IMIT8_CHIP8_SCHEDULER_H
@@ -0,0 +1,753 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * SessionServer
+ * Many Chip8 sessions served over sockets by a small pool of epoll workers.
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "SessionServer.h"
+
+#define SESSION_SERVER_EVENTS 64
+#define SESSION_SERVER_READ_SIZE 4096
+
+static unsigned long long
+nowNanoseconds()
+{
+    return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static void
+putLittleEndian(std::string& out, unsigned long long value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+    {
+        out += static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+LatencyStats::
+LatencyStats()
+{
+    count = 0;
+    total = 0;
+    max = 0;
+    std::memset(buckets, 0, sizeof(buckets));
+}
+
+void LatencyStats::
+add(unsigned long long microseconds)
+{
+    ++count;
+    total += microseconds;
+    if (microseconds > max)
+    {
+        max = microseconds;
+    }
+    // bucket b holds [2^(b-1), 2^b)
+    int bucket = 0;
+    while (bucket < SESSION_SERVER_LATENCY_BUCKETS - 1 && (microseconds >> bucket) != 0)
+    {
+        ++bucket;
+    }
+    ++buckets[bucket];
+}
+
+unsigned long long LatencyStats::
+getCount() const
+{
+    return count;
+}
+
+double LatencyStats::
+getMean() const
+{
+    return count == 0 ? 0.0 : static_cast<double>(total) / count;
+}
+
+unsigned long long LatencyStats::
+getMax() const
+{
+    return max;
+}
+
+unsigned long long LatencyStats::
+getPercentile(double fraction) const
+{
+    unsigned long long wanted = static_cast<unsigned long long>(fraction * count + 0.5);
+    unsigned long long seen = 0;
+    for (int bucket = 0; bucket < SESSION_SERVER_LATENCY_BUCKETS; ++bucket)
+    {
+        seen += buckets[bucket];
+        if (seen >= wanted && seen != 0)
+        {
+            return std::min(1ULL << bucket, max + 1);
+        }
+    }
+    return max + 1;
+}
+
+std::string LatencyStats::
+describe() const
+{
+    if (count == 0)
+    {
+        return "none";
+    }
+    return "mean " + std::to_string(static_cast<unsigned long long>(getMean() + 0.5)) + " us, p99 < " +
+           std::to_string(getPercentile(0.99)) + " us, max " + std::to_string(max) + " us";
+}
+
+SessionServer::
+SessionServer(LogWriter* logWrit)
+{
+    logWriter = logWrit;
+    isServing.store(false);
+    serverSocket = -1;
+    nextSessionId.store(1);
+    sessionCount.store(0);
+}
+
+SessionServer::
+~SessionServer()
+{
+    stop();
+}
+
+bool SessionServer::
+setRom(const std::vector<unsigned char>& newRom)
+{
+    if (newRom.empty() || newRom.size() > MEMORY_SIZE - CODE_START)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Session server: the ROM must be 1 to " +
+                       std::to_string(MEMORY_SIZE - CODE_START) + " bytes");
+        return false;
+    }
+    rom = newRom;
+    return true;
+}
+
+bool SessionServer::
+start(const std::string& address, int workerCount)
+{
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        sockaddr_un local;
+        std::memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        std::string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(local.sun_path))
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, "Session server: bad socket path (" + path + ")");
+            return false;
+        }
+        std::strncpy(local.sun_path, path.c_str(), sizeof(local.sun_path) - 1);
+        serverSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(path.c_str());
+        if (serverSocket < 0 || bind(serverSocket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0)
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, "Session server (" + address + "): " + std::strerror(errno));
+            closeServerSocket();
+            return false;
+        }
+        serverPath = path;
+    }
+    else
+    {
+        char* end = nullptr;
+        unsigned long port = std::strtoul(address.c_str(), &end, 10);
+        if (address.empty() || *end != '\0' || port == 0 || port > 65535)
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, "Session server: bad port (" + address + ")");
+            return false;
+        }
+        sockaddr_in local;
+        std::memset(&local, 0, sizeof(local));
+        local.sin_family = AF_INET;
+        local.sin_port = htons(static_cast<unsigned short>(port));
+        local.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // never reachable from other machines
+        serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+        int isReusable = 1;
+        if (serverSocket >= 0)
+        {
+            setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &isReusable, sizeof(isReusable));
+        }
+        if (serverSocket < 0 || bind(serverSocket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0)
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, "Session server (" + address + "): " + std::strerror(errno));
+            closeServerSocket();
+            return false;
+        }
+    }
+    if (listen(serverSocket, SOMAXCONN) != 0)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Session server (" + address + "): " + std::strerror(errno));
+        closeServerSocket();
+        return false;
+    }
+
+    // every worker ticks at the frame rate and wakes when the acceptor hands it a client
+    itimerspec interval;
+    interval.it_interval.tv_sec = 0;
+    interval.it_interval.tv_nsec = USECONDS_PER_FRAME * 1000L;
+    interval.it_value = interval.it_interval;
+    for (int i = 0; i < workerCount; ++i)
+    {
+        std::unique_ptr<Worker> worker(new Worker());
+        worker->epoll = epoll_create1(EPOLL_CLOEXEC);
+        worker->timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        worker->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        worker->load.store(0);
+        bool isReady = worker->epoll >= 0 && worker->timer >= 0 && worker->wake >= 0 &&
+                       timerfd_settime(worker->timer, 0, &interval, nullptr) == 0;
+        for (int descriptor : {worker->timer, worker->wake})
+        {
+            epoll_event event;
+            event.events = EPOLLIN;
+            event.data.fd = descriptor;
+            isReady = isReady && epoll_ctl(worker->epoll, EPOLL_CTL_ADD, descriptor, &event) == 0;
+        }
+        workers.push_back(std::move(worker));
+        if (!isReady)
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, std::string("Session server: could not set up a worker: ") +
+                           std::strerror(errno));
+            stop();
+            return false;
+        }
+    }
+
+    isServing.store(true);
+    for (std::unique_ptr<Worker>& worker : workers)
+    {
+        worker->thread = std::thread(&SessionServer::work, this, std::ref(*worker));
+    }
+    acceptor = std::thread(&SessionServer::accept, this);
+    logWriter->log(LogWriter::LogLevel::INFO, "Session server listening on " + address + " with " +
+                   std::to_string(workerCount) + " workers");
+    return true;
+}
+
+void SessionServer::
+stop()
+{
+    isServing.store(false);
+    if (acceptor.joinable())
+    {
+        acceptor.join();
+    }
+    for (std::unique_ptr<Worker>& worker : workers)
+    {
+        if (worker->thread.joinable())
+        {
+            worker->thread.join();
+        }
+        while (!worker->sessions.empty())
+        {
+            close(*worker, *worker->sessions.begin()->second);
+        }
+        for (int descriptor : worker->incoming)
+        {
+            ::close(descriptor);
+        }
+        for (int descriptor : {worker->epoll, worker->timer, worker->wake})
+        {
+            if (descriptor >= 0)
+            {
+                ::close(descriptor);
+            }
+        }
+    }
+    workers.clear();
+    closeServerSocket();
+}
+
+std::vector<std::string> SessionServer::
+takeReports()
+{
+    std::lock_guard<std::mutex> lock(reportMutex);
+    std::vector<std::string> taken;
+    taken.swap(reports);
+    return taken;
+}
+
+unsigned long long SessionServer::
+getSessionCount() const
+{
+    return sessionCount.load();
+}
+
+// Acceptor thread: hand each new client to the worker with the fewest sessions
+void SessionServer::
+accept()
+{
+    while (isServing.load())
+    {
+        pollfd waiting = {serverSocket, POLLIN, 0};
+        if (poll(&waiting, 1, SESSION_SERVER_POLL_MILLISECONDS) <= 0)
+        {
+            continue;
+        }
+        int accepted = ::accept4(serverSocket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (accepted < 0)
+        {
+            continue;
+        }
+        int isNoDelay = 1;
+        setsockopt(accepted, IPPROTO_TCP, TCP_NODELAY, &isNoDelay, sizeof(isNoDelay)); // fails harmlessly on Unix sockets
+
+        Worker* chosen = nullptr;
+        size_t fewest = 0;
+        for (std::unique_ptr<Worker>& worker : workers)
+        {
+            std::lock_guard<std::mutex> lock(worker->incomingMutex);
+            size_t load = worker->incoming.size() + worker->load.load(std::memory_order_relaxed);
+            if (chosen == nullptr || load < fewest)
+            {
+                chosen = worker.get();
+                fewest = load;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(chosen->incomingMutex);
+            chosen->incoming.push_back(accepted);
+        }
+        unsigned long long one = 1;
+        if (write(chosen->wake, &one, sizeof(one)) < 0)
+        {
+            // the counter can only overflow if the worker is gone; it drains incoming on its next tick anyway
+        }
+    }
+}
+
+// Worker thread: owns its sessions outright, so no session is ever touched by two threads
+void SessionServer::
+work(Worker& worker)
+{
+    epoll_event events[SESSION_SERVER_EVENTS];
+    while (isServing.load())
+    {
+        int ready = epoll_wait(worker.epoll, events, SESSION_SERVER_EVENTS, SESSION_SERVER_POLL_MILLISECONDS);
+        for (int i = 0; i < ready; ++i)
+        {
+            int descriptor = events[i].data.fd;
+            unsigned long long count;
+            if (descriptor == worker.wake)
+            {
+                if (read(worker.wake, &count, sizeof(count)) > 0)
+                {
+                    std::vector<int> incoming;
+                    {
+                        std::lock_guard<std::mutex> lock(worker.incomingMutex);
+                        incoming.swap(worker.incoming);
+                    }
+                    for (int socket : incoming)
+                    {
+                        adopt(worker, socket);
+                    }
+                }
+            }
+            else if (descriptor == worker.timer)
+            {
+                // a late tick still runs one frame: sessions slow down rather than run in bursts
+                if (read(worker.timer, &count, sizeof(count)) > 0)
+                {
+                    runFrames(worker);
+                }
+            }
+            else
+            {
+                auto found = worker.sessions.find(descriptor);
+                if (found == worker.sessions.end())
+                {
+                    continue;
+                }
+                Session& session = *found->second;
+                if (events[i].events & (EPOLLERR | EPOLLHUP))
+                {
+                    close(worker, session);
+                    continue;
+                }
+                if (events[i].events & EPOLLOUT)
+                {
+                    flush(worker, session);
+                }
+                if ((events[i].events & EPOLLIN) && worker.sessions.count(descriptor) != 0)
+                {
+                    receive(worker, session);
+                }
+            }
+        }
+    }
+}
+
+void SessionServer::
+adopt(Worker& worker, int socket)
+{
+    std::unique_ptr<Session> session(new Session());
+    session->socket = socket;
+    session->id = nextSessionId.fetch_add(1);
+    session->cpu.reset(new Chip8(logWriter));
+    session->cpu->setKeyWaitBlocking(false);
+    session->cpu->setIdleDetection(true);
+    session->outputSent = 0;
+    std::memset(session->lastScreen, 0, SCREEN_SIZE);
+    session->isResyncing = true;
+    session->dirtyRows = 0;
+    session->isRunning = !rom.empty() && session->cpu->loadBuffer(rom.data(), rom.size());
+    session->isClosing = false;
+    session->isWaitingToWrite = false;
+    session->frames = 0;
+    session->bytesSent = 0;
+    session->pendingInputTime = 0;
+    session->inFlightInputTime = 0;
+    session->pendingOutputTime = 0;
+
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = socket;
+    if (epoll_ctl(worker.epoll, EPOLL_CTL_ADD, socket, &event) != 0)
+    {
+        ::close(socket);
+        return;
+    }
+    Session& adopted = *session;
+    worker.sessions[socket] = std::move(session);
+    worker.load.fetch_add(1, std::memory_order_relaxed);
+    sessionCount.fetch_add(1);
+
+    std::string hello = "H";
+    putLittleEndian(hello, adopted.id, 4);
+    putLittleEndian(hello, SCREEN_WIDTH, 1);
+    putLittleEndian(hello, SCREEN_HEIGHT, 1);
+    adopted.output += hello;
+    flush(worker, adopted);
+}
+
+void SessionServer::
+runFrames(Worker& worker)
+{
+    unsigned long long tick = nowNanoseconds();
+    std::vector<Session*> ticked;
+    ticked.reserve(worker.sessions.size());
+    for (auto& entry : worker.sessions)
+    {
+        ticked.push_back(entry.second.get());
+    }
+    for (Session* session : ticked)
+    {
+        if (!session->isRunning || session->isClosing)
+        {
+            continue;
+        }
+        Chip8& cpu = *session->cpu;
+        bool isRunning = true;
+        for (int i = 0; i < OPCODES_PER_FRAME && isRunning; ++i)
+        {
+            isRunning = cpu.runCycle();
+            if (cpu.isIdle())
+            {
+                break;
+            }
+        }
+        cpu.updateTimers();
+        session->dirtyRows |= cpu.takeDirtyRegion().rows;
+        ++session->frames;
+        if (session->pendingInputTime != 0 && session->inFlightInputTime == 0)
+        {
+            session->inFlightInputTime = session->pendingInputTime;
+        }
+        session->pendingInputTime = 0;
+        if (encodeFrame(*session) && session->pendingOutputTime == 0)
+        {
+            session->pendingOutputTime = tick;
+        }
+        if (!isRunning)
+        {
+            end(worker, *session, HALTED);
+        }
+        else
+        {
+            flush(worker, *session);
+        }
+    }
+}
+
+void SessionServer::
+receive(Worker& worker, Session& session)
+{
+    char buffer[SESSION_SERVER_READ_SIZE];
+    for (;;)
+    {
+        ssize_t received = recv(session.socket, buffer, sizeof(buffer), 0);
+        if (received > 0)
+        {
+            session.input.append(buffer, static_cast<size_t>(received));
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        close(worker, session); // the client hung up
+        return;
+    }
+    if (session.isClosing)
+    {
+        return;
+    }
+    if (session.pendingInputTime == 0)
+    {
+        session.pendingInputTime = nowNanoseconds();
+    }
+    if (!parse(session))
+    {
+        end(worker, session, BAD_REQUEST);
+    }
+    else if (session.isClosing)
+    {
+        flush(worker, session);
+    }
+}
+
+// Apply every complete request in session.input. Returns false on a malformed one.
+bool SessionServer::
+parse(Session& session)
+{
+    size_t at = 0;
+    while (at < session.input.size() && !session.isClosing)
+    {
+        const unsigned char* request = reinterpret_cast<const unsigned char*>(session.input.data()) + at;
+        size_t available = session.input.size() - at;
+        if (request[0] == 'K')
+        {
+            if (available < 3)
+            {
+                break;
+            }
+            if (request[1] >= NUMBER_OF_KEYPAD_BUTTONS || request[2] > 1)
+            {
+                return false;
+            }
+            session.cpu->setKey(request[1], request[2] == 1);
+            at += 3;
+        }
+        else if (request[0] == 'L')
+        {
+            if (available < 5)
+            {
+                break;
+            }
+            size_t length = request[1] | (request[2] << 8) | (request[3] << 16) |
+                            (static_cast<size_t>(request[4]) << 24);
+            if (length == 0 || length > MEMORY_SIZE - CODE_START)
+            {
+                return false;
+            }
+            if (available < 5 + length)
+            {
+                break;
+            }
+            session.cpu->init();
+            session.isRunning = session.cpu->loadBuffer(request + 5, length);
+            session.isResyncing = true;
+            at += 5 + length;
+        }
+        else if (request[0] == 'Q')
+        {
+            session.isClosing = true;
+            at += 1;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    session.input.erase(0, at);
+    return true;
+}
+
+// Queue the rows that differ from what the client last saw. Only rows the machine drew on can differ, so
+// only those are compared, unless resyncing. Returns false if nothing was queued.
+bool SessionServer::
+encodeFrame(Session& session)
+{
+    if (session.output.size() - session.outputSent > SESSION_SERVER_MAX_BACKLOG)
+    {
+        session.isResyncing = true; // too far behind: skip this frame, send everything once caught up
+        return false;
+    }
+    const unsigned char* screen = session.cpu->getScreen();
+    unsigned int toCompare = session.isResyncing ? ~0u : session.dirtyRows;
+    size_t header = session.output.size();
+    int rows = 0;
+    for (int row = 0; row < SCREEN_HEIGHT; ++row)
+    {
+        if (!(toCompare & (1u << row)))
+        {
+            continue;
+        }
+        const unsigned char* bytes = screen + row * SCREEN_WIDTH_SIZE;
+        if (!session.isResyncing && std::memcmp(bytes, session.lastScreen + row * SCREEN_WIDTH_SIZE, SCREEN_WIDTH_SIZE) == 0)
+        {
+            continue;
+        }
+        if (rows == 0)
+        {
+            session.output += 'F';
+            putLittleEndian(session.output, session.frames, 8);
+            session.output += '\0'; // row count, filled in below
+        }
+        ++rows;
+        session.output += static_cast<char>(row);
+        for (int column = 0; column < SCREEN_WIDTH_SIZE;)
+        {
+            int run = 1;
+            while (column + run < SCREEN_WIDTH_SIZE && bytes[column + run] == bytes[column])
+            {
+                ++run;
+            }
+            session.output += static_cast<char>(run);
+            session.output += static_cast<char>(bytes[column]);
+            column += run;
+        }
+    }
+    if (rows != 0)
+    {
+        session.output[header + 9] = static_cast<char>(rows);
+        std::memcpy(session.lastScreen, screen, SCREEN_SIZE);
+    }
+    session.isResyncing = false;
+    session.dirtyRows = 0;
+    return rows != 0;
+}
+
+// Write as much queued output as the socket takes; wait for EPOLLOUT if it fills up
+void SessionServer::
+flush(Worker& worker, Session& session)
+{
+    while (session.outputSent < session.output.size())
+    {
+        ssize_t sent = send(session.socket, session.output.data() + session.outputSent,
+                            session.output.size() - session.outputSent, MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            session.outputSent += static_cast<size_t>(sent);
+            session.bytesSent += static_cast<unsigned long long>(sent);
+        }
+        else if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            if (!session.isWaitingToWrite)
+            {
+                epoll_event event;
+                event.events = EPOLLIN | EPOLLRDHUP | EPOLLOUT;
+                event.data.fd = session.socket;
+                epoll_ctl(worker.epoll, EPOLL_CTL_MOD, session.socket, &event);
+                session.isWaitingToWrite = true;
+            }
+            return;
+        }
+        else
+        {
+            close(worker, session);
+            return;
+        }
+    }
+
+    // everything queued is on the wire
+    session.output.clear();
+    session.outputSent = 0;
+    unsigned long long now = nowNanoseconds();
+    if (session.pendingOutputTime != 0)
+    {
+        session.frameLatency.add((now - session.pendingOutputTime) / 1000);
+        session.pendingOutputTime = 0;
+    }
+    if (session.inFlightInputTime != 0)
+    {
+        session.inputLatency.add((now - session.inFlightInputTime) / 1000);
+        session.inFlightInputTime = 0;
+    }
+    if (session.isWaitingToWrite)
+    {
+        epoll_event event;
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = session.socket;
+        epoll_ctl(worker.epoll, EPOLL_CTL_MOD, session.socket, &event);
+        session.isWaitingToWrite = false;
+    }
+    if (session.isClosing)
+    {
+        close(worker, session);
+    }
+}
+
+void SessionServer::
+end(Worker& worker, Session& session, EndReason reason)
+{
+    session.output += 'E';
+    session.output += static_cast<char>(reason);
+    session.isRunning = false;
+    session.isClosing = true;
+    flush(worker, session);
+}
+
+void SessionServer::
+close(Worker& worker, Session& session)
+{
+    std::string report = "session " + std::to_string(session.id) + ": " + std::to_string(session.frames) +
+                         " frames, " + std::to_string(session.bytesSent) + " bytes sent; input latency " +
+                         session.inputLatency.describe() + "; frame latency " + session.frameLatency.describe();
+    {
+        std::lock_guard<std::mutex> lock(reportMutex);
+        reports.push_back(report);
+    }
+    epoll_ctl(worker.epoll, EPOLL_CTL_DEL, session.socket, nullptr);
+    ::close(session.socket);
+    worker.sessions.erase(session.socket); // frees session
+    worker.load.fetch_sub(1, std::memory_order_relaxed);
+    sessionCount.fetch_sub(1);
+}
+
+void SessionServer::
+closeServerSocket()
+{
+    if (serverSocket >= 0)
+    {
+        ::close(serverSocket);
+        serverSocket = -1;
+    }
+    if (!serverPath.empty())
+    {
+        unlink(serverPath.c_str());
+        serverPath.clear();
+    }
+}
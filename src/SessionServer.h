@@ -0,0 +1,156 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * SessionServer
+ * Hosts many interactive Chip8 sessions in one process, one per client on a localhost TCP port or a Unix
+ * domain socket. Clients are spread over a few worker threads; each worker waits on its clients with epoll,
+ * runs a frame of every session it owns 60 times a second and sends back only the screen rows that changed.
+ *
+ * Protocol, all integers little-endian. Client to server:
+ *     'K' key pressed                  press (pressed = 1) or release (0) keypad button key (0-15)
+ *     'L' u32 length, length bytes     load a ROM and restart the session
+ *     'Q'                              end the session
+ * Server to client:
+ *     'H' u32 session, u8 width, u8 height         once, on connecting
+ *     'F' u64 frame, u8 rows, rows x {u8 row, runs}  after a frame that changed the screen. A row's 8 bytes
+ *                                                  are sent as (u8 count, u8 byte) runs that add up to 8.
+ *     'E' u8 reason                                the session ended (0: the program halted, 1: bad request)
+ * A client that falls more than SESSION_SERVER_MAX_BACKLOG bytes behind misses frames and is sent the whole
+ * screen once it has caught up.
+ */
+
+#ifndef IMIT8_CHIP8_SESSIONSERVER_H
+#define IMIT8_CHIP8_SESSIONSERVER_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Chip8.h"
+#include "LogWriter.h"
+
+#define SESSION_SERVER_MAX_BACKLOG 65536
+#define SESSION_SERVER_LATENCY_BUCKETS 32
+#define SESSION_SERVER_POLL_MILLISECONDS 100
+
+// Distribution of latencies in microseconds, in power of two buckets
+class LatencyStats
+{
+    public:
+        LatencyStats();
+        void add(unsigned long long microseconds);
+
+        unsigned long long getCount() const;
+        double getMean() const;
+        unsigned long long getMax() const;
+
+        // Upper bound of the bucket holding the given fraction of samples, e.g. 0.99
+        unsigned long long getPercentile(double fraction) const;
+
+        // "mean 120 us, p99 < 256 us, max 301 us", or "none"
+        std::string describe() const;
+
+    private:
+        unsigned long long count;
+        unsigned long long total;
+        unsigned long long max;
+        unsigned long long buckets[SESSION_SERVER_LATENCY_BUCKETS];
+};
+
+class SessionServer
+{
+    public:
+        enum EndReason
+        {
+            HALTED = 0,
+            BAD_REQUEST = 1
+        };
+
+        explicit SessionServer(LogWriter* logWriter);
+        ~SessionServer();
+
+        // ROM that every session starts with, until its client loads another
+        bool setRom(const std::vector<unsigned char>& rom);
+
+        // Listen on 127.0.0.1:port, or on a Unix domain socket when given "unix:PATH", with `workers` threads
+        bool start(const std::string& address, int workers);
+
+        // Disconnect everyone and join the threads
+        void stop();
+
+        // One line per session that has ended since the last call: frames, bytes sent and latencies
+        std::vector<std::string> takeReports();
+
+        unsigned long long getSessionCount() const;
+
+    private:
+        struct Session
+        {
+            int socket;
+            unsigned int id;
+            std::unique_ptr<Chip8> cpu;
+            std::string input;                        // bytes received but not yet parsed
+            std::string output;                       // bytes waiting for the socket
+            size_t outputSent;                        // how much of output has gone
+            unsigned char lastScreen[SCREEN_SIZE];    // screen as the client last saw it
+            bool isResyncing;                         // send every row next frame
+            unsigned int dirtyRows;                   // rows drawn on since the last frame queued (bit r for row r)
+            bool isRunning;
+            bool isClosing;                           // close once output is drained
+            bool isWaitingToWrite;                    // registered for EPOLLOUT
+            unsigned long long frames;
+            unsigned long long bytesSent;
+            unsigned long long pendingInputTime;      // when the oldest key not yet run arrived (ns), or 0
+            unsigned long long inFlightInputTime;     // the same for keys that have run, until output drains
+            unsigned long long pendingOutputTime;     // when the frame now in output started (ns), or 0
+            LatencyStats inputLatency;                // key arrives -> the frame that ran it is on the wire
+            LatencyStats frameLatency;                // frame tick -> its rows are on the wire
+        };
+
+        struct Worker
+        {
+            std::thread thread;
+            int epoll;
+            int timer;
+            int wake;
+            std::mutex incomingMutex;                 // guards incoming
+            std::vector<int> incoming;                // sockets handed over by the acceptor
+            std::unordered_map<int, std::unique_ptr<Session>> sessions;
+            std::atomic<unsigned int> load;           // sessions.size() for the acceptor to read
+        };
+
+        LogWriter* logWriter;
+        std::vector<unsigned char> rom;
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::thread acceptor;
+        std::atomic<bool> isServing;
+        int serverSocket;
+        std::string serverPath;
+        std::atomic<unsigned int> nextSessionId;
+        std::atomic<unsigned long long> sessionCount;
+
+        std::mutex reportMutex;                       // guards reports
+        std::vector<std::string> reports;
+
+        void accept();
+        void work(Worker& worker);
+        void adopt(Worker& worker, int socket);
+        void runFrames(Worker& worker);
+        void receive(Worker& worker, Session& session);
+        bool parse(Session& session);
+        bool encodeFrame(Session& session);
+        void flush(Worker& worker, Session& session);
+        void end(Worker& worker, Session& session, EndReason reason);
+        void close(Worker& worker, Session& session);
+        void closeServerSocket();
+};
+
+#endif //IMIT8_CHIP8_SESSIONSERVER_H
@@ -0,0 +1,252 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * SharedFrame
+ * Seqlocked screen in POSIX shared memory.
+ */
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include "SharedFrame.h"
+
+// another process maps the same words, which only works if no lock hides inside the atomics
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2, "SharedFrame needs lock-free atomics");
+static_assert(SHARED_FRAME_WORDS == SCREEN_HEIGHT, "publish stores a screen row as one word");
+
+SharedFrame::
+SharedFrame(LogWriter* logWrit)
+{
+    logWriter = logWrit;
+    layout = nullptr;
+    isWriter = false;
+}
+
+SharedFrame::
+~SharedFrame()
+{
+    close();
+}
+
+bool SharedFrame::
+create(const std::string& name)
+{
+    if (name.empty() || name.find('/') != std::string::npos)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Shared frame names cannot be empty or contain '/' (" + name + ")");
+        return false;
+    }
+    path = "/imit8-" + name;
+    int descriptor = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    bool isNew = descriptor >= 0;
+    if (!isNew && errno == EEXIST)
+    {
+        descriptor = shm_open(path.c_str(), O_RDWR, 0);
+    }
+    if (descriptor < 0)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not create shared memory " + path + " (" + std::strerror(errno) + ")");
+        return false;
+    }
+    void* memory = MAP_FAILED;
+    struct stat status;
+    if (isNew ? ftruncate(descriptor, sizeof(Layout)) == 0 :
+        fstat(descriptor, &status) == 0 && static_cast<size_t>(status.st_size) >= sizeof(Layout))
+    {
+        memory = mmap(nullptr, sizeof(Layout), PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    }
+    ::close(descriptor);
+    if (memory == MAP_FAILED)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not map shared memory " + path + " (" +
+                       (isNew ? std::strerror(errno) : "too small for an imit8 frame; pick another name or remove it") + ")");
+        if (isNew)
+        {
+            shm_unlink(path.c_str());
+        }
+        return false;
+    }
+    layout = static_cast<Layout*>(memory);
+    if (!isNew && !isAbandoned())
+    {
+        unmap();
+        return false;
+    }
+    isWriter = true;
+
+    // a segment left by an earlier run may still have readers: carry on from its sequence number
+    unsigned int sequence = layout->sequence.load(std::memory_order_relaxed);
+    layout->sequence.store(sequence + 1 + (sequence & 1), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    layout->magic = SHARED_FRAME_MAGIC;
+    layout->version = SHARED_FRAME_VERSION;
+    layout->width = SCREEN_WIDTH;
+    layout->height = SCREEN_HEIGHT;
+    layout->writerPid = static_cast<int>(getpid());
+    layout->status.store(RUNNING, std::memory_order_relaxed);
+    layout->frame.store(0, std::memory_order_relaxed);
+    layout->publishedNanoseconds.store(0, std::memory_order_relaxed);
+    for (int i = 0; i < SHARED_FRAME_WORDS; ++i)
+    {
+        layout->screen[i].store(0, std::memory_order_relaxed);
+    }
+    layout->sequence.store(sequence + 2 + (sequence & 1), std::memory_order_release);
+    return true;
+}
+
+// A segment that already exists is only taken over once its writer has stopped or died: two writers would
+// break the sequence lock, and readers would then accept torn frames
+bool SharedFrame::
+isAbandoned()
+{
+    if (layout->magic != SHARED_FRAME_MAGIC || layout->version != SHARED_FRAME_VERSION)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, path + " exists but is not a version " +
+                       std::to_string(SHARED_FRAME_VERSION) + " imit8 frame; pick another name or remove it");
+        return false;
+    }
+    if (layout->status.load(std::memory_order_relaxed) == STOPPED || !isWriterAlive())
+    {
+        return true;
+    }
+    logWriter->log(LogWriter::LogLevel::ERROR, path + " is in use by process " + std::to_string(layout->writerPid) +
+                   "; pick another name");
+    return false;
+}
+
+bool SharedFrame::
+attach(const std::string& name)
+{
+    path = "/imit8-" + name;
+    int descriptor = shm_open(path.c_str(), O_RDONLY, 0);
+    if (descriptor < 0)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not open shared memory " + path + " (" + std::strerror(errno) + ")");
+        return false;
+    }
+    void* memory = MAP_FAILED;
+    struct stat status;
+    if (fstat(descriptor, &status) == 0 && static_cast<size_t>(status.st_size) >= sizeof(Layout))
+    {
+        memory = mmap(nullptr, sizeof(Layout), PROT_READ, MAP_SHARED, descriptor, 0);
+    }
+    ::close(descriptor);
+    if (memory == MAP_FAILED)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not map shared memory " + path);
+        return false;
+    }
+    layout = static_cast<Layout*>(memory);
+    isWriter = false;
+    if (layout->magic != SHARED_FRAME_MAGIC || layout->version != SHARED_FRAME_VERSION ||
+        layout->width != SCREEN_WIDTH || layout->height != SCREEN_HEIGHT)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, path + " is not a version " + std::to_string(SHARED_FRAME_VERSION) +
+                       " imit8 frame");
+        unmap();
+        return false;
+    }
+    return true;
+}
+
+void SharedFrame::
+publish(const unsigned char* screen, unsigned long long frame, unsigned int rows)
+{
+    unsigned int sequence = layout->sequence.load(std::memory_order_relaxed);
+    layout->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i = 0; i < SHARED_FRAME_WORDS; ++i)
+    {
+        if (!(rows & (1u << i)))
+        {
+            continue;
+        }
+        unsigned long long word;
+        std::memcpy(&word, screen + i * 8, 8);
+        layout->screen[i].store(word, std::memory_order_relaxed);
+    }
+    layout->frame.store(frame, std::memory_order_relaxed);
+    layout->publishedNanoseconds.store(static_cast<unsigned long long>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count()), std::memory_order_relaxed);
+    layout->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void SharedFrame::
+close()
+{
+    if (layout == nullptr)
+    {
+        return;
+    }
+    if (isWriter)
+    {
+        unsigned int sequence = layout->sequence.load(std::memory_order_relaxed);
+        layout->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        layout->status.store(STOPPED, std::memory_order_relaxed);
+        layout->sequence.store(sequence + 2, std::memory_order_release);
+        shm_unlink(path.c_str());
+    }
+    unmap();
+}
+
+bool SharedFrame::
+read(Snapshot& snapshot) const
+{
+    for (int tries = 0; tries < SHARED_FRAME_READ_TRIES; ++tries)
+    {
+        unsigned int sequence = layout->sequence.load(std::memory_order_acquire);
+        if (sequence & 1)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        for (int i = 0; i < SHARED_FRAME_WORDS; ++i)
+        {
+            unsigned long long word = layout->screen[i].load(std::memory_order_relaxed);
+            std::memcpy(snapshot.screen + i * 8, &word, 8);
+        }
+        snapshot.status = layout->status.load(std::memory_order_relaxed);
+        snapshot.frame = layout->frame.load(std::memory_order_relaxed);
+        snapshot.publishedNanoseconds = layout->publishedNanoseconds.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (layout->sequence.load(std::memory_order_relaxed) == sequence)
+        {
+            snapshot.sequence = sequence;
+            snapshot.writerPid = layout->writerPid;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool SharedFrame::
+hasChanged(unsigned int sequence) const
+{
+    return layout->sequence.load(std::memory_order_acquire) != sequence;
+}
+
+bool SharedFrame::
+isWriterAlive() const
+{
+    return kill(layout->writerPid, 0) == 0 || errno != ESRCH;
+}
+
+void SharedFrame::
+unmap()
+{
+    munmap(layout, sizeof(Layout));
+    layout = nullptr;
+}
@@ -0,0 +1,100 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * SharedFrame
+ * A screen published in a POSIX shared memory segment (/imit8-NAME) for viewers in other processes. The
+ * emulator is the only writer and never waits: it bumps a sequence number to odd, stores the frame and bumps
+ * it back to even. A reader copies the frame out and keeps it only if the sequence was even and unchanged
+ * around the copy, retrying otherwise, so it never sees half of one frame and half of the next.
+ */
+
+#ifndef IMIT8_CHIP8_SHAREDFRAME_H
+#define IMIT8_CHIP8_SHAREDFRAME_H
+
+#include <atomic>
+#include <string>
+#include "Chip8.h"
+#include "LogWriter.h"
+
+#define SHARED_FRAME_MAGIC 0x38544D49     // "IMT8" in little endian
+#define SHARED_FRAME_VERSION 1
+#define SHARED_FRAME_WORDS (SCREEN_SIZE / 8)   // one per row
+#define SHARED_FRAME_READ_TRIES 100000
+
+class SharedFrame
+{
+    public:
+        enum Status
+        {
+            RUNNING = 1,
+            STOPPED = 2                   // the emulator has exited; no more frames will come
+        };
+
+        // What a reader gets: one consistent frame
+        struct Snapshot
+        {
+            unsigned int sequence;        // changes whenever a new frame is published
+            unsigned int status;
+            unsigned long long frame;     // the emulator's frame number when the screen was published
+            unsigned long long publishedNanoseconds;  // steady clock time of publishing
+            int writerPid;
+            unsigned char screen[SCREEN_SIZE];
+        };
+
+        explicit SharedFrame(LogWriter* logWriter);
+        ~SharedFrame();
+
+        // Writer: create /imit8-name, or take it over from a writer that has stopped or died, and publish to it
+        bool create(const std::string& name);
+
+        // Reader: map an existing /imit8-name read only
+        bool attach(const std::string& name);
+
+        // Writer: publish a screen in which only the rows set in `rows` (bit r for row r) differ from the last one
+        void publish(const unsigned char* screen, unsigned long long frame, unsigned int rows);
+
+        // Writer: mark the segment stopped and remove its name. Readers already attached keep the last frame.
+        void close();
+
+        // Reader: copy out the latest frame. Fails only if the writer stayed in the middle of publishing for
+        // SHARED_FRAME_READ_TRIES attempts, e.g. because it died there.
+        bool read(Snapshot& snapshot) const;
+
+        // Reader: has a frame been published since `sequence`? Cheap enough to poll.
+        bool hasChanged(unsigned int sequence) const;
+
+        // Is the process that last published here still there? Only a process known to be gone counts as not:
+        // one that merely may not be signalled (another user's) counts as alive.
+        bool isWriterAlive() const;
+
+    private:
+        // Layout of the segment. Everything a reader loads while the writer may store is atomic.
+        struct Layout
+        {
+            unsigned int magic;
+            unsigned int version;
+            unsigned int width;
+            unsigned int height;
+            int writerPid;
+            alignas(64) std::atomic<unsigned int> sequence;
+            std::atomic<unsigned int> status;
+            std::atomic<unsigned long long> frame;
+            std::atomic<unsigned long long> publishedNanoseconds;
+            std::atomic<unsigned long long> screen[SHARED_FRAME_WORDS];
+        };
+
+        LogWriter* logWriter;
+        Layout* layout;
+        std::string path;
+        bool isWriter;
+
+        bool isAbandoned();
+        void unmap();
+};
+
+#endif //IMIT8_CHIP8_SHAREDFRAME_H
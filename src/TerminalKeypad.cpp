@@ -0,0 +1,115 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * TerminalKeypad
+ * Non-blocking reads of standard input, turned into key presses and releases.
+ */
+
+#include <cctype>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include "TerminalKeypad.h"
+
+#define KEYPAD_READ_BYTES 64
+
+TerminalKeypad::
+TerminalKeypad(LogWriter* logWrit)
+{
+    logWriter = logWrit;
+    isOpen = false;
+    isTerminal = false;
+    isEnded = false;
+    std::memset(&savedSettings, 0, sizeof(savedSettings));
+    std::memset(heldFrames, 0, sizeof(heldFrames));
+}
+
+TerminalKeypad::
+~TerminalKeypad()
+{
+    close();
+}
+
+bool TerminalKeypad::
+open()
+{
+    if (isatty(STDIN_FILENO))
+    {
+        if (tcgetattr(STDIN_FILENO, &savedSettings) != 0)
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, "Could not read the terminal's settings for the keypad");
+            return false;
+        }
+        termios settings = savedSettings;
+        settings.c_lflag &= ~static_cast<tcflag_t>(ICANON | ECHO);
+        settings.c_cc[VMIN] = 0;
+        settings.c_cc[VTIME] = 0;
+        if (tcsetattr(STDIN_FILENO, TCSANOW, &settings) != 0)
+        {
+            logWriter->log(LogWriter::LogLevel::ERROR, "Could not change the terminal's settings for the keypad");
+            return false;
+        }
+        isTerminal = true;
+    }
+    isOpen = true;
+    isEnded = false;
+    return true;
+}
+
+void TerminalKeypad::
+close()
+{
+    if (isTerminal)
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &savedSettings);
+        isTerminal = false;
+    }
+    isOpen = false;
+}
+
+void TerminalKeypad::
+poll(Core& core)
+{
+    if (!isOpen)
+    {
+        return;
+    }
+    for (unsigned char key = 0; key < KEYPAD_KEYS; ++key)
+    {
+        if (heldFrames[key] != 0 && --heldFrames[key] == 0)
+        {
+            core.setKey(key, false);
+        }
+    }
+
+    pollfd input = {STDIN_FILENO, POLLIN, 0};
+    while (!isEnded && ::poll(&input, 1, 0) > 0)
+    {
+        char buffer[KEYPAD_READ_BYTES];
+        ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (length <= 0)
+        {
+            isEnded = true; // at the end of a pipe or file, or broken: the keys are simply never pressed again
+            break;
+        }
+        for (ssize_t i = 0; i < length; ++i)
+        {
+            unsigned char typed = static_cast<unsigned char>(buffer[i]);
+            if (!isxdigit(typed))
+            {
+                continue;
+            }
+            unsigned char key = static_cast<unsigned char>(isdigit(typed) ? typed - '0' : tolower(typed) - 'a' + 10);
+            if (heldFrames[key] == 0)
+            {
+                core.setKey(key, true);
+            }
+            heldFrames[key] = KEYPAD_HOLD_FRAMES;
+        }
+    }
+}
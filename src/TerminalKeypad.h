@@ -0,0 +1,48 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * TerminalKeypad
+ * The keypad from standard input, polled once a frame instead of read when 0xFR0A asks: a typed hex digit
+ * presses that key. Terminals only report presses, so a key is released once it has not been typed for
+ * KEYPAD_HOLD_FRAMES; held down, it repeats at the terminal's auto-repeat rate and so stays pressed.
+ */
+
+#ifndef IMIT8_CHIP8_TERMINALKEYPAD_H
+#define IMIT8_CHIP8_TERMINALKEYPAD_H
+
+#include <termios.h>
+#include "Core.h"
+#include "LogWriter.h"
+
+#define KEYPAD_KEYS 16
+#define KEYPAD_HOLD_FRAMES 6
+
+class TerminalKeypad
+{
+    public:
+        explicit TerminalKeypad(LogWriter* logWriter);
+        ~TerminalKeypad();
+
+        // Start polling. When standard input is a terminal, line buffering and echo are turned off until
+        // close(); Ctrl-C still interrupts.
+        bool open();
+        void close();
+
+        // Press the keys typed since the last call and release the ones that have not been typed for a while
+        void poll(Core& core);
+
+    private:
+        LogWriter* logWriter;
+        bool isOpen;
+        bool isTerminal;                    // the terminal's settings were changed and are to be put back
+        bool isEnded;                       // standard input is at its end
+        termios savedSettings;
+        unsigned int heldFrames[KEYPAD_KEYS];   // frames left before each key is released, 0 when up
+};
+
+#endif //IMIT8_CHIP8_TERMINALKEYPAD_H
@@ -0,0 +1,174 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Tracer
+ * Per thread event rings and the Chrome trace JSON writer.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <unistd.h>
+#include "Tracer.h"
+
+// Make text safe inside a JSON string
+static std::string
+escapeJson(const std::string& text)
+{
+    std::string escaped;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            escaped += '\\';
+        }
+        escaped += static_cast<unsigned char>(c) < 0x20 ? ' ' : c;
+    }
+    return escaped;
+}
+
+Tracer::
+Tracer(LogWriter* logWrit)
+{
+    static std::atomic<unsigned long long> tracersMade(0);
+    logWriter = logWrit;
+    generation = ++tracersMade;
+    startTime = std::chrono::steady_clock::now();
+}
+
+// The calling thread's ring, made on its first event. Cached per thread, so only a thread's first event
+// for a tracer takes ringsMutex. The cache is keyed on the generation, not the address: a tracer made
+// where a destroyed one was must not be handed that one's ring. A thread moving between tracers finds
+// its existing ring again rather than making another.
+Tracer::Ring* Tracer::
+getRing()
+{
+    static thread_local unsigned long long owner = 0;
+    static thread_local Ring* ring = nullptr;
+    if (owner != generation)
+    {
+        std::thread::id thread = std::this_thread::get_id();
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        std::vector<std::unique_ptr<Ring>>::iterator found =
+                std::find_if(rings.begin(), rings.end(),
+                             [thread](const std::unique_ptr<Ring>& candidate) { return candidate->thread == thread; });
+        if (found != rings.end())
+        {
+            ring = found->get();
+        }
+        else
+        {
+            rings.emplace_back(new Ring());
+            ring = rings.back().get();
+            ring->events.resize(TRACE_RING_EVENTS);
+            ring->recorded = 0;
+            ring->id = static_cast<unsigned int>(rings.size());
+            ring->threadName = "thread " + std::to_string(ring->id);
+            ring->thread = thread;
+        }
+        owner = generation;
+    }
+    return ring;
+}
+
+void Tracer::
+record(const char* name, unsigned long long start)
+{
+    unsigned long long end = now();
+    Ring* ring = getRing();
+    std::lock_guard<std::mutex> lock(ring->mutex);
+    Event& event = ring->events[ring->recorded % TRACE_RING_EVENTS];
+    event.name = name;
+    event.start = start;
+    event.duration = end - start;
+    ++ring->recorded;
+}
+
+void Tracer::
+nameThread(const std::string& name)
+{
+    Ring* ring = getRing();
+    std::lock_guard<std::mutex> lock(ring->mutex);
+    ring->threadName = name;
+}
+
+bool Tracer::
+write(const std::string& path)
+{
+    // copy the rings out first: logging below records events of its own, so no ring may be held then
+    struct Copy
+    {
+        std::string threadName;
+        unsigned int id;
+        unsigned long long recorded;
+        std::vector<Event> events;
+    };
+    std::vector<Copy> copies;
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for (const std::unique_ptr<Ring>& ring : rings)
+        {
+            std::lock_guard<std::mutex> ringLock(ring->mutex);
+            Copy copy;
+            copy.threadName = ring->threadName;
+            copy.id = ring->id;
+            copy.recorded = ring->recorded;
+            unsigned long long kept = std::min(ring->recorded, static_cast<unsigned long long>(TRACE_RING_EVENTS));
+            for (unsigned long long i = ring->recorded - kept; i < ring->recorded; ++i)
+            {
+                copy.events.push_back(ring->events[i % TRACE_RING_EVENTS]);
+            }
+            copies.push_back(std::move(copy));
+        }
+    }
+
+    std::string temporaryPath = path + ".tmp";
+    std::ofstream output(temporaryPath, std::ios::trunc);
+    if (!output.is_open())
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not open trace file " + temporaryPath);
+        return false;
+    }
+    long pid = static_cast<long>(getpid());
+    output << std::fixed << std::setprecision(3);
+    output << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool isFirst = true;
+    for (const Copy& copy : copies)
+    {
+        output << (isFirst ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+               << ",\"tid\":" << copy.id << ",\"args\":{\"name\":\"" << escapeJson(copy.threadName) << "\"}}";
+        isFirst = false;
+        for (const Event& event : copy.events)
+        {
+            // complete events, in microseconds
+            output << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"imit8\",\"ph\":\"X\",\"pid\":" << pid
+                   << ",\"tid\":" << copy.id << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":"
+                   << event.duration / 1000.0 << '}';
+        }
+    }
+    output << "\n]}\n";
+    output.close();
+    if (!output.good() || std::rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        logWriter->log(LogWriter::LogLevel::ERROR, "Could not write trace file " + path);
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+
+    for (const Copy& copy : copies)
+    {
+        if (copy.recorded > TRACE_RING_EVENTS)
+        {
+            logWriter->log(LogWriter::LogLevel::WARNING, "Trace kept only the latest events of " + copy.threadName,
+                           {{"recorded", copy.recorded, false}, {"kept", TRACE_RING_EVENTS, false}});
+        }
+    }
+    return true;
+}
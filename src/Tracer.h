@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * Tracer
+ * A timeline of where the time goes: scoped events (emulate, present, timers, sleep, log writes, ...) kept
+ * in a ring per thread and written out as Chrome trace JSON, which chrome://tracing and Perfetto open.
+ * Each thread only ever takes its own ring's lock, so threads do not contend with each other; a full ring
+ * overwrites its oldest events, so a long run keeps its most recent TRACE_RING_EVENTS per thread.
+ *
+ * Code that may be traced holds a Tracer pointer that is nullptr when tracing is off, and marks its
+ * phases with TraceScope. Off, a scope costs two tests of that pointer, one as it opens and one as it
+ * closes. On, recording an event also compares the thread's cached ring owner with the tracer's generation
+ * before taking the ring's lock.
+ */
+
+#ifndef IMIT8_CHIP8_TRACER_H
+#define IMIT8_CHIP8_TRACER_H
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LogWriter.h"
+
+#define TRACE_RING_EVENTS 65536
+
+class Tracer
+{
+    public:
+        explicit Tracer(LogWriter* logWriter);
+
+        // Nanoseconds since the tracer was made
+        inline unsigned long long now() const
+        {
+            return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - startTime).count());
+        }
+
+        // An event on the calling thread from start (from now()) until now. name must outlive the tracer,
+        // as a string literal does.
+        void record(const char* name, unsigned long long start);
+
+        // How the calling thread is labelled in the timeline
+        void nameThread(const std::string& name);
+
+        // Everything still in the rings, as Chrome trace JSON. Written to PATH.tmp, then renamed over path,
+        // so it can be called again while running and a viewer never sees half a file.
+        bool write(const std::string& path);
+
+    private:
+        struct Event
+        {
+            const char* name;
+            unsigned long long start;       // ns since startTime
+            unsigned long long duration;    // ns
+        };
+
+        struct Ring
+        {
+            std::mutex mutex;               // the owning thread while recording, write() while copying
+            std::vector<Event> events;
+            unsigned long long recorded;    // ever, so the next slot is recorded % TRACE_RING_EVENTS
+            std::string threadName;
+            unsigned int id;                // the trace's tid
+            std::thread::id thread;         // the owner, so a thread that comes back finds its ring again
+        };
+
+        LogWriter* logWriter;
+        unsigned long long generation;      // unique per tracer ever made, unlike its address
+        std::chrono::steady_clock::time_point startTime;
+        std::mutex ringsMutex;              // guards rings itself; taken once per thread
+        std::vector<std::unique_ptr<Ring>> rings;
+
+        Ring* getRing();
+};
+
+// An event from construction to destruction, or to end()
+class TraceScope
+{
+    public:
+        inline TraceScope(Tracer* tracer, const char* name) : tracer(tracer), name(name), start(0)
+        {
+            if (tracer != nullptr)
+            {
+                start = tracer->now();
+            }
+        }
+
+        inline ~TraceScope()
+        {
+            end();
+        }
+
+        inline void end()
+        {
+            if (tracer != nullptr)
+            {
+                tracer->record(name, start);
+                tracer = nullptr;
+            }
+        }
+
+    private:
+        Tracer* tracer;
+        const char* name;
+        unsigned long long start;
+};
+
+#endif //IMIT8_CHIP8_TRACER_H
@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * imit8_bench
+ * Command line front end for the Benchmark. Exits with 1 if a benchmark regressed past the threshold.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include "Benchmark.h"
+
+static void
+printUsage()
+{
+    std::cerr << "Usage: imit8_bench [-w warmupFrames] [-f framesPerSample] [-r repeats] [-o results.json]\n"
+              << "                   [-b baseline.json] [-t thresholdPercent] [benchmark ...]" << std::endl;
+    std::cerr << "Benchmarks:";
+    for (const Benchmark::Workload& workload : Benchmark::workloads())
+    {
+        std::cerr << " " << workload.name;
+    }
+    std::cerr << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long long warmupFrames = 2000;
+    unsigned long long framesPerSample = 20000;
+    int repeats = 10;
+    double threshold = 10;
+    std::string outputFile;
+    std::string baselineFile;
+    std::vector<std::string> selected;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            switch (arg[1])
+            {
+                case 'w':
+                    warmupFrames = std::strtoull(value.c_str(), nullptr, 10);
+                    break;
+                case 'f':
+                    framesPerSample = std::max(1ULL, std::strtoull(value.c_str(), nullptr, 10));
+                    break;
+                case 'r':
+                    repeats = std::max(2, std::atoi(value.c_str()));
+                    break;
+                case 'o':
+                    outputFile = value;
+                    break;
+                case 'b':
+                    baselineFile = value;
+                    break;
+                case 't':
+                    threshold = std::atof(value.c_str());
+                    break;
+                default:
+                    printUsage();
+                    exit(1);
+            }
+        }
+        else if (arg[0] == '-')
+        {
+            printUsage();
+            exit(1);
+        }
+        else
+        {
+            selected.push_back(arg);
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if (!baselineFile.empty() && !Benchmark::readBaseline(baselineFile, baseline))
+    {
+        std::cerr << "ERROR: Could not read the baseline " << baselineFile << std::endl;
+        exit(1);
+    }
+
+    Benchmark benchmark(warmupFrames, framesPerSample, repeats);
+    std::vector<Benchmark::Result> results;
+    bool hasRegressed = false;
+    for (const Benchmark::Workload& workload : Benchmark::workloads())
+    {
+        if (!selected.empty() && std::find(selected.begin(), selected.end(), workload.name) == selected.end())
+        {
+            continue;
+        }
+        Benchmark::Result result;
+        if (!benchmark.run(workload, result))
+        {
+            std::cerr << "ERROR: " << workload.name << " stopped running." << std::endl;
+            exit(1);
+        }
+        results.push_back(result);
+
+        char line[160];
+        std::snprintf(line, sizeof(line), "%-11s %8.3f ns/instr +- %6.3f (95%%, n=%d)", result.name.c_str(),
+                      result.mean, result.confidence95, repeats);
+        std::cout << line;
+        std::map<std::string, double>::const_iterator base = baseline.find(result.name);
+        if (base != baseline.end() && base->second > 0)
+        {
+            // only a change the confidence interval cannot explain counts as a regression
+            double change = (result.mean / base->second - 1) * 100;
+            bool isRegression = result.mean - result.confidence95 > base->second * (1 + threshold / 100);
+            std::snprintf(line, sizeof(line), "  baseline %8.3f  %+6.1f%%%s", base->second, change,
+                          isRegression ? "  REGRESSION" : "");
+            std::cout << line;
+            hasRegressed |= isRegression;
+        }
+        std::cout << "  " << workload.description << std::endl;
+    }
+
+    if (results.empty())
+    {
+        printUsage();
+        exit(1);
+    }
+    if (!outputFile.empty() && !Benchmark::writeJson(outputFile, results))
+    {
+        std::cerr << "ERROR: Could not write " << outputFile << std::endl;
+        exit(1);
+    }
+    if (hasRegressed)
+    {
+        std::cerr << "imit8_bench: slower than the baseline by more than " << threshold << "%" << std::endl;
+        return 1;
+    }
+    return 0;
+}
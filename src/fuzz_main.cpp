@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * imit8_fuzz
+ * Command line front end for the Fuzzer.
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sys/stat.h>
+#include "Fuzzer.h"
+
+static void
+printUsage()
+{
+    std::cerr << "Usage: imit8_fuzz [-n execs] [-t seconds] [-f framesPerExec] [-s seed] [-o outputDir] [seed.ch8 ...]"
+              << std::endl;
+}
+
+// mkdir -p: create path and any missing parents. Returns false unless path ends up a directory.
+static bool
+makeDirectories(const std::string& path)
+{
+    for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1))
+    {
+        std::string prefix = path.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            return false;
+        }
+        if (slash == std::string::npos)
+        {
+            break;
+        }
+    }
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0)
+    {
+        return false;
+    }
+    errno = ENOTDIR;
+    return S_ISDIR(status.st_mode);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long long maxExecs = 0;
+    unsigned int maxSeconds = 0;
+    int framesPerExec = 30;
+    unsigned int seed = static_cast<unsigned int>(time(nullptr));
+    std::string outputDirectory;
+    std::vector<std::string> seedFiles;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            switch (arg[1])
+            {
+                case 'n':
+                    maxExecs = std::strtoull(value.c_str(), nullptr, 10);
+                    break;
+                case 't':
+                    maxSeconds = static_cast<unsigned int>(std::strtoul(value.c_str(), nullptr, 10));
+                    break;
+                case 'f':
+                    framesPerExec = std::max(1, std::atoi(value.c_str()));
+                    break;
+                case 's':
+                    seed = static_cast<unsigned int>(std::strtoul(value.c_str(), nullptr, 10));
+                    break;
+                case 'o':
+                    outputDirectory = value;
+                    break;
+                default:
+                    printUsage();
+                    exit(1);
+            }
+        }
+        else if (arg[0] == '-')
+        {
+            printUsage();
+            exit(1);
+        }
+        else
+        {
+            seedFiles.push_back(arg);
+        }
+    }
+
+    if (!outputDirectory.empty() && !makeDirectories(outputDirectory))
+    {
+        std::cerr << "ERROR: Could not create the output directory " << outputDirectory << ": "
+                  << std::strerror(errno) << std::endl;
+        exit(1);
+    }
+
+    Fuzzer fuzzer(seed, framesPerExec, outputDirectory);
+    for (const std::string& seedFile : seedFiles)
+    {
+        if (!fuzzer.addSeedFile(seedFile))
+        {
+            std::cerr << "WARNING: seed " << seedFile << " could not be loaded, skipping." << std::endl;
+        }
+    }
+
+    std::cout << "imit8_fuzz: seed " << seed << ", " << framesPerExec << " frames per exec" << std::endl;
+    fuzzer.run(maxExecs, maxSeconds);
+
+    return 0;
+}
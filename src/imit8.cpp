@@ -0,0 +1,225 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * imit8
+ * The C API over Chip8 and the frame sinks.
+ */
+
+#include <cstring>
+#include <new>
+#include <string>
+#include "Chip8.h"
+#include "FrameSink.h"
+#include "LogWriter.h"
+#include "imit8.h"
+
+static_assert(IMIT8_SCREEN_BYTES == SCREEN_SIZE && IMIT8_CYCLES_PER_FRAME == OPCODES_PER_FRAME,
+              "imit8.h disagrees with Chip8.h");
+
+struct imit8_machine
+{
+    explicit imit8_machine(const char* logPath) :
+            logWriter(logPath != nullptr ? logPath : "", logPath != nullptr ? LogWriter::LogLevel::INFO :
+                                                         LogWriter::LogLevel::OFF),
+            cpu(&logWriter), terminalSink(&logWriter), fileSink(&logWriter), sharedMemorySink(&logWriter),
+            pluginSink(&logWriter), sink(&nullSink)
+    {
+        cpu.setKeyWaitBlocking(false);
+        isRunning = false;
+        isScreenStale = true;
+        isSeeded = false;
+        seed = 0;
+        cycles = 0;
+        frames = 0;
+    }
+
+    LogWriter logWriter;
+    Chip8 cpu;
+    NullSink nullSink;
+    TerminalSink terminalSink;
+    FileSink fileSink;
+    SharedMemorySink sharedMemorySink;
+    PluginSink pluginSink;
+    FrameSink* sink;
+    bool isScreenStale;         // the sink's picture is not the machine's: send it the whole screen
+    bool isRunning;
+    bool isSeeded;
+    unsigned int seed;
+    unsigned long long cycles;
+    unsigned long long frames;
+    std::string error;
+};
+
+struct imit8_snapshot
+{
+    Chip8Snapshot snapshot;
+    bool isRunning;
+    unsigned long long cycles;
+};
+
+imit8_machine*
+imit8_create(const char* log_path)
+{
+    return new (std::nothrow) imit8_machine(log_path);
+}
+
+void
+imit8_destroy(imit8_machine* machine)
+{
+    if (machine != nullptr)
+    {
+        machine->sink->close();
+        delete machine;
+    }
+}
+
+int
+imit8_load_rom(imit8_machine* machine, const unsigned char* rom, size_t length)
+{
+    machine->cpu.init();
+    machine->isRunning = false;
+    machine->cycles = 0;
+    machine->frames = 0;
+    machine->isScreenStale = true;
+    if (machine->isSeeded)
+    {
+        machine->cpu.getState().randomState = machine->seed;
+    }
+    if (rom == nullptr || !machine->cpu.loadBuffer(rom, length))
+    {
+        machine->error = "ROM must be 1 to " + std::to_string(MEMORY_SIZE - CODE_START) + " bytes";
+        return 0;
+    }
+    machine->isRunning = true;
+    return 1;
+}
+
+void
+imit8_set_seed(imit8_machine* machine, unsigned int seed)
+{
+    machine->isSeeded = true;
+    machine->seed = seed | 1; // xorshift must not start at 0
+    machine->cpu.getState().randomState = machine->seed;
+}
+
+void
+imit8_set_key(imit8_machine* machine, unsigned int key, int is_pressed)
+{
+    machine->cpu.setKey(static_cast<unsigned char>(key), is_pressed != 0);
+}
+
+int
+imit8_run_cycles(imit8_machine* machine, unsigned int cycles)
+{
+    unsigned int executed = 0;
+    for (unsigned int i = 0; i < cycles && machine->isRunning; i += executed)
+    {
+        machine->isRunning = machine->cpu.runStep(cycles - i, executed);
+        machine->cycles += executed;
+    }
+    return machine->isRunning ? 1 : 0;
+}
+
+int
+imit8_run_frames(imit8_machine* machine, unsigned int frames)
+{
+    for (unsigned int i = 0; i < frames && machine->isRunning; ++i)
+    {
+        imit8_run_cycles(machine, OPCODES_PER_FRAME);
+        DirtyRegion dirty = machine->cpu.takeDirtyRegion();
+        if (machine->isScreenStale)
+        {
+            dirty.rows = ~0u;
+            std::memset(dirty.columns, 0xFF, sizeof(dirty.columns));
+            machine->isScreenStale = false;
+        }
+        if (dirty.rows != 0)
+        {
+            machine->sink->present(machine->cpu.getScreen(), dirty, machine->frames);
+        }
+        ++machine->frames;
+        machine->cpu.updateTimers();
+    }
+    return machine->isRunning ? 1 : 0;
+}
+
+const unsigned char*
+imit8_get_framebuffer(const imit8_machine* machine)
+{
+    return machine->cpu.getState().graphicsBuffer;
+}
+
+unsigned long long
+imit8_get_cycles(const imit8_machine* machine)
+{
+    return machine->cycles;
+}
+
+int
+imit8_set_sink(imit8_machine* machine, const char* sink)
+{
+    std::string text = sink != nullptr ? sink : "null";
+    size_t colon = text.find(':');
+    std::string name = text.substr(0, colon);
+    std::string argument = colon == std::string::npos ? "" : text.substr(colon + 1);
+    FrameSink* next = name == "null" ? static_cast<FrameSink*>(&machine->nullSink) :
+                      name == "terminal" ? static_cast<FrameSink*>(&machine->terminalSink) :
+                      name == "file" ? static_cast<FrameSink*>(&machine->fileSink) :
+                      name == "shm" ? static_cast<FrameSink*>(&machine->sharedMemorySink) :
+                      name == "plugin" ? static_cast<FrameSink*>(&machine->pluginSink) : nullptr;
+    if (next == nullptr)
+    {
+        machine->error = "Unknown sink " + name;
+        return 0;
+    }
+    machine->sink->close();
+    machine->sink = &machine->nullSink;
+    if (!next->open(argument))
+    {
+        machine->error = "Could not open the " + name + " sink";
+        return 0;
+    }
+    machine->sink = next;
+    machine->isScreenStale = true;
+    return 1;
+}
+
+imit8_snapshot*
+imit8_snapshot_create(void)
+{
+    return new (std::nothrow) imit8_snapshot();
+}
+
+void
+imit8_snapshot_destroy(imit8_snapshot* snapshot)
+{
+    delete snapshot;
+}
+
+void
+imit8_save(const imit8_machine* machine, imit8_snapshot* snapshot)
+{
+    machine->cpu.saveSnapshot(snapshot->snapshot);
+    snapshot->isRunning = machine->isRunning;
+    snapshot->cycles = machine->cycles;
+}
+
+void
+imit8_restore(imit8_machine* machine, const imit8_snapshot* snapshot)
+{
+    machine->cpu.restoreSnapshot(snapshot->snapshot);
+    machine->isRunning = snapshot->isRunning;
+    machine->cycles = snapshot->cycles;
+    machine->isScreenStale = true;
+}
+
+const char*
+imit8_get_error(const imit8_machine* machine)
+{
+    return machine->error.c_str();
+}
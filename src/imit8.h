@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * imit8
+ * C API of libimit8, for running machines inside another program. Each machine is independent: there is
+ * no global state, nothing is written to standard output, and nothing is logged unless a log file is
+ * named. Machines may be used from different threads, each from one thread at a time.
+ *
+ * Functions returning int return non-zero on success (or while the machine runs) and 0 otherwise; the
+ * reason for a failure is given by imit8_get_error().
+ */
+
+#ifndef IMIT8_CHIP8_IMIT8_H
+#define IMIT8_CHIP8_IMIT8_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define IMIT8_SCREEN_WIDTH 64
+#define IMIT8_SCREEN_HEIGHT 32
+#define IMIT8_SCREEN_BYTES (IMIT8_SCREEN_WIDTH / 8 * IMIT8_SCREEN_HEIGHT)
+#define IMIT8_KEYS 16
+#define IMIT8_CYCLES_PER_FRAME 10
+
+    typedef struct imit8_machine imit8_machine;
+    typedef struct imit8_snapshot imit8_snapshot;
+
+    // A machine with nothing loaded. log_path names a log file to write, or is NULL for no logging at all.
+    // Returns NULL if out of memory.
+    imit8_machine* imit8_create(const char* log_path);
+    void imit8_destroy(imit8_machine* machine);
+
+    // Reset the machine and load length bytes of ROM, copied from rom, at 0x200
+    int imit8_load_rom(imit8_machine* machine, const unsigned char* rom, size_t length);
+
+    // Seed the random number generator behind 0xCRXX, which is otherwise seeded from the clock. Runs with
+    // the same ROM, seed and keys are the same.
+    void imit8_set_seed(imit8_machine* machine, unsigned int seed);
+
+    // Press or release key 0-F. 0xFR0A waits, without blocking the caller, until a key is down.
+    void imit8_set_key(imit8_machine* machine, unsigned int key, int is_pressed);
+
+    // Run instructions without touching the timers. Returns 0 once the machine has halted.
+    int imit8_run_cycles(imit8_machine* machine, unsigned int cycles);
+
+    // Run whole frames of IMIT8_CYCLES_PER_FRAME instructions, each followed by a timer tick and, if the
+    // screen changed, a frame for the sink. Returns 0 once the machine has halted.
+    int imit8_run_frames(imit8_machine* machine, unsigned int frames);
+
+    // The screen: IMIT8_SCREEN_BYTES bytes, 1 bit per pixel, rows top to bottom, most significant bit
+    // leftmost. Valid until the machine is destroyed; it changes as the machine runs.
+    const unsigned char* imit8_get_framebuffer(const imit8_machine* machine);
+
+    // Instructions run since the ROM was loaded
+    unsigned long long imit8_get_cycles(const imit8_machine* machine);
+
+    // Send frames to a sink as imit8_chip8 --sink does: "null" (the default), "file:PATH",
+    // "shm:NAME", "plugin:LIBRARY.so[:ARGUMENT]" or "terminal". Closes the previous one.
+    int imit8_set_sink(imit8_machine* machine, const char* sink);
+
+    // Snapshots hold the whole state of a machine. Saving and restoring are plain copies, so a snapshot can
+    // be taken every frame; it can be restored into any machine.
+    imit8_snapshot* imit8_snapshot_create(void);
+    void imit8_snapshot_destroy(imit8_snapshot* snapshot);
+    void imit8_save(const imit8_machine* machine, imit8_snapshot* snapshot);
+    void imit8_restore(imit8_machine* machine, const imit8_snapshot* snapshot);
+
+    // Why the last call that failed did, or "" if none has
+    const char* imit8_get_error(const imit8_machine* machine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //IMIT8_CHIP8_IMIT8_H
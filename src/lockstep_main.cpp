@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * imit8_lockstep
+ * Command line front end for Lockstep: checks a candidate engine against the interpreter on each ROM given.
+ * Exits with 1 if any ROM diverged.
+ */
+
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include "Lockstep.h"
+
+static void
+printUsage()
+{
+    std::cerr << "Usage: imit8_lockstep [-c candidate] [-n interval] [-f frames] [-s seed] rom.ch8 ..." << std::endl;
+    std::cerr << "  -c  engine to check against the interpreter: interpreter, compact"
+#ifdef IMIT8_DYNAREC
+              << " or dynarec (default)"
+#endif
+              << std::endl;
+    std::cerr << "  -n  instructions between state hash comparisons (default 1000)" << std::endl;
+    std::cerr << "  -f  frames to run per ROM (default 100000, i.e. a million instructions)" << std::endl;
+    std::cerr << "  -s  seed for the keypad input of ROMs without a .keys file" << std::endl;
+}
+
+static std::unique_ptr<LockstepEngine>
+makeEngine(const std::string& name, LogWriter* logWriter)
+{
+#ifdef IMIT8_DYNAREC
+    if (name == "dynarec")
+    {
+        return std::unique_ptr<LockstepEngine>(new DynarecEngine(logWriter));
+    }
+#endif
+    if (name == "interpreter")
+    {
+        return std::unique_ptr<LockstepEngine>(new InterpreterEngine(logWriter));
+    }
+    if (name == "compact")
+    {
+        return std::unique_ptr<LockstepEngine>(new CompactEngine(logWriter));
+    }
+    return nullptr;
+}
+
+// The ROM's .keys file if it has one (the fuzzer's format: a 16-bit key mask per frame), otherwise a new
+// random set of buttons every few frames.
+static std::vector<unsigned short>
+loadKeys(const std::string& romFile, unsigned long long frames, unsigned int seed)
+{
+    std::vector<unsigned short> keys;
+    std::ifstream keysIn(romFile.substr(0, romFile.rfind('.')) + ".keys", std::ios::in | std::ios::binary);
+    unsigned short mask;
+    while (keysIn.read(reinterpret_cast<char*>(&mask), sizeof(mask)))
+    {
+        keys.push_back(mask);
+    }
+    if (!keys.empty())
+    {
+        return keys;
+    }
+
+    unsigned int random = seed | 1;
+    mask = 0;
+    for (unsigned long long frame = 0; frame < frames; ++frame)
+    {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        if (random % 8 == 0)
+        {
+            mask = static_cast<unsigned short>(random >> 8 & random >> 16);
+        }
+        keys.push_back(mask);
+    }
+    return keys;
+}
+
+int main(int argc, char* argv[])
+{
+#ifdef IMIT8_DYNAREC
+    std::string candidateName = "dynarec";
+#else
+    std::string candidateName = "interpreter";
+#endif
+    unsigned long long interval = 1000;
+    unsigned long long frames = 100000;
+    unsigned int seed = static_cast<unsigned int>(time(nullptr));
+    std::vector<std::string> romFiles;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            switch (arg[1])
+            {
+                case 'c':
+                    candidateName = value;
+                    break;
+                case 'n':
+                    interval = std::strtoull(value.c_str(), nullptr, 10);
+                    break;
+                case 'f':
+                    frames = std::strtoull(value.c_str(), nullptr, 10);
+                    break;
+                case 's':
+                    seed = static_cast<unsigned int>(std::strtoul(value.c_str(), nullptr, 10));
+                    break;
+                default:
+                    printUsage();
+                    exit(1);
+            }
+        }
+        else if (arg[0] == '-')
+        {
+            printUsage();
+            exit(1);
+        }
+        else
+        {
+            romFiles.push_back(arg);
+        }
+    }
+
+    LogWriter logWriter("lockstep_log.txt", LogWriter::LogLevel::OFF);
+    if (romFiles.empty() || makeEngine(candidateName, &logWriter) == nullptr)
+    {
+        printUsage();
+        exit(1);
+    }
+
+    std::cout << "imit8_lockstep: " << candidateName << " against the interpreter, seed " << seed << std::endl;
+    int diverged = 0;
+    for (const std::string& romFile : romFiles)
+    {
+        std::ifstream romIn(romFile, std::ios::in | std::ios::binary);
+        std::vector<unsigned char> rom((std::istreambuf_iterator<char>(romIn)), std::istreambuf_iterator<char>());
+        std::unique_ptr<LockstepEngine> reference = makeEngine("interpreter", &logWriter);
+        std::unique_ptr<LockstepEngine> candidate = makeEngine(candidateName, &logWriter);
+        Lockstep lockstep(*reference, *candidate, interval);
+        if (!lockstep.load(rom))
+        {
+            std::cerr << "WARNING: " << romFile << " could not be loaded, skipping." << std::endl;
+            continue;
+        }
+
+        bool isSame = lockstep.run(frames, loadKeys(romFile, frames, seed));
+        std::cout << romFile << ": " << lockstep.getInstructions() << " instructions, "
+                  << lockstep.getCheckpoints() << " checkpoints, trace " << std::hex << lockstep.getTraceHash()
+                  << std::dec << (lockstep.hasHalted() ? ", halted" : "") << (isSame ? ", same" : ", DIVERGED")
+                  << std::endl;
+        if (!isSame)
+        {
+            lockstep.printDivergence(std::cout);
+            ++diverged;
+        }
+    }
+    return diverged == 0 ? 0 : 1;
+}
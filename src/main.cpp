@@ -5,67 +5,756 @@
  * distribution of this software for license terms.
  */
 
+#include <csignal>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
 #include <thread>
+#include "Audio.h"
+#include "Capture.h"
 #include "Chip8.h"
-#include "Display.h"
+#include "Coverage.h"
+#include "DebugServer.h"
+#include "Debugger.h"
+#include "FrameLoop.h"
+#include "FrameSink.h"
+#include "HangDetector.h"
 #include "LogWriter.h"
+#include "Metrics.h"
+#include "PerfCounters.h"
+#include "RunAhead.h"
+#include "TerminalKeypad.h"
+#include "Tracer.h"
+#ifdef IMIT8_AOT
+#include "AotRuntime.h"
+#endif
+#ifdef IMIT8_DYNAREC
+#include "Dynarec.h"
+#endif
 
 using namespace std::chrono;
 
+// SIGUSR1 makes the log more verbose and SIGUSR2 quieter, while running
+static LogWriter* signalledLogWriter = nullptr;
+
+static void
+onLogLevelSignal(int signalNumber)
+{
+    int level = signalledLogWriter->getLevel() + (signalNumber == SIGUSR1 ? 1 : -1);
+    if (level >= LogWriter::LogLevel::OFF && level <= LogWriter::LogLevel::DEBUG)
+    {
+        signalledLogWriter->setLevel(static_cast<LogWriter::LogLevel::Level>(level));
+    }
+}
+
+// With --trace, SIGHUP writes the trace so far. With --trace or --run-ahead, SIGINT and SIGTERM end the run
+// through the normal exit, which writes the trace and puts the terminal's settings back.
+static volatile std::sig_atomic_t caughtSignal = 0;
+
+static void
+onSignal(int signalNumber)
+{
+    caughtSignal = signalNumber;
+}
+
+// Hand the screen to the sink if dirty says it changed, timing it as the present section
+static void
+presentFrame(FrameLoop<Chip8, FrameSink>& frameLoop, const DirtyRegion& dirty, PerfCounters& perfCounters,
+             Tracer* tracer)
+{
+    if (dirty.rows != 0)
+    {
+        TraceScope presentScope(tracer, "present");
+        perfCounters.beginSection(PerfCounters::PRESENT);
+        frameLoop.present(dirty);
+        perfCounters.endSection(PerfCounters::PRESENT);
+    }
+    else
+    {
+        frameLoop.present(dirty);
+    }
+}
+
+// Hits per sequence, and the share of the instructions run through Chip8::runStep they account for
+static std::string
+reportFusion(const Chip8FusionStatistics& fusion)
+{
+    static const char* const NAMES[FUSIONS] = {"ANNN DXYN", "6XNN 6YNN", "FX07 3X00 1NNN", "7XNN 3XNN 1NNN"};
+    std::stringstream text;
+    double instructions = fusion.instructions == 0 ? 1 : static_cast<double>(fusion.instructions);
+    unsigned long long fused = 0;
+    text << std::fixed << std::setprecision(2) << "Fusion:";
+    for (int kind = 0; kind < FUSIONS; ++kind)
+    {
+        fused += fusion.fusedInstructions[kind];
+        text << (kind == 0 ? " " : ", ") << NAMES[kind] << " " << fusion.hits[kind] << " times ("
+             << fusion.fusedInstructions[kind] * 100 / instructions << "%";
+        if (fusion.shortBudget[kind] != 0)
+        {
+            text << ", " << fusion.shortBudget[kind] << " too close to the end of a frame";
+        }
+        text << ")";
+    }
+    text << "; " << fused * 100 / instructions << "% of " << fusion.instructions << " instructions fused.";
+    return text.str();
+}
+
+static void
+printUsage()
+{
+    std::cerr << "Usage: imit8-chip8 [--headless] [--turbo] [--frames N] [--no-idle-skip] [--no-hang-check]\n"
+              << "                   [--no-fusion] [--fusion-report]\n"
+              << "                   [--dynarec] [--debug] [--gdb PORT] [--audio-wav PATH] [--audio-pcm PATH]\n"
+              << "                   [--capture PATH] [--capture-scale N] [--sink SINK]\n"
+              << "                   [--coverage PATH] [--coverage-listing PATH] [--perf] [--perf-interval N]\n"
+              << "                   [--trace PATH] [--run-ahead N]\n"
+              << "                   [--metrics-file PATH] [--metrics-socket PATH] [--log PATH] [--log-level LEVEL]\n"
+              << "                   [--log-json] [--log-max-bytes N] [--log-max-age SECONDS] [--log-keep N]\n"
+              << "                   dir/filename.ext" << std::endl;
+    std::cerr << "  --headless  do not draw to the terminal (same as --sink null)" << std::endl;
+    std::cerr << "  --turbo     do not wait between frames" << std::endl;
+    std::cerr << "  --frames N  stop after N frames" << std::endl;
+#ifndef IMIT8_AOT
+    std::cerr << "  --no-idle-skip  run wait loops to the end of the frame instead of skipping ahead" << std::endl;
+#endif
+    std::cerr << "  --no-hang-check  keep running a headless program stuck in an endless loop instead of stopping"
+              << std::endl;
+    std::cerr << "                   it with exit status 3" << std::endl;
+    std::cerr << "  --no-fusion      run common instruction sequences one instruction at a time" << std::endl;
+    std::cerr << "  --fusion-report  add how often each fused sequence ran to the summary" << std::endl;
+#ifndef IMIT8_AOT
+    std::cerr << "  --debug     start paused in the debugger (type h at the prompt for commands)" << std::endl;
+    std::cerr << "  --gdb PORT  start paused, waiting for a remote debugger on 127.0.0.1:PORT (or unix:PATH)" << std::endl;
+#endif
+    std::cerr << "  --audio-wav PATH       record the sound timer's tone to a WAV file" << std::endl;
+    std::cerr << "  --audio-pcm PATH       stream it as raw 44.1 kHz s16le mono PCM (- for stdout)" << std::endl;
+    std::cerr << "  --capture PATH         record the screen to PATH.y4m, PATH.gif or PATH000000.png, ..." << std::endl;
+    std::cerr << "  --capture-scale N      draw each Chip-8 pixel as N x N pixels in the capture (default 4)" << std::endl;
+    std::cerr << "  --sink SINK            where frames go: terminal (default), null, file:PATH (PBM stream)," << std::endl;
+    std::cerr << "                         shm:NAME (shared memory for imit8_view NAME) or plugin:LIBRARY.so[:ARGUMENT]"
+              << std::endl;
+#ifndef IMIT8_AOT
+    std::cerr << "  --coverage PATH        add executed addresses, skip outcomes and data accesses to the lcov-like"
+              << std::endl;
+    std::cerr << "                         tracefile PATH" << std::endl;
+    std::cerr << "  --coverage-listing PATH  also write an annotated disassembly with the merged hit counts" << std::endl;
+    std::cerr << "  --run-ahead N          show the screen N frames (at most 8) ahead of the machine to hide the"
+              << std::endl;
+    std::cerr << "                         program's input lag; keys 0-F are read from the terminal every frame"
+              << std::endl;
+#endif
+    std::cerr << "  --perf                 report host cycles, instructions, branch and cache misses per emulated"
+              << std::endl;
+    std::cerr << "                         instruction, per frame drawn and per opCode class (Linux perf events)"
+              << std::endl;
+    std::cerr << "  --perf-interval N      sample one instruction in N on average for the opCode classes (default 64,"
+              << std::endl;
+    std::cerr << "                         0 for none)" << std::endl;
+    std::cerr << "  --trace PATH           write a Chrome trace (chrome://tracing, Perfetto) of each frame's phases and"
+              << std::endl;
+    std::cerr << "                         of log writes to PATH at exit, or while running on SIGHUP" << std::endl;
+    std::cerr << "  --metrics-file PATH    rewrite PATH with Prometheus metrics every second" << std::endl;
+    std::cerr << "  --metrics-socket PATH  serve Prometheus metrics on a Unix domain socket" << std::endl;
+    std::cerr << "  --log PATH             log to PATH instead of log.txt" << std::endl;
+    std::cerr << "  --log-level LEVEL      off, error, warning, info (default) or debug; SIGUSR1 and SIGUSR2 raise and"
+              << std::endl;
+    std::cerr << "                         lower it while running" << std::endl;
+    std::cerr << "  --log-json             write JSON lines with monotonic timestamps and the frame number" << std::endl;
+    std::cerr << "  --log-max-bytes N      start a new log file past N bytes (default 64 MiB, 0 for never)" << std::endl;
+    std::cerr << "  --log-max-age SECONDS  start a new log file after SECONDS (default never)" << std::endl;
+    std::cerr << "  --log-keep N           rotated log files to keep, gzipped when built with zlib (default 4)" << std::endl;
+#ifdef IMIT8_DYNAREC
+    std::cerr << "  --dynarec   translate the program to native code as it runs" << std::endl;
+#endif
+}
+
 int main(int argc, char* argv[])
 {
-    if (argc != 2)
+    bool isHeadless = false;
+    bool isTurbo = false;
+    bool isDynarec = false;
+    bool isDebugging = false;
+#ifndef IMIT8_AOT
+    bool isIdleSkipping = true;         // recompiled blocks are not checked for wait loops
+#endif
+    bool isHangChecking = true;
+    bool isFusing = true;
+    bool isFusionReporting = false;
+    unsigned long long maxFrames = 0;
+    const char* romFile = nullptr;
+    const char* metricsFile = nullptr;
+    const char* debugAddress = nullptr;
+    const char* audioWav = nullptr;
+    const char* audioPcm = nullptr;
+    const char* metricsSocket = nullptr;
+    const char* capturePath = nullptr;
+    unsigned int captureScale = CAPTURE_DEFAULT_SCALE;
+    const char* sinkSpecification = nullptr;
+    const char* coveragePath = nullptr;
+    const char* coverageListing = nullptr;
+    bool isPerfCounting = false;
+    unsigned int perfInterval = PERF_DEFAULT_SAMPLE_INTERVAL;
+    const char* tracePath = nullptr;
+    unsigned int runAheadFrames = 0;
+    const char* logPath = "log.txt";
+    LogWriter::LogLevel::Level logLevel = LogWriter::LogLevel::INFO;
+    bool isLogJson = false;
+    unsigned long long logMaxBytes = LOG_DEFAULT_MAX_BYTES;
+    unsigned long long logMaxSeconds = 0;
+    unsigned int logKeep = LOG_DEFAULT_KEEP;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--headless") == 0)
+        {
+            isHeadless = true;
+        }
+        else if (std::strcmp(argv[i], "--turbo") == 0)
+        {
+            isTurbo = true;
+        }
+#ifdef IMIT8_DYNAREC
+        else if (std::strcmp(argv[i], "--dynarec") == 0)
+        {
+            isDynarec = true;
+        }
+#endif
+        else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            maxFrames = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--no-hang-check") == 0)
+        {
+            isHangChecking = false;
+        }
+        else if (std::strcmp(argv[i], "--no-fusion") == 0)
+        {
+            isFusing = false;
+        }
+        else if (std::strcmp(argv[i], "--fusion-report") == 0)
+        {
+            isFusionReporting = true;
+        }
+#ifndef IMIT8_AOT
+        else if (std::strcmp(argv[i], "--no-idle-skip") == 0)
+        {
+            isIdleSkipping = false;
+        }
+        else if (std::strcmp(argv[i], "--debug") == 0)
+        {
+            isDebugging = true;
+        }
+        else if (std::strcmp(argv[i], "--gdb") == 0 && i + 1 < argc)
+        {
+            isDebugging = true;
+            debugAddress = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--coverage") == 0 && i + 1 < argc)
+        {
+            coveragePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--coverage-listing") == 0 && i + 1 < argc)
+        {
+            coverageListing = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc)
+        {
+            runAheadFrames = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        }
+#endif
+        else if (std::strcmp(argv[i], "--audio-wav") == 0 && i + 1 < argc)
+        {
+            audioWav = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--audio-pcm") == 0 && i + 1 < argc)
+        {
+            audioPcm = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--capture") == 0 && i + 1 < argc)
+        {
+            capturePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--capture-scale") == 0 && i + 1 < argc)
+        {
+            captureScale = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--sink") == 0 && i + 1 < argc)
+        {
+            sinkSpecification = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--perf") == 0)
+        {
+            isPerfCounting = true;
+        }
+        else if (std::strcmp(argv[i], "--perf-interval") == 0 && i + 1 < argc)
+        {
+            perfInterval = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc)
+        {
+            metricsFile = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--metrics-socket") == 0 && i + 1 < argc)
+        {
+            metricsSocket = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--log") == 0 && i + 1 < argc)
+        {
+            logPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--log-level") == 0 && i + 1 < argc &&
+                 LogWriter::LogLevel::parse(argv[i + 1], logLevel))
+        {
+            ++i;
+        }
+        else if (std::strcmp(argv[i], "--log-json") == 0)
+        {
+            isLogJson = true;
+        }
+        else if (std::strcmp(argv[i], "--log-max-bytes") == 0 && i + 1 < argc)
+        {
+            logMaxBytes = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--log-max-age") == 0 && i + 1 < argc)
+        {
+            logMaxSeconds = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--log-keep") == 0 && i + 1 < argc)
+        {
+            logKeep = static_cast<unsigned int>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (argv[i][0] != '-' && romFile == nullptr)
+        {
+            romFile = argv[i];
+        }
+        else
+        {
+            printUsage();
+            exit(1);
+        }
+    }
+
+    if (isDebugging && isDynarec)
+    {
+        std::cerr << "ERROR: --debug and --gdb need the interpreter and cannot be combined with --dynarec." << std::endl;
+        exit(1);
+    }
+
+    if (coveragePath != nullptr && isDynarec)
+    {
+        std::cerr << "ERROR: --coverage needs the interpreter and cannot be combined with --dynarec." << std::endl;
+        exit(1);
+    }
+    if (coverageListing != nullptr && coveragePath == nullptr)
+    {
+        std::cerr << "ERROR: --coverage-listing needs --coverage." << std::endl;
+        exit(1);
+    }
+
+    if (runAheadFrames != 0 && (isDynarec || isDebugging))
+    {
+        std::cerr << "ERROR: --run-ahead needs the interpreter and cannot be combined with --dynarec, --debug or --gdb."
+                  << std::endl;
+        exit(1);
+    }
+
+    if (romFile == nullptr)
     {
         std::cerr << "ERROR: No input program file provided." << std::endl;
-        std::cerr << "Usage: imit8-chip8 dir/filename.ext" << std::endl;
+        printUsage();
         exit(1);
     }
 
-    LogWriter logWriter;
+    LogWriter logWriter(logPath, logLevel);
+    logWriter.setFormat(isLogJson ? LogWriter::JSON_LINES : LogWriter::TEXT);
+    logWriter.setRotation(logMaxBytes, logMaxSeconds, logKeep);
+    signalledLogWriter = &logWriter;
+    std::signal(SIGUSR1, onLogLevelSignal);
+    std::signal(SIGUSR2, onLogLevelSignal);
+    // phases are traced through activeTracer, which stays nullptr unless asked for
+    Tracer tracer(&logWriter);
+    Tracer* activeTracer = nullptr;
+    if (tracePath != nullptr)
+    {
+        activeTracer = &tracer;
+        tracer.nameThread("main");
+        logWriter.setTracer(&tracer);
+        std::signal(SIGHUP, onSignal);
+    }
+    if (tracePath != nullptr || runAheadFrames != 0)
+    {
+        std::signal(SIGINT, onSignal);
+        std::signal(SIGTERM, onSignal);
+    }
+    Metrics metrics;
+    bool isMetered = metricsFile != nullptr || metricsSocket != nullptr;
+    if (isMetered)
+    {
+        logWriter.setMetrics(&metrics);
+    }
     Chip8 cpu0(&logWriter);
-    Display screen(cpu0.getScreen(), &logWriter); // create display and give access to vram
+    if (isMetered)
+    {
+        cpu0.setMetrics(&metrics);
+    }
+    if (metricsSocket != nullptr && !metrics.startServer(metricsSocket, &logWriter))
+    {
+        std::cerr << "ERROR: Could not serve metrics on " << metricsSocket << std::endl;
+        exit(1);
+    }
+
+    // pick where frames go: "name" or "name:argument"
+    std::string sinkText = sinkSpecification != nullptr ? sinkSpecification : isHeadless ? "null" : "terminal";
+    size_t sinkColon = sinkText.find(':');
+    std::string sinkName = sinkText.substr(0, sinkColon);
+    std::string sinkArgument = sinkColon == std::string::npos ? "" : sinkText.substr(sinkColon + 1);
+    NullSink nullSink;
+    TerminalSink terminalSink(&logWriter);
+    FileSink fileSink(&logWriter);
+    SharedMemorySink sharedMemorySink(&logWriter);
+    PluginSink pluginSink(&logWriter);
+    FrameSink* sink = sinkName == "null" ? static_cast<FrameSink*>(&nullSink) :
+                      sinkName == "terminal" ? static_cast<FrameSink*>(&terminalSink) :
+                      sinkName == "file" ? static_cast<FrameSink*>(&fileSink) :
+                      sinkName == "shm" ? static_cast<FrameSink*>(&sharedMemorySink) :
+                      sinkName == "plugin" ? static_cast<FrameSink*>(&pluginSink) : nullptr;
+    if (sink == nullptr)
+    {
+        std::cerr << "ERROR: Unknown sink " << sinkName << "." << std::endl;
+        printUsage();
+        exit(1);
+    }
 
     // load the ROM file
-    if (!cpu0.loadFile(argv[1]))
+    if (!cpu0.loadFile(romFile))
     {
         std::string loadFileFail = "ROM file (";
-        loadFileFail += argv[1];
+        loadFileFail += romFile;
         loadFileFail += ") could not be loaded. Exiting.\n";
         std::cout << loadFileFail << std::endl;
         exit(2);
     }
 
-    Display::clearScreen();
+    // counters the host refuses are left out of the report; the run goes on regardless
+    PerfCounters perfCounters(&logWriter);
+    if (isPerfCounting && perfCounters.open(perfInterval))
+    {
+        cpu0.setPerfCounters(&perfCounters);
+    }
+    Coverage coverage(&logWriter);
+    if (coveragePath != nullptr)
+    {
+        coverage.setRom(romFile, cpu0.getState().memory + CODE_START, cpu0.getState().romBytes);
+        cpu0.setCoverage(&coverage);
+    }
+
+#ifdef IMIT8_AOT
+    AotRuntime aot(&cpu0, &logWriter, &imit8AotProgram);
+#endif
+#ifdef IMIT8_DYNAREC
+    Dynarec dynarec(&cpu0, &logWriter);
+#endif
+    Debugger debugger(&cpu0, &logWriter);
+    DebugServer debugServer(&cpu0, &debugger, &logWriter);
+    if (isDebugging)
+    {
+        debugger.pause();
+    }
+#ifndef IMIT8_AOT
+    // a debugger should see every iteration of a wait loop
+    cpu0.setIdleDetection(isIdleSkipping && !isDebugging && !isDynarec);
+#endif
+    cpu0.setFusion(isFusing);
+    Audio audio(&logWriter);
+    WavSink wavSink(&logWriter);
+    PcmSink pcmSink(&logWriter);
+    AudioSink* audioSink = audioWav != nullptr ? static_cast<AudioSink*>(&wavSink) :
+                           audioPcm != nullptr ? static_cast<AudioSink*>(&pcmSink) : nullptr;
+    if (audioSink != nullptr)
+    {
+        if (!audioSink->open(audioWav != nullptr ? audioWav : audioPcm, audio.getSampleRate()))
+        {
+            std::cerr << "ERROR: Could not open the audio output." << std::endl;
+            exit(1);
+        }
+        audio.start(audioSink);
+    }
+    Capture capture(&logWriter);
+    if (capturePath != nullptr && !capture.start(Capture::formatFor(capturePath), capturePath, captureScale))
+    {
+        std::cerr << "ERROR: Could not start capturing to " << capturePath << std::endl;
+        exit(1);
+    }
+
+    if (!sink->open(sinkArgument))
+    {
+        std::cerr << "ERROR: Could not open the " << sinkName << " sink." << std::endl;
+        exit(1);
+    }
+    FrameLoop<Chip8, FrameSink> frameLoop(cpu0, *sink);
+    // frames ahead need the keypad as it is now, so keys are polled each frame rather than waited for
+    RunAhead runAhead(cpu0, runAheadFrames, !isTurbo);
+    TerminalKeypad keypad(&logWriter);
+    if (runAheadFrames != 0)
+    {
+        cpu0.setKeyWaitBlocking(false);
+        if (!keypad.open())
+        {
+            std::cerr << "ERROR: Could not read the keypad from the terminal." << std::endl;
+            exit(1);
+        }
+    }
+    // nobody is watching a headless run, so one that cannot get anywhere is stopped
+    HangDetector hangDetector;
+    isHangChecking = isHangChecking && sink == &nullSink && !isDebugging;
+    bool isHung = false;
+
+    bool isRemote = debugAddress != nullptr;
+    if (isRemote && !debugServer.start(debugAddress))
+    {
+        std::cerr << "ERROR: Could not start the debug server on " << debugAddress << std::endl;
+        exit(1);
+    }
+
     bool isRunning = true;
+    unsigned long long frames = 0;
+    unsigned long long idleSkipped = 0;
+    steady_clock::time_point runStart = steady_clock::now();
+    microseconds lastMetricsWrite(0);
 
     // main execution loop
     do
     {
+        TraceScope frameScope(activeTracer, "frame");
         microseconds frameStart = duration_cast<microseconds>(system_clock::now().time_since_epoch());
+        logWriter.setFrame(frames);
         bool toDraw = false;
+        keypad.poll(cpu0);
 
         // run one frame's worth of opCodes
-        for (int i = 0; i < OPCODES_PER_FRAME && isRunning; ++i)
+        TraceScope emulateScope(activeTracer, "emulate");
+        perfCounters.beginSection(PerfCounters::EMULATE);
+#ifdef IMIT8_AOT
+        unsigned long long recompiledBefore = aot.getCompiledInstructions();
+        isRunning = aot.runCycles(OPCODES_PER_FRAME);
+        toDraw = aot.isDirtyScreen();
+        perfCounters.addInstructions(aot.getCompiledInstructions() - recompiledBefore);
+#else
+#ifdef IMIT8_DYNAREC
+        if (isDynarec)
+        {
+            unsigned long long nativeBefore = dynarec.getStatistics().compiledInstructions;
+            isRunning = dynarec.runCycles(OPCODES_PER_FRAME);
+            toDraw = dynarec.isDirtyScreen();
+            metrics.countNativeInstructions(dynarec.getStatistics().compiledInstructions - nativeBefore);
+            perfCounters.addInstructions(dynarec.getStatistics().compiledInstructions - nativeBefore);
+        }
+#endif
+        if (!isDynarec && !isDebugging)
+        {
+            // wait loops on the delay timer or a key are cut short, as neither changes before the frame ends
+            isRunning = frameLoop.runCycles(OPCODES_PER_FRAME, toDraw);
+            unsigned long long skipped = frameLoop.takeIdleSkipped();
+            if (skipped != 0)
+            {
+                metrics.countIdleSkipped(skipped);
+                idleSkipped += skipped;
+            }
+        }
+        for (int i = 0; i < OPCODES_PER_FRAME && isRunning && isDebugging && !(isRemote && debugger.isPaused()); ++i)
         {
             isRunning = cpu0.runCycle();
             toDraw |= cpu0.isDirtyScreen();
+            if (debugger.isPaused() && !isRemote)
+            {
+                // stopped before the instruction ran: hand over to the user, then give it this slot again
+                isRunning = debugger.interact(std::cin, std::cout);
+                --i;
+            }
+        }
+#endif
+        perfCounters.endSection(PerfCounters::EMULATE);
+        emulateScope.end();
+
+        // a remote debugger only gets the machine between frames
+        debugServer.service();
+        if (debugServer.isQuitRequested())
+        {
+            isRunning = false;
         }
+        bool isHeld = isRemote && debugger.isPaused();
 
         // update screen, if necessary
-        if (toDraw)
+        DirtyRegion dirty = cpu0.takeDirtyRegion();
+        if (runAheadFrames == 0)
         {
-            screen.drawDisplay();
+            presentFrame(frameLoop, dirty, perfCounters, activeTracer);
+            if (dirty.rows != 0 && sink != &nullSink)
+            {
+                metrics.countDrawCall();
+            }
         }
 
-        cpu0.updateTimers();
+        if (!isHeld)
+        {
+            if (audioSink != nullptr)
+            {
+                TraceScope audioScope(activeTracer, "audio");
+                audio.renderFrame(cpu0.getState());
+            }
+            if (capturePath != nullptr)
+            {
+                TraceScope captureScope(activeTracer, "capture");
+                capture.captureFrame(cpu0.getScreen(), dirty);
+            }
+            TraceScope timersScope(activeTracer, "timers");
+            cpu0.updateTimers();
+            timersScope.end();
+            if (isHangChecking && hangDetector.checkFrame(cpu0.getState(), cpu0.getKeyReads()))
+            {
+                cpu0.setCoverage(nullptr); // the replay is not part of the run
+                cpu0.setPerfCounters(nullptr);
+                hangDetector.traceLoop(cpu0);
+                logWriter.log(LogWriter::LogLevel::WARNING, "Stuck in an endless loop. Exiting.",
+                              {{"first", hangDetector.getLoopStart(), true}, {"last", hangDetector.getLoopEnd(), true},
+                               {"period", hangDetector.getPeriod(), false}});
+                isHung = true;
+                isRunning = false;
+            }
+        }
 
-        // sleep to ensure screen updates occur at 60 Hz
-        microseconds frameEnd = duration_cast<microseconds>(system_clock::now().time_since_epoch());
+        // show the frames ahead instead, from where the next real frame starts
+        if (runAheadFrames != 0)
+        {
+            TraceScope runAheadScope(activeTracer, "run-ahead");
+            DirtyRegion shown = runAhead.runAhead(frameLoop, isRunning);
+            presentFrame(frameLoop, shown, perfCounters, activeTracer);
+            if (shown.rows != 0 && sink != &nullSink)
+            {
+                metrics.countDrawCall();
+            }
+            runAhead.restore();
+        }
+        ++frames;
+
+        microseconds frameEnd = isTurbo && !isMetered ? frameStart :
+                duration_cast<microseconds>(system_clock::now().time_since_epoch());
         microseconds diff = microseconds(USECONDS_PER_FRAME) - (frameEnd - frameStart);
-        std::this_thread::sleep_for(diff);
+        metrics.countFrame(!isTurbo && diff.count() < 0, toDraw, (frameEnd - frameStart).count());
+        if (metricsFile != nullptr && frameEnd - lastMetricsWrite >= seconds(1))
+        {
+            TraceScope metricsScope(activeTracer, "metrics");
+            metrics.writeTextfile(metricsFile);
+            lastMetricsWrite = frameEnd;
+        }
+
+        if (caughtSignal == SIGHUP)
+        {
+            caughtSignal = 0;
+            tracer.write(tracePath);
+        }
+        else if (caughtSignal != 0)
+        {
+            break;
+        }
+
+        if (maxFrames != 0 && frames >= maxFrames)
+        {
+            break;
+        }
+
+        // sleep to ensure screen updates occur at 60 Hz
+        if (!isTurbo || isHeld)
+        {
+            TraceScope sleepScope(activeTracer, "sleep");
+            std::this_thread::sleep_for(diff);
+        }
     } while (isRunning);
+    debugServer.stop(0);
+    keypad.close();
+    audio.stop();
+    capture.stop();
+    sink->close();
+    if (audioSink != nullptr)
+    {
+        audioSink->close();
+    }
+
+    double elapsedMs = duration_cast<duration<double, std::milli>>(steady_clock::now() - runStart).count();
+    std::string summary = "Ran " + std::to_string(frames) + " frames in " + std::to_string(elapsedMs) + " ms.";
+#ifdef IMIT8_AOT
+    summary += " AOT: " + std::to_string(aot.getCompiledInstructions()) + " recompiled and " +
+               std::to_string(aot.getInterpretedInstructions()) + " interpreted instructions.";
+#endif
+#ifdef IMIT8_DYNAREC
+    if (isDynarec)
+    {
+        const Dynarec::Statistics& stats = dynarec.getStatistics();
+        summary += " Dynarec: " + std::to_string(stats.compiledInstructions) + " native and " +
+                   std::to_string(stats.interpretedInstructions) + " interpreted instructions, " +
+                   std::to_string(stats.blocksCompiled) + " blocks compiled in " +
+                   std::to_string(stats.compileNanoseconds / 1000) + " us, " +
+                   std::to_string(stats.runNanoseconds / 1000) + " us running, " +
+                   std::to_string(stats.blocksLinked) + " links, " +
+                   std::to_string(stats.blocksInvalidated) + " invalidated, " +
+                   std::to_string(stats.cacheFlushes) + " flushes.";
+    }
+#endif
+    if (runAheadFrames != 0)
+    {
+        summary += " " + runAhead.report();
+    }
+    if (isFusionReporting)
+    {
+        summary += " " + reportFusion(cpu0.getFusionStatistics());
+    }
+    if (idleSkipped != 0)
+    {
+        summary += " Skipped " + std::to_string(idleSkipped) + " instructions in wait loops.";
+    }
+    if (coveragePath != nullptr)
+    {
+        summary += " Coverage: " + coverage.summarize() + ".";
+        if (!coverage.write(coveragePath, coverageListing != nullptr ? coverageListing : ""))
+        {
+            std::cerr << "ERROR: Could not write coverage to " << coveragePath << std::endl;
+        }
+    }
+    if (isHung)
+    {
+        std::stringstream loop;
+        loop << std::hex << std::uppercase << " Stuck in an endless loop over 0x" << hangDetector.getLoopStart()
+             << "-0x" << hangDetector.getLoopEnd() << std::dec << ", repeating every " << hangDetector.getPeriod()
+             << " frames.";
+        summary += loop.str();
+    }
+    logWriter.log(LogWriter::LogLevel::INFO, summary);
+    if (isTurbo || isHung)
+    {
+        // keep stdout clean when it carries audio
+        (audioPcm != nullptr && std::strcmp(audioPcm, "-") == 0 ? std::cerr : std::cout) << summary << std::endl;
+    }
+    if (isPerfCounting)
+    {
+        std::string report = perfCounters.report();
+        logWriter.log(LogWriter::LogLevel::INFO, report);
+        (audioPcm != nullptr && std::strcmp(audioPcm, "-") == 0 ? std::cerr : std::cout) << report << std::endl;
+    }
 
     logWriter.log(LogWriter::LogLevel::INFO, "Program loop exited normally. Shutting down.\n");
+    if (metricsFile != nullptr && !metrics.writeTextfile(metricsFile))
+    {
+        logWriter.log(LogWriter::LogLevel::ERROR, std::string("Could not write metrics to ") + metricsFile);
+    }
+    metrics.stopServer();
+    if (tracePath != nullptr && !tracer.write(tracePath))
+    {
+        std::cerr << "ERROR: Could not write the trace to " << tracePath << std::endl;
+    }
 
-    return 0;
-}
\ No newline at end of file
+    return isHung ? 3 : 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * imit8_recomp
+ * Command line front end for the Recompiler.
+ */
+
+#include <cstring>
+#include "Recompiler.h"
+
+int main(int argc, char* argv[])
+{
+    bool isListing = argc == 4 && std::strcmp(argv[1], "--listing") == 0;
+    if (argc != 3 && !isListing)
+    {
+        std::cerr << "Usage: imit8_recomp [--listing] rom.ch8 output.cpp" << std::endl;
+        exit(1);
+    }
+    const char* romFile = argv[argc - 2];
+    const char* outputFile = argv[argc - 1];
+
+    std::ifstream fin(romFile, std::ios::in | std::ios::binary);
+    std::vector<unsigned char> rom((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+    if (rom.empty() || rom.size() > MEMORY_SIZE - CODE_START)
+    {
+        std::cerr << "ERROR: ROM file (" << romFile << ") could not be loaded." << std::endl;
+        exit(2);
+    }
+
+    Recompiler recompiler(rom);
+    recompiler.analyze();
+
+    std::ofstream out(outputFile, std::ios::out | std::ios::trunc);
+    std::string romName = romFile;
+    recompiler.writeSource(out, romName.substr(romName.find_last_of("/\\") + 1));
+    if (!out.good())
+    {
+        std::cerr << "ERROR: could not write " << outputFile << std::endl;
+        exit(3);
+    }
+
+    if (isListing)
+    {
+        recompiler.writeListing(std::cout);
+    }
+    std::cout << romFile << ": " << recompiler.getBlockCount() << " blocks, "
+              << recompiler.getCompiledInstructions() << " recompiled instructions, "
+              << recompiler.getInterpretedInstructions() << " left to the interpreter." << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * imit8_server
+ * Command line front end for SessionServer. Runs until interrupted, printing a line for each session as it
+ * ends.
+ */
+
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include "SessionServer.h"
+
+static volatile std::sig_atomic_t isInterrupted = 0;
+
+static void
+onStopSignal(int)
+{
+    isInterrupted = 1;
+}
+
+static void
+printUsage()
+{
+    std::cerr << "Usage: imit8_server [-w workers] PORT|unix:PATH rom.ch8" << std::endl;
+    std::cerr << "  -w  worker threads sharing the sessions (default 2)" << std::endl;
+    std::cerr << "Every client gets its own machine running rom.ch8; see SessionServer.h for the protocol." << std::endl;
+}
+
+static void
+printReports(SessionServer& server, LogWriter& logWriter)
+{
+    for (const std::string& report : server.takeReports())
+    {
+        logWriter.log(LogWriter::LogLevel::INFO, report);
+        std::cout << report << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int workers = 2;
+    const char* address = nullptr;
+    const char* romFile = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+        {
+            workers = std::atoi(argv[++i]);
+        }
+        else if (argv[i][0] != '-' && address == nullptr)
+        {
+            address = argv[i];
+        }
+        else if (argv[i][0] != '-' && romFile == nullptr)
+        {
+            romFile = argv[i];
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (address == nullptr || romFile == nullptr || workers < 1)
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::ifstream romStream(romFile, std::ios::binary);
+    std::vector<unsigned char> rom((std::istreambuf_iterator<char>(romStream)), std::istreambuf_iterator<char>());
+    LogWriter logWriter;
+    SessionServer server(&logWriter);
+    if (!romStream.good() && !romStream.eof())
+    {
+        std::cerr << "ERROR: Could not read " << romFile << std::endl;
+        return 1;
+    }
+    if (!server.setRom(rom) || !server.start(address, workers))
+    {
+        std::cerr << "ERROR: Could not start the server; see the log." << std::endl;
+        return 1;
+    }
+
+    std::signal(SIGINT, onStopSignal);
+    std::signal(SIGTERM, onStopSignal);
+    while (!isInterrupted)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(SESSION_SERVER_POLL_MILLISECONDS));
+        printReports(server, logWriter);
+    }
+    server.stop();
+    printReports(server, logWriter);
+    return 0;
+}
@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * imit8_swarm
+ * Runs many copies of a ROM at 60 frames a second through Scheduler and reports how well they kept pace,
+ * and how much memory each machine took.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <unistd.h>
+#include "Scheduler.h"
+
+// Resident set size of this process in bytes, or 0 if it cannot be read
+static size_t
+residentBytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t totalPages = 0;
+    size_t residentPages = 0;
+    if (!(statm >> totalPages >> residentPages))
+    {
+        return 0;
+    }
+    return residentPages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+static void
+printUsage()
+{
+    std::cerr << "Usage: imit8_swarm [-n instances] [-w workers] [-s seconds] [-c core] rom.ch8" << std::endl;
+    std::cerr << "  -n  machines to run (default 1000)" << std::endl;
+    std::cerr << "  -w  worker threads (default: one per hardware thread)" << std::endl;
+    std::cerr << "  -s  seconds to run for (default 10)" << std::endl;
+    std::cerr << "  -c  compact (default), sharing the ROM between machines, or chip8" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned long instanceCount = 1000;
+    int workerCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    double seconds = 10;
+    std::string core = "compact";
+    const char* romFile = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+        {
+            instanceCount = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+        {
+            workerCount = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+        {
+            seconds = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            core = argv[++i];
+        }
+        else if (argv[i][0] != '-' && romFile == nullptr)
+        {
+            romFile = argv[i];
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (romFile == nullptr || instanceCount == 0 || workerCount < 1 || seconds <= 0 ||
+        (core != "compact" && core != "chip8"))
+    {
+        printUsage();
+        return 1;
+    }
+
+    std::ifstream romStream(romFile, std::ios::binary);
+    std::vector<unsigned char> rom((std::istreambuf_iterator<char>(romStream)), std::istreambuf_iterator<char>());
+    LogWriter logWriter;
+    LogWriter quietLogWriter("log.txt", LogWriter::LogLevel::OFF);
+    Scheduler scheduler(&logWriter, &quietLogWriter, workerCount);
+    scheduler.setCompact(core == "compact");
+    size_t residentBefore = residentBytes();
+    for (unsigned long i = 0; i < instanceCount; ++i)
+    {
+        if (!scheduler.addInstance(rom))
+        {
+            std::cerr << "ERROR: Could not load " << romFile << std::endl;
+            return 1;
+        }
+    }
+    if (!scheduler.start())
+    {
+        return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    scheduler.stop();
+    size_t residentAfter = residentBytes();
+
+    unsigned long long frames = 0;
+    unsigned long long lateFrames = 0;
+    unsigned long long worstLate = 0;
+    unsigned long long migrations = 0;
+    unsigned long long halted = 0;
+    unsigned long long laggards = 0;   // machines with more than 1% of their frames late
+    for (const Scheduler::InstanceStats& stats : scheduler.getInstanceStats())
+    {
+        frames += stats.frames;
+        lateFrames += stats.lateFrames;
+        worstLate = std::max(worstLate, stats.maxLateNanoseconds);
+        migrations += stats.migrations;
+        halted += stats.isHalted ? 1 : 0;
+        laggards += stats.lateFrames * 100 > stats.frames ? 1 : 0;
+    }
+    double expected = instanceCount * FRAMES_PER_SECOND * seconds;
+    std::ostringstream report;
+    report << std::fixed << std::setprecision(2) << instanceCount << " " << core << " machines on " << workerCount << " workers for "
+           << seconds << " s: " << frames << " frames (" << 100.0 * frames / expected << "% of pace), " << lateFrames
+           << " late (" << (frames == 0 ? 0.0 : 100.0 * lateFrames / frames) << "%), worst " << worstLate / 1e6
+           << " ms behind, " << laggards << " machines over 1% late, " << scheduler.getSteals() << " steals, "
+           << halted << " halted, " << std::setprecision(0)
+           << static_cast<double>(scheduler.getMachineBytes()) / instanceCount << " bytes per machine ("
+           << static_cast<double>(residentAfter - std::min(residentBefore, residentAfter)) / instanceCount
+           << " resident).";
+    logWriter.log(LogWriter::LogLevel::INFO, report.str());
+    std::cout << report.str() << std::endl;
+    return 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * imit8_view
+ * Draws the screen of an emulator started with --sink shm:NAME, from another process. Only reads the shared
+ * memory, so any number of viewers can watch one emulator without slowing it down.
+ */
+
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include "Display.h"
+#include "SharedFrame.h"
+
+static void
+printUsage()
+{
+    std::cerr << "Usage: imit8_view [--once] [--pbm PATH] [--log PATH] NAME" << std::endl;
+    std::cerr << "  --once      draw the current frame and exit" << std::endl;
+    std::cerr << "  --pbm PATH  write the current frame as a PBM image instead of drawing it, and exit" << std::endl;
+    std::cerr << "  --log PATH  log to PATH (by default nothing is logged)" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    bool isOnce = false;
+    const char* pbmPath = nullptr;
+    const char* logPath = nullptr;
+    const char* name = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--once") == 0)
+        {
+            isOnce = true;
+        }
+        else if (std::strcmp(argv[i], "--pbm") == 0 && i + 1 < argc)
+        {
+            pbmPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--log") == 0 && i + 1 < argc)
+        {
+            logPath = argv[++i];
+        }
+        else if (argv[i][0] != '-' && name == nullptr)
+        {
+            name = argv[i];
+        }
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+    if (name == nullptr)
+    {
+        printUsage();
+        return 1;
+    }
+
+    // a viewer only reads, so it leaves no log.txt behind wherever it is run unless asked for one
+    LogWriter logWriter(logPath != nullptr ? logPath : "", logPath != nullptr ? LogWriter::LogLevel::INFO :
+                                                                                 LogWriter::LogLevel::OFF);
+    SharedFrame sharedFrame(&logWriter);
+    if (!sharedFrame.attach(name))
+    {
+        std::cerr << "ERROR: No emulator is publishing " << name << " (start one with --sink shm:" << name << ")."
+                  << std::endl;
+        return 1;
+    }
+
+    SharedFrame::Snapshot snapshot;
+    if (!sharedFrame.read(snapshot))
+    {
+        std::cerr << "ERROR: Could not read a whole frame of " << name << "." << std::endl;
+        return 1;
+    }
+    if (pbmPath != nullptr)
+    {
+        FILE* file = std::fopen(pbmPath, "wb");
+        bool isWritten = file != nullptr &&
+                         std::fprintf(file, "P4\n# frame %llu\n%d %d\n", snapshot.frame, SCREEN_WIDTH, SCREEN_HEIGHT) > 0 &&
+                         std::fwrite(snapshot.screen, 1, SCREEN_SIZE, file) == SCREEN_SIZE;
+        if (file == nullptr || std::fclose(file) != 0 || !isWritten)
+        {
+            std::cerr << "ERROR: Could not write " << pbmPath << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    Display screen(snapshot.screen, &logWriter);
+    if (!isOnce)
+    {
+        Display::clearScreen();
+    }
+    for (;;)
+    {
+        screen.drawDisplay();
+        std::cout << name << " (pid " << snapshot.writerPid << "): frame " << snapshot.frame
+                  << (snapshot.status == SharedFrame::STOPPED ? ", stopped" : "") << std::endl;
+        if (isOnce || snapshot.status == SharedFrame::STOPPED)
+        {
+            return 0;
+        }
+
+        // poll at the emulator's frame rate; a frame that arrives in between is drawn on the next tick. An
+        // emulator that was killed never marks the segment stopped, so also give up once its process is gone.
+        unsigned int sequence = snapshot.sequence;
+        while (!sharedFrame.hasChanged(sequence))
+        {
+            if (!sharedFrame.isWriterAlive() && !sharedFrame.hasChanged(sequence))
+            {
+                std::cerr << "ERROR: The emulator publishing " << name << " (pid " << snapshot.writerPid
+                          << ") has gone without stopping." << std::endl;
+                return 1;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(USECONDS_PER_FRAME));
+        }
+        if (!sharedFrame.read(snapshot))
+        {
+            std::cerr << "ERROR: " << name << " stopped in the middle of a frame." << std::endl;
+            return 1;
+        }
+    }
+}
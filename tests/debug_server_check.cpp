@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) Chris Kim & Matt Hawkins
+ * This program is licensed under the "GPLv3 License"
+ * Please see the file License.md in the source
+ * distribution of this software for license terms.
+ */
+
+ /*
+ * debug_server_check
+ * Sends m and M packets to a DebugServer over a Unix domain socket and checks the replies, in particular
+ * that addresses and lengths whose sum wraps past 32 bits are refused rather than read or written.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "DebugServer.h"
+
+#define CHECK_REPLY_MILLISECONDS 2000
+
+// Send one packet and return the payload of the reply, or "" if none came in time
+static std::string
+exchange(DebugServer& server, int client, const std::string& payload)
+{
+    unsigned char checksum = 0;
+    for (char c : payload)
+    {
+        checksum = static_cast<unsigned char>(checksum + c);
+    }
+    char trailer[4];
+    std::snprintf(trailer, sizeof(trailer), "#%02x", checksum);
+    std::string packet = "$" + payload + trailer;
+    if (send(client, packet.data(), packet.size(), 0) != static_cast<ssize_t>(packet.size()))
+    {
+        return "";
+    }
+
+    std::string received;
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+                                                     std::chrono::milliseconds(CHECK_REPLY_MILLISECONDS);
+    while (std::chrono::steady_clock::now() < deadline)
+    {
+        server.service();
+        pollfd waiting = {client, POLLIN, 0};
+        if (poll(&waiting, 1, 10) > 0)
+        {
+            char data[1024];
+            ssize_t count = recv(client, data, sizeof(data), 0);
+            if (count <= 0)
+            {
+                return "";
+            }
+            received.append(data, static_cast<size_t>(count));
+        }
+        size_t start = received.find('$');
+        size_t hash = received.find('#', start);
+        if (start != std::string::npos && hash != std::string::npos && hash + 2 < received.size())
+        {
+            return received.substr(start + 1, hash - start - 1);
+        }
+    }
+    return "";
+}
+
+int
+main()
+{
+    LogWriter logWriter("", LogWriter::LogLevel::OFF);
+    Chip8 cpu(&logWriter);
+    const unsigned char rom[] = {0x12, 0x00}; // jump to itself
+    cpu.loadBuffer(rom, sizeof(rom));
+    Debugger debugger(&cpu, &logWriter);
+    DebugServer server(&cpu, &debugger, &logWriter);
+
+    std::string path = "/tmp/imit8_debug_server_check." + std::to_string(getpid()) + ".sock";
+    if (!server.start("unix:" + path))
+    {
+        std::cerr << "FAIL: could not start the debug server on " << path << std::endl;
+        return 1;
+    }
+    sockaddr_un remote;
+    std::memset(&remote, 0, sizeof(remote));
+    remote.sun_family = AF_UNIX;
+    std::strncpy(remote.sun_path, path.c_str(), sizeof(remote.sun_path) - 1);
+    int client = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (client < 0 || connect(client, reinterpret_cast<sockaddr*>(&remote), sizeof(remote)) != 0)
+    {
+        std::cerr << "FAIL: could not connect to " << path << std::endl;
+        return 1;
+    }
+
+    struct Case
+    {
+        const char* packet;
+        const char* reply;
+    };
+    const Case cases[] = {
+            {"mffffffff,1", "E01"},         // address + length wraps to 0
+            {"Mffffffff,1:00", "E01"},
+            {"m1,ffffffff", "E01"},         // wraps to 0
+            {"M1,ffffffff:00", "E01"},
+            {"m1000,0", "E01"},             // starts past the end
+            {"mfff,2", "E01"},              // runs past the end
+            {"Mfff,2:0000", "E01"},
+            {"m100000000,1", "E01"},        // does not fit in 32 bits, so must not be truncated to 0
+            {"M100000001,1:00", "E01"},
+            {"m-1,1", "E01"},
+            {"m200,2", "1200"},
+            {"M200,1:ab", "OK"},
+            {"m200,1", "ab"},
+            {"Mffe,2:cdef", "OK"},
+            {"mffe,2", "cdef"},
+    };
+    int failures = 0;
+    for (const Case& check : cases)
+    {
+        std::string reply = exchange(server, client, check.packet);
+        if (reply != check.reply)
+        {
+            std::cerr << "FAIL: " << check.packet << " got \"" << reply << "\", expected \"" << check.reply << "\""
+                      << std::endl;
+            ++failures;
+        }
+    }
+    close(client);
+    server.stop(0);
+    std::cout << (sizeof(cases) / sizeof(cases[0]) - failures) << " of " << sizeof(cases) / sizeof(cases[0])
+              << " packets answered as expected" << std::endl;
+    return failures == 0 ? 0 : 1;
+}